@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Decoder of measurement payloads published with CONFIG_AGGREGATOR.
+
+Usage: aggregate_decode.py [--compressed] [FILE]
+
+Reads one measurement payload as received from the broker from FILE
+(stdin if omitted), unescapes it, see slm_payload.py, decompresses it
+with --compressed when the gateway has CONFIG_CLOUD_COMPRESS, and writes
+the meter blocks to stdout: a line with meter ID, session and batch
+sequence number, followed by one line per reading or rollup decoded with
+meter_codec.py. Blocks of nodes without CONFIG_METER_CODEC are written
+as hex digits. Payloads without the aggregate type byte are a single
+meter block.
+"""
+
+import struct
+import sys
+
+import cloud_decompress
+import meter_codec
+import slm_payload
+
+# Must match AGGREGATOR_PAYLOAD_TYPE of src/aggregator.h.
+PAYLOAD_TYPE = 0x01
+
+# Must match the delivery header of src/delivery.h.
+METER_ID_SIZE = 8
+HEADER_FORMAT = "<II"
+HEADER_SIZE = METER_ID_SIZE + struct.calcsize(HEADER_FORMAT)
+
+
+def records(payload):
+    if not payload:
+        raise ValueError("empty payload")
+
+    # Meter IDs are unicast EUI-64s, the group bit of their first octet is clear.
+    if payload[0] != PAYLOAD_TYPE:
+        yield bytes(payload)
+        return
+
+    pos = 1
+    while pos < len(payload):
+        if pos + 2 > len(payload):
+            raise ValueError("truncated record length")
+        (length,) = struct.unpack_from("<H", payload, pos)
+        pos += 2
+        if pos + length > len(payload):
+            raise ValueError("truncated record")
+        yield bytes(payload[pos:pos + length])
+        pos += length
+
+
+def decode(block):
+    if len(block) < HEADER_SIZE:
+        raise ValueError("block shorter than the delivery header")
+
+    session, seq = struct.unpack_from(HEADER_FORMAT, block, METER_ID_SIZE)
+    data = block[HEADER_SIZE:]
+    if data and data[0] in (meter_codec.TYPE_DELTA, meter_codec.TYPE_ROLLUP):
+        items, _ = meter_codec.decode(data)
+    else:
+        items = data.hex()
+
+    return block[:METER_ID_SIZE].hex(), session, seq, items
+
+
+def main():
+    args = sys.argv[1:]
+    compressed = "--compressed" in args
+    if compressed:
+        args.remove("--compressed")
+
+    payload = slm_payload.read(args[0] if args else None)
+    if compressed:
+        payload = cloud_decompress.decompress(payload)
+
+    for block in records(payload):
+        meter_id, session, seq, items = decode(block)
+        if isinstance(items, str):
+            print("%s session %08x seq %u: %s" % (meter_id, session, seq, items))
+            continue
+        print("%s session %08x seq %u:" % (meter_id, session, seq))
+        for item in items:
+            if isinstance(item, meter_codec.Rollup):
+                print("  %u count %u min %d max %d mean %d last %d" % item)
+            else:
+                print("  %u %d" % item)
+
+
+if __name__ == "__main__":
+    main()
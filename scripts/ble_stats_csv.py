@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Decoder of the stats stream sent over BLE NUS with CONFIG_BLE_STATS.
+
+Usage: ble_stats_csv.py [FILE]
+
+Reads the received notifications from FILE (stdin if omitted), one per line
+as hex digits, and writes one CSV row per sample to stdout. Counters are
+cumulative on the node, rates are the differences between two rows.
+"""
+
+import csv
+import struct
+import sys
+
+FRAME_HEADER_SIZE = 2
+
+# Must match enum ble_stats_frame of src/ble_stats.h.
+FRAME_TIME = 0x01
+FRAMES = {
+    FRAME_TIME: ("<I", ["time_ms"]),
+    0x02: ("<H", ["modem_queue"]),
+    0x03: ("<HHH", ["ot_buffers_total", "ot_buffers_free", "ot_buffers_max_used"]),
+    0x04: ("<IIIIII", ["coap_exchanges", "coap_rtt_samples", "coap_rtt_sum_ms",
+                       "coap_rtt_max_ms", "coap_retransmissions", "coap_timeouts"]),
+    0x05: ("<IIII", ["batches", "batches_resent", "batches_acked", "batches_forwarded"]),
+    0x06: ("<BBBBII", ["ot_usage_p50", "ot_usage_p90", "ot_usage_p99", "ot_pressure_level",
+                       "ot_deferred_discovers", "ot_deferred_uploads"]),
+}
+
+COLUMNS = [column for _, columns in FRAMES.values() for column in columns]
+
+
+def decode(notification):
+    """Yield the samples of a notification as dictionaries."""
+    sample = None
+    pos = 0
+    while pos < len(notification):
+        if pos + FRAME_HEADER_SIZE > len(notification):
+            raise ValueError("truncated frame header")
+        frame_type, size = notification[pos], notification[pos + 1]
+        pos += FRAME_HEADER_SIZE
+        if pos + size > len(notification):
+            raise ValueError("truncated frame 0x%02x" % frame_type)
+        fields = notification[pos:pos + size]
+        pos += size
+
+        if frame_type == FRAME_TIME:
+            if sample is not None:
+                yield sample
+            sample = {}
+        if frame_type not in FRAMES:
+            # Frames of newer firmware.
+            continue
+        if sample is None:
+            raise ValueError("frame 0x%02x before time frame" % frame_type)
+
+        fmt, columns = FRAMES[frame_type]
+        if size < struct.calcsize(fmt):
+            raise ValueError("short frame 0x%02x" % frame_type)
+        sample.update(zip(columns, struct.unpack_from(fmt, fields)))
+
+    if sample is not None:
+        yield sample
+
+
+def main():
+    if len(sys.argv) > 1:
+        lines = open(sys.argv[1]).readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    writer = csv.DictWriter(sys.stdout, fieldnames=COLUMNS)
+    writer.writeheader()
+    for line in lines:
+        line = "".join(line.split())
+        if not line:
+            continue
+        for sample in decode(bytes.fromhex(line)):
+            writer.writerow(sample)
+
+
+if __name__ == "__main__":
+    main()
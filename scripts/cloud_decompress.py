@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2023 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Reference decompressor of gateway payloads published with CONFIG_CLOUD_COMPRESS.
+
+Usage: cloud_decompress.py [FILE]
+
+Reads one payload as received from the broker from FILE (stdin if
+omitted), reverses the escaping of the serial LTE modem, see
+slm_payload.py, and writes the original payload to stdout.
+"""
+
+import sys
+
+import slm_payload
+
+FORMAT_STORED = 0x0
+FORMAT_LZSS = 0x1
+
+MATCH_MIN = 3
+
+# Must match the dictionary of src/cloud_compress.c.
+DICT_METER = bytes([0x01]) + bytes(
+    b for value in range(0, 32, 2) for delta in (0, 2, 1) for b in (delta, value)
+) + b"0123456789"
+
+DICTIONARIES = {
+    0x0: b"",
+    0x1: DICT_METER,
+}
+
+
+def decompress(payload):
+    if not payload:
+        raise ValueError("empty payload")
+
+    fmt = payload[0] >> 4
+    dictionary = DICTIONARIES.get(payload[0] & 0x0F)
+    if dictionary is None:
+        raise ValueError("unknown dictionary %d" % (payload[0] & 0x0F))
+
+    if fmt == FORMAT_STORED:
+        return bytes(payload[1:])
+    if fmt != FORMAT_LZSS:
+        raise ValueError("unknown format %d" % fmt)
+
+    history = bytearray(dictionary)
+    pos = 1
+    while pos < len(payload):
+        flags = payload[pos]
+        pos += 1
+        for bit in range(8):
+            if pos >= len(payload):
+                break
+            if flags & (1 << bit):
+                if pos + 2 > len(payload):
+                    raise ValueError("truncated match")
+                token = (payload[pos] << 8) | payload[pos + 1]
+                pos += 2
+                distance = (token >> 4) + 1
+                length = (token & 0x0F) + MATCH_MIN
+                if distance > len(history):
+                    raise ValueError("match before start of history")
+                # Byte by byte, matches may overlap their own output.
+                for _ in range(length):
+                    history.append(history[-distance])
+            else:
+                history.append(payload[pos])
+                pos += 1
+
+    return bytes(history[len(dictionary):])
+
+
+def main():
+    payload = slm_payload.read(sys.argv[1] if len(sys.argv) > 1 else None)
+    sys.stdout.buffer.write(decompress(payload))
+
+
+if __name__ == "__main__":
+    main()
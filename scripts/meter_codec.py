@@ -0,0 +1,97 @@
+#
+# Copyright (c) 2023 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Decoder of measurement blocks encoded with CONFIG_METER_CODEC.
+
+A block starts with the type byte and the little-endian record count.
+The first record is absolute, the following ones carry the zig-zag
+varint delta of the timestamp delta and of the value. Rollups add the
+count, the distances of min and max from the mean and the zig-zag last
+value relative to the mean. Blocks may be padded after the last record.
+"""
+
+import collections
+import struct
+
+# Must match src/meter_codec.h.
+TYPE_DELTA = 0x01
+TYPE_ROLLUP = 0x02
+HEADER_FORMAT = "<BH"
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+
+VARINT_MAX_SIZE = 10
+
+Record = collections.namedtuple("Record", ["timestamp", "value"])
+Rollup = collections.namedtuple("Rollup", ["start", "count", "min", "max", "mean", "last"])
+
+
+def zigzag_decode(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def wrap32(value, signed):
+    value &= 0xFFFFFFFF
+    if signed and value >= 0x80000000:
+        value -= 0x100000000
+    return value
+
+
+class Decoder:
+    def __init__(self, block):
+        if len(block) < HEADER_SIZE or block[0] not in (TYPE_DELTA, TYPE_ROLLUP):
+            raise ValueError("not a meter codec block")
+
+        self.type, self.count = struct.unpack_from(HEADER_FORMAT, block)
+        self.block = block
+        self.offset = HEADER_SIZE
+        self.decoded = 0
+        self.last = None
+        self.last_delta = 0
+
+    def varint(self):
+        result = 0
+        for shift in range(0, 7 * VARINT_MAX_SIZE, 7):
+            if self.offset >= len(self.block):
+                raise ValueError("block truncated at record %u" % self.decoded)
+            byte = self.block[self.offset]
+            self.offset += 1
+            result |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return result
+
+        raise ValueError("varint too long at record %u" % self.decoded)
+
+    def pair(self):
+        timestamp = self.varint()
+        value = zigzag_decode(self.varint())
+        if self.decoded > 0:
+            self.last_delta += zigzag_decode(timestamp)
+            timestamp = self.last.timestamp + self.last_delta
+            value += self.last.value
+        self.last = Record(wrap32(timestamp, False), wrap32(value, True))
+
+        return self.last
+
+    def __iter__(self):
+        while self.decoded < self.count:
+            timestamp, value = self.pair()
+            if self.type == TYPE_ROLLUP:
+                count = self.varint()
+                below = self.varint()
+                above = self.varint()
+                last = zigzag_decode(self.varint())
+                yield Rollup(timestamp, count, wrap32(value - below, True),
+                             wrap32(value + above, True), value, wrap32(value + last, True))
+            else:
+                yield Record(timestamp, value)
+            self.decoded += 1
+
+
+def decode(block):
+    """Return the records or rollups of a block and the bytes used, without padding."""
+    decoder = Decoder(block)
+    items = list(decoder)
+
+    return items, decoder.offset
@@ -0,0 +1,46 @@
+#
+# Copyright (c) 2023 Nordic Semiconductor
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+#
+"""Wire format of payloads published through the serial LTE modem.
+
+The modem leaves data mode on its terminator anywhere in the data, so
+publish_data_send of src/modem_utils_slm.c escapes every payload before
+it reaches the broker: each '+' and escape byte is sent as the escape
+byte followed by the byte XOR 0x20, as in HDLC. Every payload received
+from the broker is unescaped here before anything else looks at it.
+"""
+
+import sys
+
+# Must match the escaping of publish_data_send in src/modem_utils_slm.c.
+ESCAPE = 0x7D
+ESCAPE_XOR = 0x20
+
+
+def unescape(payload):
+    out = bytearray()
+    pos = 0
+    while pos < len(payload):
+        if payload[pos] == ESCAPE:
+            if pos + 1 >= len(payload):
+                raise ValueError("truncated escape")
+            out.append(payload[pos + 1] ^ ESCAPE_XOR)
+            pos += 2
+        else:
+            out.append(payload[pos])
+            pos += 1
+
+    return bytes(out)
+
+
+def read(path=None):
+    """Read one payload as received from the broker from path, stdin if None, and unescape it."""
+    if path is not None:
+        with open(path, "rb") as f:
+            payload = f.read()
+    else:
+        payload = sys.stdin.buffer.read()
+
+    return unescape(payload)
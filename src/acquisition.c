@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>
+#include <zephyr/shell/shell.h>
+
+#if CONFIG_ACQUISITION_SOURCE_ADC
+#include <zephyr/drivers/adc.h>
+#endif
+
+#if CONFIG_ADC_EMUL
+#include <zephyr/drivers/adc/adc_emul.h>
+#endif
+
+#include "acquisition.h"
+
+LOG_MODULE_REGISTER(acquisition, CONFIG_ACQUISITION_LOG_LEVEL);
+
+#define BATCH_SIZE CONFIG_ACQUISITION_BATCH_SIZE
+#define EMUL_FULL_SCALE_MV 3300
+
+static void acquisition_thread(void *p1, void *p2, void *p3);
+
+K_THREAD_DEFINE(acquisition_tid, CONFIG_ACQUISITION_STACK_SIZE, acquisition_thread,
+		NULL, NULL, NULL, CONFIG_ACQUISITION_THREAD_PRIORITY, 0, SYS_FOREVER_MS);
+
+static acquisition_handler_t batch_handler;
+static int32_t samples[BATCH_SIZE];
+static struct acquisition_stats stats;
+static int64_t start_time;
+static K_MUTEX_DEFINE(stats_lock);
+
+#if CONFIG_ACQUISITION_SOURCE_ADC
+static const struct adc_dt_spec adc_channel = ADC_DT_SPEC_GET(DT_PATH(zephyr_user));
+static int16_t adc_buffer[BATCH_SIZE];
+
+#if CONFIG_ADC_EMUL
+static int32_t emul_level = EMUL_FULL_SCALE_MV / 2;
+
+/* Emulated meter: slowly drifting level with noise. */
+static int emul_value(const struct device *dev, unsigned int chan, void *data, uint32_t *result)
+{
+	emul_level = CLAMP(emul_level + (int32_t)(sys_rand32_get() % 5) - 2, 0,
+			   EMUL_FULL_SCALE_MV);
+	*result = CLAMP(emul_level + (int32_t)(sys_rand32_get() % 7) - 3, 0, EMUL_FULL_SCALE_MV);
+
+	return 0;
+}
+#endif
+
+static int source_init(void)
+{
+	int ret;
+
+	if (!adc_is_ready_dt(&adc_channel)) {
+		LOG_ERR("ADC %s is not ready", adc_channel.dev->name);
+		return -ENODEV;
+	}
+
+	ret = adc_channel_setup_dt(&adc_channel);
+	if (ret) {
+		LOG_ERR("Cannot setup ADC channel (error: %d)", ret);
+		return ret;
+	}
+
+#if CONFIG_ADC_EMUL
+	ret = adc_emul_value_func_set(adc_channel.dev, adc_channel.channel_id, emul_value, NULL);
+	if (ret) {
+		LOG_ERR("Cannot set emulated ADC input (error: %d)", ret);
+		return ret;
+	}
+#endif
+
+	return 0;
+}
+
+static int source_read(int32_t *values, size_t count)
+{
+	/* Whole batch in one sequence, the driver triggers each sampling from
+	 * a timer at interval_us, the first one right when the read starts.
+	 */
+	struct adc_sequence_options options = {
+		.interval_us = CONFIG_ACQUISITION_SAMPLE_INTERVAL,
+		.extra_samplings = count - 1,
+	};
+	struct adc_sequence sequence = {
+		.options = &options,
+		.buffer = adc_buffer,
+		.buffer_size = sizeof(adc_buffer),
+	};
+	int ret;
+
+	adc_sequence_init_dt(&adc_channel, &sequence);
+	ret = adc_read(adc_channel.dev, &sequence);
+	if (ret) {
+		return ret;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		values[i] = adc_buffer[i];
+		adc_raw_to_millivolts_dt(&adc_channel, &values[i]);
+	}
+
+	return 0;
+}
+#else
+static int32_t simulated_value;
+
+static int source_init(void)
+{
+	return 0;
+}
+
+static int source_read(int32_t *values, size_t count)
+{
+	/* Simulated meter: increasing value with noise. */
+	simulated_value += sys_rand32_get() % 16;
+	for (size_t i = 0; i < count; i++) {
+		values[i] = simulated_value + (int32_t)(sys_rand32_get() % 5) - 2;
+	}
+
+	return 0;
+}
+#endif
+
+static void acquisition_thread(void *p1, void *p2, void *p3)
+{
+	const int64_t period = k_ms_to_ticks_ceil64(CONFIG_ACQUISITION_PERIOD);
+	struct acquisition_batch batch = {
+		.interval = CONFIG_ACQUISITION_SAMPLE_INTERVAL,
+		.count = BATCH_SIZE,
+		.samples = samples,
+	};
+	int64_t next = k_uptime_ticks();
+	int64_t now;
+	uint32_t jitter, read_time, start;
+	int ret;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (true) {
+		next += period;
+		k_sleep(K_TIMEOUT_ABS_TICKS(next));
+
+		now = k_uptime_ticks();
+		jitter = (uint32_t)k_ticks_to_us_floor64(now - next);
+
+		/* The first sample is taken when the read starts. */
+		batch.time = k_uptime_get();
+		start = k_cycle_get_32();
+		ret = source_read(samples, BATCH_SIZE);
+		read_time = (uint32_t)k_cyc_to_us_floor64(k_cycle_get_32() - start);
+
+		k_mutex_lock(&stats_lock, K_FOREVER);
+		if (ret) {
+			stats.errors++;
+		} else {
+			stats.batches++;
+			stats.samples += BATCH_SIZE;
+			stats.last_jitter = jitter;
+			stats.max_jitter = MAX(stats.max_jitter, jitter);
+			stats.total_jitter += jitter;
+			stats.total_read_time += read_time;
+		}
+		k_mutex_unlock(&stats_lock);
+
+		if (ret) {
+			LOG_ERR("Cannot read batch (error: %d)", ret);
+		} else {
+			LOG_DBG("Batch of %u samples at %lld ms, jitter %u us, read %u us",
+				BATCH_SIZE, batch.time, jitter, read_time);
+			batch_handler(&batch);
+		}
+
+		/* Skip periods missed by a slow batch instead of catching up. */
+		if (k_uptime_ticks() - next > period) {
+			k_mutex_lock(&stats_lock, K_FOREVER);
+			stats.overruns++;
+			k_mutex_unlock(&stats_lock);
+			next = k_uptime_ticks();
+		}
+	}
+}
+
+int acquisition_init(acquisition_handler_t handler)
+{
+	int ret;
+
+	if (handler == NULL) {
+		return -EINVAL;
+	}
+
+	ret = source_init();
+	if (ret) {
+		return ret;
+	}
+
+	batch_handler = handler;
+	start_time = k_uptime_get();
+	k_thread_start(acquisition_tid);
+
+	return 0;
+}
+
+void acquisition_get_stats(struct acquisition_stats *out)
+{
+	k_mutex_lock(&stats_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&stats_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct acquisition_stats current;
+	int64_t elapsed;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&stats_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		start_time = k_uptime_get();
+		k_mutex_unlock(&stats_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	acquisition_get_stats(&current);
+	elapsed = k_uptime_get() - start_time;
+
+	shell_fprintf(shell, SHELL_INFO, "batches: %u samples: %llu errors: %u overruns: %u\n",
+		      current.batches, current.samples, current.errors, current.overruns);
+	shell_fprintf(shell, SHELL_INFO, "throughput: %llu samples/min\n",
+		      elapsed ? current.samples * MSEC_PER_SEC * 60 / elapsed : 0);
+	shell_fprintf(shell, SHELL_INFO, "jitter last/avg/max: %u/%llu/%u us\n",
+		      current.last_jitter,
+		      current.batches ? current.total_jitter / current.batches : 0,
+		      current.max_jitter);
+	shell_fprintf(shell, SHELL_INFO, "batch read time avg: %llu us\n",
+		      current.batches ? current.total_read_time / current.batches : 0);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_acquisition,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset acquisition statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(acquisition, &sub_acquisition, "acquisition commands", NULL);
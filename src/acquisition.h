@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __ACQUISITION_H__
+#define __ACQUISITION_H__
+
+#include <stdint.h>
+
+/**@brief Batch of samples taken in one acquisition period. */
+struct acquisition_batch {
+	/** Uptime of the first sample, taken when the read starts [ms]. */
+	int64_t time;
+	/** Interval between samples [us]. */
+	uint32_t interval;
+	/** Number of samples. */
+	uint16_t count;
+	/** Samples, in millivolts for the ADC source. */
+	const int32_t *samples;
+};
+
+/**@brief Acquisition statistics. */
+struct acquisition_stats {
+	/** Number of batches delivered. */
+	uint32_t batches;
+	/** Number of samples delivered. */
+	uint64_t samples;
+	/** Failed batch reads. */
+	uint32_t errors;
+	/** Periods skipped because a batch took longer than the period. */
+	uint32_t overruns;
+	/** Wakeup delay of the last batch [us]. */
+	uint32_t last_jitter;
+	/** Longest wakeup delay [us]. */
+	uint32_t max_jitter;
+	/** Sum of all wakeup delays [us]. */
+	uint64_t total_jitter;
+	/** Sum of all batch read times [us]. */
+	uint64_t total_read_time;
+};
+
+/**
+ * @brief Callback function for acquired batch.
+ *
+ * @note Called from the acquisition thread.
+ */
+typedef void (*acquisition_handler_t)(const struct acquisition_batch *batch);
+
+/**
+ * @brief Initialize the measurement source and start the acquisition thread.
+ */
+int acquisition_init(acquisition_handler_t handler);
+
+/**
+ * @brief Get a copy of the acquisition statistics.
+ */
+void acquisition_get_stats(struct acquisition_stats *stats);
+
+#endif /* __ACQUISITION_H__ */
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/coap.h>
+#include <openthread/thread.h>
+#if CONFIG_OPENTHREAD_FTD
+#include <openthread/thread_ftd.h>
+#endif
+
+#include "aggregator.h"
+#include "block_pool.h"
+#include "coap_utils.h"
+#include "delivery.h"
+#include "modem_utils.h"
+
+#if CONFIG_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
+LOG_MODULE_REGISTER(aggregator, CONFIG_AGGREGATOR_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_AGGREGATOR_MAX_SIZE % AGGREGATOR_BLOCK_SIZE == 0,
+	     "Aggregated batch must consist of whole blocks");
+BUILD_ASSERT(BLOCK_POOL_BLOCK_SIZE >= AGGREGATOR_BLOCK_SIZE,
+	     "Pool blocks must hold the fresh records of a block");
+
+/* Batch collected from children, forwarded upstream as one transfer */
+static uint8_t batch[CONFIG_AGGREGATOR_MAX_SIZE];
+static size_t batch_length;
+static uint16_t batch_records;
+static int64_t batch_start_time;
+static bool batch_in_transfer;
+
+/* Modem the batch is forwarded to */
+static otIp6Address upstream;
+static bool has_upstream;
+
+static struct k_work_delayable flush_work;
+
+static struct aggregator_stats stats;
+static K_MUTEX_DEFINE(aggregator_lock);
+
+bool aggregator_accepts(const otIp6Address *address)
+{
+#if CONFIG_OPENTHREAD_FTD
+	otInstance *instance = openthread_get_default_instance();
+	otDeviceRole role = otThreadGetDeviceRole(instance);
+	uint16_t max_children = otThreadGetMaxAllowedChildren(instance);
+
+	if ((role != OT_DEVICE_ROLE_ROUTER) && (role != OT_DEVICE_ROLE_LEADER)) {
+		return false;
+	}
+
+	for (uint16_t i = 0; i < max_children; i++) {
+		otChildIp6AddressIterator iterator = OT_CHILD_IP6_ADDRESS_ITERATOR_INIT;
+		otChildInfo child_info;
+		otIp6Address child_address;
+
+		if (otThreadGetChildInfoByIndex(instance, i, &child_info) != OT_ERROR_NONE) {
+			continue;
+		}
+		while (otThreadGetChildNextIp6Address(instance, i, &iterator, &child_address) ==
+		       OT_ERROR_NONE) {
+			if (otIp6IsAddressEqual(&child_address, address)) {
+				return true;
+			}
+		}
+	}
+#else
+	ARG_UNUSED(address);
+#endif
+	return false;
+}
+
+int aggregator_add(const otIp6Address *address, const uint8_t *block, size_t length)
+{
+	size_t record_length = AGGREGATOR_RECORD_HEADER_SIZE + length;
+	struct delivery_header header;
+	size_t block_end;
+	int ret = 0;
+
+	if ((delivery_header_parse(block, length, &header) != 0) || (header.seq == 0)) {
+		return 0;
+	}
+	if (record_length > AGGREGATOR_BLOCK_SIZE) {
+		return -EMSGSIZE;
+	}
+
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+
+	if (batch_in_transfer) {
+		stats.refused++;
+		ret = -EBUSY;
+		goto end;
+	}
+
+	/* Records do not cross blocks, the rest of the block stays zero. */
+	block_end = ROUND_DOWN(batch_length, AGGREGATOR_BLOCK_SIZE) + AGGREGATOR_BLOCK_SIZE;
+	if (batch_length + record_length > block_end) {
+		batch_length = block_end;
+	}
+	if (batch_length + record_length > sizeof(batch)) {
+		stats.refused++;
+		k_work_reschedule(&flush_work, K_NO_WAIT);
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	if (batch_records == 0) {
+		batch_start_time = k_uptime_get();
+		k_work_reschedule(&flush_work, K_MSEC(CONFIG_AGGREGATOR_DELAY));
+	}
+
+	memcpy(&batch[batch_length], address, sizeof(*address));
+	sys_put_le16((uint16_t)length, &batch[batch_length + sizeof(*address)]);
+	memcpy(&batch[batch_length + AGGREGATOR_RECORD_HEADER_SIZE], block, length);
+	batch_length += record_length;
+	batch_records++;
+	stats.records++;
+	LOG_DBG("Batch %u of session %08x aggregated, %zu B", header.seq, header.session,
+		batch_length);
+
+	/* Blocks of a meter are alike, forward once the next one does not fit. */
+	if (batch_length + record_length > sizeof(batch)) {
+		k_work_reschedule(&flush_work, K_NO_WAIT);
+	}
+
+end:
+	k_mutex_unlock(&aggregator_lock);
+
+	return ret;
+}
+
+void aggregator_modem_found(const otIp6Address *address)
+{
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+	upstream = *address;
+	has_upstream = true;
+	k_mutex_unlock(&aggregator_lock);
+}
+
+/* Called by the CoAP blockwise client, the batch is not changed in transfer. */
+static void on_batch_tx(void *context, uint8_t *block, uint32_t position, uint16_t *block_length,
+			bool *more)
+{
+	size_t length = MIN(batch_length - position, (size_t)*block_length);
+
+	ARG_UNUSED(context);
+
+	memcpy(block, &batch[position], length);
+	*block_length = (uint16_t)length;
+	*more = (position + length < batch_length);
+}
+
+static void on_batch_response(void *context, otMessage *message, const otMessageInfo *message_info,
+			      otError error)
+{
+	ARG_UNUSED(context);
+	ARG_UNUSED(message_info);
+
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+
+	batch_in_transfer = false;
+	if ((error == OT_ERROR_NONE) && (message != NULL) &&
+	    (otCoapMessageGetCode(message) == OT_COAP_CODE_CHANGED)) {
+		LOG_INF("Batch of %u records forwarded, %zu B", batch_records, batch_length);
+		stats.batches++;
+		stats.bytes += batch_length;
+#if CONFIG_ENERGY_ACCOUNTING
+		energy_uploaded(batch_length);
+#endif
+		stats.delay += k_uptime_get() - batch_start_time;
+		memset(batch, 0, sizeof(batch));
+		batch_length = 0;
+		batch_records = 0;
+	} else {
+		/* Look for another modem before the next attempt. */
+		LOG_WRN("Batch forwarding failed (error: %d)", error);
+		stats.failed++;
+		has_upstream = false;
+		k_work_reschedule(&flush_work, K_MSEC(CONFIG_AGGREGATOR_DELAY));
+	}
+
+	k_mutex_unlock(&aggregator_lock);
+}
+
+static void flush_work_handler(struct k_work *work)
+{
+	otIp6Address address;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+
+	if (batch_in_transfer || (batch_records == 0)) {
+		k_mutex_unlock(&aggregator_lock);
+		return;
+	}
+
+	if (!has_upstream) {
+		k_mutex_unlock(&aggregator_lock);
+		LOG_INF("No modem to forward batch to, discover");
+		coap_utils_modem_discover();
+		k_work_reschedule(&flush_work, K_MSEC(CONFIG_AGGREGATOR_DELAY));
+		return;
+	}
+
+	address = upstream;
+	batch_in_transfer = true;
+
+	k_mutex_unlock(&aggregator_lock);
+
+	if (coap_utils_aggregate_upload(&address, on_batch_tx, on_batch_response) !=
+	    OT_ERROR_NONE) {
+		on_batch_response(NULL, NULL, NULL, OT_ERROR_FAILED);
+	}
+}
+
+/* Publish the fresh records of a block received from a router as one message. */
+static otError on_aggregate_rx(void *context, const uint8_t *block, uint32_t position,
+			       uint16_t block_length, bool more, uint32_t total_length)
+{
+	size_t offset = 0;
+	uint16_t records = 0;
+	bool tracked = false;
+	uint32_t tag = 0;
+	/* Fresh records of the block, published together */
+	struct net_buf *buf;
+	int ret;
+
+	ARG_UNUSED(context);
+	ARG_UNUSED(position);
+	ARG_UNUSED(more);
+	ARG_UNUSED(total_length);
+
+	buf = block_pool_alloc();
+	if (buf == NULL) {
+		return OT_ERROR_NO_BUFS;
+	}
+
+	while (offset + AGGREGATOR_RECORD_HEADER_SIZE <= block_length) {
+		struct delivery_header header;
+		otIp6Address address;
+		uint16_t length;
+
+		memcpy(&address, &block[offset], sizeof(address));
+		length = sys_get_le16(&block[offset + sizeof(address)]);
+		offset += AGGREGATOR_RECORD_HEADER_SIZE;
+		if (length == 0) {
+			break;
+		}
+		if ((offset + length > block_length) ||
+		    (delivery_header_parse(&block[offset], length, &header) != 0)) {
+			LOG_ERR("Invalid aggregated record");
+			goto error;
+		}
+
+		records++;
+		ret = tracked ? delivery_forward_join(&header, length, &address, tag) :
+				delivery_forward_prepare(&header, length, &address, &tag);
+		if (ret == 0) {
+			/* The block holds at most as much as the published framing. */
+			if (!tracked) {
+				net_buf_add_u8(buf, AGGREGATOR_PAYLOAD_TYPE);
+			}
+			net_buf_add_le16(buf, length);
+			net_buf_add_mem(buf, &block[offset], length);
+			tracked = true;
+		}
+		offset += length;
+	}
+
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+	stats.rx_blocks++;
+	stats.rx_records += records;
+	k_mutex_unlock(&aggregator_lock);
+
+	if (!tracked) {
+		net_buf_unref(buf);
+		return OT_ERROR_NONE;
+	}
+
+	/* The cloud acknowledgement of the tag is relayed to every meter. */
+	ret = modem_cloud_publish_buf(MODEM_TRAFFIC_BULK, buf, tag);
+	net_buf_unref(buf);
+	if (ret != 0) {
+		delivery_forward_cancel(tag);
+	}
+
+	if (ret == -EBUSY) {
+		LOG_DBG("Modem is busy, wait for next round");
+		return OT_ERROR_BUSY;
+	} else if (ret == -ENOMEM) {
+		LOG_ERR("No memory to upload data");
+		return OT_ERROR_NO_BUFS;
+	} else if (ret != 0) {
+		LOG_ERR("Fail to upload data to cloud");
+		return OT_ERROR_FAILED;
+	}
+
+	return OT_ERROR_NONE;
+
+error:
+	net_buf_unref(buf);
+	if (tracked) {
+		delivery_forward_cancel(tag);
+	}
+	return OT_ERROR_PARSE;
+}
+
+int aggregator_init(void)
+{
+	k_work_init_delayable(&flush_work, flush_work_handler);
+	coap_utils_set_aggregate_handler(on_aggregate_rx);
+
+	return 0;
+}
+
+void aggregator_get_stats(struct aggregator_stats *out)
+{
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&aggregator_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct aggregator_stats current;
+	size_t length;
+	uint16_t records;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&aggregator_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&aggregator_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&aggregator_lock, K_FOREVER);
+	current = stats;
+	length = batch_length;
+	records = batch_records;
+	k_mutex_unlock(&aggregator_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "batch: %u records %zu/%u B\n", records, length,
+		      CONFIG_AGGREGATOR_MAX_SIZE);
+	shell_fprintf(shell, SHELL_INFO, "records: %u refused: %u\n", current.records,
+		      current.refused);
+	shell_fprintf(shell, SHELL_INFO, "batches: %u bytes: %llu failed: %u\n", current.batches,
+		      current.bytes, current.failed);
+	shell_fprintf(shell, SHELL_INFO, "aggregation delay avg: %llu ms\n",
+		      current.batches ? current.delay / current.batches : 0);
+	shell_fprintf(shell, SHELL_INFO, "received blocks: %u records: %u\n", current.rx_blocks,
+		      current.rx_records);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_aggregator,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset aggregation statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(aggregator, &sub_aggregator, "aggregator commands", NULL);
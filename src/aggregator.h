@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __AGGREGATOR_H__
+#define __AGGREGATOR_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openthread/ip6.h>
+
+/**@brief Size of the blocks an aggregated batch is transferred in. */
+#define AGGREGATOR_BLOCK_SIZE 512
+
+/**
+ * @brief Size of the record header in front of every meter block.
+ *
+ * Encoded as the meter address followed by the little-endian block length.
+ * Records do not cross block boundaries, a zero length ends the records of
+ * a block.
+ */
+#define AGGREGATOR_RECORD_HEADER_SIZE (sizeof(otIp6Address) + sizeof(uint16_t))
+
+/**
+ * @brief Type byte in front of the records published by the modem.
+ *
+ * A published meter block starts with the meter ID, a unicast EUI-64 whose
+ * first octet never has the group bit set, so the odd type byte tells an
+ * aggregated payload from a single block on the same topic. The records
+ * follow, each as the little-endian block length and the block.
+ */
+#define AGGREGATOR_PAYLOAD_TYPE 0x01
+
+/**@brief Aggregation statistics. */
+struct aggregator_stats {
+	/** Meter blocks collected from children. */
+	uint32_t records;
+	/** Meter blocks refused, batch full or in transfer. */
+	uint32_t refused;
+	/** Batches forwarded upstream, and their size. */
+	uint32_t batches;
+	uint64_t bytes;
+	/** Batch transfers that failed. */
+	uint32_t failed;
+	/** Sum of the time from the first record to the forwarded batch [ms]. */
+	uint64_t delay;
+	/** Aggregated blocks and records received from routers. */
+	uint32_t rx_blocks;
+	uint32_t rx_records;
+};
+
+/**
+ * @brief Initialize aggregation.
+ *
+ * Must be called after OpenThread CoAP is initialized, the aggregate resource
+ * is served from then on.
+ */
+int aggregator_init(void);
+
+/**
+ * @brief Check if measurement of the meter is aggregated by this node.
+ *
+ * True for children of this node while it is a router.
+ *
+ * @note Must be called with the OpenThread API locked, e.g. from a CoAP handler.
+ */
+bool aggregator_accepts(const otIp6Address *address);
+
+/**
+ * @brief Add meter block to the batch forwarded upstream.
+ *
+ * @param[in] address address of the meter.
+ * @param[in] block   block starting with the delivery header.
+ * @param[in] length  size of the block.
+ *
+ * @retval 0         Block is added, or carries no batch.
+ * @retval -EBUSY    Batch is in transfer.
+ * @retval -ENOMEM   Batch is full, it is forwarded now.
+ * @retval -EMSGSIZE Block does not fit in a record.
+ */
+int aggregator_add(const otIp6Address *address, const uint8_t *block, size_t length);
+
+/**
+ * @brief Note a modem reporting idle state, batches are forwarded to it.
+ */
+void aggregator_modem_found(const otIp6Address *address);
+
+/**
+ * @brief Get a copy of the aggregation statistics.
+ */
+void aggregator_get_stats(struct aggregator_stats *stats);
+
+#endif /* __AGGREGATOR_H__ */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "bearer_select.h"
+
+LOG_MODULE_REGISTER(bearer_select, CONFIG_BEARER_SELECT_LOG_LEVEL);
+
+/* Bearer used when none was measured, the former fixed system mode */
+#define BEARER_DEFAULT BEARER_NB_IOT
+
+/* Weight of a new publish in the averages, 1 / 2^n */
+#define AVERAGE_SHIFT 2
+
+/* GNSS stays off, LTE preference follows the enabled bearer. */
+static const char *const mode_cmds[BEARER_COUNT] = {
+	[BEARER_LTE_M] = "AT%XSYSTEMMODE=1,0,0,0\r\n",
+	[BEARER_NB_IOT] = "AT%XSYSTEMMODE=0,1,0,0\r\n",
+};
+
+static const char *const bearer_names[BEARER_COUNT] = {
+	[BEARER_LTE_M] = "LTE-M",
+	[BEARER_NB_IOT] = "NB-IoT",
+};
+
+static struct bearer_select_stats stats = {
+	.selected = BEARER_COUNT,
+	.bearers = {
+		[BEARER_LTE_M] = {.rsrp = BEARER_RSRP_UNKNOWN},
+		[BEARER_NB_IOT] = {.rsrp = BEARER_RSRP_UNKNOWN},
+	},
+};
+static K_MUTEX_DEFINE(select_lock);
+
+static uint32_t average(uint32_t average, uint32_t sample, uint32_t count)
+{
+	if (count == 0) {
+		return sample;
+	}
+
+	return average - (average >> AVERAGE_SHIFT) + (sample >> AVERAGE_SHIFT);
+}
+
+/* Throughput a bearer is selected by, 0 if not eligible, with the lock held. */
+static uint32_t score_get(enum bearer bearer)
+{
+	const struct bearer_measurement *measurement = &stats.bearers[bearer];
+
+	if (measurement->unavailable || (measurement->publishes == 0)) {
+		return 0;
+	}
+	if ((measurement->rsrp != BEARER_RSRP_UNKNOWN) &&
+	    (measurement->rsrp < CONFIG_BEARER_SELECT_MIN_RSRP)) {
+		return 0;
+	}
+
+	return measurement->throughput;
+}
+
+/* Bearer without a publish that did not fail either, with the lock held. */
+static bool unprobed(enum bearer bearer)
+{
+	return (stats.bearers[bearer].publishes == 0) && !stats.bearers[bearer].unavailable;
+}
+
+const char *bearer_select_mode_cmd(enum bearer bearer)
+{
+	return mode_cmds[bearer];
+}
+
+void bearer_select_signal(enum bearer bearer, int16_t rsrp)
+{
+	k_mutex_lock(&select_lock, K_FOREVER);
+	stats.bearers[bearer].rsrp = rsrp;
+	k_mutex_unlock(&select_lock);
+}
+
+void bearer_select_publish(enum bearer bearer, size_t bytes, uint32_t latency)
+{
+	struct bearer_measurement *measurement = &stats.bearers[bearer];
+	uint32_t throughput = (uint32_t)((bytes * MSEC_PER_SEC) / MAX(latency, 1));
+
+	k_mutex_lock(&select_lock, K_FOREVER);
+	measurement->throughput = average(measurement->throughput, throughput,
+					  measurement->publishes);
+	measurement->latency = average(measurement->latency, latency, measurement->publishes);
+	measurement->publishes++;
+	measurement->unavailable = false;
+	k_mutex_unlock(&select_lock);
+
+	LOG_DBG("%s: %zu B in %u ms, %u B/s", bearer_names[bearer], bytes, latency, throughput);
+}
+
+void bearer_select_probe_done(enum bearer bearer, bool measured)
+{
+	k_mutex_lock(&select_lock, K_FOREVER);
+	if (!measured) {
+		LOG_WRN("No publish on %s", bearer_names[bearer]);
+		stats.bearers[bearer].failures++;
+		stats.bearers[bearer].unavailable = true;
+	}
+	k_mutex_unlock(&select_lock);
+}
+
+enum bearer bearer_select_decide(void)
+{
+	enum bearer best;
+	uint32_t best_score = 0;
+	uint32_t score;
+
+	k_mutex_lock(&select_lock, K_FOREVER);
+
+	best = stats.selected;
+	if (best < BEARER_COUNT) {
+		/* Another bearer must be better by the hysteresis to be selected. */
+		best_score = (uint32_t)(((uint64_t)score_get(best) *
+					 (100 + CONFIG_BEARER_SELECT_HYSTERESIS)) / 100);
+	}
+
+	for (enum bearer bearer = 0; bearer < BEARER_COUNT; bearer++) {
+		score = score_get(bearer);
+		if (score > best_score) {
+			best = bearer;
+			best_score = score;
+		}
+	}
+
+	/* No bearer is eligible, the selected one included: try one not probed yet. */
+	if (best_score == 0) {
+		best = BEARER_DEFAULT;
+		for (enum bearer bearer = 0; !unprobed(best) && (bearer < BEARER_COUNT); bearer++) {
+			if (unprobed(bearer)) {
+				best = bearer;
+			}
+		}
+	}
+
+	stats.selections++;
+	if (best != stats.selected) {
+		LOG_INF("%s selected, %u B/s", bearer_names[best], stats.bearers[best].throughput);
+		stats.switches++;
+		stats.selected = best;
+	}
+
+	k_mutex_unlock(&select_lock);
+
+	return best;
+}
+
+void bearer_select_get_stats(struct bearer_select_stats *out)
+{
+	k_mutex_lock(&select_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&select_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct bearer_select_stats current;
+
+	bearer_select_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "selected: %s, selections: %u, switches: %u\n",
+		      (current.selected < BEARER_COUNT) ? bearer_names[current.selected] : "none",
+		      current.selections, current.switches);
+
+	for (size_t i = 0; i < BEARER_COUNT; i++) {
+		struct bearer_measurement *measurement = &current.bearers[i];
+
+		shell_fprintf(shell, SHELL_INFO,
+			      "%s: %u B/s, latency %u ms, rsrp %d dBm, probes %u, failures %u%s\n",
+			      bearer_names[i], measurement->throughput, measurement->latency,
+			      (measurement->rsrp != BEARER_RSRP_UNKNOWN) ? measurement->rsrp : 0,
+			      measurement->publishes, measurement->failures,
+			      measurement->unavailable ? " (unavailable)" : "");
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_bearer,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get measurements and selection of the LTE bearers.\n",
+		cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(bearer, &sub_bearer, "LTE bearer selection commands", NULL);
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BEARER_SELECT_H__
+#define __BEARER_SELECT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief Radio access technology of the LTE link. */
+enum bearer {
+	BEARER_LTE_M,
+	BEARER_NB_IOT,
+	BEARER_COUNT,
+};
+
+/**@brief RSRP not reported yet. */
+#define BEARER_RSRP_UNKNOWN INT16_MIN
+
+/**@brief Measurements of a bearer. */
+struct bearer_measurement {
+	/** Probe publish throughput [B/s] and latency [ms], averaged over probes. */
+	uint32_t throughput;
+	uint32_t latency;
+	/** Last reported RSRP [dBm], or BEARER_RSRP_UNKNOWN. */
+	int16_t rsrp;
+	/** Probes measured, and probes without an acknowledged publish. */
+	uint32_t publishes;
+	uint32_t failures;
+	/** Last probe found no network or broker on the bearer. */
+	bool unavailable;
+};
+
+/**@brief Bearer selection statistics. */
+struct bearer_select_stats {
+	/** Selected bearer, BEARER_COUNT before the first selection. */
+	uint8_t selected;
+	/** Selections, and those changing the bearer. */
+	uint32_t selections;
+	uint32_t switches;
+	struct bearer_measurement bearers[BEARER_COUNT];
+};
+
+/**
+ * @brief Get the AT command setting the modem system mode to a bearer.
+ */
+const char *bearer_select_mode_cmd(enum bearer bearer);
+
+/**
+ * @brief Record the signal quality reported on a bearer.
+ *
+ * @param[in] rsrp RSRP [dBm].
+ */
+void bearer_select_signal(enum bearer bearer, int16_t rsrp);
+
+/**
+ * @brief Record a probe publish acknowledged by the broker on a bearer.
+ *
+ * Only probes are recorded, so that all bearers are compared by publishes
+ * of the same size.
+ *
+ * @param[in] bytes   bytes published.
+ * @param[in] latency time from sending to the acknowledgement [ms].
+ */
+void bearer_select_publish(enum bearer bearer, size_t bytes, uint32_t latency);
+
+/**
+ * @brief Record the end of a probe of a bearer.
+ *
+ * @param[in] measured the probe publish was acknowledged.
+ */
+void bearer_select_probe_done(enum bearer bearer, bool measured);
+
+/**
+ * @brief Select the bearer with the highest throughput.
+ *
+ * Bearers with an RSRP below CONFIG_BEARER_SELECT_MIN_RSRP, or found
+ * unavailable, are not selected. The selected bearer is only left for one
+ * exceeding its throughput by CONFIG_BEARER_SELECT_HYSTERESIS percent.
+ * Without any eligible bearer, the default one is selected, or a bearer
+ * not probed yet if the default one was.
+ *
+ * @return selected bearer.
+ */
+enum bearer bearer_select_decide(void);
+
+/**
+ * @brief Get a copy of the bearer selection statistics.
+ */
+void bearer_select_get_stats(struct bearer_select_stats *stats);
+
+#endif /* __BEARER_SELECT_H__ */
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <bluetooth/services/nus.h>
+
+#include "ble_export.h"
+#include "ble_utils.h"
+#include "meter_codec.h"
+
+LOG_MODULE_REGISTER(ble_export, CONFIG_BLE_EXPORT_LOG_LEVEL);
+
+/* Notification holding at least one record */
+#define PAYLOAD_MIN_SIZE (BLE_EXPORT_HEADER_SIZE + METER_CODEC_HEADER_SIZE + METER_CODEC_RECORD_MAX_SIZE)
+
+#define SEND_RETRY_DELAY K_MSEC(10)
+
+static ble_export_fill_t export_fill;
+static struct bt_conn *export_conn;
+static uint32_t export_cursor;
+/* Last notification is queued, the export ends once all are sent */
+static bool export_finishing;
+static int64_t export_start_time;
+static struct k_work_delayable send_work;
+static struct bt_gatt_exchange_params exchange_params;
+
+/* Notifications that may be queued in the stack */
+static K_SEM_DEFINE(credits, CONFIG_BLE_EXPORT_WINDOW, CONFIG_BLE_EXPORT_WINDOW);
+
+static struct ble_export_stats stats;
+static K_MUTEX_DEFINE(export_lock);
+
+/* Throughput in hundredths of kB/s, bytes per millisecond are kB/s. */
+static uint32_t throughput(const struct ble_export_stats *export_stats)
+{
+	if (export_stats->duration == 0) {
+		return 0;
+	}
+
+	return (uint32_t)((uint64_t)export_stats->bytes * 100 / export_stats->duration);
+}
+
+/* End the export, with the lock held. */
+static void export_end(bool aborted)
+{
+	stats.duration = (uint32_t)(k_uptime_get() - export_start_time);
+	if (aborted) {
+		stats.aborted++;
+		LOG_WRN("Export aborted at %u, %u B sent", export_cursor, stats.bytes);
+	} else {
+		LOG_INF("Exported %u B in %u ms, %u.%02u kB/s", stats.bytes, stats.duration,
+			throughput(&stats) / 100, throughput(&stats) % 100);
+	}
+
+	k_work_cancel_delayable(&send_work);
+	bt_conn_unref(export_conn);
+	export_conn = NULL;
+}
+
+static void send_work_handler(struct k_work *work)
+{
+	uint8_t payload[BLE_UTILS_PAYLOAD_MAX_SIZE];
+	int ret;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&export_lock, K_FOREVER);
+
+	while ((export_conn != NULL) && !export_finishing &&
+	       (k_sem_take(&credits, K_NO_WAIT) == 0)) {
+		uint16_t size = MIN(bt_nus_get_mtu(export_conn), sizeof(payload));
+		uint32_t cursor = export_cursor;
+		uint16_t length;
+
+		if (size < PAYLOAD_MIN_SIZE) {
+			LOG_ERR("ATT MTU too small for export, %u B payload", size);
+			k_sem_give(&credits);
+			export_end(true);
+			break;
+		}
+		if (stats.notifications == 0) {
+			export_start_time = k_uptime_get();
+			stats.payload_size = size;
+		}
+
+		length = export_fill(&cursor, &payload[BLE_EXPORT_HEADER_SIZE],
+				     size - BLE_EXPORT_HEADER_SIZE);
+		sys_put_le32(cursor, payload);
+
+		ret = bt_nus_send(export_conn, payload, BLE_EXPORT_HEADER_SIZE + length);
+		if (ret == -ENOMEM) {
+			/* Stack buffers are shared with other traffic. */
+			k_sem_give(&credits);
+			k_work_reschedule(&send_work, SEND_RETRY_DELAY);
+			break;
+		} else if (ret) {
+			LOG_ERR("Cannot send notification (error: %d)", ret);
+			k_sem_give(&credits);
+			export_end(true);
+			break;
+		}
+
+		export_cursor = cursor;
+		stats.notifications++;
+		stats.bytes += BLE_EXPORT_HEADER_SIZE + length;
+		export_finishing = (length == 0);
+	}
+
+	k_mutex_unlock(&export_lock);
+}
+
+void ble_export_sent(struct bt_conn *conn)
+{
+	k_mutex_lock(&export_lock, K_FOREVER);
+
+	if ((export_conn != NULL) && (conn == export_conn)) {
+		k_sem_give(&credits);
+		if (export_finishing && (k_sem_count_get(&credits) == CONFIG_BLE_EXPORT_WINDOW)) {
+			export_end(false);
+		} else {
+			k_work_reschedule(&send_work, K_NO_WAIT);
+		}
+	}
+
+	k_mutex_unlock(&export_lock);
+}
+
+static void exchange_func(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	ARG_UNUSED(params);
+
+	if (err) {
+		LOG_WRN("MTU exchange failed (err %u)", err);
+	} else {
+		LOG_INF("MTU exchanged, %u B", bt_gatt_get_mtu(conn));
+	}
+
+	/* Stream with whatever MTU was agreed on. */
+	k_work_reschedule(&send_work, K_NO_WAIT);
+}
+
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+	ARG_UNUSED(conn);
+
+	LOG_INF("PHY updated, tx %u rx %u", param->tx_phy, param->rx_phy);
+}
+
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+	ARG_UNUSED(conn);
+
+	LOG_INF("Data length updated, tx %u B rx %u B", info->tx_max_len, info->rx_max_len);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	ARG_UNUSED(reason);
+
+	k_mutex_lock(&export_lock, K_FOREVER);
+	if ((export_conn != NULL) && (conn == export_conn)) {
+		export_end(true);
+	}
+	k_mutex_unlock(&export_lock);
+}
+
+BT_CONN_CB_DEFINE(export_conn_callbacks) = {
+	.disconnected = disconnected,
+	.le_phy_updated = le_phy_updated,
+	.le_data_len_updated = le_data_len_updated,
+};
+
+int ble_export_start(struct bt_conn *conn, uint32_t cursor)
+{
+	int ret;
+
+	k_mutex_lock(&export_lock, K_FOREVER);
+
+	if (export_conn != NULL) {
+		k_mutex_unlock(&export_lock);
+		return -EBUSY;
+	}
+
+	export_conn = bt_conn_ref(conn);
+	export_cursor = cursor;
+	export_finishing = false;
+	k_sem_init(&credits, CONFIG_BLE_EXPORT_WINDOW, CONFIG_BLE_EXPORT_WINDOW);
+	stats.exports++;
+	stats.resumed += (cursor != 0) ? 1 : 0;
+	stats.notifications = 0;
+	stats.bytes = 0;
+	export_start_time = k_uptime_get();
+	LOG_INF("Export from %u", cursor);
+
+	k_mutex_unlock(&export_lock);
+
+	/* Link updates are requests, the export goes on if the peer refuses them. */
+	ret = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (ret) {
+		LOG_WRN("Cannot request 2M PHY (error: %d)", ret);
+	}
+	ret = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (ret) {
+		LOG_WRN("Cannot request data length update (error: %d)", ret);
+	}
+
+	exchange_params.func = exchange_func;
+	ret = bt_gatt_exchange_mtu(conn, &exchange_params);
+	if (ret) {
+		/* MTU was exchanged already, e.g. by the central. */
+		k_work_reschedule(&send_work, K_NO_WAIT);
+	}
+
+	return 0;
+}
+
+int ble_export_init(ble_export_fill_t fill)
+{
+	export_fill = fill;
+	k_work_init_delayable(&send_work, send_work_handler);
+
+	return 0;
+}
+
+void ble_export_get_stats(struct ble_export_stats *out)
+{
+	k_mutex_lock(&export_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&export_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ble_export_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&export_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&export_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	ble_export_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "exports: %u resumed: %u aborted: %u\n", current.exports,
+		      current.resumed, current.aborted);
+	shell_fprintf(shell, SHELL_INFO, "last: %u notifications of %u B, %u B in %u ms\n",
+		      current.notifications, current.payload_size, current.bytes,
+		      current.duration);
+	shell_fprintf(shell, SHELL_INFO, "throughput: %u.%02u kB/s\n", throughput(&current) / 100,
+		      throughput(&current) % 100);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_ble_export,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset bulk export statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(ble_export, &sub_ble_export, "BLE bulk export commands", NULL);
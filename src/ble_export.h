@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BLE_EXPORT_H__
+#define __BLE_EXPORT_H__
+
+#include <stdint.h>
+
+#include <zephyr/bluetooth/conn.h>
+
+/**
+ * @brief Size of the header of every export notification.
+ *
+ * Encoded as the little-endian cursor to resume the export from after this
+ * notification, followed by a meter codec block. A notification with the
+ * header alone ends the export.
+ */
+#define BLE_EXPORT_HEADER_SIZE 4
+
+/**
+ * @brief Callback encoding stored readings for the export.
+ *
+ * @param[in,out] cursor time [s] of the first reading to encode, advanced
+ *                       past the encoded readings.
+ * @param[out]    buf    buffer for a meter codec block.
+ * @param[in]     size   size of @p buf.
+ *
+ * @return Size of the block, 0 when no reading is left.
+ */
+typedef uint16_t (*ble_export_fill_t)(uint32_t *cursor, uint8_t *buf, uint16_t size);
+
+/**@brief Bulk export statistics. */
+struct ble_export_stats {
+	/** Exports started, and those resuming an earlier one. */
+	uint32_t exports;
+	uint32_t resumed;
+	/** Exports ended by a disconnection or a failed notification. */
+	uint32_t aborted;
+	/** Notifications and bytes sent by the last export. */
+	uint32_t notifications;
+	uint32_t bytes;
+	/** Duration of the last export [ms]. */
+	uint32_t duration;
+	/** ATT payload size used by the last export. */
+	uint16_t payload_size;
+};
+
+/**
+ * @brief Initialize bulk export.
+ *
+ * @param[in] fill called for the readings of every notification.
+ */
+int ble_export_init(ble_export_fill_t fill);
+
+/**
+ * @brief Start streaming stored readings over NUS.
+ *
+ * The connection is switched to 2M PHY, maximum data length and a large
+ * ATT MTU first. Up to CONFIG_BLE_EXPORT_WINDOW notifications are queued at
+ * a time.
+ *
+ * @param[in] conn   connection to export to.
+ * @param[in] cursor time [s] to start from, 0 for all readings, or the cursor
+ *                   of the last notification received to resume an export.
+ *
+ * @retval 0      Export started.
+ * @retval -EBUSY Export is ongoing.
+ */
+int ble_export_start(struct bt_conn *conn, uint32_t cursor);
+
+/**
+ * @brief Handle notification sent over NUS, see bt_nus_cb.
+ */
+void ble_export_sent(struct bt_conn *conn);
+
+/**
+ * @brief Get a copy of the bulk export statistics.
+ */
+void ble_export_get_stats(struct ble_export_stats *stats);
+
+#endif /* __BLE_EXPORT_H__ */
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <bluetooth/services/nus.h>
+
+#include "ble_fallback.h"
+#include "ble_utils.h"
+#include "block_pool.h"
+
+LOG_MODULE_REGISTER(ble_fallback, CONFIG_BLE_FALLBACK_LOG_LEVEL);
+
+/* Opcode and handle of a write */
+#define ATT_WRITE_HEADER_SIZE 3
+/* Block holding the framing of an upload and a few records */
+#define BLOCK_MIN_SIZE 64
+
+#define COLLECTOR_NAME CONFIG_BLE_FALLBACK_COLLECTOR_NAME
+#define COLLECTOR_NAME_LEN (sizeof(COLLECTOR_NAME) - 1)
+
+enum fallback_state {
+	FALLBACK_IDLE,
+	FALLBACK_SCANNING,
+	FALLBACK_CONNECTING,
+	FALLBACK_SENDING,
+	/* Last block written with response */
+	FALLBACK_CONFIRMING,
+	/* Ended, waiting for the disconnection */
+	FALLBACK_ENDED,
+};
+
+static const struct ble_fallback_cb *callbacks;
+static enum fallback_state state;
+static struct bt_conn *fallback_conn;
+static uint16_t rx_handle;
+static int64_t send_start_time;
+/* Blocks of the fallback written without response, delivered once a write is confirmed */
+static uint16_t unconfirmed_blocks;
+static struct k_work send_work;
+static struct k_work_delayable scan_timeout_work;
+
+static struct bt_gatt_exchange_params exchange_params;
+static struct bt_gatt_discover_params discover_params;
+static struct bt_gatt_write_params write_params;
+/* Last block, kept until its write is confirmed */
+static struct net_buf *last_block;
+
+/* Writes without response that may be queued in the stack */
+static K_SEM_DEFINE(credits, CONFIG_BLE_FALLBACK_WINDOW, CONFIG_BLE_FALLBACK_WINDOW);
+
+static struct ble_fallback_stats stats;
+static K_MUTEX_DEFINE(fallback_lock);
+
+/* Throughput in hundredths of kB/s, bytes per millisecond are kB/s. */
+static uint32_t throughput(uint64_t bytes, uint64_t duration)
+{
+	if (duration == 0) {
+		return 0;
+	}
+
+	return (uint32_t)(bytes * 100 / duration);
+}
+
+/* End the fallback, with the lock held. */
+static void fallback_end(int err)
+{
+	if (state == FALLBACK_SENDING || state == FALLBACK_CONFIRMING) {
+		stats.duration += k_uptime_get() - send_start_time;
+	}
+
+	if (err == -ETIMEDOUT) {
+		stats.not_found++;
+		LOG_WRN("No collector found");
+	} else if (err) {
+		stats.failed++;
+		LOG_WRN("Fallback failed (error: %d)", err);
+	} else {
+		LOG_INF("Measurement handed to collector");
+	}
+
+	k_work_cancel_delayable(&scan_timeout_work);
+	if (fallback_conn != NULL) {
+		state = FALLBACK_ENDED;
+		bt_conn_disconnect(fallback_conn, BT_HCI_ERR_REMOTE_USER_TERM_CONN);
+	} else {
+		state = FALLBACK_IDLE;
+	}
+
+	callbacks->done(err);
+}
+
+static void write_sent(struct bt_conn *conn, void *user_data)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(user_data);
+
+	/* Called from the stack, the send work takes the lock. */
+	k_sem_give(&credits);
+	k_work_submit(&send_work);
+}
+
+static void write_confirmed(struct bt_conn *conn, uint8_t err, struct bt_gatt_write_params *params)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(params);
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+	/* Also called when the connection is lost before the response. */
+	net_buf_unref(last_block);
+	last_block = NULL;
+	if (state == FALLBACK_CONFIRMING) {
+		fallback_end(err ? -EIO : 0);
+	}
+	k_mutex_unlock(&fallback_lock);
+}
+
+static void send_work_handler(struct k_work *work)
+{
+	struct net_buf *block;
+	uint16_t length;
+	uint16_t size;
+	bool more;
+	int ret;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	while ((state == FALLBACK_SENDING) && (k_sem_take(&credits, K_NO_WAIT) == 0)) {
+		size = MIN(bt_gatt_get_mtu(fallback_conn) - ATT_WRITE_HEADER_SIZE,
+			   BLE_UTILS_PAYLOAD_MAX_SIZE);
+		if (size < BLOCK_MIN_SIZE) {
+			LOG_ERR("ATT MTU too small for fallback, %u B payload", size);
+			fallback_end(-EMSGSIZE);
+			break;
+		}
+		block = block_pool_alloc();
+		if (block == NULL) {
+			fallback_end(-ENOMEM);
+			break;
+		}
+		length = callbacks->fill(block->data, size, &more);
+		if (length == 0) {
+			/* Nothing confirms the blocks already written, they are sent again. */
+			net_buf_unref(block);
+			fallback_end((unconfirmed_blocks > 0) ? -ENODATA : 0);
+			break;
+		}
+
+		if (more) {
+			/* The stack copies the block. */
+			ret = bt_gatt_write_without_response_cb(fallback_conn, rx_handle, block->data,
+								length, false, write_sent, NULL);
+			net_buf_unref(block);
+			unconfirmed_blocks++;
+		} else {
+			/* Writes are handled in order, the response confirms all blocks. */
+			write_params.func = write_confirmed;
+			write_params.handle = rx_handle;
+			write_params.offset = 0;
+			write_params.data = block->data;
+			write_params.length = length;
+			ret = bt_gatt_write(fallback_conn, &write_params);
+			if (ret) {
+				net_buf_unref(block);
+			} else {
+				last_block = block;
+			}
+		}
+		if (ret) {
+			LOG_ERR("Cannot write block (error: %d)", ret);
+			fallback_end(ret);
+			break;
+		}
+
+		stats.blocks++;
+		stats.bytes += length;
+		if (!more) {
+			state = FALLBACK_CONFIRMING;
+		}
+	}
+
+	k_mutex_unlock(&fallback_lock);
+}
+
+static uint8_t discover_func(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			     struct bt_gatt_discover_params *params)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(params);
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	if (state != FALLBACK_CONNECTING) {
+		goto end;
+	}
+
+	if (attr == NULL) {
+		LOG_ERR("Collector has no NUS RX characteristic");
+		fallback_end(-ENOENT);
+		goto end;
+	}
+
+	rx_handle = bt_gatt_attr_value_handle(attr);
+	k_sem_init(&credits, CONFIG_BLE_FALLBACK_WINDOW, CONFIG_BLE_FALLBACK_WINDOW);
+	unconfirmed_blocks = 0;
+	state = FALLBACK_SENDING;
+	send_start_time = k_uptime_get();
+	k_work_submit(&send_work);
+
+end:
+	k_mutex_unlock(&fallback_lock);
+
+	return BT_GATT_ITER_STOP;
+}
+
+static void discover_start(struct bt_conn *conn)
+{
+	int ret;
+
+	discover_params.uuid = BT_UUID_NUS_RX;
+	discover_params.func = discover_func;
+	discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+	ret = bt_gatt_discover(conn, &discover_params);
+	if (ret) {
+		LOG_ERR("Cannot discover collector (error: %d)", ret);
+		k_mutex_lock(&fallback_lock, K_FOREVER);
+		fallback_end(ret);
+		k_mutex_unlock(&fallback_lock);
+	}
+}
+
+static void exchange_func(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	ARG_UNUSED(params);
+
+	if (err) {
+		LOG_WRN("MTU exchange failed (err %u)", err);
+	} else {
+		LOG_INF("MTU exchanged, %u B", bt_gatt_get_mtu(conn));
+	}
+
+	/* Send with whatever MTU was agreed on. */
+	discover_start(conn);
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	int ret;
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	if ((fallback_conn == NULL) || (conn != fallback_conn)) {
+		k_mutex_unlock(&fallback_lock);
+		return;
+	}
+
+	if (err) {
+		LOG_ERR("Cannot connect to collector (err %u)", err);
+		bt_conn_unref(fallback_conn);
+		fallback_conn = NULL;
+		fallback_end(-ECONNREFUSED);
+		k_mutex_unlock(&fallback_lock);
+		return;
+	}
+
+	LOG_INF("Connected to collector");
+	k_mutex_unlock(&fallback_lock);
+
+	/* Link updates are requests, the transfer goes on if the peer refuses them. */
+	ret = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (ret) {
+		LOG_WRN("Cannot request 2M PHY (error: %d)", ret);
+	}
+	ret = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (ret) {
+		LOG_WRN("Cannot request data length update (error: %d)", ret);
+	}
+
+	exchange_params.func = exchange_func;
+	ret = bt_gatt_exchange_mtu(conn, &exchange_params);
+	if (ret) {
+		discover_start(conn);
+	}
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	if ((fallback_conn != NULL) && (conn == fallback_conn)) {
+		LOG_INF("Disconnected from collector (reason %u)", reason);
+		bt_conn_unref(fallback_conn);
+		fallback_conn = NULL;
+		if (state != FALLBACK_ENDED) {
+			fallback_end(-ENOTCONN);
+		}
+		state = FALLBACK_IDLE;
+	}
+
+	k_mutex_unlock(&fallback_lock);
+}
+
+BT_CONN_CB_DEFINE(fallback_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+};
+
+static bool collector_name_match(struct bt_data *data, void *user_data)
+{
+	bool *found = user_data;
+
+	if ((data->type == BT_DATA_NAME_COMPLETE) && (data->data_len == COLLECTOR_NAME_LEN) &&
+	    (memcmp(data->data, COLLECTOR_NAME, COLLECTOR_NAME_LEN) == 0)) {
+		*found = true;
+		return false;
+	}
+
+	return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
+			 struct net_buf_simple *ad)
+{
+	bool found = false;
+	int ret;
+
+	if ((type != BT_GAP_ADV_TYPE_ADV_IND) && (type != BT_GAP_ADV_TYPE_SCAN_RSP)) {
+		return;
+	}
+
+	bt_data_parse(ad, collector_name_match, &found);
+	if (!found) {
+		return;
+	}
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	if (state != FALLBACK_SCANNING) {
+		goto end;
+	}
+
+	LOG_INF("Collector found, RSSI %d", rssi);
+	bt_le_scan_stop();
+	k_work_cancel_delayable(&scan_timeout_work);
+
+	ret = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, BT_LE_CONN_PARAM_DEFAULT,
+				&fallback_conn);
+	if (ret) {
+		LOG_ERR("Cannot connect to collector (error: %d)", ret);
+		fallback_conn = NULL;
+		fallback_end(ret);
+		goto end;
+	}
+	state = FALLBACK_CONNECTING;
+
+end:
+	k_mutex_unlock(&fallback_lock);
+}
+
+static void scan_timeout_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+	if (state == FALLBACK_SCANNING) {
+		bt_le_scan_stop();
+		fallback_end(-ETIMEDOUT);
+	}
+	k_mutex_unlock(&fallback_lock);
+}
+
+int ble_fallback_start(void)
+{
+	int ret;
+
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+
+	if (state != FALLBACK_IDLE) {
+		ret = -EBUSY;
+		goto end;
+	}
+
+	ret = bt_le_scan_start(BT_LE_SCAN_ACTIVE, device_found);
+	if (ret) {
+		LOG_ERR("Cannot start scanning (error: %d)", ret);
+		goto end;
+	}
+
+	stats.sessions++;
+	state = FALLBACK_SCANNING;
+	k_work_reschedule(&scan_timeout_work, K_MSEC(CONFIG_BLE_FALLBACK_SCAN_TIMEOUT));
+	LOG_INF("Looking for collector");
+
+end:
+	k_mutex_unlock(&fallback_lock);
+
+	return ret;
+}
+
+void ble_fallback_mesh_upload(size_t bytes, uint32_t duration)
+{
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+	stats.mesh_uploads++;
+	stats.mesh_bytes += bytes;
+	stats.mesh_duration += duration;
+	k_mutex_unlock(&fallback_lock);
+}
+
+int ble_fallback_init(const struct ble_fallback_cb *cb)
+{
+	callbacks = cb;
+	k_work_init(&send_work, send_work_handler);
+	k_work_init_delayable(&scan_timeout_work, scan_timeout_work_handler);
+
+	return 0;
+}
+
+void ble_fallback_get_stats(struct ble_fallback_stats *out)
+{
+	k_mutex_lock(&fallback_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&fallback_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ble_fallback_stats current;
+	uint32_t rate;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&fallback_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&fallback_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	ble_fallback_get_stats(&current);
+
+	rate = throughput(current.mesh_bytes, current.mesh_duration);
+	shell_fprintf(shell, SHELL_INFO, "mesh: %u uploads, %llu B, %u.%02u kB/s\n",
+		      current.mesh_uploads, current.mesh_bytes, rate / 100, rate % 100);
+	rate = throughput(current.bytes, current.duration);
+	shell_fprintf(shell, SHELL_INFO, "ble: %u blocks, %llu B, %u.%02u kB/s\n", current.blocks,
+		      current.bytes, rate / 100, rate % 100);
+	shell_fprintf(shell, SHELL_INFO, "fallbacks: %u (no collector: %u, failed: %u)\n",
+		      current.sessions, current.not_found, current.failed);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_ble_fallback,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset uplink statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(ble_fallback, &sub_ble_fallback, "BLE fallback uplink commands", NULL);
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BLE_FALLBACK_H__
+#define __BLE_FALLBACK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**@brief Callbacks of the BLE fallback uplink. */
+struct ble_fallback_cb {
+	/**
+	 * @brief Fill the next measurement block, framed as for CoAP uploads.
+	 *
+	 * @param[out] block buffer for the block.
+	 * @param[in]  size  size of @p block.
+	 * @param[out] more  set if another block follows this one.
+	 *
+	 * @return Size of the block without padding, 0 when nothing is left.
+	 */
+	uint16_t (*fill)(uint8_t *block, uint16_t size, bool *more);
+	/**
+	 * @brief Called when the blocks were handed over or the fallback failed.
+	 *
+	 * The write response of the collector to the last block is its
+	 * acknowledgement of all blocks, it takes over their delivery to the
+	 * cloud.
+	 *
+	 * @param[in] err 0 once the collector confirmed the last block,
+	 *                -ENODATA if fill ran out before a block with @p more
+	 *                cleared.
+	 */
+	void (*done)(int err);
+};
+
+/**@brief Uplink statistics of the mesh and the BLE fallback. */
+struct ble_fallback_stats {
+	/** Fallbacks started, and those that found no collector. */
+	uint32_t sessions;
+	uint32_t not_found;
+	/** Fallbacks ended before the collector received the last block. */
+	uint32_t failed;
+	/** Blocks and bytes handed to collectors, and the time spent [ms]. */
+	uint32_t blocks;
+	uint64_t bytes;
+	uint64_t duration;
+	/** Uploads, bytes and time spent [ms] uploading through a gateway. */
+	uint32_t mesh_uploads;
+	uint64_t mesh_bytes;
+	uint64_t mesh_duration;
+};
+
+/**
+ * @brief Initialize the BLE fallback uplink.
+ *
+ * @param[in] cb callbacks, kept by the module.
+ */
+int ble_fallback_init(const struct ble_fallback_cb *cb);
+
+/**
+ * @brief Hand measurement over to a BLE collector.
+ *
+ * Scans for the collector named CONFIG_BLE_FALLBACK_COLLECTOR_NAME, connects
+ * to it as central and writes the blocks to its NUS RX characteristic. Blocks
+ * are written without response, CONFIG_BLE_FALLBACK_WINDOW at a time, and the
+ * last one with response, which confirms all of them.
+ *
+ * @retval 0      Fallback started, the done callback reports the result.
+ * @retval -EBUSY Fallback is ongoing.
+ */
+int ble_fallback_start(void);
+
+/**
+ * @brief Record an upload through a gateway, to compare the uplinks.
+ *
+ * @param[in] bytes    bytes uploaded.
+ * @param[in] duration time from the start of the upload to its response [ms].
+ */
+void ble_fallback_mesh_upload(size_t bytes, uint32_t duration);
+
+/**
+ * @brief Get a copy of the uplink statistics.
+ */
+void ble_fallback_get_stats(struct ble_fallback_stats *stats);
+
+#endif /* __BLE_FALLBACK_H__ */
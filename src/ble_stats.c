@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <bluetooth/services/nus.h>
+#include <openthread/message.h>
+
+#include "ble_stats.h"
+#include "ble_utils.h"
+#include "modem_utils.h"
+
+#if CONFIG_COAP_RTO
+#include "coap_rto.h"
+#endif
+
+#if CONFIG_DELIVERY
+#include "delivery.h"
+#endif
+
+#if CONFIG_OT_BUFFERS
+#include "ot_buffers.h"
+#endif
+
+LOG_MODULE_REGISTER(ble_stats, CONFIG_BLE_STATS_LOG_LEVEL);
+
+#define FRAME_SIZE(fields) (BLE_STATS_FRAME_HEADER_SIZE + (fields))
+
+#define SAMPLE_MAX_SIZE                                                                            \
+	(FRAME_SIZE(4) + FRAME_SIZE(2) + FRAME_SIZE(6) +                                           \
+	 (IS_ENABLED(CONFIG_COAP_RTO) ? FRAME_SIZE(24) : 0) +                                      \
+	 (IS_ENABLED(CONFIG_DELIVERY) ? FRAME_SIZE(16) : 0) +                                      \
+	 (IS_ENABLED(CONFIG_OT_BUFFERS) ? FRAME_SIZE(12) : 0))
+
+static struct bt_conn *stream_conn;
+static uint32_t stream_period;
+static struct k_work_delayable sample_work;
+
+/* Samples waiting for a full notification */
+static uint8_t batch[BLE_UTILS_PAYLOAD_MAX_SIZE];
+static uint16_t batch_length;
+static uint16_t batch_samples;
+
+static struct ble_stats_stats stats;
+static K_MUTEX_DEFINE(stream_lock);
+
+static uint8_t *frame_put(uint8_t *buf, enum ble_stats_frame type, uint8_t size)
+{
+	buf[0] = type;
+	buf[1] = size;
+
+	return &buf[BLE_STATS_FRAME_HEADER_SIZE];
+}
+
+static uint16_t sample_encode(uint8_t *buf)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otBufferInfo buffer_info;
+	uint8_t *pos = buf;
+
+	pos = frame_put(pos, BLE_STATS_FRAME_TIME, 4);
+	sys_put_le32((uint32_t)k_uptime_get(), pos);
+	pos += 4;
+
+	pos = frame_put(pos, BLE_STATS_FRAME_MODEM, 2);
+	sys_put_le16(MIN(modem_cloud_queue_depth(), UINT16_MAX), pos);
+	pos += 2;
+
+	openthread_api_mutex_lock(ot_context);
+	otMessageGetBufferInfo(ot_context->instance, &buffer_info);
+	openthread_api_mutex_unlock(ot_context);
+
+	pos = frame_put(pos, BLE_STATS_FRAME_OT_BUFFERS, 6);
+	sys_put_le16(buffer_info.mTotalBuffers, &pos[0]);
+	sys_put_le16(buffer_info.mFreeBuffers, &pos[2]);
+	sys_put_le16(buffer_info.mMaxUsedBuffers, &pos[4]);
+	pos += 6;
+
+#if CONFIG_COAP_RTO
+	struct coap_rto_stats rto;
+
+	coap_rto_get_stats(&rto);
+	pos = frame_put(pos, BLE_STATS_FRAME_COAP_RTO, 24);
+	sys_put_le32(rto.exchanges, &pos[0]);
+	sys_put_le32(rto.strong_samples, &pos[4]);
+	/* Wraps after 49 days of RTTs, the host takes differences. */
+	sys_put_le32((uint32_t)rto.rtt, &pos[8]);
+	sys_put_le32(rto.max_rtt, &pos[12]);
+	sys_put_le32(rto.retransmissions, &pos[16]);
+	sys_put_le32(rto.timeouts, &pos[20]);
+	pos += 24;
+#endif
+
+#if CONFIG_DELIVERY
+	struct delivery_stats delivery;
+
+	delivery_get_stats(&delivery);
+	pos = frame_put(pos, BLE_STATS_FRAME_DELIVERY, 16);
+	sys_put_le32(delivery.batches, &pos[0]);
+	sys_put_le32(delivery.resent, &pos[4]);
+	sys_put_le32(delivery.acked, &pos[8]);
+	sys_put_le32(delivery.forwarded, &pos[12]);
+	pos += 16;
+#endif
+
+#if CONFIG_OT_BUFFERS
+	struct ot_buffers_stats pressure;
+
+	ot_buffers_get_stats(&pressure);
+	pos = frame_put(pos, BLE_STATS_FRAME_OT_PRESSURE, 12);
+	pos[0] = pressure.p50;
+	pos[1] = pressure.p90;
+	pos[2] = pressure.p99;
+	pos[3] = pressure.level;
+	sys_put_le32(pressure.deferred[OT_BUFFERS_TRAFFIC_DISCOVER], &pos[4]);
+	sys_put_le32(pressure.deferred[OT_BUFFERS_TRAFFIC_UPLOAD], &pos[8]);
+	pos += 12;
+#endif
+
+	return pos - buf;
+}
+
+/* Send the batched samples, with the lock held. */
+static void batch_flush(void)
+{
+	int ret;
+
+	if (batch_length == 0) {
+		return;
+	}
+
+	/* The NUS sent callback releases the credits of a running export. */
+	ret = ble_utils_nus_notify(stream_conn, batch, batch_length, NULL);
+	if (ret) {
+		/* Stats are cumulative, the next notification makes up for it. */
+		LOG_WRN("Cannot send stats (error: %d)", ret);
+		stats.dropped += batch_samples;
+	} else {
+		stats.notifications++;
+		stats.bytes += batch_length;
+	}
+
+	batch_length = 0;
+	batch_samples = 0;
+}
+
+/* Stop streaming, with the lock held. */
+static void stream_stop(void)
+{
+	k_work_cancel_delayable(&sample_work);
+	batch_flush();
+	bt_conn_unref(stream_conn);
+	stream_conn = NULL;
+	LOG_INF("Stats stream stopped");
+}
+
+static void sample_work_handler(struct k_work *work)
+{
+	uint8_t sample[SAMPLE_MAX_SIZE];
+	uint16_t length;
+	uint16_t size;
+
+	ARG_UNUSED(work);
+
+	length = sample_encode(sample);
+
+	k_mutex_lock(&stream_lock, K_FOREVER);
+
+	if (stream_conn == NULL) {
+		goto end;
+	}
+
+	size = MIN(bt_nus_get_mtu(stream_conn), sizeof(batch));
+	if (size < length) {
+		LOG_ERR("ATT MTU too small for stats, %u B payload", size);
+		batch_length = 0;
+		stream_stop();
+		goto end;
+	}
+
+	if (batch_length + length > size) {
+		batch_flush();
+	}
+
+	memcpy(&batch[batch_length], sample, length);
+	batch_length += length;
+	batch_samples++;
+	stats.samples++;
+
+	k_work_reschedule(&sample_work, K_MSEC(stream_period));
+
+end:
+	k_mutex_unlock(&stream_lock);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	ARG_UNUSED(reason);
+
+	k_mutex_lock(&stream_lock, K_FOREVER);
+	if ((stream_conn != NULL) && (conn == stream_conn)) {
+		/* Nothing left to send the batch over. */
+		batch_length = 0;
+		stream_stop();
+	}
+	k_mutex_unlock(&stream_lock);
+}
+
+BT_CONN_CB_DEFINE(stats_conn_callbacks) = {
+	.disconnected = disconnected,
+};
+
+int ble_stats_start(struct bt_conn *conn, uint32_t period)
+{
+	int ret = 0;
+
+	k_mutex_lock(&stream_lock, K_FOREVER);
+
+	if ((stream_conn != NULL) && (conn != stream_conn)) {
+		ret = -EBUSY;
+		goto end;
+	}
+
+	if (period == 0) {
+		if (stream_conn != NULL) {
+			stream_stop();
+		}
+		goto end;
+	}
+
+	if (stream_conn == NULL) {
+		stream_conn = bt_conn_ref(conn);
+		batch_length = 0;
+		batch_samples = 0;
+		stats.streams++;
+	}
+
+	stream_period = MAX(period, CONFIG_BLE_STATS_MIN_PERIOD);
+	k_work_reschedule(&sample_work, K_NO_WAIT);
+	LOG_INF("Stats stream every %u ms", stream_period);
+
+end:
+	k_mutex_unlock(&stream_lock);
+
+	return ret;
+}
+
+int ble_stats_init(void)
+{
+	k_work_init_delayable(&sample_work, sample_work_handler);
+
+	return 0;
+}
+
+void ble_stats_get_stats(struct ble_stats_stats *out)
+{
+	k_mutex_lock(&stream_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&stream_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ble_stats_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&stream_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&stream_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	ble_stats_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "streams: %u\n", current.streams);
+	shell_fprintf(shell, SHELL_INFO, "samples: %u (dropped: %u)\n", current.samples,
+		      current.dropped);
+	shell_fprintf(shell, SHELL_INFO, "notifications: %u, %u B\n", current.notifications,
+		      current.bytes);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_ble_stats,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset stats streaming statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(ble_stats, &sub_ble_stats, "BLE stats streaming commands", NULL);
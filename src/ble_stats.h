@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BLE_STATS_H__
+#define __BLE_STATS_H__
+
+#include <stdint.h>
+
+#include <zephyr/bluetooth/conn.h>
+
+/**
+ * @brief Types of the frames of a stats stream.
+ *
+ * Every frame is encoded as the type, the size of its fields and the fields,
+ * all little-endian. A sample starts with the time frame, followed by the
+ * frames of the enabled sources. Frames of unknown type are to be skipped.
+ */
+enum ble_stats_frame {
+	/** Uptime [ms] (u32). */
+	BLE_STATS_FRAME_TIME = 0x01,
+	/** Payloads waiting for the broker (u16). */
+	BLE_STATS_FRAME_MODEM = 0x02,
+	/** OpenThread message buffers total, free and maximum used (u16 each). */
+	BLE_STATS_FRAME_OT_BUFFERS = 0x03,
+	/**
+	 * Exchanges, RTT samples, RTT sum [ms], maximum RTT [ms],
+	 * retransmissions and timeouts (u32 each), see coap_rto_stats.
+	 */
+	BLE_STATS_FRAME_COAP_RTO = 0x04,
+	/** Batches sent, resent, acknowledged and forwarded (u32 each). */
+	BLE_STATS_FRAME_DELIVERY = 0x05,
+	/**
+	 * OpenThread message buffer usage [%] not exceeded by 50, 90 and 99 %
+	 * of the samples and pressure level (u8 each), then deferred discovers
+	 * and uploads (u32 each), see ot_buffers_stats.
+	 */
+	BLE_STATS_FRAME_OT_PRESSURE = 0x06,
+};
+
+/**@brief Size of the type and the size of a frame. */
+#define BLE_STATS_FRAME_HEADER_SIZE 2
+
+/**@brief Stats streaming statistics. */
+struct ble_stats_stats {
+	/** Streams started. */
+	uint32_t streams;
+	/** Samples taken, and those dropped with their notification. */
+	uint32_t samples;
+	uint32_t dropped;
+	/** Notifications and bytes sent. */
+	uint32_t notifications;
+	uint32_t bytes;
+};
+
+/**
+ * @brief Initialize stats streaming.
+ */
+int ble_stats_init(void);
+
+/**
+ * @brief Start streaming stats over NUS, or change the period of the stream.
+ *
+ * A sample is taken every @p period. Samples are batched until the next one
+ * does not fit in the ATT payload of the connection, so notifications are
+ * sent once per several periods. The stream stops when the connection ends.
+ *
+ * @param[in] conn   connection to stream to.
+ * @param[in] period sampling period [ms], 0 to stop streaming.
+ *
+ * @retval 0      Stream started, changed or stopped.
+ * @retval -EBUSY Stream is ongoing on another connection.
+ */
+int ble_stats_start(struct bt_conn *conn, uint32_t period);
+
+/**
+ * @brief Get a copy of the stats streaming statistics.
+ */
+void ble_stats_get_stats(struct ble_stats_stats *stats);
+
+#endif /* __BLE_STATS_H__ */
@@ -57,9 +57,17 @@ static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 
 static struct bt_conn *current_conn;
+static const struct bt_gatt_attr *nus_tx_attr;
 
 static void connected(struct bt_conn *conn, uint8_t err)
 {
+	struct bt_conn_info info;
+
+	/* Connections made as central, e.g. to a collector, are not NUS clients. */
+	if ((bt_conn_get_info(conn, &info) == 0) && (info.role != BT_CONN_ROLE_PERIPHERAL)) {
+		return;
+	}
+
 	if (err) {
 		LOG_ERR("Connection failed (err %u)", err);
 		return;
@@ -73,6 +81,10 @@ static void connected(struct bt_conn *conn, uint8_t err)
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
+	if (conn != current_conn) {
+		return;
+	}
+
 	LOG_INF("Disconnected (reason %u)", reason);
 
 	if (current_conn) {
@@ -175,6 +187,8 @@ int ble_utils_init(struct bt_nus_cb *nus_clbs, ble_connection_cb_t on_connect,
 		goto end;
 	}
 
+	nus_tx_attr = bt_gatt_find_by_uuid(NULL, 0, BT_UUID_NUS_TX);
+
 	ret = bt_le_adv_start(BT_LE_ADV_CONN, ad, ARRAY_SIZE(ad), sd,
 			      ARRAY_SIZE(sd));
 	if (ret) {
@@ -185,3 +199,20 @@ int ble_utils_init(struct bt_nus_cb *nus_clbs, ble_connection_cb_t on_connect,
 end:
 	return ret;
 }
+
+int ble_utils_nus_notify(struct bt_conn *conn, const uint8_t *data, uint16_t len,
+			 bt_gatt_complete_func_t sent)
+{
+	struct bt_gatt_notify_params params = {
+		.attr = nus_tx_attr,
+		.data = data,
+		.len = len,
+		.func = sent,
+	};
+
+	if ((nus_tx_attr == NULL) || !bt_gatt_is_subscribed(conn, nus_tx_attr, BT_GATT_CCC_NOTIFY)) {
+		return -EINVAL;
+	}
+
+	return bt_gatt_notify_cb(conn, &params);
+}
@@ -13,8 +13,12 @@
 #ifndef __BLE_UTILS_H__
 #define __BLE_UTILS_H__
 
+#include <zephyr/bluetooth/gatt.h>
 #include <bluetooth/services/nus.h>
 
+/** @brief ATT payload of a notification or write with the largest MTU of 247 B. */
+#define BLE_UTILS_PAYLOAD_MAX_SIZE 244
+
 /** @brief Type indicates function called when Bluetooth LE connection
  *         is established.
  *
@@ -43,6 +47,21 @@ int ble_utils_init(struct bt_nus_cb *nus_clbs,
 		   ble_connection_cb_t on_connect,
 		   ble_disconnection_cb_t on_disconnect);
 
+/** @brief Send data over NUS with its own sent callback.
+ *
+ * Unlike bt_nus_send, the sent callback given to ble_utils_init is not called
+ * for the notification, so streams sharing NUS keep separate flow control.
+ *
+ * @param[in] conn connection subscribed to NUS notifications.
+ * @param[in] data data to send.
+ * @param[in] len  length of the data.
+ * @param[in] sent function to call when the notification is sent, or NULL.
+ * @retval 0    On success.
+ * @retval != 0 On failure.
+ */
+int ble_utils_nus_notify(struct bt_conn *conn, const uint8_t *data, uint16_t len,
+			 bt_gatt_complete_func_t sent);
+
 #endif
 
 /**
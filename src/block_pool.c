@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/shell/shell.h>
+
+#include "block_pool.h"
+
+LOG_MODULE_REGISTER(block_pool, CONFIG_BLOCK_POOL_LOG_LEVEL);
+
+static void block_destroy(struct net_buf *buf);
+
+NET_BUF_POOL_FIXED_DEFINE(block_pool, CONFIG_BLOCK_POOL_COUNT, BLOCK_POOL_BLOCK_SIZE, 0,
+			  block_destroy);
+
+static struct block_pool_stats stats;
+static K_MUTEX_DEFINE(pool_lock);
+
+static void block_destroy(struct net_buf *buf)
+{
+	k_mutex_lock(&pool_lock, K_FOREVER);
+	stats.in_use--;
+	k_mutex_unlock(&pool_lock);
+
+	net_buf_destroy(buf);
+}
+
+struct net_buf *block_pool_alloc(void)
+{
+	struct net_buf *buf = net_buf_alloc(&block_pool, K_NO_WAIT);
+
+	k_mutex_lock(&pool_lock, K_FOREVER);
+	if (buf != NULL) {
+		stats.allocs++;
+		stats.in_use++;
+		stats.max_used = MAX(stats.max_used, stats.in_use);
+	} else {
+		stats.failures++;
+		LOG_WRN("Block pool exhausted");
+	}
+	k_mutex_unlock(&pool_lock);
+
+	return buf;
+}
+
+void block_pool_get_stats(struct block_pool_stats *out)
+{
+	k_mutex_lock(&pool_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&pool_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct block_pool_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		/* Blocks in use are still returned to the pool. */
+		k_mutex_lock(&pool_lock, K_FOREVER);
+		stats.allocs = 0;
+		stats.failures = 0;
+		stats.max_used = stats.in_use;
+		k_mutex_unlock(&pool_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	block_pool_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "blocks: %u of %u B\n", CONFIG_BLOCK_POOL_COUNT,
+		      BLOCK_POOL_BLOCK_SIZE);
+	shell_fprintf(shell, SHELL_INFO, "in use: %u (max: %u)\n", current.in_use,
+		      current.max_used);
+	shell_fprintf(shell, SHELL_INFO, "allocs: %u (exhausted: %u)\n", current.allocs,
+		      current.failures);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_block_pool,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset block pool statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(block_pool, &sub_block_pool, "Block pool commands", NULL);
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __BLOCK_POOL_H__
+#define __BLOCK_POOL_H__
+
+#include <stdint.h>
+
+#include <zephyr/net/buf.h>
+
+/**
+ * @brief Size of a block of the pool.
+ *
+ * Holds a measurement transfer block, or a published payload.
+ */
+#define BLOCK_POOL_BLOCK_SIZE CONFIG_BLOCK_POOL_BLOCK_SIZE
+
+/**@brief Block pool statistics. */
+struct block_pool_stats {
+	/** Blocks taken from the pool. */
+	uint32_t allocs;
+	/** Blocks not taken, the pool was exhausted. */
+	uint32_t failures;
+	/** Blocks in use, and the highest number in use at a time. */
+	uint16_t in_use;
+	uint16_t max_used;
+};
+
+/**
+ * @brief Take a block from the shared pool.
+ *
+ * The block is filled once and handed from stage to stage by reference,
+ * with net_buf_ref and net_buf_unref. It returns to the pool when the last
+ * reference is released.
+ *
+ * @note Does not wait, callers run in the OpenThread thread or work queues.
+ *
+ * @return Empty block, or NULL if the pool is exhausted.
+ */
+struct net_buf *block_pool_alloc(void);
+
+/**
+ * @brief Get a copy of the block pool statistics.
+ */
+void block_pool_get_stats(struct block_pool_stats *stats);
+
+#endif /* __BLOCK_POOL_H__ */
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "cloud_compress.h"
+
+LOG_MODULE_REGISTER(cloud_compress, CONFIG_CLOUD_COMPRESS_LOG_LEVEL);
+
+/*
+ * LZSS stream: a flag byte precedes every 8 items, LSB first, 1 for a match.
+ * A literal is one byte. A match is two bytes, big endian:
+ * (distance - 1) << 4 | (length - MATCH_MIN).
+ * Matches may reach back into the dictionary, which is virtually placed in
+ * front of the payload. scripts/cloud_decompress.py is the reference decoder.
+ */
+#define MATCH_MIN     3
+#define MATCH_MAX     (MATCH_MIN + 15)
+#define WINDOW_SIZE   4096
+#define HASH_SIZE     BIT(CONFIG_CLOUD_COMPRESS_HASH_BITS)
+#define HEADER(format, dict) (((format) << 4) | (dict))
+
+/*
+ * Dictionary primed with meter_codec blocks: block type followed by
+ * (timestamp delta-of-delta, value delta) zig-zag pairs of a meter sampling
+ * at a fixed period, and ASCII digits of uncoded measurements.
+ */
+static const uint8_t dictionary[] = {
+	0x01, 0x00, 0x00, 0x02, 0x00, 0x01, 0x00, 0x00, 0x02, 0x02, 0x02, 0x01,
+	0x02, 0x00, 0x04, 0x02, 0x04, 0x01, 0x04, 0x00, 0x06, 0x02, 0x06, 0x01,
+	0x06, 0x00, 0x08, 0x02, 0x08, 0x01, 0x08, 0x00, 0x0a, 0x02, 0x0a, 0x01,
+	0x0a, 0x00, 0x0c, 0x02, 0x0c, 0x01, 0x0c, 0x00, 0x0e, 0x02, 0x0e, 0x01,
+	0x0e, 0x00, 0x10, 0x02, 0x10, 0x01, 0x10, 0x00, 0x12, 0x02, 0x12, 0x01,
+	0x12, 0x00, 0x14, 0x02, 0x14, 0x01, 0x14, 0x00, 0x16, 0x02, 0x16, 0x01,
+	0x16, 0x00, 0x18, 0x02, 0x18, 0x01, 0x18, 0x00, 0x1a, 0x02, 0x1a, 0x01,
+	0x1a, 0x00, 0x1c, 0x02, 0x1c, 0x01, 0x1c, 0x00, 0x1e, 0x02, 0x1e, 0x01,
+	0x1e, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+};
+
+#if CONFIG_CLOUD_COMPRESS_DICTIONARY
+#define DICT_ID   CLOUD_COMPRESS_DICT_METER
+#define DICT_SIZE sizeof(dictionary)
+#else
+#define DICT_ID   CLOUD_COMPRESS_DICT_NONE
+#define DICT_SIZE 0
+#endif
+
+BUILD_ASSERT(sizeof(dictionary) + CONFIG_CLOUD_COMPRESS_MAX_INPUT <= WINDOW_SIZE,
+	     "Dictionary and payload must fit in the match window");
+
+struct lzss_state {
+	const uint8_t *in;
+	size_t total;
+	uint8_t *out;
+	size_t out_size;
+	size_t length;
+	size_t flag_pos;
+	uint8_t flag_bit;
+};
+
+static int16_t hash_head[HASH_SIZE];
+static int16_t hash_prev[DICT_SIZE + CONFIG_CLOUD_COMPRESS_MAX_INPUT];
+static struct cloud_compress_stats stats;
+static K_MUTEX_DEFINE(compress_lock);
+
+static inline uint8_t byte_at(const struct lzss_state *state, size_t pos)
+{
+	return (pos < DICT_SIZE) ? dictionary[pos] : state->in[pos - DICT_SIZE];
+}
+
+static inline uint32_t hash_at(const struct lzss_state *state, size_t pos)
+{
+	uint32_t key = byte_at(state, pos) | (byte_at(state, pos + 1) << 8) |
+		       (byte_at(state, pos + 2) << 16);
+
+	return (key * 2654435761U) >> (32 - CONFIG_CLOUD_COMPRESS_HASH_BITS);
+}
+
+static void hash_insert(const struct lzss_state *state, size_t pos)
+{
+	uint32_t hash;
+
+	if (pos + MATCH_MIN > state->total) {
+		return;
+	}
+
+	hash = hash_at(state, pos);
+	hash_prev[pos] = hash_head[hash];
+	hash_head[hash] = (int16_t)pos;
+}
+
+static size_t match_find(const struct lzss_state *state, size_t pos, size_t *distance)
+{
+	size_t best = 0;
+	size_t max = MIN(MATCH_MAX, state->total - pos);
+	int16_t candidate;
+
+	if (max < MATCH_MIN) {
+		return 0;
+	}
+
+	candidate = hash_head[hash_at(state, pos)];
+	for (int depth = 0; (candidate >= 0) && (depth < CONFIG_CLOUD_COMPRESS_CHAIN_DEPTH);
+	     depth++) {
+		size_t length = 0;
+
+		/* Overlapping matches are fine, the decoder copies byte by byte. */
+		while ((length < max) &&
+		       (byte_at(state, candidate + length) == byte_at(state, pos + length))) {
+			length++;
+		}
+		if (length > best) {
+			best = length;
+			*distance = pos - candidate;
+			if (best == max) {
+				break;
+			}
+		}
+		candidate = hash_prev[candidate];
+	}
+
+	return (best >= MATCH_MIN) ? best : 0;
+}
+
+static int item_put(struct lzss_state *state, bool match, uint16_t value)
+{
+	size_t size = match ? 2 : 1;
+
+	if (state->flag_bit == 8) {
+		if (state->length + 1 + size > state->out_size) {
+			return -ENOMEM;
+		}
+		state->flag_pos = state->length++;
+		state->out[state->flag_pos] = 0;
+		state->flag_bit = 0;
+	} else if (state->length + size > state->out_size) {
+		return -ENOMEM;
+	}
+
+	if (match) {
+		state->out[state->flag_pos] |= BIT(state->flag_bit);
+		state->out[state->length++] = value >> 8;
+	}
+	state->out[state->length++] = (uint8_t)value;
+	state->flag_bit++;
+
+	return 0;
+}
+
+static int lzss_compress(struct lzss_state *state)
+{
+	size_t pos, length, distance = 0;
+	int ret;
+
+	memset(hash_head, 0xff, sizeof(hash_head));
+	for (pos = 0; pos < DICT_SIZE; pos++) {
+		hash_insert(state, pos);
+	}
+
+	while (pos < state->total) {
+		length = match_find(state, pos, &distance);
+		if (length > 0) {
+			ret = item_put(state, true, ((distance - 1) << 4) | (length - MATCH_MIN));
+		} else {
+			ret = item_put(state, false, byte_at(state, pos));
+			length = 1;
+		}
+		if (ret != 0) {
+			return ret;
+		}
+
+		while (length-- > 0) {
+			hash_insert(state, pos++);
+		}
+	}
+
+	return 0;
+}
+
+int cloud_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size)
+{
+	struct lzss_state state = {
+		.in = in,
+		.total = DICT_SIZE + in_len,
+		.out = out,
+		/* Not worth it unless smaller than the stored payload. */
+		.out_size = MIN(out_size, CLOUD_COMPRESS_HEADER_SIZE + in_len),
+		.length = CLOUD_COMPRESS_HEADER_SIZE,
+		.flag_bit = 8,
+	};
+	uint32_t start = k_cycle_get_32();
+	int ret = -ENOMEM;
+
+	k_mutex_lock(&compress_lock, K_FOREVER);
+
+	if (in_len <= CONFIG_CLOUD_COMPRESS_MAX_INPUT) {
+		ret = lzss_compress(&state);
+	}
+
+	if ((ret == 0) && (state.length < CLOUD_COMPRESS_HEADER_SIZE + in_len)) {
+		out[0] = HEADER(CLOUD_COMPRESS_FORMAT_LZSS, DICT_ID);
+		ret = state.length;
+	} else if (CLOUD_COMPRESS_HEADER_SIZE + in_len <= out_size) {
+		out[0] = HEADER(CLOUD_COMPRESS_FORMAT_STORED, CLOUD_COMPRESS_DICT_NONE);
+		memcpy(&out[CLOUD_COMPRESS_HEADER_SIZE], in, in_len);
+		ret = CLOUD_COMPRESS_HEADER_SIZE + in_len;
+		stats.stored++;
+	} else {
+		LOG_ERR("Payload does not fit in output buffer");
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	stats.payloads++;
+	stats.bytes_in += in_len;
+	stats.bytes_out += ret;
+	stats.time += k_cyc_to_us_floor64(k_cycle_get_32() - start);
+	LOG_DBG("Compressed %zu bytes to %d", in_len, ret);
+
+end:
+	k_mutex_unlock(&compress_lock);
+
+	return ret;
+}
+
+void cloud_compress_get_stats(struct cloud_compress_stats *out)
+{
+	k_mutex_lock(&compress_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&compress_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct cloud_compress_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&compress_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&compress_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	cloud_compress_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "payloads: %u (stored: %u)\n", current.payloads,
+		      current.stored);
+	shell_fprintf(shell, SHELL_INFO, "bytes in/out: %llu/%llu\n", current.bytes_in,
+		      current.bytes_out);
+	shell_fprintf(shell, SHELL_INFO, "size after compression: %llu%%\n",
+		      current.bytes_in ? current.bytes_out * 100 / current.bytes_in : 0);
+	shell_fprintf(shell, SHELL_INFO, "time: %llu us/KB\n",
+		      current.bytes_in ? current.time * 1024 / current.bytes_in : 0);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_cloud_compress,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset compression statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(cloud_compress, &sub_cloud_compress, "cloud compression commands", NULL);
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __CLOUD_COMPRESS_H__
+#define __CLOUD_COMPRESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief Payload formats given in the high nibble of the header byte. */
+#define CLOUD_COMPRESS_FORMAT_STORED 0x0
+#define CLOUD_COMPRESS_FORMAT_LZSS   0x1
+
+/**@brief Dictionaries given in the low nibble of the header byte. */
+#define CLOUD_COMPRESS_DICT_NONE  0x0
+#define CLOUD_COMPRESS_DICT_METER 0x1
+
+/**@brief Size of the header byte. */
+#define CLOUD_COMPRESS_HEADER_SIZE 1
+
+/**@brief Compression statistics. */
+struct cloud_compress_stats {
+	/** Number of compressed payloads. */
+	uint32_t payloads;
+	/** Payloads stored as is because compression did not pay off. */
+	uint32_t stored;
+	/** Bytes given to the compressor. */
+	uint64_t bytes_in;
+	/** Bytes produced, including the header. */
+	uint64_t bytes_out;
+	/** Time spent compressing [us]. */
+	uint64_t time;
+};
+
+/**
+ * @brief Compress payload for the cloud.
+ *
+ * The output always starts with a header byte. Payloads that do not get
+ * smaller are stored as is after the header.
+ *
+ * @return Number of bytes written to @p out, or -ENOMEM if @p out is too
+ *         small for the stored payload.
+ */
+int cloud_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Get a copy of the compression statistics.
+ */
+void cloud_compress_get_stats(struct cloud_compress_stats *stats);
+
+#endif /* __CLOUD_COMPRESS_H__ */
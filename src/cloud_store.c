@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/fs/fcb.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "cloud_store.h"
+
+LOG_MODULE_REGISTER(cloud_store, CONFIG_CLOUD_STORE_LOG_LEVEL);
+
+#define STORE_PARTITION_ID FIXED_PARTITION_ID(cloud_store_partition)
+/*
+ * Bumped with the entry layout. The version is part of the magic, so stores
+ * of another layout fail to mount and are erased instead of misparsed.
+ * Version 2 added the tag to the entry header.
+ */
+#define STORE_VERSION      2
+#define STORE_MAGIC        (0x636c7300 | STORE_VERSION)
+
+/* Entry is the traffic class and the little-endian tag followed by the data. */
+#define ENTRY_HEADER_SIZE  5
+#define ENTRY_BUFFER_SIZE  ROUND_UP(ENTRY_HEADER_SIZE + CLOUD_STORE_DATA_MAX_SIZE, 16)
+
+static struct flash_sector store_sectors[CONFIG_CLOUD_STORE_MAX_SECTORS];
+static struct fcb store_fcb;
+/*
+ * Last forwarded entry. It is always in the oldest sector, which is erased
+ * as soon as the next forwarded entry is in another sector.
+ */
+static struct fcb_entry read_loc;
+static struct fcb_entry peek_loc;
+static int64_t peek_time;
+static bool peeked;
+static bool available;
+static uint8_t entry_buffer[ENTRY_BUFFER_SIZE];
+#if CONFIG_CLOUD_STORE_EVICT_BULK
+/* Urgent entries of the evicted sector, each prefixed with its length */
+static uint8_t carry_buffer[CONFIG_CLOUD_STORE_CARRY_SIZE];
+#endif
+static struct cloud_store_stats stats;
+static K_MUTEX_DEFINE(store_lock);
+
+static inline off_t entry_offset(const struct fcb_entry *loc)
+{
+	return FCB_ENTRY_FA_DATA_OFF((*loc));
+}
+
+static inline bool entry_forwarded(const struct fcb_entry *loc)
+{
+	return (read_loc.fe_sector == loc->fe_sector) && (loc->fe_elem_off <= read_loc.fe_elem_off);
+}
+
+static int entry_append(uint8_t traffic_class, uint32_t tag, const uint8_t *data, size_t size)
+{
+	struct fcb_entry loc;
+	size_t length = ENTRY_HEADER_SIZE + size;
+	int ret;
+
+	ret = fcb_append(&store_fcb, length, &loc);
+	if (ret) {
+		return ret;
+	}
+
+	/* Flash is written in whole words, the CRC covers the entry only. */
+	entry_buffer[0] = traffic_class;
+	sys_put_le32(tag, &entry_buffer[1]);
+	memcpy(&entry_buffer[ENTRY_HEADER_SIZE], data, size);
+	ret = flash_area_write(store_fcb.fap, entry_offset(&loc), entry_buffer,
+			       ROUND_UP(length, store_fcb.f_align));
+	if (ret) {
+		return ret;
+	}
+
+	ret = fcb_append_finish(&store_fcb, &loc);
+	if (ret) {
+		return ret;
+	}
+
+	stats.entries++;
+	stats.bytes += size;
+	stats.peak_entries = MAX(stats.peak_entries, stats.entries);
+
+	return 0;
+}
+
+static void entry_drop(const struct fcb_entry *loc)
+{
+	stats.entries--;
+	stats.bytes -= loc->fe_data_len - ENTRY_HEADER_SIZE;
+}
+
+/* Erase the oldest sector to make room for new entries. */
+static void store_evict(void)
+{
+	struct flash_sector *oldest = store_fcb.f_oldest;
+	struct fcb_entry loc = { 0 };
+#if CONFIG_CLOUD_STORE_EVICT_BULK
+	size_t carried = 0;
+	uint8_t traffic_class;
+#endif
+
+	while ((fcb_getnext(&store_fcb, &loc) == 0) && (loc.fe_sector == oldest)) {
+		if (entry_forwarded(&loc)) {
+			continue;
+		}
+		entry_drop(&loc);
+#if CONFIG_CLOUD_STORE_EVICT_BULK
+		if ((flash_area_read(store_fcb.fap, entry_offset(&loc), &traffic_class,
+				     sizeof(traffic_class)) == 0) &&
+		    (traffic_class == MODEM_TRAFFIC_URGENT) &&
+		    (carried + sizeof(uint16_t) + loc.fe_data_len <= sizeof(carry_buffer)) &&
+		    (flash_area_read(store_fcb.fap, entry_offset(&loc),
+				     &carry_buffer[carried + sizeof(uint16_t)], loc.fe_data_len) == 0)) {
+			sys_put_le16(loc.fe_data_len, &carry_buffer[carried]);
+			carried += sizeof(uint16_t) + loc.fe_data_len;
+			continue;
+		}
+#endif
+		stats.evicted++;
+	}
+
+	fcb_rotate(&store_fcb);
+	if (read_loc.fe_sector == oldest) {
+		memset(&read_loc, 0, sizeof(read_loc));
+	}
+	peeked = false;
+
+#if CONFIG_CLOUD_STORE_EVICT_BULK
+	/* Urgent entries move to the end of the queue. */
+	for (size_t offset = 0; offset < carried;) {
+		uint16_t length = sys_get_le16(&carry_buffer[offset]);
+		const uint8_t *entry = &carry_buffer[offset + sizeof(uint16_t)];
+
+		if (entry_append(entry[0], sys_get_le32(&entry[1]), &entry[ENTRY_HEADER_SIZE],
+				 length - ENTRY_HEADER_SIZE)) {
+			stats.evicted++;
+		}
+		offset += sizeof(uint16_t) + length;
+	}
+#endif
+
+	LOG_WRN("Store full, oldest sector evicted (%u entries kept)", stats.entries);
+}
+
+int cloud_store_init(void)
+{
+	uint32_t sector_count = ARRAY_SIZE(store_sectors);
+	const struct flash_area *fa;
+	struct fcb_entry loc = { 0 };
+	int ret;
+
+	ret = flash_area_get_sectors(STORE_PARTITION_ID, &sector_count, store_sectors);
+	if (ret) {
+		LOG_ERR("Cannot get store sectors (error: %d)", ret);
+		return ret;
+	}
+	if (sector_count < 2) {
+		LOG_ERR("Store needs at least 2 sectors");
+		return -EINVAL;
+	}
+
+	store_fcb.f_magic = STORE_MAGIC;
+	store_fcb.f_version = STORE_VERSION;
+	store_fcb.f_sector_cnt = (uint8_t)sector_count;
+	store_fcb.f_scratch_cnt = 0;
+	store_fcb.f_sectors = store_sectors;
+
+	ret = fcb_init(STORE_PARTITION_ID, &store_fcb);
+	if (ret) {
+		LOG_WRN("Cannot mount store or other version, erasing (error: %d)", ret);
+		ret = flash_area_open(STORE_PARTITION_ID, &fa);
+		if (ret == 0) {
+			ret = flash_area_erase(fa, 0, fa->fa_size);
+			flash_area_close(fa);
+		}
+		if (ret == 0) {
+			ret = fcb_init(STORE_PARTITION_ID, &store_fcb);
+		}
+		if (ret) {
+			LOG_ERR("Cannot init store (error: %d)", ret);
+			return ret;
+		}
+	}
+
+	k_mutex_lock(&store_lock, K_FOREVER);
+	memset(&read_loc, 0, sizeof(read_loc));
+	peeked = false;
+	while (fcb_getnext(&store_fcb, &loc) == 0) {
+		stats.entries++;
+		stats.bytes += loc.fe_data_len - ENTRY_HEADER_SIZE;
+	}
+	stats.peak_entries = stats.entries;
+	available = true;
+	k_mutex_unlock(&store_lock);
+
+	LOG_INF("Store of %u sectors, %u entries (%u bytes) waiting", sector_count, stats.entries,
+		stats.bytes);
+
+	return 0;
+}
+
+bool cloud_store_available(void)
+{
+	return available;
+}
+
+bool cloud_store_is_empty(void)
+{
+	return stats.entries == 0;
+}
+
+int cloud_store_put(modem_traffic_class traffic_class, uint32_t tag, const uint8_t *data,
+		    size_t size)
+{
+	int ret;
+
+	if (!available) {
+		return -ENODEV;
+	}
+	if (size > CLOUD_STORE_DATA_MAX_SIZE) {
+		return -EINVAL;
+	}
+
+	k_mutex_lock(&store_lock, K_FOREVER);
+
+	ret = entry_append(traffic_class, tag, data, size);
+	if (ret == -ENOSPC) {
+		store_evict();
+		ret = entry_append(traffic_class, tag, data, size);
+	}
+
+	if (ret) {
+		LOG_ERR("Cannot store %zu bytes (error: %d)", size, ret);
+	} else {
+		stats.stored++;
+		LOG_DBG("Stored %zu bytes, %u entries waiting", size, stats.entries);
+	}
+
+	k_mutex_unlock(&store_lock);
+
+	return ret;
+}
+
+int cloud_store_peek(modem_traffic_class *traffic_class, uint32_t *tag, uint8_t *buf, size_t size)
+{
+	uint8_t header[ENTRY_HEADER_SIZE];
+	size_t length;
+	int ret = -ENODATA;
+
+	k_mutex_lock(&store_lock, K_FOREVER);
+
+	peeked = false;
+	peek_loc = read_loc;
+	while (available && (fcb_getnext(&store_fcb, &peek_loc) == 0)) {
+		length = peek_loc.fe_data_len - ENTRY_HEADER_SIZE;
+		if (length > size) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = flash_area_read(store_fcb.fap, entry_offset(&peek_loc), header, sizeof(header));
+		if (ret == 0) {
+			ret = flash_area_read(store_fcb.fap, entry_offset(&peek_loc) + ENTRY_HEADER_SIZE,
+					      buf, length);
+		}
+		if (ret == 0) {
+			*traffic_class = header[0];
+			*tag = sys_get_le32(&header[1]);
+			peek_time = k_uptime_get();
+			peeked = true;
+			ret = length;
+			break;
+		}
+
+		/* Unreadable entry would block the queue. */
+		LOG_ERR("Cannot read entry, dropped (error: %d)", ret);
+		read_loc = peek_loc;
+		entry_drop(&peek_loc);
+		stats.evicted++;
+		ret = -ENODATA;
+	}
+
+	k_mutex_unlock(&store_lock);
+
+	return ret;
+}
+
+void cloud_store_pop(void)
+{
+	k_mutex_lock(&store_lock, K_FOREVER);
+
+	if (!peeked) {
+		goto end;
+	}
+
+	peeked = false;
+	read_loc = peek_loc;
+	entry_drop(&read_loc);
+	stats.drained++;
+	stats.bytes_drained += read_loc.fe_data_len - ENTRY_HEADER_SIZE;
+	stats.drain_time += k_uptime_get() - peek_time;
+
+	while ((read_loc.fe_sector != store_fcb.f_oldest) && (fcb_rotate(&store_fcb) == 0)) {
+	}
+
+	/* Erase forwarded entries, so they are not sent again after a reset. */
+	if (stats.entries == 0) {
+		while (!fcb_is_empty(&store_fcb) && (fcb_rotate(&store_fcb) == 0)) {
+		}
+		memset(&read_loc, 0, sizeof(read_loc));
+		LOG_INF("Store drained");
+	}
+
+end:
+	k_mutex_unlock(&store_lock);
+}
+
+void cloud_store_get_stats(struct cloud_store_stats *out)
+{
+	k_mutex_lock(&store_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&store_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct cloud_store_stats current;
+	int free_sectors = 0;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&store_lock, K_FOREVER);
+		stats.peak_entries = stats.entries;
+		stats.stored = 0;
+		stats.evicted = 0;
+		stats.drained = 0;
+		stats.bytes_drained = 0;
+		stats.drain_time = 0;
+		k_mutex_unlock(&store_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&store_lock, K_FOREVER);
+	current = stats;
+	if (available) {
+		free_sectors = fcb_free_sector_cnt(&store_fcb);
+	}
+	k_mutex_unlock(&store_lock);
+
+	if (!available) {
+		shell_error(shell, "Store is not available");
+		return -ENODEV;
+	}
+
+	shell_fprintf(shell, SHELL_INFO, "depth: %u entries, %u bytes (peak: %u entries)\n",
+		      current.entries, current.bytes, current.peak_entries);
+	shell_fprintf(shell, SHELL_INFO, "free sectors: %d/%u\n", free_sectors,
+		      store_fcb.f_sector_cnt);
+	shell_fprintf(shell, SHELL_INFO, "stored: %u evicted: %u drained: %u\n", current.stored,
+		      current.evicted, current.drained);
+	shell_fprintf(shell, SHELL_INFO, "drain rate: %llu B/s\n",
+		      current.drain_time ?
+		      current.bytes_drained * MSEC_PER_SEC / current.drain_time : 0);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_cloud_store,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset store-and-forward statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(cloud_store, &sub_cloud_store, "cloud store-and-forward commands", NULL);
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __CLOUD_STORE_H__
+#define __CLOUD_STORE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modem_utils.h"
+
+/**@brief Maximum size of stored data. */
+#define CLOUD_STORE_DATA_MAX_SIZE 1024
+
+/**@brief Store-and-forward statistics. */
+struct cloud_store_stats {
+	/** Entries waiting in flash. */
+	uint32_t entries;
+	/** Bytes waiting in flash. */
+	uint32_t bytes;
+	/** Highest number of waiting entries. */
+	uint32_t peak_entries;
+	/** Entries put into the store. */
+	uint32_t stored;
+	/** Entries lost to eviction. */
+	uint32_t evicted;
+	/** Entries forwarded to the cloud. */
+	uint32_t drained;
+	/** Bytes forwarded to the cloud. */
+	uint64_t bytes_drained;
+	/** Time from peek to pop of forwarded entries [ms]. */
+	uint64_t drain_time;
+};
+
+/**
+ * @brief Mount the store partition.
+ *
+ * Entries kept in flash from before a reset are forwarded again.
+ */
+int cloud_store_init(void);
+
+/**
+ * @brief Check if the store was mounted.
+ */
+bool cloud_store_available(void);
+
+/**
+ * @brief Check if the store is empty.
+ */
+bool cloud_store_is_empty(void);
+
+/**
+ * @brief Append data to the store.
+ *
+ * @p tag is kept with the data, see modem_cloud_publish_tagged.
+ *
+ * When the store is full the oldest sector is evicted, see
+ * CONFIG_CLOUD_STORE_EVICTION.
+ *
+ * @retval 0       Data stored.
+ * @retval -EINVAL Data larger than CLOUD_STORE_DATA_MAX_SIZE.
+ * @retval -ENODEV Store is not available.
+ */
+int cloud_store_put(modem_traffic_class traffic_class, uint32_t tag, const uint8_t *data,
+		    size_t size);
+
+/**
+ * @brief Read the oldest entry without removing it.
+ *
+ * @return Number of bytes read to @p buf, -ENODATA if the store is empty,
+ *         or -ENOMEM if @p buf is too small.
+ */
+int cloud_store_peek(modem_traffic_class *traffic_class, uint32_t *tag, uint8_t *buf, size_t size);
+
+/**
+ * @brief Remove the entry returned by the last cloud_store_peek.
+ */
+void cloud_store_pop(void);
+
+/**
+ * @brief Get a copy of the store statistics.
+ */
+void cloud_store_get_stats(struct cloud_store_stats *stats);
+
+#endif /* __CLOUD_STORE_H__ */
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "coap_rto.h"
+
+LOG_MODULE_REGISTER(coap_rto, CONFIG_COAP_RTO_LOG_LEVEL);
+
+/* OpenThread rejects ACK timeouts below OT_COAP_MIN_ACK_TIMEOUT. */
+#define RTO_MIN          MAX(CONFIG_COAP_RTO_MIN, OT_COAP_MIN_ACK_TIMEOUT)
+#define RTO_MAX          CONFIG_COAP_RTO_MAX
+#define RTO_INITIAL      CONFIG_COAP_RTO_INITIAL
+#define RTO_RETRANSMIT   CONFIG_COAP_RTO_MAX_RETRANSMIT
+/* Dithering of the ACK timeout, same as the RFC 7252 default. */
+#define RTO_RANDOM_FACTOR_NUMERATOR   3
+#define RTO_RANDOM_FACTOR_DENOMINATOR 2
+/* Weak estimator is not updated after more retransmissions (CoCoA). */
+#define RTO_WEAK_MAX_RETRANSMISSIONS  2
+/* Large RTO is aged towards the initial one after this many RTOs (CoCoA). */
+#define RTO_AGING_PERIODS             4
+#define RTO_AGING_THRESHOLD           3000
+
+struct rto_peer {
+	otIp6Address address;
+	bool in_use;
+	uint8_t refs;
+	bool has_strong;
+	bool has_weak;
+	uint32_t srtt_strong;
+	uint32_t rttvar_strong;
+	uint32_t srtt_weak;
+	uint32_t rttvar_weak;
+	uint32_t rto;
+	uint32_t min_rtt;
+	int64_t last_update;
+	int64_t last_used;
+};
+
+struct coap_rto_exchange {
+	struct rto_peer *peer;
+	bool in_use;
+	/* ACK timeout used for the exchange */
+	uint32_t timeout;
+	/* First transmission time of the current block */
+	int64_t start;
+};
+
+static struct rto_peer peers[CONFIG_COAP_RTO_PEER_COUNT];
+static struct coap_rto_exchange exchanges[CONFIG_COAP_RTO_EXCHANGE_COUNT];
+static struct coap_rto_stats stats;
+static K_MUTEX_DEFINE(rto_lock);
+
+static struct rto_peer *peer_get(const otIp6Address *address, int64_t now)
+{
+	struct rto_peer *peer = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].in_use && otIp6IsAddressEqual(&peers[i].address, address)) {
+			peers[i].last_used = now;
+			return &peers[i];
+		}
+	}
+
+	/* Take a free entry or evict the least recently used idle peer. */
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (!peers[i].in_use) {
+			peer = &peers[i];
+			break;
+		}
+		if ((peers[i].refs == 0) && ((peer == NULL) || (peers[i].last_used < peer->last_used))) {
+			peer = &peers[i];
+		}
+	}
+
+	if (peer == NULL) {
+		return NULL;
+	}
+
+	memset(peer, 0, sizeof(*peer));
+	peer->address = *address;
+	peer->in_use = true;
+	peer->rto = RTO_INITIAL;
+	peer->min_rtt = UINT32_MAX;
+	peer->last_update = now;
+	peer->last_used = now;
+
+	return peer;
+}
+
+static void peer_age(struct rto_peer *peer, int64_t now)
+{
+	if ((peer->rto > RTO_AGING_THRESHOLD) &&
+	    (now - peer->last_update > (int64_t)RTO_AGING_PERIODS * peer->rto)) {
+		peer->rto = (peer->rto + RTO_INITIAL) / 2;
+		peer->last_update = now;
+		LOG_DBG("RTO aged to %u ms", peer->rto);
+	}
+}
+
+/* RFC 6298 smoothing, returns SRTT + K * RTTVAR. */
+static uint32_t estimator_update(bool *valid, uint32_t *srtt, uint32_t *rttvar,
+				 uint32_t rtt, uint32_t k)
+{
+	if (!*valid) {
+		*srtt = rtt;
+		*rttvar = rtt / 2;
+		*valid = true;
+	} else {
+		uint32_t delta = (*srtt > rtt) ? (*srtt - rtt) : (rtt - *srtt);
+
+		*rttvar = (3 * *rttvar + delta) / 4;
+		*srtt = (7 * *srtt + rtt) / 8;
+	}
+
+	return *srtt + k * *rttvar;
+}
+
+/*
+ * Lower bound of retransmissions sent before the response arrived. The
+ * first ACK timeout is drawn from timeout to timeout times the random
+ * factor, a retransmission only counts once even the longest draw expired.
+ */
+static uint8_t retransmissions_get(uint32_t timeout, uint32_t elapsed)
+{
+	uint64_t max_timeout = ((uint64_t)timeout * RTO_RANDOM_FACTOR_NUMERATOR) /
+			       RTO_RANDOM_FACTOR_DENOMINATOR;
+	uint8_t count = 0;
+	uint64_t sent_at = 0;
+
+	while (count < RTO_RETRANSMIT) {
+		sent_at += max_timeout << count;
+		if (sent_at >= elapsed) {
+			break;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static void peer_sample(struct rto_peer *peer, uint32_t timeout, uint32_t elapsed, int64_t now)
+{
+	uint8_t count = retransmissions_get(timeout, elapsed);
+	uint32_t rto;
+
+	if (count == 0) {
+		rto = estimator_update(&peer->has_strong, &peer->srtt_strong, &peer->rttvar_strong,
+				       elapsed, 4);
+		peer->rto = (rto + peer->rto) / 2;
+		peer->min_rtt = MIN(peer->min_rtt, elapsed);
+		stats.strong_samples++;
+		stats.rtt += elapsed;
+		stats.max_rtt = MAX(stats.max_rtt, elapsed);
+	} else {
+		/*
+		 * A response arriving sooner after the last retransmission than
+		 * the fastest RTT seen belongs to an earlier transmission.
+		 */
+		uint64_t last_sent_at = (uint64_t)timeout * (BIT(count) - 1);
+
+		if ((peer->min_rtt != UINT32_MAX) && (elapsed - last_sent_at < peer->min_rtt)) {
+			stats.spurious_retransmissions++;
+			stats.retransmissions += count - 1;
+		} else {
+			stats.retransmissions += count;
+		}
+
+		if (count <= RTO_WEAK_MAX_RETRANSMISSIONS) {
+			rto = estimator_update(&peer->has_weak, &peer->srtt_weak, &peer->rttvar_weak,
+					       elapsed, 1);
+			peer->rto = (rto + 3 * peer->rto) / 4;
+			stats.weak_samples++;
+		}
+	}
+
+	peer->rto = CLAMP(peer->rto, RTO_MIN, RTO_MAX);
+	peer->last_update = now;
+	LOG_DBG("RTT %u ms, retransmissions %u, RTO %u ms", elapsed, count, peer->rto);
+}
+
+struct coap_rto_exchange *coap_rto_exchange_begin(const otIp6Address *peer,
+						  otCoapTxParameters *params)
+{
+	struct coap_rto_exchange *exchange = NULL;
+	int64_t now = k_uptime_get();
+
+	k_mutex_lock(&rto_lock, K_FOREVER);
+
+	stats.exchanges++;
+
+	for (size_t i = 0; i < ARRAY_SIZE(exchanges); i++) {
+		if (!exchanges[i].in_use) {
+			exchange = &exchanges[i];
+			break;
+		}
+	}
+
+	if (exchange != NULL) {
+		exchange->peer = peer_get(peer, now);
+		if (exchange->peer == NULL) {
+			exchange = NULL;
+		}
+	}
+
+	if (exchange == NULL) {
+		LOG_WRN("No free RTO context, using default parameters");
+		stats.untracked++;
+		goto end;
+	}
+
+	peer_age(exchange->peer, now);
+	exchange->peer->refs++;
+	exchange->in_use = true;
+	exchange->timeout = exchange->peer->rto;
+	exchange->start = now;
+
+	params->mAckTimeout = exchange->timeout;
+	params->mAckRandomFactorNumerator = RTO_RANDOM_FACTOR_NUMERATOR;
+	params->mAckRandomFactorDenominator = RTO_RANDOM_FACTOR_DENOMINATOR;
+	params->mMaxRetransmit = RTO_RETRANSMIT;
+
+end:
+	k_mutex_unlock(&rto_lock);
+
+	return exchange;
+}
+
+void coap_rto_exchange_next_block(struct coap_rto_exchange *exchange)
+{
+	int64_t now = k_uptime_get();
+
+	if (exchange == NULL) {
+		return;
+	}
+
+	k_mutex_lock(&rto_lock, K_FOREVER);
+	peer_sample(exchange->peer, exchange->timeout, (uint32_t)(now - exchange->start), now);
+	exchange->start = now;
+	k_mutex_unlock(&rto_lock);
+}
+
+void coap_rto_exchange_end(struct coap_rto_exchange *exchange, otError error)
+{
+	int64_t now = k_uptime_get();
+
+	if (exchange == NULL) {
+		return;
+	}
+
+	k_mutex_lock(&rto_lock, K_FOREVER);
+
+	if (error == OT_ERROR_NONE) {
+		peer_sample(exchange->peer, exchange->timeout, (uint32_t)(now - exchange->start), now);
+	} else if (error == OT_ERROR_RESPONSE_TIMEOUT) {
+		stats.timeouts++;
+		stats.retransmissions += RTO_RETRANSMIT;
+	}
+
+	exchange->peer->refs--;
+	exchange->in_use = false;
+
+	k_mutex_unlock(&rto_lock);
+}
+
+void coap_rto_get_stats(struct coap_rto_stats *out)
+{
+	k_mutex_lock(&rto_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&rto_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct coap_rto_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&rto_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&rto_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	coap_rto_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "exchanges: %u (untracked: %u)\n", current.exchanges,
+		      current.untracked);
+	shell_fprintf(shell, SHELL_INFO, "RTT samples strong/weak: %u/%u\n",
+		      current.strong_samples, current.weak_samples);
+	shell_fprintf(shell, SHELL_INFO, "RTT avg/max: %u/%u ms\n",
+		      current.strong_samples ? (uint32_t)(current.rtt / current.strong_samples) : 0,
+		      current.max_rtt);
+	shell_fprintf(shell, SHELL_INFO, "retransmissions: %u\n", current.retransmissions);
+	shell_fprintf(shell, SHELL_INFO, "spurious retransmissions: %u\n",
+		      current.spurious_retransmissions);
+	shell_fprintf(shell, SHELL_INFO, "timeouts: %u\n", current.timeouts);
+
+	return 0;
+}
+
+static int cmd_peers(const struct shell *shell, size_t argc, char **argv)
+{
+	char address[OT_IP6_ADDRESS_STRING_SIZE];
+
+	k_mutex_lock(&rto_lock, K_FOREVER);
+	for (size_t i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (!peers[i].in_use) {
+			continue;
+		}
+		otIp6AddressToString(&peers[i].address, address, sizeof(address));
+		shell_fprintf(shell, SHELL_INFO,
+			      "%s rto: %u ms srtt strong/weak: %u/%u ms min rtt: %u ms\n",
+			      address, peers[i].rto, peers[i].srtt_strong, peers[i].srtt_weak,
+			      (peers[i].min_rtt == UINT32_MAX) ? 0 : peers[i].min_rtt);
+	}
+	k_mutex_unlock(&rto_lock);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_coap_rto,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset retransmission statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_CMD_ARG(
+		peers, NULL,
+		"Get RTO estimation of known peers.\n",
+		cmd_peers, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(coap_rto, &sub_coap_rto, "CoAP retransmission timeout commands", NULL);
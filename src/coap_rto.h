@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __COAP_RTO_H__
+#define __COAP_RTO_H__
+
+#include <openthread/coap.h>
+#include <openthread/ip6.h>
+
+/**@brief Retransmission statistics of confirmable exchanges. */
+struct coap_rto_stats {
+	/** Number of exchanges started. */
+	uint32_t exchanges;
+	/** Number of exchanges sent with default parameters (no free context). */
+	uint32_t untracked;
+	/** RTT samples taken without retransmission. */
+	uint32_t strong_samples;
+	/** RTT samples taken after a retransmission. */
+	uint32_t weak_samples;
+	/** Sum and maximum of the RTT samples taken without retransmission [ms]. */
+	uint64_t rtt;
+	uint32_t max_rtt;
+	/** Retransmissions that were needed to get a response. */
+	uint32_t retransmissions;
+	/** Retransmissions sent although the original was answered. */
+	uint32_t spurious_retransmissions;
+	/** Exchanges that ended without response. */
+	uint32_t timeouts;
+};
+
+/**@brief Context of a single confirmable (blockwise) exchange. */
+struct coap_rto_exchange;
+
+/**
+ * @brief Start a confirmable exchange with the peer.
+ *
+ * @param[in]  peer   address of the peer.
+ * @param[out] params transmission parameters to be used for the request.
+ *
+ * @return Exchange context to be passed as response context, or NULL if no
+ *         context is available. Default parameters are used in that case and
+ *         @p params must not be passed to OpenThread.
+ */
+struct coap_rto_exchange *coap_rto_exchange_begin(const otIp6Address *peer,
+						  otCoapTxParameters *params);
+
+/**
+ * @brief Notify that a block of a blockwise exchange was acknowledged and
+ *        the next block is being sent.
+ */
+void coap_rto_exchange_next_block(struct coap_rto_exchange *exchange);
+
+/**
+ * @brief End the exchange with the result reported by the response handler.
+ *
+ * @note Passing NULL is allowed and has no effect.
+ */
+void coap_rto_exchange_end(struct coap_rto_exchange *exchange, otError error);
+
+/**
+ * @brief Get a copy of the retransmission statistics.
+ */
+void coap_rto_get_stats(struct coap_rto_stats *stats);
+
+#endif /* __COAP_RTO_H__ */
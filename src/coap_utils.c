@@ -13,6 +13,31 @@
 
 #include "coap_utils.h"
 
+#if CONFIG_SED_UTILS
+#include "sed_utils.h"
+#endif
+
+#if CONFIG_COAP_RTO
+#include "coap_rto.h"
+#endif
+
+#if CONFIG_UPLOAD_SLOT
+#include <zephyr/random/random.h>
+#include "upload_slot.h"
+#endif
+
+#if CONFIG_RUNTIME_MONITOR
+#include "runtime_monitor.h"
+#endif
+
+#if CONFIG_OT_BUFFERS
+#include "ot_buffers.h"
+#endif
+
+#if CONFIG_DELIVERY
+#include <openthread/link.h>
+#endif
+
 LOG_MODULE_REGISTER(cellular_mesh_meter_util, CONFIG_CELLULAR_MESH_METER_UTILS_LOG_LEVEL);
 
 static bool is_connected;
@@ -23,13 +48,19 @@ static bool is_connected;
 K_THREAD_STACK_DEFINE(coap_client_workq_stack_area, COAP_WORKQ_STACK_SIZE);
 static struct k_work_q coap_client_workq;
 
-static struct k_work modem_discover_work;
+static struct k_work_delayable modem_discover_work;
 static struct k_work meter_upload_work;
 static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 
 /* Variable for storing peer address acquiring in modem upload measurement handshake */
 static otIp6Address metter_peer_address;
+static bool has_metter_peer_address;
+static int64_t alarm_sent_time;
+
+static struct k_work_delayable upload_request_work;
+/* Variable for storing address of the modem to send the next upload measurement request to */
+static otIp6Address upload_request_peer_address;
 
 struct server_context {
 	struct otInstance *ot;
@@ -37,6 +68,17 @@ struct server_context {
 	meter_block_tx_callback_t on_meter_block_tx;
 	meter_block_rx_callback_t on_meter_block_rx;
 	meter_response_callback_t on_meter_response;
+	alarm_request_callback_t on_alarm_request;
+	meter_pull_callback_t on_meter_pull;
+	meter_response_callback_t on_meter_pull_response;
+	meter_block_rx_callback_t on_aggregate_rx;
+	meter_block_tx_callback_t on_aggregate_tx;
+	meter_response_callback_t on_aggregate_response;
+	meter_upload_response_callback_t on_meter_upload_response;
+	image_request_callback_t on_image_request;
+	meter_block_tx_callback_t on_image_block_tx;
+	meter_block_rx_callback_t on_image_block_rx;
+	meter_response_callback_t on_image_response;
 };
 
 static struct server_context srv_context = {
@@ -45,6 +87,17 @@ static struct server_context srv_context = {
 	.on_meter_block_tx = NULL,
 	.on_meter_block_rx = NULL,
 	.on_meter_response = NULL,
+	.on_alarm_request = NULL,
+	.on_meter_pull = NULL,
+	.on_meter_pull_response = NULL,
+	.on_aggregate_rx = NULL,
+	.on_aggregate_tx = NULL,
+	.on_aggregate_response = NULL,
+	.on_meter_upload_response = NULL,
+	.on_image_request = NULL,
+	.on_image_block_tx = NULL,
+	.on_image_block_rx = NULL,
+	.on_image_response = NULL,
 };
 
 /**@brief Definition of CoAP block resources for meter. */
@@ -57,6 +110,26 @@ static otCoapBlockwiseResource meter_resource = {
 	.mNext = NULL,
 };
 
+/**@brief Definition of CoAP block resources for aggregated measurement. */
+static otCoapBlockwiseResource aggregate_resource = {
+	.mUriPath = AGGREGATE_URI_PATH,
+	.mHandler = NULL,
+	.mContext = NULL,
+	.mReceiveHook = NULL,
+	.mTransmitHook = NULL,
+	.mNext = NULL,
+};
+
+/**@brief Definition of CoAP block resources for distributed images. */
+static otCoapBlockwiseResource image_resource = {
+	.mUriPath = IMAGE_URI_PATH,
+	.mHandler = NULL,
+	.mContext = NULL,
+	.mReceiveHook = NULL,
+	.mTransmitHook = NULL,
+	.mNext = NULL,
+};
+
 /**@brief Definition of CoAP resources for modem. */
 static otCoapResource modem_resource = {
 	.mUriPath = MODEM_URI_PATH,
@@ -65,8 +138,38 @@ static otCoapResource modem_resource = {
 	.mNext = NULL,
 };
 
+/**@brief Definition of CoAP resources for alarm. */
+static otCoapResource alarm_resource = {
+	.mUriPath = ALARM_URI_PATH,
+	.mHandler = NULL,
+	.mContext = NULL,
+	.mNext = NULL,
+};
+
 static void submit_work_if_connected(struct k_work *work);
 
+/* Send confirmable request with retransmission timeout adapted to the peer. */
+static otError send_confirmable_request(otMessage *message, const otMessageInfo *message_info,
+					otCoapResponseHandler handler)
+{
+#if CONFIG_COAP_RTO
+	otCoapTxParameters tx_params;
+	struct coap_rto_exchange *exchange;
+	otError error;
+
+	exchange = coap_rto_exchange_begin(&message_info->mPeerAddr, &tx_params);
+	error = otCoapSendRequestWithParameters(srv_context.ot, message, message_info, handler,
+						exchange, (exchange != NULL) ? &tx_params : NULL);
+	if (error != OT_ERROR_NONE) {
+		coap_rto_exchange_end(exchange, error);
+	}
+
+	return error;
+#else
+	return otCoapSendRequest(srv_context.ot, message, message_info, handler, NULL);
+#endif
+}
+
 otError coap_utils_modem_report_state_response(otMessage *request_message,
 					  const otMessageInfo *message_info)
 {
@@ -97,6 +200,15 @@ end:
 otError coap_utils_send_response(otMessage *request_message,
 								 const otMessageInfo *message_info,
 								 otCoapCode code)
+{
+	return coap_utils_send_response_payload(request_message, message_info, code, NULL, 0);
+}
+
+otError coap_utils_send_response_payload(otMessage *request_message,
+										 const otMessageInfo *message_info,
+										 otCoapCode code,
+										 const uint8_t *payload,
+										 uint16_t payload_length)
 {
 	otError error = OT_ERROR_NO_BUFS;
 	otMessage *response;
@@ -112,6 +224,18 @@ otError coap_utils_send_response(otMessage *request_message,
 		goto end;
 	}
 
+	if (payload_length > 0) {
+		error = otCoapMessageSetPayloadMarker(response);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+
+		error = otMessageAppend(response, payload, payload_length);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
 	error = otCoapSendResponse(srv_context.ot, response, message_info);
 end:
 	if (error != OT_ERROR_NONE && response != NULL) {
@@ -123,6 +247,9 @@ end:
 
 static void handle_report_state_response(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
 {
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#endif
     if (error != OT_ERROR_NONE)
     {
         LOG_ERR("report state request error %d: %s", error, otThreadErrorToString(error));
@@ -134,6 +261,9 @@ static void handle_report_state_response(void *context, otMessage *message, cons
 
 static void handle_upload_measurement_response(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
 {
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#endif
     if (error != OT_ERROR_NONE)
     {
         LOG_ERR("report state request error %d: %s", error, otThreadErrorToString(error));
@@ -143,13 +273,36 @@ static void handle_upload_measurement_response(void *context, otMessage *message
 		if (otCoapMessageGetCode(message) == OT_COAP_CODE_CHANGED) {
 			LOG_INF("Modem upload measurement success");
 			metter_peer_address = message_info->mPeerAddr;
+			has_metter_peer_address = true;
 			submit_work_if_connected(&meter_upload_work);
+			return;
 		} else if (otCoapMessageGetCode(message) == OT_COAP_CODE_SERVICE_UNAVAILABLE) {
+#if CONFIG_UPLOAD_SLOT
+			uint32_t delay;
+
+			if (upload_slot_parse(srv_context.ot, message, &delay) == 0) {
+				LOG_INF("Modem is busy, upload slot in %u ms", delay);
+				upload_request_peer_address = message_info->mPeerAddr;
+				k_work_reschedule_for_queue(&coap_client_workq, &upload_request_work,
+							    K_MSEC(delay));
+#if CONFIG_SED_UTILS
+				sed_utils_boost_stop();
+#endif
+				return;
+			}
+#endif
 			LOG_INF("Modem is busy, wait for next round");
+			error = OT_ERROR_BUSY;
 		} else {
 			LOG_ERR("Modem upload measurement failed");
+			error = OT_ERROR_FAILED;
 		}
 	}
+#if CONFIG_SED_UTILS
+	sed_utils_boost_stop();
+#endif
+	/* Upload is not started, let the application try again. */
+	srv_context.on_meter_response(NULL, message, message_info, error);
 }
 
 otError coap_utils_modem_upload_measurement(const otMessageInfo *message_info)
@@ -182,7 +335,18 @@ otError coap_utils_modem_upload_measurement(const otMessageInfo *message_info)
 		goto end;
 	}
 
-	error = otCoapSendRequest(srv_context.ot, message, message_info, &handle_upload_measurement_response, NULL);
+#if CONFIG_DELIVERY
+	otExtAddress eui64;
+
+	/* The meter ID in the header of each block tells the modem which upload it is part of. */
+	otLinkGetFactoryAssignedIeeeEui64(srv_context.ot, &eui64);
+	error = otMessageAppend(message, eui64.m8, sizeof(eui64.m8));
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+#endif
+
+	error = send_confirmable_request(message, message_info, &handle_upload_measurement_response);
 	LOG_INF("Sent modem upload measurement");
 
 end:
@@ -230,7 +394,7 @@ otError coap_utils_modem_report_state(const otMessageInfo *message_info,
 		goto end;
 	}
 
-	error = otCoapSendRequest(srv_context.ot, message, message_info, &handle_report_state_response, NULL);
+	error = send_confirmable_request(message, message_info, &handle_report_state_response);
 	LOG_INF("Sent modem state: %d", modem_state);
 
 end:
@@ -242,6 +406,189 @@ end:
 	return error;
 }
 
+static void handle_cloud_ack_response(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
+{
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#endif
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("cloud ack request error %d: %s", error, otThreadErrorToString(error));
+	} else if (otCoapMessageGetCode(message) != OT_COAP_CODE_CHANGED) {
+		LOG_ERR("Cloud ack rejected by the meter");
+	}
+}
+
+static void handle_mailbox_ack_response(void *context, otMessage *message,
+					const otMessageInfo *message_info, otError error)
+{
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#endif
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("mailbox ack request error %d: %s", error, otThreadErrorToString(error));
+	} else if (otCoapMessageGetCode(message) != OT_COAP_CODE_CHANGED) {
+		LOG_ERR("Mailbox ack rejected by the modem");
+	}
+}
+
+/* Send modem command with payload, the OpenThread API may be locked by the caller. */
+static otError modem_command_send(const otIp6Address *peer_addr, uint8_t modem_command,
+				  const uint8_t *payload, uint16_t length,
+				  otCoapResponseHandler handler)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+
+	openthread_api_mutex_lock(ot_context);
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, OT_COAP_TYPE_CONFIRMABLE, OT_COAP_CODE_PUT);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, MODEM_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, &modem_command, sizeof(modem_command));
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, payload, length);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = *peer_addr;
+	message_info.mPeerPort = COAP_PORT;
+
+	error = send_confirmable_request(message, &message_info, handler);
+	LOG_INF("Sent modem command: %d", modem_command);
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send modem command %d: %d", modem_command, error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
+otError coap_utils_modem_cloud_ack(const otIp6Address *peer_addr, const uint8_t *payload,
+				   uint16_t length)
+{
+	/* Called from the modem work queue when the broker acknowledged data. */
+	return modem_command_send(peer_addr, MODEM_COMMAND_CLOUD_ACK, payload, length,
+				  &handle_cloud_ack_response);
+}
+
+otError coap_utils_modem_mailbox_ack(const otIp6Address *peer_addr, const uint8_t *payload,
+				     uint16_t length)
+{
+	return modem_command_send(peer_addr, MODEM_COMMAND_MAILBOX_ACK, payload, length,
+				  &handle_mailbox_ack_response);
+}
+
+static void handle_alarm_response(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
+{
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#endif
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("alarm request error %d: %s", error, otThreadErrorToString(error));
+	} else if (otCoapMessageGetCode(message) == OT_COAP_CODE_CHANGED) {
+		LOG_INF("Alarm accepted in %lld ms", k_uptime_get() - alarm_sent_time);
+	} else {
+		LOG_ERR("Alarm rejected by the modem");
+	}
+}
+
+otError coap_utils_send_alarm(const uint8_t *data, uint16_t length)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+	char multicast_address[] = "ff03::01";
+	bool confirmable;
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	/* Multicast alarm can only be non-confirmable. */
+	confirmable = IS_ENABLED(CONFIG_ALARM_CONFIRMABLE) && has_metter_peer_address;
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, confirmable ? OT_COAP_TYPE_CONFIRMABLE : OT_COAP_TYPE_NON_CONFIRMABLE,
+			  OT_COAP_CODE_PUT);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, ALARM_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, data, length);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	if (has_metter_peer_address) {
+		message_info.mPeerAddr = metter_peer_address;
+	} else {
+		error = otIp6AddressFromString(multicast_address, &message_info.mPeerAddr);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+	message_info.mPeerPort = COAP_PORT;
+
+	alarm_sent_time = k_uptime_get();
+	if (confirmable) {
+		error = send_confirmable_request(message, &message_info, &handle_alarm_response);
+	} else {
+		error = otCoapSendRequest(srv_context.ot, message, &message_info, NULL, NULL);
+	}
+	LOG_INF("Sent alarm");
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send alarm: %d", error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
 static void send_modem_discover_request(struct k_work *item)
 {
 	ARG_UNUSED(item);
@@ -253,6 +600,15 @@ static void send_modem_discover_request(struct k_work *item)
 	char multicast_address[] = "ff03::01";
 	otMessageInfo message_info;
 
+#if CONFIG_OT_BUFFERS
+	uint32_t delay = ot_buffers_admit(OT_BUFFERS_TRAFFIC_DISCOVER);
+
+	if (delay > 0) {
+		k_work_reschedule_for_queue(&coap_client_workq, &modem_discover_work, K_MSEC(delay));
+		return;
+	}
+#endif
+
 	message = otCoapNewMessage(srv_context.ot, NULL);
 	if (message == NULL) {
 		goto end;
@@ -295,8 +651,46 @@ end:
 	return;
 }
 
+static void send_upload_request(struct k_work *item)
+{
+	ARG_UNUSED(item);
+	otMessageInfo message_info;
+	otError error;
+
+#if CONFIG_OT_BUFFERS
+	uint32_t delay = ot_buffers_admit(OT_BUFFERS_TRAFFIC_UPLOAD);
+
+	if (delay > 0) {
+		k_work_reschedule_for_queue(&coap_client_workq, &upload_request_work, K_MSEC(delay));
+		return;
+	}
+#endif
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = upload_request_peer_address;
+	message_info.mPeerPort = COAP_PORT;
+
+#if CONFIG_SED_UTILS
+	sed_utils_boost_start();
+#endif
+	error = coap_utils_modem_upload_measurement(&message_info);
+	if (error != OT_ERROR_NONE) {
+#if CONFIG_SED_UTILS
+		sed_utils_boost_stop();
+#endif
+		srv_context.on_meter_response(NULL, NULL, NULL, error);
+	}
+}
+
 static void meter_response_handler(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
 {
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+	context = NULL;
+#endif
+#if CONFIG_SED_UTILS
+	sed_utils_boost_stop();
+#endif
 	srv_context.on_meter_response(context, message, message_info, error);
 }
 
@@ -310,6 +704,21 @@ otError meter_block_tx_hook(void *context,
 	return OT_ERROR_NONE;
 }
 
+static otError meter_upload_tx_hook(void *context,
+								   uint8_t *block,
+								   uint32_t position,
+								   uint16_t *block_length,
+								   bool *more)
+{
+#if CONFIG_COAP_RTO
+	/* Blocks after the first one are sent once the previous block is acknowledged. */
+	if (position != 0) {
+		coap_rto_exchange_next_block(context);
+	}
+#endif
+	return meter_block_tx_hook(context, block, position, block_length, more);
+}
+
 static otError meter_block_rx_hook(void *context,
 								   const uint8_t *block,
 								   uint32_t position,
@@ -349,9 +758,23 @@ static void send_meter_upload_request(struct k_work *item)
 	if (error != OT_ERROR_NONE) {
 		goto end;
 	}
+#if CONFIG_COAP_RTO
+	otCoapTxParameters tx_params;
+	struct coap_rto_exchange *exchange;
+
+	exchange = coap_rto_exchange_begin(&message_info.mPeerAddr, &tx_params);
+	error = otCoapSendRequestBlockWiseWithParameters(srv_context.ot, message, &message_info,
+											&meter_response_handler, exchange,
+											(exchange != NULL) ? &tx_params : NULL,
+											&meter_upload_tx_hook, &meter_block_rx_hook);
+	if (error != OT_ERROR_NONE) {
+		coap_rto_exchange_end(exchange, error);
+	}
+#else
 	error = otCoapSendRequestBlockWise(srv_context.ot, message, &message_info,
 									  &meter_response_handler, NULL,
-									  &meter_block_tx_hook, &meter_block_rx_hook);
+									  &meter_upload_tx_hook, &meter_block_rx_hook);
+#endif
 	if (error != OT_ERROR_NONE) {
 		goto end;
 	}
@@ -362,70 +785,661 @@ end:
 	};
 }
 
-static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
-				    void *user_data)
+void coap_utils_set_meter_pull_handler(meter_pull_callback_t on_meter_pull)
 {
-	if (flags & OT_CHANGED_THREAD_ROLE) {
-		switch (otThreadGetDeviceRole(ot_context->instance)) {
-		case OT_DEVICE_ROLE_CHILD:
-		case OT_DEVICE_ROLE_ROUTER:
-		case OT_DEVICE_ROLE_LEADER:
-			k_work_submit_to_queue(&coap_client_workq, &on_connect_work);
-			is_connected = true;
-			break;
-
-		case OT_DEVICE_ROLE_DISABLED:
-		case OT_DEVICE_ROLE_DETACHED:
-		default:
-			k_work_submit_to_queue(&coap_client_workq, &on_disconnect_work);
-			is_connected = false;
-			break;
-		}
-	}
+	srv_context.on_meter_pull = on_meter_pull;
 }
-static struct openthread_state_changed_cb ot_state_chaged_cb = {
-	.state_changed_cb = on_thread_state_changed
-};
 
-static void submit_work_if_connected(struct k_work *work)
+otError coap_utils_meter_pull_respond(otMessage *request_message,
+									  const otMessageInfo *message_info)
 {
-	if (is_connected) {
-		k_work_submit_to_queue(&coap_client_workq, work);
-	} else {
-		LOG_INF("Connection is broken");
-	}
-}
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *response;
 
-void coap_client_utils_init(ot_connection_cb_t on_connect,
-			    ot_disconnection_cb_t on_disconnect)
-{
-	coap_init(AF_INET6, NULL);
+	response = otCoapNewMessage(srv_context.ot, NULL);
+	if (response == NULL) {
+		goto end;
+	}
 
+	error = otCoapMessageInitResponse(response, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT,
+									  OT_COAP_CODE_CONTENT);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
 
-	k_work_queue_init(&coap_client_workq);
+	error = otCoapMessageAppendBlock2Option(response, 0, true, OT_COAP_OPTION_BLOCK_SZX_512);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
 
-	k_work_queue_start(&coap_client_workq, coap_client_workq_stack_area,
-					K_THREAD_STACK_SIZEOF(coap_client_workq_stack_area),
-					COAP_WORKQ_PRIORITY, NULL);
+	error = otCoapMessageSetPayloadMarker(response);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
 
-	k_work_init(&on_connect_work, on_connect);
-	k_work_init(&on_disconnect_work, on_disconnect);
-	k_work_init(&modem_discover_work, send_modem_discover_request);
-	k_work_init(&meter_upload_work, send_meter_upload_request);
+	error = otCoapSendResponseBlockWise(srv_context.ot, response, message_info, NULL,
+										&meter_block_tx_hook);
+end:
+	if (error != OT_ERROR_NONE && response != NULL) {
+		LOG_ERR("Failed to send meter pull response: %d", error);
+		otMessageFree(response);
+	}
 
-	openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
-	openthread_start(openthread_get_default_context());
+	return error;
 }
 
-void coap_utils_modem_discover(void)
+static void meter_pull_response_handler(void *context, otMessage *message,
+										const otMessageInfo *message_info, otError error)
 {
-	submit_work_if_connected(&modem_discover_work);
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+	context = NULL;
+#endif
+	srv_context.on_meter_pull_response(context, message, message_info, error);
 }
 
-static void meter_request_handler(void *context, otMessage *message,
-								  const otMessageInfo *message_info)
+otError coap_utils_meter_pull(const otIp6Address *peer_addr, const uint8_t *payload,
+							  uint16_t length, meter_response_callback_t handler)
 {
-	ARG_UNUSED(context);
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, OT_COAP_TYPE_CONFIRMABLE, OT_COAP_CODE_GET);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, METER_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendBlock2Option(message, 0, false, OT_COAP_OPTION_BLOCK_SZX_512);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	if (length > 0) {
+		error = otCoapMessageSetPayloadMarker(message);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+
+		error = otMessageAppend(message, payload, length);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = *peer_addr;
+	message_info.mPeerPort = COAP_PORT;
+
+	srv_context.on_meter_pull_response = handler;
+#if CONFIG_COAP_RTO
+	otCoapTxParameters tx_params;
+	struct coap_rto_exchange *exchange;
+
+	exchange = coap_rto_exchange_begin(&message_info.mPeerAddr, &tx_params);
+	error = otCoapSendRequestBlockWiseWithParameters(srv_context.ot, message, &message_info,
+											&meter_pull_response_handler, exchange,
+											(exchange != NULL) ? &tx_params : NULL,
+											NULL, &meter_block_rx_hook);
+	if (error != OT_ERROR_NONE) {
+		coap_rto_exchange_end(exchange, error);
+	}
+#else
+	error = otCoapSendRequestBlockWise(srv_context.ot, message, &message_info,
+									  &meter_pull_response_handler, NULL,
+									  NULL, &meter_block_rx_hook);
+#endif
+	LOG_INF("Sent meter pull request");
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send meter pull request: %d", error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
+static otError aggregate_rx_hook(void *context,
+								 const uint8_t *block,
+								 uint32_t position,
+								 uint16_t block_length,
+								 bool more,
+								 uint32_t total_length)
+{
+	return srv_context.on_aggregate_rx(context, block, position, block_length, more, total_length);
+}
+
+static otError aggregate_tx_hook(void *context,
+								 uint8_t *block,
+								 uint32_t position,
+								 uint16_t *block_length,
+								 bool *more)
+{
+#if CONFIG_COAP_RTO
+	/* Blocks after the first one are sent once the previous block is acknowledged. */
+	if (position != 0) {
+		coap_rto_exchange_next_block(context);
+	}
+#endif
+	srv_context.on_aggregate_tx(context, block, position, block_length, more);
+	return OT_ERROR_NONE;
+}
+
+static void aggregate_request_handler(void *context, otMessage *message,
+									  const otMessageInfo *message_info)
+{
+	ARG_UNUSED(context);
+
+	if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+		LOG_ERR("Aggregate handler - Unexpected CoAP code");
+		return;
+	}
+
+	if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+	}
+}
+
+void coap_utils_set_aggregate_handler(meter_block_rx_callback_t on_aggregate_rx)
+{
+	srv_context.on_aggregate_rx = on_aggregate_rx;
+
+	aggregate_resource.mContext = srv_context.ot;
+	aggregate_resource.mHandler = aggregate_request_handler;
+	aggregate_resource.mReceiveHook = &aggregate_rx_hook;
+	otCoapAddBlockWiseResource(srv_context.ot, &aggregate_resource);
+}
+
+static void aggregate_response_handler(void *context, otMessage *message,
+									   const otMessageInfo *message_info, otError error)
+{
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+	context = NULL;
+#endif
+	srv_context.on_aggregate_response(context, message, message_info, error);
+}
+
+otError coap_utils_aggregate_upload(const otIp6Address *peer_addr,
+									meter_block_tx_callback_t on_block_tx,
+									meter_response_callback_t handler)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, OT_COAP_TYPE_CONFIRMABLE, OT_COAP_CODE_PUT);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, AGGREGATE_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendBlock1Option(message, 0, true, OT_COAP_OPTION_BLOCK_SZX_512);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = *peer_addr;
+	message_info.mPeerPort = COAP_PORT;
+
+	srv_context.on_aggregate_tx = on_block_tx;
+	srv_context.on_aggregate_response = handler;
+#if CONFIG_COAP_RTO
+	otCoapTxParameters tx_params;
+	struct coap_rto_exchange *exchange;
+
+	exchange = coap_rto_exchange_begin(&message_info.mPeerAddr, &tx_params);
+	error = otCoapSendRequestBlockWiseWithParameters(srv_context.ot, message, &message_info,
+											&aggregate_response_handler, exchange,
+											(exchange != NULL) ? &tx_params : NULL,
+											&aggregate_tx_hook, NULL);
+	if (error != OT_ERROR_NONE) {
+		coap_rto_exchange_end(exchange, error);
+	}
+#else
+	error = otCoapSendRequestBlockWise(srv_context.ot, message, &message_info,
+									  &aggregate_response_handler, NULL,
+									  &aggregate_tx_hook, NULL);
+#endif
+	LOG_INF("Sent aggregate upload request");
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send aggregate upload request: %d", error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
+static otError image_tx_hook(void *context,
+							 uint8_t *block,
+							 uint32_t position,
+							 uint16_t *block_length,
+							 bool *more)
+{
+	srv_context.on_image_block_tx(context, block, position, block_length, more);
+	return OT_ERROR_NONE;
+}
+
+static otError image_rx_hook(void *context,
+							 const uint8_t *block,
+							 uint32_t position,
+							 uint16_t block_length,
+							 bool more,
+							 uint32_t total_length)
+{
+	return srv_context.on_image_block_rx(context, block, position, block_length, more, total_length);
+}
+
+static void image_request_handler(void *context, otMessage *message,
+								  const otMessageInfo *message_info)
+{
+	ARG_UNUSED(context);
+
+	/* Multicast blocks are received by the gateway sending them as well. */
+	if (otIp6IsAddressEqual(&(message_info->mPeerAddr), otThreadGetMeshLocalEid(srv_context.ot))) {
+		return;
+	}
+
+	if ((otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) &&
+		(otCoapMessageGetCode(message) != OT_COAP_CODE_GET)) {
+		LOG_ERR("Image handler - Unexpected CoAP code");
+		return;
+	}
+
+	srv_context.on_image_request(message, message_info);
+
+	if ((otCoapMessageGetCode(message) == OT_COAP_CODE_PUT) &&
+		(otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE)) {
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+	}
+}
+
+void coap_utils_set_image_handler(image_request_callback_t on_image_request,
+								  meter_block_tx_callback_t on_image_block_tx)
+{
+	srv_context.on_image_request = on_image_request;
+	srv_context.on_image_block_tx = on_image_block_tx;
+
+	image_resource.mContext = srv_context.ot;
+	image_resource.mHandler = image_request_handler;
+	image_resource.mTransmitHook = &image_tx_hook;
+	otCoapAddBlockWiseResource(srv_context.ot, &image_resource);
+}
+
+static void image_response_handler(void *context, otMessage *message,
+								   const otMessageInfo *message_info, otError error)
+{
+	ARG_UNUSED(message_info);
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+#else
+	ARG_UNUSED(context);
+#endif
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("image request error %d: %s", error, otThreadErrorToString(error));
+	} else if (otCoapMessageGetCode(message) != OT_COAP_CODE_CHANGED) {
+		LOG_ERR("Image report rejected by the gateway");
+	}
+}
+
+otError coap_utils_image_send(const otIp6Address *peer_addr, const uint8_t *payload,
+							  uint16_t length)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+	char multicast_address[] = "ff03::01";
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	/* Multicast requests can only be non-confirmable. */
+	otCoapMessageInit(message, (peer_addr != NULL) ? OT_COAP_TYPE_CONFIRMABLE :
+													 OT_COAP_TYPE_NON_CONFIRMABLE,
+					  OT_COAP_CODE_PUT);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, IMAGE_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, payload, length);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	if (peer_addr != NULL) {
+		message_info.mPeerAddr = *peer_addr;
+	} else {
+		error = otIp6AddressFromString(multicast_address, &message_info.mPeerAddr);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+	message_info.mPeerPort = COAP_PORT;
+
+	if (peer_addr != NULL) {
+		error = send_confirmable_request(message, &message_info, &image_response_handler);
+	} else {
+		error = otCoapSendRequest(srv_context.ot, message, &message_info, NULL, NULL);
+	}
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send image request: %d", error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
+otError coap_utils_image_respond(otMessage *request_message, const otMessageInfo *message_info)
+{
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *response;
+	otCoapOptionIterator iterator;
+	uint64_t block2 = 0;
+
+	/* Repairs start at the first block the meter is missing. */
+	if ((otCoapOptionIteratorInit(&iterator, request_message) == OT_ERROR_NONE) &&
+		(otCoapOptionIteratorGetFirstOptionMatching(&iterator, OT_COAP_OPTION_BLOCK2) != NULL)) {
+		otCoapOptionIteratorGetOptionUintValue(&iterator, &block2);
+	}
+
+	response = otCoapNewMessage(srv_context.ot, NULL);
+	if (response == NULL) {
+		goto end;
+	}
+
+	error = otCoapMessageInitResponse(response, request_message, OT_COAP_TYPE_ACKNOWLEDGMENT,
+									  OT_COAP_CODE_CONTENT);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendBlock2Option(response, (uint32_t)(block2 >> 4), true,
+											OT_COAP_OPTION_BLOCK_SZX_256);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(response);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapSendResponseBlockWise(srv_context.ot, response, message_info, NULL,
+										&image_tx_hook);
+end:
+	if (error != OT_ERROR_NONE && response != NULL) {
+		LOG_ERR("Failed to send image response: %d", error);
+		otMessageFree(response);
+	}
+
+	return error;
+}
+
+static void image_repair_response_handler(void *context, otMessage *message,
+										  const otMessageInfo *message_info, otError error)
+{
+#if CONFIG_COAP_RTO
+	coap_rto_exchange_end(context, error);
+	context = NULL;
+#endif
+	srv_context.on_image_response(context, message, message_info, error);
+}
+
+otError coap_utils_image_repair(const otIp6Address *peer_addr, uint32_t block,
+								const uint8_t *payload, uint16_t length,
+								meter_block_rx_callback_t on_block_rx,
+								meter_response_callback_t handler)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *message;
+	otMessageInfo message_info;
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	openthread_api_mutex_lock(ot_context);
+
+	message = otCoapNewMessage(srv_context.ot, NULL);
+	if (message == NULL) {
+		goto end;
+	}
+
+	otCoapMessageInit(message, OT_COAP_TYPE_CONFIRMABLE, OT_COAP_CODE_GET);
+	otCoapMessageGenerateToken(message, OT_COAP_DEFAULT_TOKEN_LENGTH);
+	error = otCoapMessageAppendUriPathOptions(message, IMAGE_URI_PATH);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendBlock2Option(message, block, false, OT_COAP_OPTION_BLOCK_SZX_256);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otMessageAppend(message, payload, length);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = *peer_addr;
+	message_info.mPeerPort = COAP_PORT;
+
+	srv_context.on_image_block_rx = on_block_rx;
+	srv_context.on_image_response = handler;
+#if CONFIG_COAP_RTO
+	otCoapTxParameters tx_params;
+	struct coap_rto_exchange *exchange;
+
+	exchange = coap_rto_exchange_begin(&message_info.mPeerAddr, &tx_params);
+	error = otCoapSendRequestBlockWiseWithParameters(srv_context.ot, message, &message_info,
+											&image_repair_response_handler, exchange,
+											(exchange != NULL) ? &tx_params : NULL,
+											NULL, &image_rx_hook);
+	if (error != OT_ERROR_NONE) {
+		coap_rto_exchange_end(exchange, error);
+	}
+#else
+	error = otCoapSendRequestBlockWise(srv_context.ot, message, &message_info,
+									  &image_repair_response_handler, NULL,
+									  NULL, &image_rx_hook);
+#endif
+	LOG_INF("Sent image repair request from block %u", block);
+
+end:
+	if (error != OT_ERROR_NONE && message != NULL) {
+		LOG_ERR("Failed to send image repair request: %d", error);
+		otMessageFree(message);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+
+	return error;
+}
+
+static void on_thread_state_changed(otChangedFlags flags, struct openthread_context *ot_context,
+				    void *user_data)
+{
+	if (flags & OT_CHANGED_THREAD_ROLE) {
+		switch (otThreadGetDeviceRole(ot_context->instance)) {
+		case OT_DEVICE_ROLE_CHILD:
+		case OT_DEVICE_ROLE_ROUTER:
+		case OT_DEVICE_ROLE_LEADER:
+			k_work_submit_to_queue(&coap_client_workq, &on_connect_work);
+			is_connected = true;
+			break;
+
+		case OT_DEVICE_ROLE_DISABLED:
+		case OT_DEVICE_ROLE_DETACHED:
+		default:
+			k_work_submit_to_queue(&coap_client_workq, &on_disconnect_work);
+			is_connected = false;
+			break;
+		}
+	}
+}
+static struct openthread_state_changed_cb ot_state_chaged_cb = {
+	.state_changed_cb = on_thread_state_changed
+};
+
+static void submit_work_if_connected(struct k_work *work)
+{
+	if (is_connected) {
+		k_work_submit_to_queue(&coap_client_workq, work);
+	} else {
+		LOG_INF("Connection is broken");
+	}
+}
+
+void coap_client_utils_init(ot_connection_cb_t on_connect,
+			    ot_disconnection_cb_t on_disconnect)
+{
+	const struct k_work_queue_config workq_config = {
+		.name = "coap_client_workq",
+	};
+
+	coap_init(AF_INET6, NULL);
+
+
+	k_work_queue_init(&coap_client_workq);
+
+	k_work_queue_start(&coap_client_workq, coap_client_workq_stack_area,
+					K_THREAD_STACK_SIZEOF(coap_client_workq_stack_area),
+					COAP_WORKQ_PRIORITY, &workq_config);
+
+	k_work_init(&on_connect_work, on_connect);
+	k_work_init(&on_disconnect_work, on_disconnect);
+	k_work_init_delayable(&modem_discover_work, send_modem_discover_request);
+	k_work_init(&meter_upload_work, send_meter_upload_request);
+	k_work_init_delayable(&upload_request_work, send_upload_request);
+
+#if CONFIG_RUNTIME_MONITOR
+	runtime_monitor_workq_register(&coap_client_workq, "coap_client_workq");
+	runtime_monitor_work_register(&on_connect_work, "on_connect");
+	runtime_monitor_work_register(&on_disconnect_work, "on_disconnect");
+	runtime_monitor_work_register(&modem_discover_work.work, "modem_discover");
+	runtime_monitor_work_register(&meter_upload_work, "meter_upload");
+	runtime_monitor_work_register(&upload_request_work.work, "upload_request");
+#endif
+
+	openthread_state_changed_cb_register(openthread_get_default_context(), &ot_state_chaged_cb);
+	openthread_start(openthread_get_default_context());
+}
+
+void coap_utils_modem_discover(void)
+{
+	k_timeout_t delay = K_NO_WAIT;
+
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return;
+	}
+
+#if CONFIG_SED_UTILS
+	sed_utils_boost_start();
+#endif
+#if CONFIG_UPLOAD_SLOT
+	/* Spread discovers of meters triggered at the same time, e.g. on modem recovery. */
+	delay = K_MSEC(sys_rand32_get() % (CONFIG_UPLOAD_SLOT_DISCOVER_JITTER + 1));
+#endif
+	k_work_schedule_for_queue(&coap_client_workq, &modem_discover_work, delay);
+}
+
+otError coap_utils_modem_upload_measurement_schedule(const otIp6Address *peer_addr,
+						     k_timeout_t delay)
+{
+	if (!is_connected) {
+		LOG_INF("Connection is broken");
+		return OT_ERROR_INVALID_STATE;
+	}
+
+	upload_request_peer_address = *peer_addr;
+	k_work_reschedule_for_queue(&coap_client_workq, &upload_request_work, delay);
+
+	return OT_ERROR_NONE;
+}
+
+static void meter_request_handler(void *context, otMessage *message,
+								  const otMessageInfo *message_info)
+{
+	ARG_UNUSED(context);
+
+	if ((otCoapMessageGetCode(message) == OT_COAP_CODE_GET) && srv_context.on_meter_pull) {
+		srv_context.on_meter_pull(message, message_info);
+		return;
+	}
 
 	if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
 		LOG_ERR("Meter handler - Unexpected CoAP code");
@@ -435,10 +1449,27 @@ static void meter_request_handler(void *context, otMessage *message,
 	LOG_HEXDUMP_INF(message_info->mPeerAddr.mFields.m8, sizeof(message_info->mPeerAddr.mFields.m8), "peer address:");
 
 	if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
-		coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+		uint8_t payload[METER_RESPONSE_MAX_SIZE];
+		uint16_t length = 0;
+
+		if (srv_context.on_meter_upload_response) {
+			length = srv_context.on_meter_upload_response(message_info, payload,
+														  sizeof(payload));
+		}
+		if (length > 0) {
+			coap_utils_send_response_payload(message, message_info, OT_COAP_CODE_CHANGED,
+											 payload, length);
+		} else {
+			coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+		}
 	}
 }
 
+void coap_utils_set_meter_upload_response_handler(meter_upload_response_callback_t handler)
+{
+	srv_context.on_meter_upload_response = handler;
+}
+
 static void modem_request_handler(void *context, otMessage *message,
 				  const otMessageInfo *message_info)
 {
@@ -464,6 +1495,31 @@ static void modem_request_handler(void *context, otMessage *message,
 	srv_context.on_modem_request(message, message_info);
 }
 
+static void alarm_request_handler(void *context, otMessage *message,
+				  const otMessageInfo *message_info)
+{
+	ARG_UNUSED(context);
+	static uint16_t message_id;
+
+	if (otIp6IsAddressEqual(&(message_info->mPeerAddr), otThreadGetMeshLocalEid(srv_context.ot))) {
+		LOG_WRN("Received message from itself");
+		return;
+	}
+
+	if (otCoapMessageGetMessageId(message) == message_id) {
+		LOG_WRN("Received the same message id");
+		return;
+	}
+	message_id = otCoapMessageGetMessageId(message);
+
+	if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+		LOG_ERR("Alarm handler - Unexpected CoAP code");
+		return;
+	}
+
+	srv_context.on_alarm_request(message, message_info);
+}
+
 static void coap_default_handler(void *context, otMessage *message,
 				 const otMessageInfo *message_info)
 {
@@ -478,7 +1534,8 @@ static void coap_default_handler(void *context, otMessage *message,
 int ot_coap_init(modem_request_callback_t on_modem_request,
 				 meter_block_tx_callback_t on_meter_block_tx,
 				 meter_block_rx_callback_t on_meter_block_rx,
-				 meter_response_callback_t on_meter_response)
+				 meter_response_callback_t on_meter_response,
+				 alarm_request_callback_t on_alarm_request)
 {
 	otError error;
 
@@ -486,6 +1543,7 @@ int ot_coap_init(modem_request_callback_t on_modem_request,
 	srv_context.on_meter_block_tx = on_meter_block_tx;
 	srv_context.on_meter_block_rx = on_meter_block_rx;
 	srv_context.on_meter_response = on_meter_response;
+	srv_context.on_alarm_request = on_alarm_request;
 
 	srv_context.ot = openthread_get_default_instance();
 	if (!srv_context.ot) {
@@ -502,8 +1560,12 @@ int ot_coap_init(modem_request_callback_t on_modem_request,
 	modem_resource.mContext = srv_context.ot;
 	modem_resource.mHandler = modem_request_handler;
 
+	alarm_resource.mContext = srv_context.ot;
+	alarm_resource.mHandler = alarm_request_handler;
+
 	otCoapSetDefaultHandler(srv_context.ot, coap_default_handler, NULL);
 	otCoapAddResource(srv_context.ot, &modem_resource);
+	otCoapAddResource(srv_context.ot, &alarm_resource);
 	otCoapAddBlockWiseResource(srv_context.ot, &meter_resource);
 
 	error = otCoapStart(srv_context.ot, COAP_PORT);
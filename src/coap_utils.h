@@ -21,12 +21,26 @@
 #define COAP_PORT OT_DEFAULT_COAP_PORT
 #define METER_URI_PATH "meter"
 #define MODEM_URI_PATH "modem"
+#define ALARM_URI_PATH "alarm"
+#define AGGREGATE_URI_PATH "aggregate"
+#define IMAGE_URI_PATH "image"
+
+/**@brief Maximum size of an alarm payload. */
+#define ALARM_MAX_SIZE 64
+
+/**@brief Maximum size of the payload of the response to a meter upload. */
+#define METER_RESPONSE_MAX_SIZE 64
+
+/**@brief Size of the blocks images are distributed and repaired in. */
+#define IMAGE_BLOCK_SIZE 256
 
 /**@brief Enumeration describing modem commands. */
 enum modem_command {
 	MODEM_COMMAND_DISCOVER,
 	MODEM_COMMAND_REPORT_STATE,
 	MODEM_COMMAND_UPLOAD_MEASUREMENT,
+	MODEM_COMMAND_CLOUD_ACK,
+	MODEM_COMMAND_MAILBOX_ACK,
 };
 
 /** @brief Type indicates function called when OpenThread connection
@@ -67,9 +81,43 @@ otError coap_utils_modem_report_state_response(otMessage *request_message,
 
 /**
  * @brief Send CoAP request to upload measurement to the remote modem.
+ *
+ * With CONFIG_DELIVERY the request carries the meter ID after the command.
  */
 otError coap_utils_modem_upload_measurement(const otMessageInfo *message_info);
 
+/**
+ * @brief Send CoAP request to upload measurement to the given modem after @p delay.
+ *
+ * @note A failed request is reported to the meter response callback.
+ */
+otError coap_utils_modem_upload_measurement_schedule(const otIp6Address *peer_addr,
+						     k_timeout_t delay);
+
+/**
+ * @brief Relay acknowledgement of the cloud to the meter that uploaded the data.
+ *
+ * @note The payload follows the command byte as is.
+ */
+otError coap_utils_modem_cloud_ack(const otIp6Address *peer_addr, const uint8_t *payload,
+				   uint16_t length);
+
+/**
+ * @brief Acknowledge commands of the mailbox to the modem that delivered them.
+ *
+ * @note The payload follows the command byte as is.
+ */
+otError coap_utils_modem_mailbox_ack(const otIp6Address *peer_addr, const uint8_t *payload,
+				     uint16_t length);
+
+/**
+ * @brief Send alarm to the modem ahead of any ongoing measurement upload.
+ *
+ * @note The alarm is sent to the modem used by the last upload, or to all
+ *       nodes of the realm if no modem is known yet.
+ */
+otError coap_utils_send_alarm(const uint8_t *data, uint16_t length);
+
 /**
  * @brief Send CoAP response with given response code.
  */
@@ -77,12 +125,27 @@ otError coap_utils_send_response(otMessage *request_message,
 								 const otMessageInfo *message_info,
 								 otCoapCode code);
 
+/**
+ * @brief Send CoAP response with given response code and payload.
+ */
+otError coap_utils_send_response_payload(otMessage *request_message,
+										 const otMessageInfo *message_info,
+										 otCoapCode code,
+										 const uint8_t *payload,
+										 uint16_t payload_length);
+
 /**
  * @brief Callback function for modem request.
  */
 typedef void (*modem_request_callback_t)(otMessage *message,
 										 const otMessageInfo *message_info);
 
+/**
+ * @brief Callback function for alarm request.
+ */
+typedef void (*alarm_request_callback_t)(otMessage *message,
+										 const otMessageInfo *message_info);
+
 /**
  * @brief Callback function for meter block transmission.
  */
@@ -107,13 +170,120 @@ typedef otError (*meter_block_rx_callback_t)(void *aContext,
  */
 typedef void (*meter_response_callback_t)(void *context, otMessage *message, const otMessageInfo *message_info, otError error);
 
+/**
+ * @brief Callback function for Block2 read of the meter resource.
+ */
+typedef void (*meter_pull_callback_t)(otMessage *message,
+									  const otMessageInfo *message_info);
+
+/**
+ * @brief Set callback for Block2 reads of the meter resource.
+ *
+ * @note Reads are ignored while no callback is set.
+ */
+void coap_utils_set_meter_pull_handler(meter_pull_callback_t on_meter_pull);
+
+/**
+ * @brief Respond to a Block2 read with measurement blocks.
+ *
+ * @note Blocks are filled by the meter block transmission callback.
+ */
+otError coap_utils_meter_pull_respond(otMessage *request_message,
+									  const otMessageInfo *message_info);
+
+/**
+ * @brief Read measurement of a meter with Block2 GET requests.
+ *
+ * @note Blocks are passed to the meter block reception callback, and
+ *       @p handler is called when the read ended.
+ */
+otError coap_utils_meter_pull(const otIp6Address *peer_addr, const uint8_t *payload,
+							  uint16_t length, meter_response_callback_t handler);
+
+/**
+ * @brief Callback function filling the payload of the response to a meter upload.
+ *
+ * @return Size of the payload, 0 for none.
+ */
+typedef uint16_t (*meter_upload_response_callback_t)(const otMessageInfo *message_info,
+													 uint8_t *payload, uint16_t size);
+
+/**
+ * @brief Set callback for the payload of the response to a meter upload.
+ *
+ * @note The payload is sent with the response to the last block.
+ */
+void coap_utils_set_meter_upload_response_handler(meter_upload_response_callback_t handler);
+
+/**
+ * @brief Set callback for blocks of aggregated measurement uploads.
+ *
+ * @note The aggregate resource is served once a callback is set.
+ */
+void coap_utils_set_aggregate_handler(meter_block_rx_callback_t on_aggregate_rx);
+
+/**
+ * @brief Upload aggregated measurement of several meters with Block1 PUT requests.
+ *
+ * @note Blocks are filled by @p on_block_tx, and @p handler is called when
+ *       the upload ended.
+ */
+otError coap_utils_aggregate_upload(const otIp6Address *peer_addr,
+									meter_block_tx_callback_t on_block_tx,
+									meter_response_callback_t handler);
+
+/**
+ * @brief Callback function for image request.
+ */
+typedef void (*image_request_callback_t)(otMessage *message,
+										 const otMessageInfo *message_info);
+
+/**
+ * @brief Set callbacks for the image resource.
+ *
+ * @note The image resource is served once callbacks are set. Confirmable PUT
+ *       requests are acknowledged after @p on_image_request returned, Block2
+ *       reads are answered with coap_utils_image_respond.
+ */
+void coap_utils_set_image_handler(image_request_callback_t on_image_request,
+								  meter_block_tx_callback_t on_image_block_tx);
+
+/**
+ * @brief Send image message to the image resource of a node.
+ *
+ * @note The message is multicast to all nodes of the realm as non-confirmable
+ *       request when @p peer_addr is NULL.
+ */
+otError coap_utils_image_send(const otIp6Address *peer_addr, const uint8_t *payload,
+							  uint16_t length);
+
+/**
+ * @brief Respond to a Block2 read of the image resource.
+ *
+ * @note The response starts at the block asked for, blocks are filled by the
+ *       image block transmission callback.
+ */
+otError coap_utils_image_respond(otMessage *request_message, const otMessageInfo *message_info);
+
+/**
+ * @brief Read image blocks from @p block on with Block2 GET requests.
+ *
+ * @note Blocks are passed to @p on_block_rx, and @p handler is called when
+ *       the read ended.
+ */
+otError coap_utils_image_repair(const otIp6Address *peer_addr, uint32_t block,
+								const uint8_t *payload, uint16_t length,
+								meter_block_rx_callback_t on_block_rx,
+								meter_response_callback_t handler);
+
 /**
  * @brief Initialize CoAP server utilities.
  */
 int ot_coap_init(modem_request_callback_t on_modem_request,
 				 meter_block_tx_callback_t on_meter_block_tx,
 				 meter_block_rx_callback_t on_meter_block_rx,
-				 meter_response_callback_t on_meter_response);
+				 meter_response_callback_t on_meter_response,
+				 alarm_request_callback_t on_alarm_request);
 
 #endif
 
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "deadband.h"
+
+LOG_MODULE_REGISTER(deadband, CONFIG_DEADBAND_LOG_LEVEL);
+
+/* Values coalesced since the last report */
+struct deadband_band {
+	uint32_t start;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+};
+
+static bool has_reference;
+static uint32_t reference_timestamp;
+static int32_t reference_value;
+static struct deadband_band band;
+static uint32_t absolute_threshold = CONFIG_DEADBAND_ABSOLUTE;
+static uint32_t relative_threshold = CONFIG_DEADBAND_RELATIVE;
+static uint32_t heartbeat = CONFIG_DEADBAND_HEARTBEAT;
+static struct deadband_stats stats;
+static K_MUTEX_DEFINE(deadband_lock);
+
+void deadband_init(void)
+{
+	k_mutex_lock(&deadband_lock, K_FOREVER);
+	has_reference = false;
+	memset(&band, 0, sizeof(band));
+	absolute_threshold = CONFIG_DEADBAND_ABSOLUTE;
+	relative_threshold = CONFIG_DEADBAND_RELATIVE;
+	heartbeat = CONFIG_DEADBAND_HEARTBEAT;
+	k_mutex_unlock(&deadband_lock);
+}
+
+/* Merge the band into the reported item, the item keeps its last value. */
+static void band_merge(struct meter_rollup *item)
+{
+	uint32_t count = band.count + item->count;
+
+	LOG_DBG("%u values coalesced: min %d max %d mean %lld", band.count, band.min, band.max,
+		band.sum / band.count);
+
+	item->start = band.start;
+	item->min = MIN(item->min, band.min);
+	item->max = MAX(item->max, band.max);
+	item->mean = (int32_t)((band.sum + (int64_t)item->mean * item->count) / count);
+	item->count = count;
+}
+
+bool deadband_check(struct meter_rollup *item)
+{
+	uint32_t timestamp = item->start;
+	int32_t value = item->mean;
+	bool report = true;
+	int64_t deviation;
+	uint64_t width;
+
+	k_mutex_lock(&deadband_lock, K_FOREVER);
+
+	stats.checked++;
+
+	if (!has_reference) {
+		stats.exceptions++;
+		goto end;
+	}
+
+	/* Band is the larger of the absolute and the relative (per mille) width. */
+	deviation = (int64_t)value - reference_value;
+	width = MAX((uint64_t)absolute_threshold,
+		    (uint64_t)llabs(reference_value) * relative_threshold / 1000);
+
+	if ((uint64_t)llabs(deviation) > width) {
+		stats.exceptions++;
+	} else if ((heartbeat > 0) && (timestamp - reference_timestamp >= heartbeat)) {
+		stats.heartbeats++;
+	} else {
+		if (band.count == 0) {
+			band.start = item->start;
+			band.min = item->min;
+			band.max = item->max;
+			band.sum = 0;
+		}
+		band.count += item->count;
+		band.min = MIN(band.min, item->min);
+		band.max = MAX(band.max, item->max);
+		band.sum += (int64_t)item->mean * item->count;
+		stats.skipped++;
+		report = false;
+		goto end;
+	}
+
+	if (band.count > 0) {
+		band_merge(item);
+	}
+
+end:
+	if (report) {
+		/* The reference is the reported value, not the mean of the merged band. */
+		has_reference = true;
+		reference_timestamp = timestamp;
+		reference_value = value;
+		band.count = 0;
+	}
+
+	k_mutex_unlock(&deadband_lock);
+
+	return report;
+}
+
+void deadband_get_stats(struct deadband_stats *out)
+{
+	k_mutex_lock(&deadband_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&deadband_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct deadband_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&deadband_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&deadband_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	deadband_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "checked: %u exceptions: %u heartbeats: %u skipped: %u\n",
+		      current.checked, current.exceptions, current.heartbeats, current.skipped);
+	shell_fprintf(shell, SHELL_INFO, "skip rate: %u%%\n",
+		      current.checked ? current.skipped * 100 / current.checked : 0);
+
+	return 0;
+}
+
+static int cmd_band(const struct shell *shell, size_t argc, char **argv)
+{
+	k_mutex_lock(&deadband_lock, K_FOREVER);
+	if (argc > 1) {
+		absolute_threshold = strtoul(argv[1], NULL, 10);
+	}
+	if (argc > 2) {
+		relative_threshold = strtoul(argv[2], NULL, 10);
+	}
+	if (argc > 3) {
+		heartbeat = strtoul(argv[3], NULL, 10);
+	}
+	shell_fprintf(shell, SHELL_INFO, "absolute: %u relative: %u permille heartbeat: %u s\n",
+		      absolute_threshold, relative_threshold, heartbeat);
+	k_mutex_unlock(&deadband_lock);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_deadband,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset deadband statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_CMD_ARG(
+		band, NULL,
+		"Get/Set thresholds. (absolute) (relative permille) (heartbeat seconds)\n",
+		cmd_band, 1, 3),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(deadband, &sub_deadband, "deadband filter commands", NULL);
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __DEADBAND_H__
+#define __DEADBAND_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "meter_codec.h"
+
+/**@brief Deadband filter statistics. */
+struct deadband_stats {
+	/** Number of checked values. */
+	uint32_t checked;
+	/** Values outside the band. */
+	uint32_t exceptions;
+	/** Values reported because the heartbeat was due. */
+	uint32_t heartbeats;
+	/** Values coalesced within the band. */
+	uint32_t skipped;
+};
+
+/**
+ * @brief Initialize deadband filter with the configured thresholds.
+ */
+void deadband_init(void);
+
+/**
+ * @brief Check if a reading, or rollup, has to be reported.
+ *
+ * The item is reported when its mean leaves the band around the last
+ * reported value, or when nothing was reported for the heartbeat period.
+ * Other items are coalesced into the band, which is merged into the next
+ * reported item, so it covers the interval since the last report with
+ * the count, minimum, maximum and mean of all its values.
+ *
+ * @param[in,out] item item to check, merged with the band when reported.
+ *
+ * @retval true  Report the item.
+ * @retval false Skip the item.
+ */
+bool deadband_check(struct meter_rollup *item);
+
+/**
+ * @brief Get a copy of the filter statistics.
+ */
+void deadband_get_stats(struct deadband_stats *stats);
+
+#endif /* __DEADBAND_H__ */
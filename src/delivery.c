@@ -0,0 +1,665 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/random/random.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/link.h>
+
+#include "coap_utils.h"
+#include "delivery.h"
+
+LOG_MODULE_REGISTER(delivery, CONFIG_DELIVERY_LOG_LEVEL);
+
+/* Acknowledged sequences remembered per meter, below the highest one. */
+#define ACK_WINDOW 32
+
+struct journal_entry {
+	uint32_t seq;
+	uint16_t count;
+	bool acked;
+	/* Received by a modem, waiting for the cloud */
+	bool accepted;
+	int64_t first_time;
+	/* Zero if the batch has to be sent again right away */
+	int64_t sent_time;
+};
+
+struct meter_entry {
+	uint8_t id[DELIVERY_METER_ID_SIZE];
+	uint32_t session;
+	/* Highest acknowledged sequence, bit n of the mask is acked_top - n. */
+	uint32_t acked_top;
+	uint32_t acked_mask;
+	int64_t used;
+	bool in_use;
+};
+
+struct pending_entry {
+	uint32_t tag;
+	struct delivery_header header;
+	otIp6Address peer;
+	bool own;
+	int64_t time;
+};
+
+static struct delivery_header own_header;
+static delivery_ack_handler_t own_ack_handler;
+
+static struct journal_entry journal[CONFIG_DELIVERY_JOURNAL_SIZE];
+static size_t journal_head;
+static size_t journal_count;
+
+static struct meter_entry meters[CONFIG_DELIVERY_METER_COUNT];
+static struct pending_entry pending[CONFIG_DELIVERY_PENDING_COUNT];
+static uint32_t next_tag;
+
+static struct delivery_stats stats;
+static K_MUTEX_DEFINE(delivery_lock);
+
+static inline struct journal_entry *journal_at(size_t index)
+{
+	return &journal[(journal_head + index) % ARRAY_SIZE(journal)];
+}
+
+static inline bool journal_is_due(const struct journal_entry *entry, int64_t now)
+{
+	return !entry->acked && ((entry->sent_time == 0) ||
+				 (now - entry->sent_time >= CONFIG_DELIVERY_ACK_TIMEOUT * MSEC_PER_SEC));
+}
+
+static inline uint32_t seq_next(uint32_t seq)
+{
+	/* Zero marks a block without batch. */
+	return (seq == UINT32_MAX) ? 1 : seq + 1;
+}
+
+int delivery_init(delivery_ack_handler_t ack_handler)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otExtAddress eui64;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	openthread_api_mutex_lock(ot_context);
+	otLinkGetFactoryAssignedIeeeEui64(ot_context->instance, &eui64);
+	openthread_api_mutex_unlock(ot_context);
+
+	memcpy(own_header.id, eui64.m8, sizeof(own_header.id));
+	/* Sequences restart on every boot, the session tells them apart. */
+	own_header.session = sys_rand32_get();
+	own_header.seq = 1;
+	own_ack_handler = ack_handler;
+	next_tag = seq_next(sys_rand32_get());
+
+	journal_head = 0;
+	journal_count = 0;
+	memset(meters, 0, sizeof(meters));
+	memset(pending, 0, sizeof(pending));
+
+	LOG_INF("Meter %02x%02x%02x%02x%02x%02x%02x%02x session %08x", own_header.id[0],
+		own_header.id[1], own_header.id[2], own_header.id[3], own_header.id[4],
+		own_header.id[5], own_header.id[6], own_header.id[7], own_header.session);
+
+	k_mutex_unlock(&delivery_lock);
+
+	return 0;
+}
+
+static size_t header_encode(const struct delivery_header *header, uint8_t *buf)
+{
+	memcpy(buf, header->id, DELIVERY_METER_ID_SIZE);
+	sys_put_le32(header->session, &buf[DELIVERY_METER_ID_SIZE]);
+	sys_put_le32(header->seq, &buf[DELIVERY_METER_ID_SIZE + sizeof(uint32_t)]);
+
+	return DELIVERY_HEADER_SIZE;
+}
+
+size_t delivery_header_encode(uint32_t seq, uint8_t *buf)
+{
+	struct delivery_header header = own_header;
+
+	header.seq = seq;
+
+	return header_encode(&header, buf);
+}
+
+int delivery_header_parse(const uint8_t *buf, size_t length, struct delivery_header *header)
+{
+	if (length < DELIVERY_HEADER_SIZE) {
+		return -EBADMSG;
+	}
+
+	memcpy(header->id, buf, DELIVERY_METER_ID_SIZE);
+	header->session = sys_get_le32(&buf[DELIVERY_METER_ID_SIZE]);
+	header->seq = sys_get_le32(&buf[DELIVERY_METER_ID_SIZE + sizeof(uint32_t)]);
+
+	return 0;
+}
+
+int delivery_journal_next(uint16_t queued, struct delivery_batch *batch)
+{
+	int64_t now = k_uptime_get();
+	uint16_t offset = 0;
+	int ret;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	/* Oldest batch first, so the meter releases items in order. */
+	for (size_t i = 0; i < journal_count; i++) {
+		struct journal_entry *entry = journal_at(i);
+
+		if (journal_is_due(entry, now)) {
+			batch->seq = entry->seq;
+			batch->offset = offset;
+			batch->count = entry->count;
+			ret = 0;
+			goto end;
+		}
+		offset += entry->count;
+	}
+
+	if (journal_count == ARRAY_SIZE(journal)) {
+		ret = -ENOSPC;
+	} else if (offset >= queued) {
+		ret = -ENODATA;
+	} else {
+		batch->seq = own_header.seq;
+		batch->offset = offset;
+		batch->count = 0;
+		ret = -ENOENT;
+	}
+
+end:
+	k_mutex_unlock(&delivery_lock);
+
+	return ret;
+}
+
+uint32_t delivery_journal_add(uint16_t count)
+{
+	struct journal_entry *entry;
+	uint32_t seq;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	__ASSERT_NO_MSG(journal_count < ARRAY_SIZE(journal));
+	entry = journal_at(journal_count++);
+	entry->seq = own_header.seq;
+	entry->count = count;
+	entry->acked = false;
+	entry->accepted = false;
+	entry->first_time = k_uptime_get();
+	entry->sent_time = entry->first_time;
+	seq = entry->seq;
+	own_header.seq = seq_next(seq);
+	stats.batches++;
+
+	k_mutex_unlock(&delivery_lock);
+
+	return seq;
+}
+
+void delivery_journal_sent(uint32_t seq)
+{
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	for (size_t i = 0; i < journal_count; i++) {
+		struct journal_entry *entry = journal_at(i);
+
+		if (entry->seq == seq) {
+			LOG_DBG("Batch %u sent again", seq);
+			entry->sent_time = k_uptime_get();
+			entry->accepted = false;
+			stats.resent++;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&delivery_lock);
+}
+
+bool delivery_journal_due(uint16_t queued)
+{
+	struct delivery_batch batch;
+	int ret = delivery_journal_next(queued, &batch);
+
+	return (ret == 0) || (ret == -ENOENT);
+}
+
+uint16_t delivery_journal_ack(const struct delivery_header *header)
+{
+	uint16_t released = 0;
+	uint32_t ack_time;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	if ((memcmp(header->id, own_header.id, DELIVERY_METER_ID_SIZE) != 0) ||
+	    (header->session != own_header.session)) {
+		LOG_WRN("Acknowledgement of another meter or session");
+		goto end;
+	}
+
+	for (size_t i = 0; i < journal_count; i++) {
+		struct journal_entry *entry = journal_at(i);
+
+		if ((entry->seq == header->seq) && !entry->acked) {
+			entry->acked = true;
+			ack_time = (uint32_t)(k_uptime_get() - entry->first_time);
+			stats.acked++;
+			stats.ack_time += ack_time;
+			stats.max_ack_time = MAX(stats.max_ack_time, ack_time);
+			LOG_DBG("Batch %u acknowledged in %u ms", entry->seq, ack_time);
+			break;
+		}
+	}
+
+	while ((journal_count > 0) && journal_at(0)->acked) {
+		released += journal_at(0)->count;
+		journal_head = (journal_head + 1) % ARRAY_SIZE(journal);
+		journal_count--;
+	}
+
+end:
+	k_mutex_unlock(&delivery_lock);
+
+	return released;
+}
+
+uint16_t delivery_journal_drop(void)
+{
+	uint16_t dropped = 0;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	if (journal_count > 0) {
+		dropped = journal_at(0)->count;
+		LOG_WRN("Batch %u dropped before acknowledgement", journal_at(0)->seq);
+		journal_head = (journal_head + 1) % ARRAY_SIZE(journal);
+		journal_count--;
+		stats.dropped += dropped;
+	}
+
+	k_mutex_unlock(&delivery_lock);
+
+	return dropped;
+}
+
+void delivery_journal_accepted(uint32_t seq)
+{
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	for (size_t i = 0; (seq != 0) && (i < journal_count); i++) {
+		if (journal_at(i)->seq == seq) {
+			journal_at(i)->accepted = true;
+			break;
+		}
+	}
+
+	k_mutex_unlock(&delivery_lock);
+}
+
+void delivery_journal_cursor(const struct delivery_header *cursor)
+{
+	size_t last;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	last = journal_count;
+	if ((memcmp(cursor->id, own_header.id, DELIVERY_METER_ID_SIZE) == 0) &&
+	    (cursor->session == own_header.session)) {
+		for (size_t i = 0; (cursor->seq != 0) && (i < journal_count); i++) {
+			if (journal_at(i)->seq == cursor->seq) {
+				last = i;
+				break;
+			}
+		}
+	}
+
+	/* Batches are journaled in order, the modem received all up to the cursor. */
+	for (size_t i = 0; (last < journal_count) && (i <= last); i++) {
+		journal_at(i)->accepted = true;
+	}
+
+	k_mutex_unlock(&delivery_lock);
+}
+
+uint16_t delivery_journal_retry(void)
+{
+	uint16_t retried = 0;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	/* The upload resumes after the batches a modem already received. */
+	for (size_t i = 0; i < journal_count; i++) {
+		struct journal_entry *entry = journal_at(i);
+
+		if (entry->acked) {
+			continue;
+		}
+		if (entry->accepted) {
+			stats.kept++;
+		} else {
+			entry->sent_time = 0;
+			retried++;
+		}
+	}
+
+	k_mutex_unlock(&delivery_lock);
+
+	return retried;
+}
+
+static struct meter_entry *meter_find(const uint8_t *id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(meters); i++) {
+		if (meters[i].in_use && (memcmp(meters[i].id, id, DELIVERY_METER_ID_SIZE) == 0)) {
+			return &meters[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct meter_entry *meter_get(const uint8_t *id)
+{
+	struct meter_entry *meter = meter_find(id);
+
+	if (meter == NULL) {
+		/* The least recently used meter gets its batches forwarded again. */
+		meter = &meters[0];
+		for (size_t i = 1; (i < ARRAY_SIZE(meters)) && meter->in_use; i++) {
+			if (!meters[i].in_use || (meters[i].used < meter->used)) {
+				meter = &meters[i];
+			}
+		}
+		memset(meter, 0, sizeof(*meter));
+		memcpy(meter->id, id, DELIVERY_METER_ID_SIZE);
+		meter->in_use = true;
+	}
+	meter->used = k_uptime_get();
+
+	return meter;
+}
+
+static bool meter_is_acked(const struct meter_entry *meter, uint32_t seq)
+{
+	if ((meter->acked_top == 0) || (seq > meter->acked_top)) {
+		return false;
+	}
+
+	/* Older than the window, the meter released it long ago. */
+	if (meter->acked_top - seq >= ACK_WINDOW) {
+		return true;
+	}
+
+	return (meter->acked_mask & BIT(meter->acked_top - seq)) != 0;
+}
+
+static void meter_set_acked(struct meter_entry *meter, uint32_t seq)
+{
+	uint32_t shift;
+
+	if (seq > meter->acked_top) {
+		shift = seq - meter->acked_top;
+		meter->acked_mask = (shift < ACK_WINDOW) ? (meter->acked_mask << shift) : 0;
+		meter->acked_top = seq;
+	}
+	if (meter->acked_top - seq < ACK_WINDOW) {
+		meter->acked_mask |= BIT(meter->acked_top - seq);
+	}
+}
+
+static struct pending_entry *pending_find(const struct delivery_header *header)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(pending); i++) {
+		if ((pending[i].tag != 0) && (pending[i].header.seq == header->seq) &&
+		    (pending[i].header.session == header->session) &&
+		    (memcmp(pending[i].header.id, header->id, DELIVERY_METER_ID_SIZE) == 0)) {
+			return &pending[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct pending_entry *pending_alloc(int64_t now)
+{
+	struct pending_entry *oldest = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(pending); i++) {
+		if (pending[i].tag == 0) {
+			return &pending[i];
+		}
+		if ((oldest == NULL) || (pending[i].time < oldest->time)) {
+			oldest = &pending[i];
+		}
+	}
+
+	/* Acknowledgements lost on the way, e.g. evicted from the cloud store. */
+	if (now - oldest->time >= (int64_t)CONFIG_DELIVERY_PENDING_TIMEOUT * MSEC_PER_SEC) {
+		LOG_DBG("Batch %u of session %08x expired", oldest->header.seq,
+			oldest->header.session);
+		return oldest;
+	}
+
+	return NULL;
+}
+
+/* Called without delivery_lock, relaying sends a CoAP request. */
+static void ack_send(const struct delivery_header *header, const otIp6Address *peer)
+{
+	uint8_t payload[DELIVERY_HEADER_SIZE];
+
+	if (peer == NULL) {
+		if (own_ack_handler) {
+			own_ack_handler(header);
+		}
+		return;
+	}
+
+	if (coap_utils_modem_cloud_ack(peer, payload, header_encode(header, payload)) ==
+	    OT_ERROR_NONE) {
+		k_mutex_lock(&delivery_lock, K_FOREVER);
+		stats.acks_relayed++;
+		k_mutex_unlock(&delivery_lock);
+	}
+}
+
+static int forward_track(const struct delivery_header *header, size_t length,
+			 const otIp6Address *peer, bool join, uint32_t *tag)
+{
+	struct meter_entry *meter;
+	struct pending_entry *entry;
+	int64_t now = k_uptime_get();
+	bool acked;
+
+	if (header->seq == 0) {
+		return -ENODATA;
+	}
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	meter = meter_get(header->id);
+	if (meter->session != header->session) {
+		/* Meter rebooted, its sequences start over. */
+		meter->session = header->session;
+		meter->acked_top = 0;
+		meter->acked_mask = 0;
+	}
+
+	acked = meter_is_acked(meter, header->seq);
+	if (acked || (pending_find(header) != NULL)) {
+		LOG_INF("Batch %u of session %08x already forwarded", header->seq, header->session);
+		stats.duplicates++;
+		stats.duplicate_bytes += length;
+		k_mutex_unlock(&delivery_lock);
+		/* The acknowledgement got lost, otherwise the meter would not resend. */
+		if (acked) {
+			ack_send(header, peer);
+		}
+		return -EALREADY;
+	}
+
+	stats.forwarded++;
+	/* Joined batches are published untracked with an untracked group. */
+	entry = (join && (*tag == 0)) ? NULL : pending_alloc(now);
+	if (entry == NULL) {
+		LOG_WRN("Pending table full, batch %u not tracked", header->seq);
+		stats.untracked++;
+		*tag = 0;
+		goto end;
+	}
+
+	if (join) {
+		entry->tag = *tag;
+	} else {
+		entry->tag = next_tag;
+		next_tag = seq_next(next_tag);
+	}
+	entry->header = *header;
+	entry->own = (peer == NULL);
+	if (peer != NULL) {
+		entry->peer = *peer;
+	}
+	entry->time = now;
+	*tag = entry->tag;
+
+end:
+	k_mutex_unlock(&delivery_lock);
+
+	return 0;
+}
+
+int delivery_forward_prepare(const struct delivery_header *header, size_t length,
+			     const otIp6Address *peer, uint32_t *tag)
+{
+	return forward_track(header, length, peer, false, tag);
+}
+
+int delivery_forward_join(const struct delivery_header *header, size_t length,
+			  const otIp6Address *peer, uint32_t tag)
+{
+	return forward_track(header, length, peer, true, &tag);
+}
+
+void delivery_forward_cancel(uint32_t tag)
+{
+	uint32_t cancelled = 0;
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+
+	for (size_t i = 0; (tag != 0) && (i < ARRAY_SIZE(pending)); i++) {
+		if (pending[i].tag == tag) {
+			pending[i].tag = 0;
+			cancelled++;
+		}
+	}
+	stats.forwarded -= MAX(cancelled, 1);
+
+	k_mutex_unlock(&delivery_lock);
+}
+
+void delivery_acked(uint32_t tag)
+{
+	struct pending_entry acked;
+	struct meter_entry *meter;
+	bool found = false;
+
+	/* Every batch published with the tag is acknowledged, one at a time. */
+	do {
+		acked.tag = 0;
+
+		k_mutex_lock(&delivery_lock, K_FOREVER);
+
+		for (size_t i = 0; (tag != 0) && (i < ARRAY_SIZE(pending)); i++) {
+			if (pending[i].tag == tag) {
+				acked = pending[i];
+				pending[i].tag = 0;
+				break;
+			}
+		}
+
+		if (acked.tag != 0) {
+			meter = meter_find(acked.header.id);
+			if ((meter != NULL) && (meter->session == acked.header.session)) {
+				meter_set_acked(meter, acked.header.seq);
+			}
+		}
+
+		k_mutex_unlock(&delivery_lock);
+
+		if (acked.tag != 0) {
+			found = true;
+			LOG_DBG("Batch %u of session %08x acknowledged", acked.header.seq,
+				acked.header.session);
+			ack_send(&acked.header, acked.own ? NULL : &acked.peer);
+		}
+	} while (acked.tag != 0);
+
+	if (!found) {
+		LOG_DBG("Unknown tag %u acknowledged", tag);
+	}
+}
+
+void delivery_get_stats(struct delivery_stats *out)
+{
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&delivery_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct delivery_stats current;
+	uint32_t journaled, pending_count = 0;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&delivery_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&delivery_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&delivery_lock, K_FOREVER);
+	current = stats;
+	journaled = journal_count;
+	for (size_t i = 0; i < ARRAY_SIZE(pending); i++) {
+		pending_count += (pending[i].tag != 0) ? 1 : 0;
+	}
+	k_mutex_unlock(&delivery_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "session: %08x next sequence: %u\n", own_header.session,
+		      own_header.seq);
+	shell_fprintf(shell, SHELL_INFO, "journal: %u/%u batches\n", journaled,
+		      CONFIG_DELIVERY_JOURNAL_SIZE);
+	shell_fprintf(shell, SHELL_INFO, "batches: %u resent: %u acked: %u dropped items: %u\n",
+		      current.batches, current.resent, current.acked, current.dropped);
+	shell_fprintf(shell, SHELL_INFO, "kept after failed uploads: %u\n", current.kept);
+	shell_fprintf(shell, SHELL_INFO, "ack time avg/max: %llu/%u ms\n",
+		      current.acked ? current.ack_time / current.acked : 0, current.max_ack_time);
+	shell_fprintf(shell, SHELL_INFO, "forwarded: %u untracked: %u pending: %u\n",
+		      current.forwarded, current.untracked, pending_count);
+	shell_fprintf(shell, SHELL_INFO, "duplicates: %u (%llu B not published)\n",
+		      current.duplicates, current.duplicate_bytes);
+	shell_fprintf(shell, SHELL_INFO, "acks relayed: %u\n", current.acks_relayed);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_delivery,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset delivery statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(delivery, &sub_delivery, "delivery commands", NULL);
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __DELIVERY_H__
+#define __DELIVERY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openthread/ip6.h>
+
+/**@brief Size of the meter ID, the factory assigned EUI-64. */
+#define DELIVERY_METER_ID_SIZE 8
+
+/**@brief Size of the header in front of every measurement batch. */
+#define DELIVERY_HEADER_SIZE (DELIVERY_METER_ID_SIZE + 2 * sizeof(uint32_t))
+
+/**
+ * @brief Header identifying a measurement batch end to end.
+ *
+ * Encoded as the meter ID followed by little-endian session and sequence.
+ * The session is drawn at random on every boot and the sequence counts
+ * batches within the session, so the cloud can drop duplicates by the
+ * whole header.
+ */
+struct delivery_header {
+	uint8_t id[DELIVERY_METER_ID_SIZE];
+	uint32_t session;
+	/** Sequence of the batch, 0 if the block carries no batch. */
+	uint32_t seq;
+};
+
+/**@brief Batch of the meter journal. */
+struct delivery_batch {
+	uint32_t seq;
+	/** Position of the first item in the measurement queue. */
+	uint16_t offset;
+	/** Number of items in the batch. */
+	uint16_t count;
+};
+
+/**@brief Delivery statistics. */
+struct delivery_stats {
+	/** Batches sent by the meter for the first time. */
+	uint32_t batches;
+	/** Batches sent again after the acknowledgement timed out. */
+	uint32_t resent;
+	/** Batches acknowledged by the cloud. */
+	uint32_t acked;
+	/** Items dropped from the journal before they were acknowledged. */
+	uint32_t dropped;
+	/** Batches not sent again after a failed upload, a modem received them. */
+	uint32_t kept;
+	/** Sum and maximum of the time from first send to acknowledgement [ms]. */
+	uint64_t ack_time;
+	uint32_t max_ack_time;
+	/** Batches forwarded to the cloud by the gateway. */
+	uint32_t forwarded;
+	/** Batches forwarded without duplicate suppression, pending table full. */
+	uint32_t untracked;
+	/** Duplicate batches not forwarded, and their size. */
+	uint32_t duplicates;
+	uint64_t duplicate_bytes;
+	/** Acknowledgements relayed to meters. */
+	uint32_t acks_relayed;
+};
+
+/**
+ * @brief Callback for acknowledged batches of the own journal.
+ *
+ * Called when the own modem published a batch of the own meter.
+ */
+typedef void (*delivery_ack_handler_t)(const struct delivery_header *header);
+
+/**
+ * @brief Initialize delivery tracking.
+ *
+ * Must be called after OpenThread is initialized, the meter ID is read
+ * from the radio.
+ */
+int delivery_init(delivery_ack_handler_t own_ack_handler);
+
+/**
+ * @brief Encode header of a batch of the own meter.
+ *
+ * @return Number of bytes written to @p buf, DELIVERY_HEADER_SIZE.
+ */
+size_t delivery_header_encode(uint32_t seq, uint8_t *buf);
+
+/**
+ * @brief Parse header in front of a batch.
+ *
+ * @retval 0        @p header is set.
+ * @retval -EBADMSG @p length cannot hold the header.
+ */
+int delivery_header_parse(const uint8_t *buf, size_t length, struct delivery_header *header);
+
+/**
+ * @brief Get the batch to send next.
+ *
+ * @param[in]  queued number of items in the measurement queue.
+ * @param[out] batch  batch to send.
+ *
+ * @retval 0        @p batch is a journaled batch whose acknowledgement timed
+ *                  out. It has to be sent again with the same items.
+ * @retval -ENOENT  @p batch->offset is where a new batch starts.
+ * @retval -ENODATA Nothing is due and no items follow the journaled ones.
+ * @retval -ENOSPC  Journal is full and nothing is due.
+ */
+int delivery_journal_next(uint16_t queued, struct delivery_batch *batch);
+
+/**
+ * @brief Journal a new batch following the journaled ones.
+ *
+ * @return Sequence of the batch.
+ */
+uint32_t delivery_journal_add(uint16_t count);
+
+/**
+ * @brief Note that a journaled batch was sent again.
+ */
+void delivery_journal_sent(uint32_t seq);
+
+/**
+ * @brief Check if there is a batch to send.
+ *
+ * @param[in] queued number of items in the measurement queue.
+ */
+bool delivery_journal_due(uint16_t queued);
+
+/**
+ * @brief Mark the batch of @p header acknowledged.
+ *
+ * @return Number of items to remove from the head of the measurement queue.
+ *         Batches acknowledged out of order are released once all batches
+ *         in front of them are acknowledged.
+ */
+uint16_t delivery_journal_ack(const struct delivery_header *header);
+
+/**
+ * @brief Drop the oldest batch to make room in the measurement queue.
+ *
+ * @return Number of items to remove from the head of the measurement queue,
+ *         0 if the journal is empty.
+ */
+uint16_t delivery_journal_drop(void);
+
+/**
+ * @brief Note that a modem received the batch.
+ *
+ * The batch is not sent again by delivery_journal_retry, only when its
+ * acknowledgement times out.
+ */
+void delivery_journal_accepted(uint32_t seq);
+
+/**
+ * @brief Note the last batch a modem received, read back from the modem.
+ *
+ * Journaled batches up to the one of @p cursor are marked received as by
+ * delivery_journal_accepted. A cursor of another session marks nothing.
+ */
+void delivery_journal_cursor(const struct delivery_header *cursor);
+
+/**
+ * @brief Send batches no modem received again on the next upload.
+ *
+ * Called when an upload failed, so the next upload resumes after the last
+ * batch a modem received.
+ *
+ * @return Number of batches to send again.
+ */
+uint16_t delivery_journal_retry(void);
+
+/**
+ * @brief Prepare forwarding of a batch to the cloud.
+ *
+ * @param[in]  header batch header.
+ * @param[in]  length size of the block carrying the batch.
+ * @param[in]  peer   address of the uploading meter, NULL for the own meter.
+ * @param[out] tag    tag to publish the batch with, 0 if not tracked.
+ *
+ * @retval 0         Batch has to be published with @p tag.
+ * @retval -EALREADY Batch was already forwarded. It is acknowledged again
+ *                   if the cloud already acknowledged it.
+ * @retval -ENODATA  Block carries no batch.
+ */
+int delivery_forward_prepare(const struct delivery_header *header, size_t length,
+			     const otIp6Address *peer, uint32_t *tag);
+
+/**
+ * @brief Prepare forwarding of a batch published together with others.
+ *
+ * Like delivery_forward_prepare, but the batch is tracked with the @p tag
+ * of the first batch of the publish. The acknowledgement of the tag is
+ * relayed to every meter of the publish.
+ */
+int delivery_forward_join(const struct delivery_header *header, size_t length,
+			  const otIp6Address *peer, uint32_t tag);
+
+/**
+ * @brief Cancel forwarding of batches that were not published.
+ */
+void delivery_forward_cancel(uint32_t tag);
+
+/**
+ * @brief Handle acknowledgement of a published batch, see modem_set_ack_handler.
+ */
+void delivery_acked(uint32_t tag);
+
+/**
+ * @brief Get a copy of the delivery statistics.
+ */
+void delivery_get_stats(struct delivery_stats *stats);
+
+#endif /* __DELIVERY_H__ */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/radio_stats.h>
+#include <openthread/thread.h>
+
+#if CONFIG_BT_NUS
+#include <zephyr/bluetooth/conn.h>
+#endif
+
+#include "energy.h"
+
+LOG_MODULE_REGISTER(energy, CONFIG_ENERGY_ACCOUNTING_LOG_LEVEL);
+
+/* Charge [uA us] of 1 nAh */
+#define CHARGE_PER_NAH (3600ULL * USEC_PER_MSEC)
+
+/* No component for a state without consumption */
+#define COMPONENT_NONE ENERGY_COMPONENT_COUNT
+
+static const uint32_t currents[ENERGY_COMPONENT_COUNT] = {
+	[ENERGY_SLEEP] = CONFIG_ENERGY_CURRENT_SLEEP,
+	[ENERGY_CPU] = CONFIG_ENERGY_CURRENT_CPU,
+	[ENERGY_RADIO_TX] = CONFIG_ENERGY_CURRENT_RADIO_TX,
+	[ENERGY_RADIO_RX] = CONFIG_ENERGY_CURRENT_RADIO_RX,
+	[ENERGY_BLE_ADVERTISING] = CONFIG_ENERGY_CURRENT_BLE_ADVERTISING,
+	[ENERGY_BLE_CONNECTED] = CONFIG_ENERGY_CURRENT_BLE_CONNECTED,
+	[ENERGY_MODEM_AWAKE] = CONFIG_ENERGY_CURRENT_MODEM_AWAKE,
+	[ENERGY_MODEM_CONNECTED] = CONFIG_ENERGY_CURRENT_MODEM_CONNECTED,
+};
+
+static const char *const component_names[ENERGY_COMPONENT_COUNT] = {
+	[ENERGY_SLEEP] = "sleep",
+	[ENERGY_CPU] = "cpu",
+	[ENERGY_RADIO_TX] = "802.15.4 tx",
+	[ENERGY_RADIO_RX] = "802.15.4 rx",
+	[ENERGY_BLE_ADVERTISING] = "ble advertising",
+	[ENERGY_BLE_CONNECTED] = "ble connected",
+	[ENERGY_MODEM_AWAKE] = "modem awake",
+	[ENERGY_MODEM_CONNECTED] = "modem connected",
+};
+
+static const char *const role_names[ENERGY_ROLE_COUNT] = {
+	[ENERGY_ROLE_METER] = "meter",
+	[ENERGY_ROLE_ROUTER] = "router",
+	[ENERGY_ROLE_GATEWAY] = "gateway",
+};
+
+static struct k_work_delayable update_work;
+
+static struct energy_stats stats;
+static enum energy_role role;
+static K_MUTEX_DEFINE(energy_lock);
+
+/* Cumulative counters at the last update */
+static int64_t last_update;
+static uint64_t last_cpu_cycles;
+static uint64_t last_radio_tx;
+static uint64_t last_radio_rx;
+
+/* Components following state changes, charged since state_since [ticks] */
+static enum energy_component modem_component = COMPONENT_NONE;
+static enum energy_component ble_component = COMPONENT_NONE;
+static int64_t state_since;
+
+#if CONFIG_BT_NUS
+static uint8_t ble_connections;
+#endif
+
+/* Charge a component for the given time [us], with the lock held. */
+static void charge_add(enum energy_component component, uint64_t time)
+{
+	uint64_t charge;
+
+	if (component == COMPONENT_NONE) {
+		return;
+	}
+
+	charge = time * currents[component];
+	stats.time[component] += time;
+	stats.charge[component] += charge;
+	stats.role_charge[role] += charge;
+}
+
+/* Charge the components following state changes up to now, with the lock held. */
+static void state_advance(void)
+{
+	int64_t now = k_uptime_ticks();
+	uint64_t time = k_ticks_to_us_floor64(now - state_since);
+
+	charge_add(modem_component, time);
+	charge_add(ble_component, time);
+	state_since = now;
+}
+
+static enum energy_component modem_component_get(modem_state state)
+{
+	switch (state) {
+	case MODEM_STATE_OFF:
+	case MODEM_STATE_IDLE:
+		/* Registered or looking for a network */
+		return ENERGY_MODEM_AWAKE;
+	case MODEM_STATE_BUSY:
+		return ENERGY_MODEM_CONNECTED;
+	default:
+		/* Not synchronized, no modem attached or powered off */
+		return COMPONENT_NONE;
+	}
+}
+
+static void update_work_handler(struct k_work *work)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	const otRadioTimeStats *radio;
+	k_thread_runtime_stats_t cpu;
+	enum energy_role next_role;
+	uint64_t radio_tx;
+	uint64_t radio_rx;
+	uint64_t wall_time;
+	uint64_t cpu_time;
+	int64_t now;
+
+	ARG_UNUSED(work);
+
+	openthread_api_mutex_lock(ot_context);
+	radio = otRadioTimeStatsGet(ot_context->instance);
+	radio_tx = radio->mTxTime;
+	radio_rx = radio->mRxTime;
+	switch (otThreadGetDeviceRole(ot_context->instance)) {
+	case OT_DEVICE_ROLE_ROUTER:
+	case OT_DEVICE_ROLE_LEADER:
+		next_role = ENERGY_ROLE_ROUTER;
+		break;
+	default:
+		next_role = ENERGY_ROLE_METER;
+		break;
+	}
+	openthread_api_mutex_unlock(ot_context);
+
+	if (modem_get_state() != MODEM_STATE_UNKNOWN) {
+		next_role = ENERGY_ROLE_GATEWAY;
+	}
+
+	if (k_thread_runtime_stats_all_get(&cpu) != 0) {
+		cpu.total_cycles = last_cpu_cycles;
+	}
+
+	k_mutex_lock(&energy_lock, K_FOREVER);
+
+	now = k_uptime_ticks();
+	wall_time = k_ticks_to_us_floor64(now - last_update);
+	/* Non-idle threads, the SoC sleeps for the rest of the time. */
+	cpu_time = MIN(k_cyc_to_us_floor64(cpu.total_cycles - last_cpu_cycles), wall_time);
+	state_advance();
+	charge_add(ENERGY_SLEEP, wall_time - cpu_time);
+	charge_add(ENERGY_CPU, cpu_time);
+	charge_add(ENERGY_RADIO_TX, radio_tx - last_radio_tx);
+	charge_add(ENERGY_RADIO_RX, radio_rx - last_radio_rx);
+	stats.role_time[role] += wall_time;
+
+	last_update = now;
+	last_cpu_cycles = cpu.total_cycles;
+	last_radio_tx = radio_tx;
+	last_radio_rx = radio_rx;
+
+	if (next_role != role) {
+		LOG_INF("Energy charged to %s role", role_names[next_role]);
+		role = next_role;
+	}
+
+	k_mutex_unlock(&energy_lock);
+
+	k_work_reschedule(&update_work, K_MSEC(CONFIG_ENERGY_ACCOUNTING_PERIOD));
+}
+
+void energy_modem_state(modem_state state)
+{
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	state_advance();
+	modem_component = modem_component_get(state);
+	k_mutex_unlock(&energy_lock);
+}
+
+void energy_uploaded(size_t bytes)
+{
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	stats.role_bytes[role] += bytes;
+	k_mutex_unlock(&energy_lock);
+}
+
+#if CONFIG_BT_NUS
+static void ble_connected(struct bt_conn *conn, uint8_t err)
+{
+	ARG_UNUSED(conn);
+
+	if (err) {
+		return;
+	}
+
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	state_advance();
+	ble_connections++;
+	ble_component = ENERGY_BLE_CONNECTED;
+	k_mutex_unlock(&energy_lock);
+}
+
+static void ble_disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	ARG_UNUSED(conn);
+	ARG_UNUSED(reason);
+
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	state_advance();
+	if (ble_connections > 0) {
+		ble_connections--;
+	}
+	/* Advertising resumes once no connection is left. */
+	ble_component = (ble_connections > 0) ? ENERGY_BLE_CONNECTED : ENERGY_BLE_ADVERTISING;
+	k_mutex_unlock(&energy_lock);
+}
+
+BT_CONN_CB_DEFINE(energy_conn_callbacks) = {
+	.connected = ble_connected,
+	.disconnected = ble_disconnected,
+};
+#endif
+
+int energy_init(void)
+{
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	last_update = k_uptime_ticks();
+	state_since = last_update;
+#if CONFIG_BT_NUS
+	ble_component = ENERGY_BLE_ADVERTISING;
+#endif
+	modem_component = modem_component_get(modem_get_state());
+	k_mutex_unlock(&energy_lock);
+
+	k_work_init_delayable(&update_work, update_work_handler);
+	k_work_schedule(&update_work, K_NO_WAIT);
+
+	return 0;
+}
+
+void energy_get_stats(struct energy_stats *out)
+{
+	k_mutex_lock(&energy_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&energy_lock);
+}
+
+static void charge_print(const struct shell *shell, const char *name, uint64_t time,
+			 uint64_t charge)
+{
+	uint64_t nah = charge / CHARGE_PER_NAH;
+
+	shell_fprintf(shell, SHELL_INFO, "%-16s %10llu ms %8llu.%03llu uAh\n", name,
+		      time / USEC_PER_MSEC, nah / 1000, nah % 1000);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct energy_stats current;
+	uint64_t per_kb;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&energy_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&energy_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	energy_get_stats(&current);
+
+	for (size_t i = 0; i < ENERGY_COMPONENT_COUNT; i++) {
+		charge_print(shell, component_names[i], current.time[i], current.charge[i]);
+	}
+
+	for (size_t i = 0; i < ENERGY_ROLE_COUNT; i++) {
+		if (current.role_time[i] == 0) {
+			continue;
+		}
+
+		charge_print(shell, role_names[i], current.role_time[i], current.role_charge[i]);
+
+		/* nAh per KB */
+		per_kb = current.role_bytes[i] ?
+			 (current.role_charge[i] / CHARGE_PER_NAH) * 1024 / current.role_bytes[i] : 0;
+		shell_fprintf(shell, SHELL_INFO, "  uploaded: %llu B, %llu.%03llu uAh/KB\n",
+			      current.role_bytes[i], per_kb / 1000, per_kb % 1000);
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_energy,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset energy estimate per component and role. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(energy, &sub_energy, "Energy accounting commands", NULL);
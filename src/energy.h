@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __ENERGY_H__
+#define __ENERGY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "modem_utils.h"
+
+/**@brief Consumers of the energy estimate, each with its own current. */
+enum energy_component {
+	/** Whole node asleep, over the full time. */
+	ENERGY_SLEEP,
+	/** CPU running threads other than idle. */
+	ENERGY_CPU,
+	/** 802.15.4 radio transmitting and receiving. */
+	ENERGY_RADIO_TX,
+	ENERGY_RADIO_RX,
+	/** BLE advertising, and with a connection. */
+	ENERGY_BLE_ADVERTISING,
+	ENERGY_BLE_CONNECTED,
+	/** Modem awake without a session, and in an upload session. */
+	ENERGY_MODEM_AWAKE,
+	ENERGY_MODEM_CONNECTED,
+	ENERGY_COMPONENT_COUNT,
+};
+
+/**@brief Role of the node, energy and uploads are counted per role. */
+enum energy_role {
+	/** Child uploading its own measurement. */
+	ENERGY_ROLE_METER,
+	/** Router, forwarding uploads of its children too. */
+	ENERGY_ROLE_ROUTER,
+	/** Node with a modem, publishing to the cloud. */
+	ENERGY_ROLE_GATEWAY,
+	ENERGY_ROLE_COUNT,
+};
+
+/**@brief Energy estimate since boot or reset. */
+struct energy_stats {
+	/** Time [us] and charge [uA us] per energy_component. */
+	uint64_t time[ENERGY_COMPONENT_COUNT];
+	uint64_t charge[ENERGY_COMPONENT_COUNT];
+	/** Time [us], charge [uA us] and bytes uploaded per energy_role. */
+	uint64_t role_time[ENERGY_ROLE_COUNT];
+	uint64_t role_charge[ENERGY_ROLE_COUNT];
+	uint64_t role_bytes[ENERGY_ROLE_COUNT];
+};
+
+/**
+ * @brief Initialize the energy estimate.
+ *
+ * The estimate is updated every CONFIG_ENERGY_ACCOUNTING_PERIOD and
+ * charged to the role the node has at that time.
+ */
+int energy_init(void);
+
+/**
+ * @brief Record a modem state change, for the time the modem spends in it.
+ */
+void energy_modem_state(modem_state state);
+
+/**
+ * @brief Record bytes the node delivered upstream, to a modem or the cloud.
+ *
+ * Bytes are counted before cloud compression, so the figures of all roles
+ * refer to the same measurement data.
+ *
+ * @param[in] bytes bytes delivered.
+ */
+void energy_uploaded(size_t bytes);
+
+/**
+ * @brief Get a copy of the energy estimate, as of its last update.
+ */
+void energy_get_stats(struct energy_stats *stats);
+
+#endif /* __ENERGY_H__ */
@@ -0,0 +1,1105 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/random/random.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+#include <openthread/coap.h>
+#include <openthread/thread.h>
+#include <psa/crypto.h>
+#if CONFIG_IMAGE_DIST_MCUBOOT
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/sys/reboot.h>
+#endif
+
+#include "coap_utils.h"
+#include "image_dist.h"
+
+LOG_MODULE_REGISTER(image_dist, CONFIG_IMAGE_DIST_LOG_LEVEL);
+
+#if CONFIG_IMAGE_DIST_MCUBOOT
+#define IMAGE_PARTITION_ID FIXED_PARTITION_ID(slot1_partition)
+#else
+#define IMAGE_PARTITION_ID FIXED_PARTITION_ID(image_partition)
+#endif
+
+#define IMAGE_MAX_BLOCKS (CONFIG_IMAGE_DIST_MAX_SIZE / IMAGE_BLOCK_SIZE)
+#define IMAGE_MAX_PAGES  (CONFIG_IMAGE_DIST_MAX_SIZE / CONFIG_IMAGE_DIST_ERASE_SIZE)
+
+/* Header fields covered by the MAC, in front of it */
+#define IMAGE_MAC_OFFSET (IMAGE_DIST_HEADER_SIZE - IMAGE_DIST_MAC_SIZE)
+/* Message type, image ID and block number in front of the data of a block */
+#define BLOCK_MESSAGE_HEADER_SIZE 5
+/* Message type, image ID, status and number of repaired blocks */
+#define DONE_MESSAGE_SIZE 6
+/* Longest line of a config image, as for commands received over BLE NUS */
+#define CONFIG_LINE_MAX_SIZE 64
+/* Block data as hex digits behind "d<offset>," */
+#define CLOUD_MESSAGE_MAX_SIZE (2 * IMAGE_BLOCK_SIZE + 16)
+
+#define REBOOT_DELAY K_SECONDS(5)
+
+BUILD_ASSERT(CONFIG_IMAGE_DIST_MAX_SIZE % CONFIG_IMAGE_DIST_ERASE_SIZE == 0,
+	     "Image partition must consist of whole pages");
+BUILD_ASSERT(CONFIG_IMAGE_DIST_ERASE_SIZE % IMAGE_BLOCK_SIZE == 0,
+	     "Blocks must not cross pages");
+
+/* Messages of the image resource, identified by their first byte */
+enum image_message {
+	/* Image header and RLOC16 of the gateway, multicast before the blocks */
+	IMAGE_MESSAGE_ANNOUNCE,
+	/* Image ID, block number and block data, multicast */
+	IMAGE_MESSAGE_BLOCK,
+	/* Image header and RLOC16 of the gateway, multicast after the last block */
+	IMAGE_MESSAGE_END,
+	/* Report of a meter to the gateway */
+	IMAGE_MESSAGE_DONE,
+};
+
+enum image_status {
+	IMAGE_STATUS_VERIFIED,
+	IMAGE_STATUS_INVALID,
+	IMAGE_STATUS_INCOMPLETE,
+};
+
+struct image {
+	uint16_t id;
+	uint8_t type;
+	uint32_t size;
+	uint32_t crc;
+	uint8_t mac[IMAGE_DIST_MAC_SIZE];
+};
+
+static const struct flash_area *image_area;
+static struct image image;
+/* Image is verified, on the gateway it was fetched from the cloud */
+static bool image_valid;
+static bool image_source;
+static uint8_t config_key[IMAGE_DIST_MAC_SIZE];
+static size_t config_key_length;
+static uint8_t buffer[IMAGE_BLOCK_SIZE];
+/* Pages of the partition erased for the image */
+static uint8_t erased[DIV_ROUND_UP(IMAGE_MAX_PAGES, 8)];
+
+/* Meter receiving the image */
+static bool image_receiving;
+static uint8_t received[DIV_ROUND_UP(IMAGE_MAX_BLOCKS, 8)];
+static uint32_t received_count;
+static uint16_t repaired_count;
+static uint8_t repair_attempts;
+static otIp6Address gateway;
+static struct k_work_delayable repair_work;
+static struct k_work finish_work;
+#if CONFIG_IMAGE_DIST_MCUBOOT
+static struct k_work_delayable reboot_work;
+#endif
+static image_dist_command_handler_t command_handler;
+
+/* Gateway fetching the image from the cloud and multicasting it */
+static uint32_t cloud_offset;
+static bool cloud_receiving;
+static char cloud_message[CLOUD_MESSAGE_MAX_SIZE + 1];
+static bool distributing;
+/* Gateway with a lower RLOC16 announced the same image. */
+static bool distributor_elected;
+static uint32_t send_step;
+static int64_t distribution_start;
+static otIp6Address done_meters[CONFIG_IMAGE_DIST_METER_COUNT];
+static uint16_t done_count;
+static struct k_work_delayable send_work;
+
+static struct image_dist_stats stats;
+static K_MUTEX_DEFINE(image_lock);
+
+static bool bit_test(const uint8_t *map, uint32_t bit)
+{
+	return (map[bit / 8] & BIT(bit % 8)) != 0;
+}
+
+static void bit_set(uint8_t *map, uint32_t bit)
+{
+	map[bit / 8] |= BIT(bit % 8);
+}
+
+static uint32_t image_block_count(void)
+{
+	return DIV_ROUND_UP(image.size, IMAGE_BLOCK_SIZE);
+}
+
+static uint16_t image_block_length(uint32_t block)
+{
+	return (uint16_t)MIN(image.size - block * IMAGE_BLOCK_SIZE, IMAGE_BLOCK_SIZE);
+}
+
+static void image_header_encode(uint8_t *data)
+{
+	sys_put_le16(image.id, &data[0]);
+	data[2] = image.type;
+	sys_put_le32(image.size, &data[3]);
+	sys_put_le32(image.crc, &data[7]);
+	memcpy(&data[IMAGE_MAC_OFFSET], image.mac, IMAGE_DIST_MAC_SIZE);
+}
+
+static int image_header_parse(const uint8_t *data, size_t length, struct image *out)
+{
+	if (length < IMAGE_DIST_HEADER_SIZE) {
+		return -EINVAL;
+	}
+
+	out->id = sys_get_le16(&data[0]);
+	out->type = data[2];
+	out->size = sys_get_le32(&data[3]);
+	out->crc = sys_get_le32(&data[7]);
+	memcpy(out->mac, &data[IMAGE_MAC_OFFSET], IMAGE_DIST_MAC_SIZE);
+
+	if (((out->type != IMAGE_DIST_TYPE_CONFIG) && (out->type != IMAGE_DIST_TYPE_FIRMWARE)) ||
+	    (out->size == 0) || (out->size > CONFIG_IMAGE_DIST_MAX_SIZE)) {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Forget the stored image, pages are erased when the first block is written to them. */
+static void image_begin(const struct image *new_image)
+{
+	image = *new_image;
+	image_valid = false;
+	image_source = false;
+	distributor_elected = false;
+	image_receiving = false;
+	memset(erased, 0, sizeof(erased));
+	memset(received, 0, sizeof(received));
+	received_count = 0;
+	repaired_count = 0;
+	repair_attempts = 0;
+}
+
+static int image_block_write(uint32_t block, const uint8_t *data, uint16_t length)
+{
+	uint32_t offset = block * IMAGE_BLOCK_SIZE;
+	uint32_t page = offset / CONFIG_IMAGE_DIST_ERASE_SIZE;
+	size_t write_length = ROUND_UP(length, flash_area_align(image_area));
+	int ret;
+
+	if (!bit_test(erased, page)) {
+		ret = flash_area_erase(image_area, page * CONFIG_IMAGE_DIST_ERASE_SIZE,
+				       CONFIG_IMAGE_DIST_ERASE_SIZE);
+		if (ret) {
+			return ret;
+		}
+		bit_set(erased, page);
+	}
+
+	/* The end of the last block is padded to the write block size. */
+	memmove(buffer, data, length);
+	memset(&buffer[length], 0xff, write_length - length);
+
+	return flash_area_write(image_area, offset, buffer, write_length);
+}
+
+static int image_verify(void)
+{
+	uint32_t crc = 0;
+	int ret;
+
+	for (uint32_t offset = 0; offset < image.size; offset += sizeof(buffer)) {
+		size_t length = MIN(image.size - offset, sizeof(buffer));
+
+		ret = flash_area_read(image_area, offset, buffer, length);
+		if (ret) {
+			return ret;
+		}
+		crc = crc32_ieee_update(crc, buffer, length);
+	}
+
+	return (crc == image.crc) ? 0 : -EBADMSG;
+}
+
+/* Check the HMAC-SHA256 of the header and the config image, with the lock held. */
+static int config_authenticate(void)
+{
+	psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+	psa_mac_operation_t operation = PSA_MAC_OPERATION_INIT;
+	uint8_t header[IMAGE_DIST_HEADER_SIZE];
+	psa_key_id_t key_id;
+	psa_status_t status;
+
+	if (config_key_length == 0) {
+		return -EACCES;
+	}
+
+	psa_set_key_usage_flags(&attributes, PSA_KEY_USAGE_VERIFY_MESSAGE);
+	psa_set_key_algorithm(&attributes, PSA_ALG_HMAC(PSA_ALG_SHA_256));
+	psa_set_key_type(&attributes, PSA_KEY_TYPE_HMAC);
+	status = psa_import_key(&attributes, config_key, config_key_length, &key_id);
+	if (status != PSA_SUCCESS) {
+		return -EIO;
+	}
+
+	image_header_encode(header);
+	status = psa_mac_verify_setup(&operation, key_id, PSA_ALG_HMAC(PSA_ALG_SHA_256));
+	if (status == PSA_SUCCESS) {
+		status = psa_mac_update(&operation, header, IMAGE_MAC_OFFSET);
+	}
+	for (uint32_t offset = 0; (status == PSA_SUCCESS) && (offset < image.size);
+	     offset += sizeof(buffer)) {
+		size_t length = MIN(image.size - offset, sizeof(buffer));
+
+		if (flash_area_read(image_area, offset, buffer, length) != 0) {
+			status = PSA_ERROR_STORAGE_FAILURE;
+			break;
+		}
+		status = psa_mac_update(&operation, buffer, length);
+	}
+	if (status == PSA_SUCCESS) {
+		status = psa_mac_verify_finish(&operation, image.mac, sizeof(image.mac));
+	} else {
+		psa_mac_abort(&operation);
+	}
+
+	psa_destroy_key(key_id);
+
+	return (status == PSA_SUCCESS) ? 0 : -EBADMSG;
+}
+
+/*
+ * Check that the verified image comes from the operator, with the lock held.
+ * The CRC only detects damaged blocks, anybody on the mesh could send one.
+ */
+static int image_authenticate(void)
+{
+	if (image.type == IMAGE_DIST_TYPE_CONFIG) {
+		return config_authenticate();
+	}
+
+#if CONFIG_IMAGE_DIST_MCUBOOT
+	struct mcuboot_img_header header;
+
+	/* MCUboot checks the signature of the image before the test swap. */
+	return (boot_read_bank_header(IMAGE_PARTITION_ID, &header, sizeof(header)) == 0) ?
+		       0 : -EBADMSG;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/* Gateways with the same image leave it to the one with the lowest RLOC16, with the lock held. */
+static void distributor_elect(const uint8_t *data, size_t length)
+{
+	uint16_t rloc16;
+
+	if (length < IMAGE_DIST_HEADER_SIZE + sizeof(uint16_t)) {
+		return;
+	}
+
+	/* Called in the OpenThread thread, the API is locked. */
+	rloc16 = sys_get_le16(&data[IMAGE_DIST_HEADER_SIZE]);
+	if (rloc16 >= otThreadGetRloc16(openthread_get_default_instance())) {
+		return;
+	}
+
+	if (!distributor_elected) {
+		LOG_INF("Image %u distributed by %04x", image.id, rloc16);
+		stats.yielded++;
+	}
+	distributor_elected = true;
+	/* Repairs are still served, meters may have been announced the image by this gateway. */
+	distributing = false;
+}
+
+static uint32_t first_missing_block(void)
+{
+	uint32_t block = 0;
+
+	while ((block < image_block_count()) && bit_test(received, block)) {
+		block++;
+	}
+
+	return block;
+}
+
+/* Store block of the image received by the meter, with the lock held. */
+static void block_receive(uint32_t block, const uint8_t *data, uint16_t length, bool repair)
+{
+	if (!image_receiving || (block >= image_block_count()) || bit_test(received, block)) {
+		return;
+	}
+	if (length != image_block_length(block)) {
+		LOG_WRN("Invalid length %u of block %u", length, block);
+		return;
+	}
+	if (image_block_write(block, data, length) != 0) {
+		LOG_ERR("Cannot write block %u", block);
+		return;
+	}
+
+	bit_set(received, block);
+	received_count++;
+	if (repair) {
+		repaired_count++;
+		stats.repaired_blocks++;
+	}
+
+	if (received_count == image_block_count()) {
+		k_work_cancel_delayable(&repair_work);
+		k_work_submit(&finish_work);
+	}
+}
+
+static void on_announce(const uint8_t *data, size_t length, const otIp6Address *source, bool end)
+{
+	struct image announced;
+	k_timeout_t repair_delay;
+
+	if (image_header_parse(data, length, &announced) != 0) {
+		LOG_WRN("Invalid image header");
+		return;
+	}
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if ((image_source || cloud_receiving) && (announced.id == image.id)) {
+		distributor_elect(data, length);
+		goto end;
+	}
+
+	if ((announced.id != image.id) || (!image_receiving && !image_valid)) {
+		if (distributing || cloud_receiving) {
+			LOG_WRN("Image %u ignored while distributing", announced.id);
+			goto end;
+		}
+		LOG_INF("Receiving image %u, %u B", announced.id, announced.size);
+		image_begin(&announced);
+		image_receiving = true;
+		gateway = *source;
+		stats.images++;
+	}
+
+	if (image_receiving) {
+		/* Meters missing blocks spread their repairs after the last block. */
+		repair_delay = end ? K_MSEC(sys_rand32_get() % CONFIG_IMAGE_DIST_REPAIR_JITTER) :
+				     K_MSEC(CONFIG_IMAGE_DIST_REPAIR_DELAY);
+		k_work_reschedule(&repair_work, repair_delay);
+	}
+
+end:
+	k_mutex_unlock(&image_lock);
+}
+
+static void on_block(const uint8_t *data, size_t length)
+{
+	if (length < BLOCK_MESSAGE_HEADER_SIZE - 1) {
+		return;
+	}
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (image_receiving && (sys_get_le16(&data[0]) == image.id)) {
+		/* Repair starts on its own if the end of the image is missed. */
+		k_work_reschedule(&repair_work, K_MSEC(CONFIG_IMAGE_DIST_REPAIR_DELAY));
+		block_receive(sys_get_le16(&data[2]), &data[4], length - 4, false);
+	}
+
+	k_mutex_unlock(&image_lock);
+}
+
+static void on_done(const uint8_t *data, size_t length, const otIp6Address *source)
+{
+	uint32_t completion;
+
+	if (length < DONE_MESSAGE_SIZE - 1) {
+		return;
+	}
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (!image_source || (sys_get_le16(&data[0]) != image.id)) {
+		goto end;
+	}
+
+	/* Reports sent again are counted once. */
+	for (uint16_t i = 0; i < MIN(done_count, ARRAY_SIZE(done_meters)); i++) {
+		if (otIp6IsAddressEqual(&done_meters[i], source)) {
+			goto end;
+		}
+	}
+	if (done_count < ARRAY_SIZE(done_meters)) {
+		done_meters[done_count] = *source;
+	}
+	done_count++;
+
+	completion = (uint32_t)(k_uptime_get() - distribution_start);
+	if (data[2] == IMAGE_STATUS_VERIFIED) {
+		stats.meters_done++;
+		stats.completion += completion;
+		stats.max_completion = MAX(stats.max_completion, completion);
+	} else {
+		stats.meters_failed++;
+	}
+	LOG_INF("Meter %u of image %u done in %u ms, status %u, %u blocks repaired", done_count,
+		image.id, completion, data[2], sys_get_le16(&data[3]));
+
+end:
+	k_mutex_unlock(&image_lock);
+}
+
+static void on_repair_request(otMessage *message, const otMessageInfo *message_info,
+			      const uint8_t *data, size_t length)
+{
+	bool available;
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+	available = image_source && image_valid &&
+		    ((length < sizeof(uint16_t)) || (sys_get_le16(data) == image.id));
+	k_mutex_unlock(&image_lock);
+
+	if (!available) {
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_NOT_FOUND);
+	} else if (coap_utils_image_respond(message, message_info) != OT_ERROR_NONE) {
+		LOG_ERR("Cannot respond to image repair");
+	}
+}
+
+/* Called in the OpenThread thread for the image resource. */
+static void on_image_request(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t payload[BLOCK_MESSAGE_HEADER_SIZE + IMAGE_BLOCK_SIZE];
+	uint16_t length;
+
+	length = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload));
+
+	if (otCoapMessageGetCode(message) == OT_COAP_CODE_GET) {
+		on_repair_request(message, message_info, payload, length);
+		return;
+	}
+	if (length == 0) {
+		return;
+	}
+
+	switch (payload[0]) {
+	case IMAGE_MESSAGE_ANNOUNCE:
+	case IMAGE_MESSAGE_END:
+		on_announce(&payload[1], length - 1, &message_info->mPeerAddr,
+			    payload[0] == IMAGE_MESSAGE_END);
+		break;
+
+	case IMAGE_MESSAGE_BLOCK:
+		on_block(&payload[1], length - 1);
+		break;
+
+	case IMAGE_MESSAGE_DONE:
+		on_done(&payload[1], length - 1, &message_info->mPeerAddr);
+		break;
+
+	default:
+		LOG_WRN("Invalid image message %u", payload[0]);
+	}
+}
+
+/* Called by the CoAP blockwise server for repairs. */
+static void on_image_block_tx(void *context, uint8_t *block, uint32_t position,
+			      uint16_t *block_length, bool *more)
+{
+	size_t length = 0;
+
+	ARG_UNUSED(context);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (image_valid && (position < image.size)) {
+		length = MIN(image.size - position, (size_t)*block_length);
+		if (flash_area_read(image_area, position, block, length) != 0) {
+			LOG_ERR("Cannot read image at %u", position);
+			length = 0;
+		}
+		stats.repair_blocks++;
+	}
+	*block_length = (uint16_t)length;
+	*more = (length > 0) && (position + length < image.size);
+
+	k_mutex_unlock(&image_lock);
+}
+
+/* Called by the CoAP blockwise client for blocks of a repair. */
+static otError on_repair_block_rx(void *context, const uint8_t *block, uint32_t position,
+				  uint16_t block_length, bool more, uint32_t total_length)
+{
+	bool complete;
+
+	ARG_UNUSED(context);
+	ARG_UNUSED(more);
+	ARG_UNUSED(total_length);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+	block_receive(position / IMAGE_BLOCK_SIZE, block, block_length, true);
+	complete = !image_receiving || (received_count == image_block_count());
+	k_mutex_unlock(&image_lock);
+
+	/* Blocks after the last missing one are not read. */
+	return complete ? OT_ERROR_ABORT : OT_ERROR_NONE;
+}
+
+static void on_repair_response(void *context, otMessage *message,
+			       const otMessageInfo *message_info, otError error)
+{
+	ARG_UNUSED(context);
+	ARG_UNUSED(message);
+	ARG_UNUSED(message_info);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+	if (image_receiving && (received_count < image_block_count())) {
+		LOG_WRN("Image repair ended with %u/%u blocks (error: %d)", received_count,
+			image_block_count(), error);
+		k_work_reschedule(&repair_work, K_MSEC(CONFIG_IMAGE_DIST_REPAIR_DELAY +
+						       sys_rand32_get() %
+						       CONFIG_IMAGE_DIST_REPAIR_JITTER));
+	}
+	k_mutex_unlock(&image_lock);
+}
+
+static void done_send(const otIp6Address *address, uint16_t id, enum image_status status,
+		      uint16_t repaired)
+{
+	uint8_t message[DONE_MESSAGE_SIZE];
+
+	message[0] = IMAGE_MESSAGE_DONE;
+	sys_put_le16(id, &message[1]);
+	message[3] = (uint8_t)status;
+	sys_put_le16(repaired, &message[4]);
+
+	if (coap_utils_image_send(address, message, sizeof(message)) != OT_ERROR_NONE) {
+		LOG_ERR("Cannot report image %u", id);
+	}
+}
+
+static void repair_work_handler(struct k_work *work)
+{
+	uint8_t payload[sizeof(uint16_t)];
+	otIp6Address address;
+	uint32_t block;
+	uint16_t id, repaired;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (!image_receiving || (received_count == image_block_count())) {
+		k_mutex_unlock(&image_lock);
+		return;
+	}
+
+	address = gateway;
+	id = image.id;
+	if (repair_attempts >= CONFIG_IMAGE_DIST_REPAIR_ATTEMPTS) {
+		LOG_ERR("Image %u incomplete, %u/%u blocks", id, received_count,
+			image_block_count());
+		image_receiving = false;
+		repaired = repaired_count;
+		k_mutex_unlock(&image_lock);
+		done_send(&address, id, IMAGE_STATUS_INCOMPLETE, repaired);
+		return;
+	}
+	repair_attempts++;
+	block = first_missing_block();
+
+	k_mutex_unlock(&image_lock);
+
+	LOG_INF("Repair image %u, %u blocks missing", id, image_block_count() - received_count);
+	sys_put_le16(id, payload);
+	if (coap_utils_image_repair(&address, block, payload, sizeof(payload), on_repair_block_rx,
+				    on_repair_response) != OT_ERROR_NONE) {
+		k_work_reschedule(&repair_work, K_MSEC(CONFIG_IMAGE_DIST_REPAIR_DELAY));
+	}
+}
+
+/* Run the lines of a config image as commands. */
+static void config_apply(uint32_t size)
+{
+	uint8_t line[CONFIG_LINE_MAX_SIZE + 1];
+	uint8_t chunk[32];
+	size_t line_length = 0;
+	bool too_long = false;
+	int ret;
+
+	for (uint32_t offset = 0; offset < size; offset += sizeof(chunk)) {
+		size_t length = MIN(size - offset, sizeof(chunk));
+
+		k_mutex_lock(&image_lock, K_FOREVER);
+		ret = flash_area_read(image_area, offset, chunk, length);
+		k_mutex_unlock(&image_lock);
+		if (ret) {
+			LOG_ERR("Cannot read config image (error: %d)", ret);
+			return;
+		}
+
+		for (size_t i = 0; i < length; i++) {
+			bool last = (offset + i + 1 == size);
+
+			if ((chunk[i] != '\n') && (chunk[i] != '\r')) {
+				if (line_length < CONFIG_LINE_MAX_SIZE) {
+					line[line_length++] = chunk[i];
+				} else {
+					too_long = true;
+				}
+				if (!last) {
+					continue;
+				}
+			}
+			if (too_long) {
+				LOG_WRN("Config line too long");
+			} else if (line_length > 0) {
+				line[line_length] = '\0';
+				LOG_INF("Config command: %s", (const char *)line);
+				command_handler(line, line_length);
+			}
+			line_length = 0;
+			too_long = false;
+		}
+	}
+}
+
+#if CONFIG_IMAGE_DIST_MCUBOOT
+static void reboot_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	LOG_INF("Reboot to apply firmware image");
+	sys_reboot(SYS_REBOOT_WARM);
+}
+#endif
+
+static void finish_work_handler(struct k_work *work)
+{
+	struct image finished;
+	otIp6Address address;
+	uint16_t repaired;
+	int ret;
+
+	ARG_UNUSED(work);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (!image_receiving) {
+		k_mutex_unlock(&image_lock);
+		return;
+	}
+	image_receiving = false;
+	ret = image_verify();
+	if (ret == 0) {
+		ret = image_authenticate();
+	}
+	image_valid = (ret == 0);
+	if (!image_valid) {
+		stats.invalid++;
+	}
+	finished = image;
+	address = gateway;
+	repaired = repaired_count;
+
+	k_mutex_unlock(&image_lock);
+
+	if (ret) {
+		LOG_ERR("Image %u invalid (error: %d)", finished.id, ret);
+		done_send(&address, finished.id, IMAGE_STATUS_INVALID, repaired);
+		return;
+	}
+
+	LOG_INF("Image %u verified, %u blocks repaired", finished.id, repaired);
+	done_send(&address, finished.id, IMAGE_STATUS_VERIFIED, repaired);
+
+	if (finished.type == IMAGE_DIST_TYPE_CONFIG) {
+		config_apply(finished.size);
+		return;
+	}
+
+#if CONFIG_IMAGE_DIST_MCUBOOT
+	ret = boot_request_upgrade(BOOT_UPGRADE_TEST);
+	if (ret) {
+		LOG_ERR("Cannot request firmware upgrade (error: %d)", ret);
+		return;
+	}
+	/* Leave time for the report to reach the gateway. */
+	k_work_schedule(&reboot_work, REBOOT_DELAY);
+#endif
+}
+
+static void send_work_handler(struct k_work *work)
+{
+	uint8_t message[BLOCK_MESSAGE_HEADER_SIZE + IMAGE_BLOCK_SIZE];
+	struct openthread_context *ot_context = openthread_get_default_context();
+	uint16_t length = 0;
+	uint16_t rloc16;
+	uint32_t blocks;
+	otError error;
+
+	ARG_UNUSED(work);
+
+	openthread_api_mutex_lock(ot_context);
+	rloc16 = otThreadGetRloc16(ot_context->instance);
+	openthread_api_mutex_unlock(ot_context);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (!distributing) {
+		k_mutex_unlock(&image_lock);
+		return;
+	}
+
+	blocks = image_block_count();
+	if ((send_step == 0) || (send_step > blocks)) {
+		message[0] = (send_step == 0) ? IMAGE_MESSAGE_ANNOUNCE : IMAGE_MESSAGE_END;
+		image_header_encode(&message[1]);
+		sys_put_le16(rloc16, &message[1 + IMAGE_DIST_HEADER_SIZE]);
+		length = 1 + IMAGE_DIST_HEADER_SIZE + sizeof(uint16_t);
+	} else {
+		uint32_t block = send_step - 1;
+
+		message[0] = IMAGE_MESSAGE_BLOCK;
+		sys_put_le16(image.id, &message[1]);
+		sys_put_le16((uint16_t)block, &message[3]);
+		length = image_block_length(block);
+		if (flash_area_read(image_area, block * IMAGE_BLOCK_SIZE,
+				    &message[BLOCK_MESSAGE_HEADER_SIZE], length) != 0) {
+			LOG_ERR("Cannot read block %u", block);
+			distributing = false;
+			k_mutex_unlock(&image_lock);
+			return;
+		}
+		length += BLOCK_MESSAGE_HEADER_SIZE;
+	}
+
+	k_mutex_unlock(&image_lock);
+
+	error = coap_utils_image_send(NULL, message, length);
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	/* Messages not sent are tried again, lost ones are repaired by the meters. */
+	if (error == OT_ERROR_NONE) {
+		if ((send_step > 0) && (send_step <= blocks)) {
+			stats.multicast_blocks++;
+		}
+		send_step++;
+	}
+	if (send_step > blocks + 1) {
+		LOG_INF("Image %u multicast in %lld ms", image.id,
+			k_uptime_get() - distribution_start);
+		distributing = false;
+	} else if (send_step == 1) {
+		/* Gateways fetching the same image hear each other's announcement. */
+		k_work_reschedule(&send_work, K_MSEC(CONFIG_IMAGE_DIST_ELECTION_DELAY));
+	} else {
+		k_work_reschedule(&send_work, K_MSEC(CONFIG_IMAGE_DIST_BLOCK_INTERVAL));
+	}
+
+	k_mutex_unlock(&image_lock);
+}
+
+int image_dist_start(void)
+{
+	int ret = 0;
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	if (!image_source || !image_valid) {
+		ret = -ENOENT;
+	} else if (distributing) {
+		ret = -EBUSY;
+	} else if (distributor_elected) {
+		ret = -EALREADY;
+	} else {
+		distributing = true;
+		send_step = 0;
+		distribution_start = k_uptime_get();
+		done_count = 0;
+		stats.distributions++;
+		k_work_reschedule(&send_work, K_NO_WAIT);
+		LOG_INF("Distributing image %u, %u blocks", image.id, image_block_count());
+	}
+
+	k_mutex_unlock(&image_lock);
+
+	return ret;
+}
+
+/* Append data of the image fetched from the cloud, with the lock held. */
+static int cloud_data(uint32_t offset, const char *hex, size_t hex_length)
+{
+	uint8_t data[IMAGE_BLOCK_SIZE];
+	size_t length = hex2bin(hex, hex_length, data, sizeof(data));
+	size_t taken = 0;
+
+	if ((length == 0) || (length * 2 != hex_length)) {
+		return -EINVAL;
+	}
+	/* Messages delivered again are dropped. */
+	if (offset + length <= cloud_offset) {
+		return 0;
+	}
+	if ((offset != cloud_offset) || (offset + length > image.size)) {
+		return -EINVAL;
+	}
+
+	while (taken < length) {
+		uint32_t block = cloud_offset / IMAGE_BLOCK_SIZE;
+		size_t block_offset = cloud_offset % IMAGE_BLOCK_SIZE;
+		size_t chunk = MIN(length - taken, IMAGE_BLOCK_SIZE - block_offset);
+		int ret;
+
+		/* Blocks are written once complete, the buffer keeps the partial one. */
+		memcpy(&buffer[block_offset], &data[taken], chunk);
+		taken += chunk;
+		cloud_offset += chunk;
+		if ((cloud_offset % IMAGE_BLOCK_SIZE == 0) || (cloud_offset == image.size)) {
+			ret = image_block_write(block, buffer, image_block_length(block));
+			if (ret) {
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void image_dist_cloud_message(const uint8_t *data, size_t size)
+{
+	struct image fetched;
+	uint32_t offset;
+	char *end;
+	int ret = 0;
+	bool start = false;
+
+	if ((size == 0) || (size > CLOUD_MESSAGE_MAX_SIZE)) {
+		LOG_WRN("Invalid image message from the cloud");
+		return;
+	}
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+
+	memcpy(cloud_message, data, size);
+	cloud_message[size] = '\0';
+
+	switch (cloud_message[0]) {
+	case 's':
+		if (distributing || image_receiving) {
+			LOG_WRN("Image from the cloud ignored while distributing");
+			goto end;
+		}
+		fetched.id = (uint16_t)strtoul(&cloud_message[1], &end, 10);
+		if (*end++ != ',') {
+			ret = -EINVAL;
+			break;
+		}
+		fetched.type = (uint8_t)*end++;
+		if (*end++ != ',') {
+			ret = -EINVAL;
+			break;
+		}
+		fetched.size = strtoul(end, &end, 10);
+		if (*end++ != ',') {
+			ret = -EINVAL;
+			break;
+		}
+		fetched.crc = strtoul(end, &end, 16);
+		memset(fetched.mac, 0, sizeof(fetched.mac));
+		if (*end == ',') {
+			end++;
+			if (hex2bin(end, strlen(end), fetched.mac, sizeof(fetched.mac)) !=
+			    sizeof(fetched.mac)) {
+				ret = -EINVAL;
+				break;
+			}
+			end += strlen(end);
+		}
+		if ((*end != '\0') || ((fetched.type != IMAGE_DIST_TYPE_CONFIG) &&
+				       (fetched.type != IMAGE_DIST_TYPE_FIRMWARE)) ||
+		    (fetched.size == 0) || (fetched.size > CONFIG_IMAGE_DIST_MAX_SIZE)) {
+			ret = -EINVAL;
+			break;
+		}
+		image_begin(&fetched);
+		cloud_offset = 0;
+		cloud_receiving = true;
+		LOG_INF("Fetching image %u, %u B", fetched.id, fetched.size);
+		break;
+
+	case 'd':
+		if (!cloud_receiving) {
+			goto end;
+		}
+		offset = strtoul(&cloud_message[1], &end, 10);
+		if (*end++ != ',') {
+			ret = -EINVAL;
+			break;
+		}
+		ret = cloud_data(offset, end, strlen(end));
+		break;
+
+	case 'e':
+		if (!cloud_receiving) {
+			goto end;
+		}
+		cloud_receiving = false;
+		if (cloud_offset != image.size) {
+			ret = -ENODATA;
+			break;
+		}
+		ret = image_verify();
+		if (ret == 0) {
+			ret = image_authenticate();
+		}
+		if (ret == 0) {
+			LOG_INF("Image %u fetched", image.id);
+			image_valid = true;
+			image_source = true;
+			start = true;
+		}
+		break;
+
+	default:
+		ret = -EINVAL;
+	}
+
+	if (ret) {
+		LOG_ERR("Cannot fetch image (error: %d)", ret);
+		cloud_receiving = false;
+	}
+
+end:
+	k_mutex_unlock(&image_lock);
+
+	if (start) {
+		image_dist_start();
+	}
+}
+
+int image_dist_init(image_dist_command_handler_t on_command)
+{
+	int ret;
+
+	ret = flash_area_open(IMAGE_PARTITION_ID, &image_area);
+	if (ret) {
+		return ret;
+	}
+	if (image_area->fa_size < CONFIG_IMAGE_DIST_MAX_SIZE) {
+		return -ENOSPC;
+	}
+
+	if (psa_crypto_init() != PSA_SUCCESS) {
+		return -EIO;
+	}
+	config_key_length = hex2bin(CONFIG_IMAGE_DIST_CONFIG_KEY,
+				    strlen(CONFIG_IMAGE_DIST_CONFIG_KEY), config_key,
+				    sizeof(config_key));
+	if (config_key_length == 0) {
+		LOG_WRN("No config image key, config images are rejected");
+	}
+
+	command_handler = on_command;
+	k_work_init_delayable(&repair_work, repair_work_handler);
+	k_work_init(&finish_work, finish_work_handler);
+	k_work_init_delayable(&send_work, send_work_handler);
+#if CONFIG_IMAGE_DIST_MCUBOOT
+	k_work_init_delayable(&reboot_work, reboot_work_handler);
+#endif
+	coap_utils_set_image_handler(on_image_request, on_image_block_tx);
+
+	return 0;
+}
+
+void image_dist_get_stats(struct image_dist_stats *out)
+{
+	k_mutex_lock(&image_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&image_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct image_dist_stats current;
+	struct image stored;
+	uint32_t blocks, received_blocks;
+	bool valid, source;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&image_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&image_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&image_lock, K_FOREVER);
+	current = stats;
+	stored = image;
+	blocks = image_block_count();
+	received_blocks = received_count;
+	valid = image_valid;
+	source = image_source;
+	k_mutex_unlock(&image_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "image: %u type: %c size: %u B %s\n", stored.id,
+		      stored.type ? stored.type : '-', stored.size,
+		      valid ? "verified" : "not verified");
+	if (source) {
+		/* Unicast would transfer every block to every meter. */
+		shell_fprintf(shell, SHELL_INFO,
+			      "distributions: %u yielded: %u multicast blocks: %u repair blocks: %u\n",
+			      current.distributions, current.yielded, current.multicast_blocks,
+			      current.repair_blocks);
+		shell_fprintf(shell, SHELL_INFO, "meters done: %u failed: %u unicast blocks: %u\n",
+			      current.meters_done, current.meters_failed,
+			      (current.meters_done + current.meters_failed) * blocks);
+		shell_fprintf(shell, SHELL_INFO, "completion avg/max: %llu/%u ms\n",
+			      current.meters_done ? current.completion / current.meters_done : 0,
+			      current.max_completion);
+	} else {
+		shell_fprintf(shell, SHELL_INFO, "blocks: %u/%u\n", received_blocks, blocks);
+		shell_fprintf(shell, SHELL_INFO, "images: %u repaired blocks: %u invalid: %u\n",
+			      current.images, current.repaired_blocks, current.invalid);
+	}
+
+	return 0;
+}
+
+static int cmd_send(const struct shell *shell, size_t argc, char **argv)
+{
+	int ret = image_dist_start();
+
+	if (ret == -ENOENT) {
+		shell_fprintf(shell, SHELL_INFO, "No image to distribute\n");
+	} else if (ret == -EBUSY) {
+		shell_fprintf(shell, SHELL_INFO, "Distribution ongoing\n");
+	} else if (ret == -EALREADY) {
+		shell_fprintf(shell, SHELL_INFO, "Image distributed by another gateway\n");
+	} else {
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+	}
+
+	return ret;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_image_dist,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset image distribution statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_CMD_ARG(
+		send, NULL,
+		"Multicast the fetched image to the meters again.\n",
+		cmd_send, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(image_dist, &sub_image_dist, "image distribution commands", NULL);
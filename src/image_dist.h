@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __IMAGE_DIST_H__
+#define __IMAGE_DIST_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief Image types. */
+enum image_dist_type {
+	/** Commands run by the meter, one per line. */
+	IMAGE_DIST_TYPE_CONFIG = 'c',
+	/** Firmware update, applied with MCUboot once it checked the signature. */
+	IMAGE_DIST_TYPE_FIRMWARE = 'f',
+};
+
+/**@brief Size of the HMAC-SHA256 of a config image. */
+#define IMAGE_DIST_MAC_SIZE 32
+
+/**
+ * @brief Size of the image header.
+ *
+ * Encoded as the little-endian image ID, the type, the little-endian size, the
+ * little-endian CRC-32 (IEEE) of the image and the HMAC-SHA256 of the fields
+ * in front of it and the image with CONFIG_IMAGE_DIST_CONFIG_KEY. The HMAC is
+ * zero for firmware images, which are signed for MCUboot.
+ */
+#define IMAGE_DIST_HEADER_SIZE (11 + IMAGE_DIST_MAC_SIZE)
+
+/**@brief Callback running a command of a config image. */
+typedef void (*image_dist_command_handler_t)(const uint8_t *data, uint16_t length);
+
+/**@brief Image distribution statistics. */
+struct image_dist_stats {
+	/** Distributions started by this gateway. */
+	uint32_t distributions;
+	/** Images left to a gateway with a lower RLOC16. */
+	uint32_t yielded;
+	/** Blocks multicast to the meters. */
+	uint32_t multicast_blocks;
+	/** Blocks served to meters repairing their image. */
+	uint32_t repair_blocks;
+	/** Meters reporting a verified or a failed image. */
+	uint32_t meters_done;
+	uint32_t meters_failed;
+	/** Sum and maximum of the time from the start to a meter report [ms]. */
+	uint64_t completion;
+	uint32_t max_completion;
+	/** Images received by this meter, and their blocks fetched by repair. */
+	uint32_t images;
+	uint32_t repaired_blocks;
+	/** Images failing verification or authentication on this meter. */
+	uint32_t invalid;
+};
+
+/**
+ * @brief Initialize image distribution.
+ *
+ * Must be called after OpenThread CoAP is initialized, the image resource is
+ * served from then on.
+ *
+ * @param[in] on_command called for every line of a received config image.
+ */
+int image_dist_init(image_dist_command_handler_t on_command);
+
+/**
+ * @brief Handle image message received from the cloud, see modem_set_image_handler.
+ *
+ * The image is sent as "s<id>,<type>,<size>,<crc>,<hmac>" with the type as its
+ * letter, the CRC as 8 hex digits and the HMAC of a config image as 64 hex
+ * digits, then "d<offset>,<data>" in order with the data as hex digits, and
+ * "e" once complete. The image is multicast to the meters when it is verified
+ * and authenticated, unless a gateway with a lower RLOC16 announces it.
+ */
+void image_dist_cloud_message(const uint8_t *data, size_t size);
+
+/**
+ * @brief Multicast the stored image to the meters again.
+ *
+ * @retval 0       Distribution started.
+ * @retval -ENOENT No verified image.
+ * @retval -EBUSY  Distribution is ongoing.
+ * @retval -EALREADY A gateway with a lower RLOC16 distributes the image.
+ */
+int image_dist_start(void);
+
+/**
+ * @brief Get a copy of the image distribution statistics.
+ */
+void image_dist_get_stats(struct image_dist_stats *stats);
+
+#endif /* __IMAGE_DIST_H__ */
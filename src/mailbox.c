@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "coap_utils.h"
+#include "delivery.h"
+#include "mailbox.h"
+
+LOG_MODULE_REGISTER(mailbox, CONFIG_MAILBOX_LOG_LEVEL);
+
+#define METER_ID_HEX_SIZE (2 * DELIVERY_METER_ID_SIZE)
+#define COMMAND_ID_HEX_SIZE (2 * sizeof(uint16_t))
+/* Meter ID, command ID and their colons */
+#define MESSAGE_HEADER_SIZE (METER_ID_HEX_SIZE + 1 + COMMAND_ID_HEX_SIZE + 1)
+
+BUILD_ASSERT(MAILBOX_COMMAND_HEADER_SIZE + CONFIG_MAILBOX_COMMAND_SIZE <= METER_RESPONSE_MAX_SIZE,
+	     "A command must fit in the response to an upload");
+
+struct mailbox_command {
+	uint8_t data[CONFIG_MAILBOX_COMMAND_SIZE];
+	uint8_t length;
+	uint16_t id;
+	int64_t time;
+	/* Sent to the meter at least once */
+	bool sent;
+};
+
+struct mailbox {
+	uint8_t id[DELIVERY_METER_ID_SIZE];
+	otIp6Address address;
+	bool has_address;
+	/* Commands in order of arrival */
+	struct mailbox_command commands[CONFIG_MAILBOX_DEPTH];
+	uint8_t count;
+};
+
+static struct mailbox mailboxes[CONFIG_MAILBOX_COUNT];
+static struct mailbox_stats stats;
+static K_MUTEX_DEFINE(mailbox_lock);
+
+/* IDs of the commands run by this meter, the oldest overwritten first */
+static uint16_t run_ids[2 * CONFIG_MAILBOX_DEPTH];
+static size_t run_count;
+static size_t run_next;
+
+static struct mailbox *mailbox_find(const uint8_t *id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(mailboxes); i++) {
+		if ((mailboxes[i].count > 0) &&
+		    (memcmp(mailboxes[i].id, id, DELIVERY_METER_ID_SIZE) == 0)) {
+			return &mailboxes[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct mailbox *mailbox_get(const uint8_t *id)
+{
+	struct mailbox *mailbox = mailbox_find(id);
+
+	for (size_t i = 0; (mailbox == NULL) && (i < ARRAY_SIZE(mailboxes)); i++) {
+		if (mailboxes[i].count == 0) {
+			mailbox = &mailboxes[i];
+			memset(mailbox, 0, sizeof(*mailbox));
+			memcpy(mailbox->id, id, DELIVERY_METER_ID_SIZE);
+		}
+	}
+
+	return mailbox;
+}
+
+void mailbox_cloud_command(const uint8_t *data, size_t size)
+{
+	uint8_t id[DELIVERY_METER_ID_SIZE];
+	uint8_t command_id[sizeof(uint16_t)];
+	struct mailbox *mailbox;
+	struct mailbox_command *command;
+	size_t length = size - MESSAGE_HEADER_SIZE;
+
+	if ((size <= MESSAGE_HEADER_SIZE) || (data[METER_ID_HEX_SIZE] != ':') ||
+	    (data[MESSAGE_HEADER_SIZE - 1] != ':') ||
+	    (hex2bin((const char *)data, METER_ID_HEX_SIZE, id, sizeof(id)) != sizeof(id)) ||
+	    (hex2bin((const char *)&data[METER_ID_HEX_SIZE + 1], COMMAND_ID_HEX_SIZE, command_id,
+		     sizeof(command_id)) != sizeof(command_id)) ||
+	    (length > CONFIG_MAILBOX_COMMAND_SIZE)) {
+		LOG_WRN("Invalid command from the cloud");
+		k_mutex_lock(&mailbox_lock, K_FOREVER);
+		stats.dropped++;
+		k_mutex_unlock(&mailbox_lock);
+		return;
+	}
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+
+	mailbox = mailbox_get(id);
+	for (uint8_t i = 0; (mailbox != NULL) && (i < mailbox->count); i++) {
+		/* The broker delivers again what it got no acknowledgement for. */
+		if (mailbox->commands[i].id == sys_get_be16(command_id)) {
+			LOG_DBG("Command %04x already waiting", mailbox->commands[i].id);
+			stats.duplicates++;
+			goto end;
+		}
+	}
+	if ((mailbox == NULL) || (mailbox->count >= CONFIG_MAILBOX_DEPTH)) {
+		LOG_WRN("No room for command to meter %.*s", METER_ID_HEX_SIZE, (const char *)data);
+		stats.dropped++;
+		goto end;
+	}
+
+	command = &mailbox->commands[mailbox->count++];
+	memcpy(command->data, &data[MESSAGE_HEADER_SIZE], length);
+	command->length = (uint8_t)length;
+	command->id = sys_get_be16(command_id);
+	command->time = k_uptime_get();
+	command->sent = false;
+	stats.queued++;
+	stats.max_depth = MAX(stats.max_depth, mailbox->count);
+	LOG_INF("Command queued for meter %.*s, %u waiting", METER_ID_HEX_SIZE,
+		(const char *)data, mailbox->count);
+
+end:
+	k_mutex_unlock(&mailbox_lock);
+}
+
+void mailbox_meter_seen(const otIp6Address *address, const uint8_t *id)
+{
+	struct mailbox *mailbox;
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+
+	mailbox = mailbox_find(id);
+	if (mailbox != NULL) {
+		mailbox->address = *address;
+		mailbox->has_address = true;
+	}
+
+	k_mutex_unlock(&mailbox_lock);
+}
+
+static struct mailbox *mailbox_find_address(const otIp6Address *address)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(mailboxes); i++) {
+		if ((mailboxes[i].count > 0) && mailboxes[i].has_address &&
+		    otIp6IsAddressEqual(&mailboxes[i].address, address)) {
+			return &mailboxes[i];
+		}
+	}
+
+	return NULL;
+}
+
+uint16_t mailbox_take(const otIp6Address *address, uint8_t *buf, uint16_t size)
+{
+	struct mailbox *mailbox;
+	uint16_t length = 0;
+	uint8_t taken = 0;
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+
+	mailbox = mailbox_find_address(address);
+	while ((mailbox != NULL) && (taken < mailbox->count)) {
+		struct mailbox_command *command = &mailbox->commands[taken];
+
+		if (length + MAILBOX_COMMAND_HEADER_SIZE + command->length > size) {
+			break;
+		}
+		buf[length] = command->length;
+		sys_put_le16(command->id, &buf[length + 1]);
+		length += MAILBOX_COMMAND_HEADER_SIZE;
+		memcpy(&buf[length], command->data, command->length);
+		length += command->length;
+		taken++;
+
+		if (command->sent) {
+			stats.resent++;
+		}
+		command->sent = true;
+	}
+
+	if (taken > 0) {
+		LOG_INF("%u commands sent, %u waiting", taken, mailbox->count);
+	}
+
+	k_mutex_unlock(&mailbox_lock);
+
+	return length;
+}
+
+void mailbox_ack(const otIp6Address *address, uint16_t id)
+{
+	struct mailbox *mailbox;
+	uint32_t latency;
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+
+	mailbox = mailbox_find_address(address);
+	for (uint8_t i = 0; (mailbox != NULL) && (i < mailbox->count); i++) {
+		if (mailbox->commands[i].id != id) {
+			continue;
+		}
+
+		latency = (uint32_t)(k_uptime_get() - mailbox->commands[i].time);
+		stats.delivered++;
+		stats.latency += latency;
+		stats.max_latency = MAX(stats.max_latency, latency);
+
+		mailbox->count--;
+		memmove(&mailbox->commands[i], &mailbox->commands[i + 1],
+			(mailbox->count - i) * sizeof(mailbox->commands[0]));
+		LOG_INF("Command %04x delivered, %u waiting", id, mailbox->count);
+		break;
+	}
+
+	k_mutex_unlock(&mailbox_lock);
+}
+
+bool mailbox_command_new(uint16_t id)
+{
+	bool fresh = true;
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+
+	for (size_t i = 0; i < run_count; i++) {
+		if (run_ids[i] == id) {
+			fresh = false;
+			break;
+		}
+	}
+
+	if (fresh) {
+		run_ids[run_next] = id;
+		run_next = (run_next + 1) % ARRAY_SIZE(run_ids);
+		run_count = MIN(run_count + 1, ARRAY_SIZE(run_ids));
+	}
+
+	k_mutex_unlock(&mailbox_lock);
+
+	return fresh;
+}
+
+void mailbox_get_stats(struct mailbox_stats *out)
+{
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&mailbox_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct mailbox_stats current;
+	uint32_t waiting = 0, meters = 0;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&mailbox_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&mailbox_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&mailbox_lock, K_FOREVER);
+	current = stats;
+	for (size_t i = 0; i < ARRAY_SIZE(mailboxes); i++) {
+		waiting += mailboxes[i].count;
+		meters += (mailboxes[i].count > 0) ? 1 : 0;
+	}
+	k_mutex_unlock(&mailbox_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "waiting: %u commands for %u/%u meters\n", waiting,
+		      meters, CONFIG_MAILBOX_COUNT);
+	shell_fprintf(shell, SHELL_INFO, "queued: %u dropped: %u duplicates: %u\n",
+		      current.queued, current.dropped, current.duplicates);
+	shell_fprintf(shell, SHELL_INFO, "delivered: %u resent: %u\n", current.delivered,
+		      current.resent);
+	shell_fprintf(shell, SHELL_INFO, "depth max: %u/%u\n", current.max_depth,
+		      CONFIG_MAILBOX_DEPTH);
+	shell_fprintf(shell, SHELL_INFO, "delivery latency avg/max: %llu/%u ms\n",
+		      current.delivered ? current.latency / current.delivered : 0,
+		      current.max_latency);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_mailbox,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset mailbox statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(mailbox, &sub_mailbox, "mailbox commands", NULL);
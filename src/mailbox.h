@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __MAILBOX_H__
+#define __MAILBOX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openthread/ip6.h>
+
+/**
+ * @brief Size of the header of a delivered command.
+ *
+ * Encoded as the length byte of the command followed by the little-endian
+ * command ID.
+ */
+#define MAILBOX_COMMAND_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint16_t))
+
+/**@brief Mailbox statistics. */
+struct mailbox_stats {
+	/** Commands received from the cloud and queued. */
+	uint32_t queued;
+	/** Commands dropped, malformed or mailbox full. */
+	uint32_t dropped;
+	/** Commands received again from the cloud, and sent again to meters. */
+	uint32_t duplicates;
+	uint32_t resent;
+	/** Commands acknowledged by meters. */
+	uint32_t delivered;
+	/** Largest number of commands waiting in a mailbox. */
+	uint8_t max_depth;
+	/** Sum and maximum of the time from queueing to acknowledgement [ms]. */
+	uint64_t latency;
+	uint32_t max_latency;
+};
+
+/**
+ * @brief Queue command received from the cloud, see modem_set_command_handler.
+ *
+ * The message is the meter ID as 16 hex digits, a colon, the command ID as
+ * 4 hex digits, a colon and the command, e.g. "f4ce36000102abcd:002a:c20".
+ * A command already waiting with the same ID is not queued again.
+ */
+void mailbox_cloud_command(const uint8_t *data, size_t size);
+
+/**
+ * @brief Note the address of a meter, its mailbox is delivered to it.
+ *
+ * @param[in] address address of the meter.
+ * @param[in] id      meter ID from the delivery header.
+ */
+void mailbox_meter_seen(const otIp6Address *address, const uint8_t *id);
+
+/**
+ * @brief Get commands waiting for the meter at @p address.
+ *
+ * Commands are encoded one after another, each as its header followed by
+ * the command. Commands stay in the mailbox until the meter acknowledges
+ * them, and are sent again with the next upload until then.
+ *
+ * @return Number of bytes written to @p buf.
+ */
+uint16_t mailbox_take(const otIp6Address *address, uint8_t *buf, uint16_t size);
+
+/**
+ * @brief Remove the command acknowledged by the meter at @p address.
+ */
+void mailbox_ack(const otIp6Address *address, uint16_t id);
+
+/**
+ * @brief Check if a command delivered to this meter was not run yet.
+ *
+ * The IDs of the last 2 * CONFIG_MAILBOX_DEPTH commands are remembered, so
+ * commands sent again because their acknowledgement was lost run once.
+ *
+ * @return true if the command is new, it is remembered as run.
+ */
+bool mailbox_command_new(uint16_t id);
+
+/**
+ * @brief Get a copy of the mailbox statistics.
+ */
+void mailbox_get_stats(struct mailbox_stats *stats);
+
+#endif /* __MAILBOX_H__ */
@@ -4,13 +4,16 @@
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
 
+#include <stdlib.h>
 #include <zephyr/kernel.h>
 #include <dk_buttons_and_leds.h>
 #include <zephyr/logging/log.h>
 #include <ram_pwrdn.h>
 #include <zephyr/device.h>
 #include <zephyr/pm/device.h>
+#include <zephyr/sys/byteorder.h>
 
+#include "block_pool.h"
 #include "coap_utils.h"
 #include "modem_utils.h"
 
@@ -18,6 +21,78 @@
 #include "ble_utils.h"
 #endif
 
+#if CONFIG_BLE_EXPORT
+#include "ble_export.h"
+#endif
+
+#if CONFIG_BLE_STATS
+#include "ble_stats.h"
+#endif
+
+#if CONFIG_BLE_FALLBACK
+#include "ble_fallback.h"
+#endif
+
+#if CONFIG_SED_UTILS
+#include "sed_utils.h"
+#endif
+
+#if CONFIG_UPLOAD_SLOT
+#include "upload_slot.h"
+#endif
+
+#if CONFIG_METER_CODEC
+#include "meter_codec.h"
+#endif
+
+#if CONFIG_ACQUISITION
+#include "acquisition.h"
+#endif
+
+#if CONFIG_CLOUD_STORE
+#include "cloud_store.h"
+#endif
+
+#if CONFIG_ROLLUP
+#include "rollup.h"
+#endif
+
+#if CONFIG_DEADBAND
+#include "deadband.h"
+#endif
+
+#if CONFIG_DELIVERY
+#include "delivery.h"
+#endif
+
+#if CONFIG_METER_PULL
+#include "meter_pull.h"
+#endif
+
+#if CONFIG_AGGREGATOR
+#include "aggregator.h"
+#endif
+
+#if CONFIG_MAILBOX
+#include "mailbox.h"
+#endif
+
+#if CONFIG_IMAGE_DIST
+#include "image_dist.h"
+#endif
+
+#if CONFIG_RUNTIME_MONITOR
+#include "runtime_monitor.h"
+#endif
+
+#if CONFIG_OT_BUFFERS
+#include "ot_buffers.h"
+#endif
+
+#if CONFIG_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
 #include <zephyr/drivers/uart.h>
 #include <zephyr/usb/usb_device.h>
 
@@ -32,23 +107,271 @@ LOG_MODULE_REGISTER(cellular_mesh_meter, CONFIG_CELLULAR_MESH_METER_LOG_LEVEL);
 #define MEASURE_BLOCK_SIZE 512
 #define UPLOAD_MEASUREMENT_TIMEOUT		K_MSEC(100)
 #define UPLOAD_MEASUREMENT_RETRY_LIMIT	100
+#define ALARM_TAMPER "tamper"
+#define MEASURE_QUEUE_SIZE 128
+
+#if CONFIG_DELIVERY
+#define MEASURE_HEADER_SIZE DELIVERY_HEADER_SIZE
+#else
+#define MEASURE_HEADER_SIZE 0
+#endif
+
+BUILD_ASSERT(BLOCK_POOL_BLOCK_SIZE >= MEASURE_BLOCK_SIZE,
+	     "Pool blocks must hold a measurement block");
 
 static bool uploading_measurement = false;
 static uint16_t uploading_measurement_retry_count = 0;
 static struct k_work_delayable uploading_measurement_work;
+/* Session of the own modem held by the upload of the own measurement */
+static uint32_t own_upload_session;
 static uint32_t max_block_count = DEFAULT_MEASURE_CNT;
 
-#if CONFIG_BT_NUS
+int upload_measurement(void);
+int send_alarm(const uint8_t *alarm, size_t len);
 
-#define COMMAND_UPLOAD_MEASUREMENT  'u'
-#define COMMAND_CHANGE_UPLOAD_COUNT 'c'
+#if CONFIG_METER_CODEC
+/* Readings, or rollups of readings, waiting for upload */
+K_MSGQ_DEFINE(measurement_queue, sizeof(struct meter_rollup), MEASURE_QUEUE_SIZE, 4);
+static K_MUTEX_DEFINE(measurement_lock);
+#endif
 
-int upload_measurement(void);
+/* Meter uploading, or read, in the session claiming the modem */
+static otIp6Address upload_session_peer;
 
-static void on_nus_received(struct bt_conn *conn, const uint8_t *const data, uint16_t len)
+#if CONFIG_UPLOAD_SLOT
+/* Bytes received from the meter in the current upload session */
+static size_t upload_session_bytes;
+#endif
+
+/* Session holding the modem busy, 0 if none, and the last one handed out */
+static uint32_t upload_session_id;
+static uint32_t upload_session_count;
+/* Claims of the modem by uploads of meters and reads of the gateway */
+static K_MUTEX_DEFINE(upload_session_lock);
+
+/* Begin the session of the meter at @p peer, NULL for the own measurement. */
+static void upload_session_begin(const otIp6Address *peer)
 {
-	LOG_INF("Received data: %c", data[0]);
+	if (peer != NULL) {
+		upload_session_peer = *peer;
+	} else {
+		memset(&upload_session_peer, 0, sizeof(upload_session_peer));
+	}
+#if CONFIG_UPLOAD_SLOT
+	upload_session_bytes = 0;
+#endif
+}
+
+/* Start the session of the meter if the modem is idle, with the modem busy from then on. */
+static uint32_t upload_session_claim(const otIp6Address *peer)
+{
+	uint32_t id = 0;
+
+	k_mutex_lock(&upload_session_lock, K_FOREVER);
+	if (modem_get_state() == MODEM_STATE_IDLE) {
+		upload_session_begin(peer);
+		modem_set_state(MODEM_STATE_BUSY);
+		if (++upload_session_count == 0) {
+			upload_session_count++;
+		}
+		id = upload_session_count;
+		upload_session_id = id;
+	}
+	k_mutex_unlock(&upload_session_lock);
+
+	return id;
+}
+
+/* End the session holding the modem, only if it is @p id when not 0. */
+static void upload_session_release(uint32_t id)
+{
+	k_mutex_lock(&upload_session_lock, K_FOREVER);
+	if ((upload_session_id != 0) && ((id == 0) || (id == upload_session_id))) {
+		upload_session_id = 0;
+		/* The modem may have gone off meanwhile. */
+		if (modem_get_state() == MODEM_STATE_BUSY) {
+			modem_set_state(MODEM_STATE_IDLE);
+		}
+	}
+	k_mutex_unlock(&upload_session_lock);
+}
+
+#if CONFIG_DELIVERY
+#define UPLOAD_TRANSFER_COUNT 8
+
+/* Upload of a meter into the store or the aggregator, neither claims the modem */
+struct upload_transfer {
+	uint8_t id[DELIVERY_METER_ID_SIZE];
+	otIp6Address peer;
+	bool active;
+};
+
+/* Found by the meter ID in the header of each block, touched by CoAP handlers only */
+static struct upload_transfer upload_transfers[UPLOAD_TRANSFER_COUNT];
+static uint8_t upload_transfer_next;
+
+static struct upload_transfer *upload_transfer_find(const uint8_t *id)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(upload_transfers); i++) {
+		if (upload_transfers[i].active &&
+		    (memcmp(upload_transfers[i].id, id, DELIVERY_METER_ID_SIZE) == 0)) {
+			return &upload_transfers[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Start the transfer of the meter, replacing the oldest one when all are taken. */
+static void upload_transfer_begin(const uint8_t *id, const otIp6Address *peer)
+{
+	struct upload_transfer *transfer = &upload_transfers[upload_transfer_next];
+
+	upload_transfer_next = (upload_transfer_next + 1) % ARRAY_SIZE(upload_transfers);
+	memcpy(transfer->id, id, DELIVERY_METER_ID_SIZE);
+	transfer->peer = *peer;
+	transfer->active = true;
+}
+
+static void upload_transfer_end(const uint8_t *id)
+{
+	struct upload_transfer *transfer = upload_transfer_find(id);
+
+	if (transfer != NULL) {
+		transfer->active = false;
+	}
+}
+
+/* Sequence of the last filled block, received by the modem once the next block is requested */
+static uint32_t measurement_block_seq;
+#endif
+
+#if CONFIG_BLE_FALLBACK
+/* Discovers no gateway answered since the last upload through the mesh */
+static uint8_t discover_failures;
+/* Start and size of the upload through the mesh, for its throughput */
+static int64_t mesh_upload_start;
+static size_t mesh_upload_bytes;
+#endif
+
+#if CONFIG_ENERGY_ACCOUNTING
+/* Bytes of the upload to a modem or collector, for the energy per byte */
+static size_t upload_bytes;
+#endif
+
+#if CONFIG_UPLOAD_FAILOVER
+/* Modems that reported idle state to the discover, the one in use first */
+static otIp6Address upload_modems[CONFIG_UPLOAD_FAILOVER_MODEM_COUNT];
+static uint8_t upload_modem_count;
+static uint8_t upload_failovers;
+
+static void upload_modem_add(const otIp6Address *address)
+{
+	for (uint8_t i = 0; i < upload_modem_count; i++) {
+		if (otIp6IsAddressEqual(&upload_modems[i], address)) {
+			return;
+		}
+	}
+
+	if (upload_modem_count < ARRAY_SIZE(upload_modems)) {
+		upload_modems[upload_modem_count++] = *address;
+	}
+}
+
+/* Continue the failed upload with the next modem, each modem is tried once. */
+static bool upload_failover(void)
+{
+	otIp6Address failed = upload_modems[0];
+
+	if (upload_failovers + 1 >= upload_modem_count) {
+		return false;
+	}
+
+	memmove(&upload_modems[0], &upload_modems[1], (upload_modem_count - 1) * sizeof(failed));
+	upload_modems[upload_modem_count - 1] = failed;
+	upload_failovers++;
+
+	LOG_INF("Upload continues with modem %u of %u", upload_failovers + 1, upload_modem_count);
+	return coap_utils_modem_upload_measurement_schedule(&upload_modems[0], K_NO_WAIT) ==
+	       OT_ERROR_NONE;
+}
+#endif
+
+#if CONFIG_DELIVERY
+/* Release items acknowledged by the cloud from the measurement queue. */
+static void measurement_acked(const struct delivery_header *header)
+{
+	struct meter_rollup item;
+	uint16_t released;
+
+	k_mutex_lock(&measurement_lock, K_FOREVER);
+	released = delivery_journal_ack(header);
+	for (uint16_t i = 0; i < released; i++) {
+		k_msgq_get(&measurement_queue, &item, K_NO_WAIT);
+	}
+	k_mutex_unlock(&measurement_lock);
 
+	LOG_INF("Batch %u acknowledged, %u items released", header->seq, released);
+}
+
+static void on_cloud_ack(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t payload[DELIVERY_HEADER_SIZE];
+	struct delivery_header header;
+	uint16_t length;
+
+	length = otMessageRead(message, otMessageGetOffset(message) + sizeof(uint8_t), payload,
+			       sizeof(payload));
+	if (delivery_header_parse(payload, length, &header) != 0) {
+		LOG_ERR("Missing header of the acknowledged batch");
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_BAD_REQUEST);
+		return;
+	}
+
+	measurement_acked(&header);
+	coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+}
+
+/* Answer a read of the gateway with the batches following its cursor. */
+static void on_meter_pull(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t payload[DELIVERY_HEADER_SIZE];
+	struct delivery_header cursor;
+	uint16_t length;
+
+	length = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload));
+	if (delivery_header_parse(payload, length, &cursor) == 0) {
+		delivery_journal_cursor(&cursor);
+	}
+
+	if (uploading_measurement) {
+		/* Batches of the upload in progress are still on their way. */
+		LOG_INF("Read while uploading measurement");
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_SERVICE_UNAVAILABLE);
+		return;
+	}
+
+	/* Batches behind the cursor did not reach the gateway, send them again. */
+	delivery_journal_retry();
+
+	if (!delivery_journal_due(k_msgq_num_used_get(&measurement_queue))) {
+		coap_utils_send_response(message, message_info, OT_COAP_CODE_VALID);
+	} else if (coap_utils_meter_pull_respond(message, message_info) != OT_ERROR_NONE) {
+		LOG_ERR("Cannot respond to read");
+	}
+}
+#endif
+
+#if CONFIG_BT_NUS || CONFIG_MAILBOX || CONFIG_IMAGE_DIST
+
+#define COMMAND_UPLOAD_MEASUREMENT  'u'
+#define COMMAND_CHANGE_UPLOAD_COUNT 'c'
+#define COMMAND_SEND_ALARM          'a'
+#define COMMAND_SET_ROLLUP_INTERVAL 'r'
+
+/* Run command received over BLE NUS, from the cloud or in a config image. */
+static void meter_command_execute(const uint8_t *data, uint16_t len)
+{
 	switch (*data) {
 	case COMMAND_UPLOAD_MEASUREMENT:
 		upload_measurement();
@@ -62,9 +385,136 @@ static void on_nus_received(struct bt_conn *conn, const uint8_t *const data, uin
 		}
 		break;
 
+#if CONFIG_ROLLUP
+	case COMMAND_SET_ROLLUP_INTERVAL:
+		if (len > 1) {
+			rollup_set_interval(atoi((const char *)&data[1]));
+		} else {
+			LOG_WRN("Invalid data length");
+		}
+		break;
+#endif
+
+	case COMMAND_SEND_ALARM:
+		if (len > 1) {
+			send_alarm(&data[1], len - 1);
+		} else {
+			send_alarm((const uint8_t *)ALARM_TAMPER, strlen(ALARM_TAMPER));
+		}
+		break;
+
 	default:
-		LOG_WRN("Received invalid data from NUS");
+		LOG_WRN("Received invalid command");
+	}
+}
+
+#endif /* CONFIG_BT_NUS || CONFIG_MAILBOX || CONFIG_IMAGE_DIST */
+
+#if CONFIG_MAILBOX
+/* Run commands of the mailbox, delivered with the response to the last block, and ack them. */
+static void meter_commands_receive(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t payload[METER_RESPONSE_MAX_SIZE];
+	/* Commands are parsed as text, e.g. the upload count. */
+	uint8_t command[CONFIG_MAILBOX_COMMAND_SIZE + 1];
+	/* IDs of all received commands, run now or before */
+	uint8_t ack[METER_RESPONSE_MAX_SIZE / MAILBOX_COMMAND_HEADER_SIZE * sizeof(uint16_t)];
+	uint16_t length, offset = 0, ack_length = 0;
+
+	length = otMessageRead(message, otMessageGetOffset(message), payload, sizeof(payload));
+	while ((offset + MAILBOX_COMMAND_HEADER_SIZE <= length) && (payload[offset] > 0) &&
+	       (offset + MAILBOX_COMMAND_HEADER_SIZE + payload[offset] <= length) &&
+	       (payload[offset] <= CONFIG_MAILBOX_COMMAND_SIZE)) {
+		uint8_t command_length = payload[offset];
+		uint16_t id = sys_get_le16(&payload[offset + 1]);
+
+		offset += MAILBOX_COMMAND_HEADER_SIZE;
+		memcpy(command, &payload[offset], command_length);
+		command[command_length] = '\0';
+		offset += command_length;
+
+		sys_put_le16(id, &ack[ack_length]);
+		ack_length += sizeof(uint16_t);
+		if (!mailbox_command_new(id)) {
+			LOG_INF("Command %04x from the cloud already run", id);
+			continue;
+		}
+		LOG_INF("Command %04x from the cloud: %s", id, (const char *)command);
+		meter_command_execute(command, command_length);
+	}
+
+	if (ack_length > 0) {
+		coap_utils_modem_mailbox_ack(&message_info->mPeerAddr, ack, ack_length);
+	}
+}
+
+/* Remove commands acknowledged by the meter from its mailbox. */
+static void on_mailbox_ack(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t payload[METER_RESPONSE_MAX_SIZE];
+	uint16_t length;
+
+	length = otMessageRead(message, otMessageGetOffset(message) + sizeof(uint8_t), payload,
+			       sizeof(payload));
+	for (uint16_t offset = 0; offset + sizeof(uint16_t) <= length; offset += sizeof(uint16_t)) {
+		mailbox_ack(&message_info->mPeerAddr, sys_get_le16(&payload[offset]));
+	}
+
+	coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+}
+
+static uint16_t on_meter_upload_response(const otMessageInfo *message_info, uint8_t *payload,
+					 uint16_t size)
+{
+	return mailbox_take(&message_info->mPeerAddr, payload, size);
+}
+#endif
+
+#if CONFIG_BT_NUS
+
+#define COMMAND_BLE_EXPORT 'x'
+#define COMMAND_BLE_STATS  's'
+
+static void on_nus_received(struct bt_conn *conn, const uint8_t *const data, uint16_t len)
+{
+	if (len == 0) {
+		LOG_WRN("Received empty data");
+		return;
+	}
+
+	LOG_INF("Received data: %c", data[0]);
+
+#if CONFIG_BLE_EXPORT
+	/* Export from the cursor given in decimal, e.g. "x1718000000". */
+	if (data[0] == COMMAND_BLE_EXPORT) {
+		char cursor[11] = { 0 };
+		int ret;
+
+		memcpy(cursor, &data[1], MIN(len - 1, sizeof(cursor) - 1));
+		ret = ble_export_start(conn, strtoul(cursor, NULL, 10));
+		if (ret) {
+			LOG_WRN("Cannot start export (error: %d)", ret);
+		}
+		return;
+	}
+#endif
+
+#if CONFIG_BLE_STATS
+	/* Stream stats every period given in decimal ms, e.g. "s1000", "s0" stops. */
+	if (data[0] == COMMAND_BLE_STATS) {
+		char period[11] = { 0 };
+		int ret;
+
+		memcpy(period, &data[1], MIN(len - 1, sizeof(period) - 1));
+		ret = ble_stats_start(conn, strtoul(period, NULL, 10));
+		if (ret) {
+			LOG_WRN("Cannot start stats stream (error: %d)", ret);
+		}
+		return;
 	}
+#endif
+
+	meter_command_execute(data, len);
 }
 
 static void on_ble_connect(struct k_work *item)
@@ -106,6 +556,7 @@ static void on_button_changed(uint32_t button_state, uint32_t has_changed)
 	}
 
 	if (buttons & DK_BTN2_MSK) {
+		send_alarm((const uint8_t *)ALARM_TAMPER, strlen(ALARM_TAMPER));
 	}
 
 	if (buttons & DK_BTN3_MSK) {
@@ -115,6 +566,25 @@ static void on_button_changed(uint32_t button_state, uint32_t has_changed)
 	}
 }
 
+/* Check if the own modem takes data, while offline into the cloud store. */
+static bool modem_accepts_data(modem_state state)
+{
+#if CONFIG_CLOUD_STORE
+	if ((state == MODEM_STATE_OFF) && cloud_store_available()) {
+		return true;
+	}
+#endif
+	return (state == MODEM_STATE_IDLE) || (state == MODEM_STATE_BUSY);
+}
+
+#if CONFIG_AGGREGATOR
+/* Check if data of the meter goes upstream in batches, the own modem takes none. */
+static bool aggregates_data(modem_state state, const otIp6Address *peer)
+{
+	return !modem_accepts_data(state) && aggregator_accepts(peer);
+}
+#endif
+
 static void on_modem_request(otMessage *message, const otMessageInfo *message_info)
 {
 	uint8_t command;
@@ -138,12 +608,39 @@ static void on_modem_request(otMessage *message, const otMessageInfo *message_in
 
 	switch (command) {
 	case MODEM_COMMAND_DISCOVER:
-		if ((current_modem_state == MODEM_STATE_IDLE ) || (current_modem_state == MODEM_STATE_BUSY)) {
+#if CONFIG_OT_BUFFERS
+		/* Meters discover again once message buffers are available. */
+		if (ot_buffers_admit(OT_BUFFERS_TRAFFIC_DISCOVER) > 0) {
+			LOG_INF("Message buffers short, discover not answered");
+			break;
+		}
+#endif
+		if (modem_accepts_data(current_modem_state)) {
+#if CONFIG_METER_PULL
+			/* Meters looking for a modem are read from now on. */
+			meter_pull_roster_add(&message_info->mPeerAddr);
+#endif
 			otMessageInfo report_state_message_info;
+
+			/* To meters the store looks like an idle modem. */
+			if (current_modem_state == MODEM_STATE_OFF) {
+				current_modem_state = MODEM_STATE_IDLE;
+			}
 			memset(&report_state_message_info, 0, sizeof(report_state_message_info));
 			report_state_message_info.mPeerAddr = message_info->mPeerAddr;
 			report_state_message_info.mPeerPort = COAP_PORT;
 			coap_utils_modem_report_state(&report_state_message_info, current_modem_state);
+#if CONFIG_AGGREGATOR
+		} else if (aggregates_data(current_modem_state, &message_info->mPeerAddr)) {
+			otMessageInfo report_state_message_info;
+
+			/* Children upload to the router, which forwards their data in batches. */
+			LOG_INF("Aggregate measurement of child");
+			memset(&report_state_message_info, 0, sizeof(report_state_message_info));
+			report_state_message_info.mPeerAddr = message_info->mPeerAddr;
+			report_state_message_info.mPeerPort = COAP_PORT;
+			coap_utils_modem_report_state(&report_state_message_info, MODEM_STATE_IDLE);
+#endif
 		} else {	//MODEM_STATE_OFF
 			LOG_INF("Modem is off");
 		}
@@ -156,23 +653,132 @@ static void on_modem_request(otMessage *message, const otMessageInfo *message_in
 		} else {
 			LOG_INF("Remote modem state: %d", remote_modem_state);
 			coap_utils_modem_report_state_response(message, message_info);
+#if CONFIG_BLE_FALLBACK
+			if (remote_modem_state == MODEM_STATE_IDLE) {
+				discover_failures = 0;
+			}
+#endif
 			if ((remote_modem_state == MODEM_STATE_IDLE) && (uploading_measurement == false)) {
+				uploading_measurement = true;
+#if CONFIG_BLE_FALLBACK
+				mesh_upload_start = k_uptime_get();
+				mesh_upload_bytes = 0;
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+				upload_bytes = 0;
+#endif
+#if CONFIG_UPLOAD_FAILOVER
+				upload_modem_count = 0;
+				upload_failovers = 0;
+#endif
+#if CONFIG_OT_BUFFERS
+				/* The request is deferred while message buffers are short. */
+				coap_utils_modem_upload_measurement_schedule(&message_info->mPeerAddr,
+									     K_NO_WAIT);
+#else
 				otMessageInfo upload_measurement_message_info;
 
-				uploading_measurement = true;
 				memset(&upload_measurement_message_info, 0, sizeof(upload_measurement_message_info));
 				upload_measurement_message_info.mPeerAddr = message_info->mPeerAddr;
 				upload_measurement_message_info.mPeerPort = COAP_PORT;
 				coap_utils_modem_upload_measurement(&upload_measurement_message_info);
+#endif
 			}
+#if CONFIG_UPLOAD_FAILOVER
+			/* Other idle modems take over if the upload fails. */
+			if (remote_modem_state == MODEM_STATE_IDLE) {
+				upload_modem_add(&message_info->mPeerAddr);
+			}
+#endif
+#if CONFIG_AGGREGATOR
+			if (remote_modem_state == MODEM_STATE_IDLE) {
+				aggregator_modem_found(&message_info->mPeerAddr);
+			}
+#endif
 		}
 		break;
 
 	case MODEM_COMMAND_UPLOAD_MEASUREMENT:
 		LOG_INF("Receive Upload Measurement command");
-		if (current_modem_state == MODEM_STATE_IDLE) {
+#if CONFIG_DELIVERY
+		uint8_t meter_id[DELIVERY_METER_ID_SIZE];
+
+		if (otMessageRead(message, otMessageGetOffset(message) + sizeof(command), meter_id,
+				  sizeof(meter_id)) != sizeof(meter_id)) {
+			LOG_ERR("Missing meter ID of the upload");
+			coap_utils_send_response(message, message_info, OT_COAP_CODE_BAD_REQUEST);
+			break;
+		}
+		/* A new upload of the meter ends its unfinished transfer. */
+		upload_transfer_end(meter_id);
+#endif
+#if CONFIG_OT_BUFFERS
+		uint32_t buffers_delay = ot_buffers_admit(OT_BUFFERS_TRAFFIC_UPLOAD);
+
+		if (buffers_delay > 0) {
+			LOG_INF("Message buffers short, meter uploads in %u ms", buffers_delay);
+#if CONFIG_UPLOAD_SLOT
+			struct upload_slot slot = {.delay = buffers_delay};
+			uint8_t payload[UPLOAD_SLOT_ENCODED_SIZE];
+
+			coap_utils_send_response_payload(message, message_info,
+							 OT_COAP_CODE_SERVICE_UNAVAILABLE, payload,
+							 upload_slot_encode(&slot, payload));
+#else
+			coap_utils_send_response(message, message_info, OT_COAP_CODE_SERVICE_UNAVAILABLE);
+#endif
+			break;
+		}
+#endif
+#if CONFIG_AGGREGATOR
+		if (aggregates_data(current_modem_state, &message_info->mPeerAddr)) {
+			LOG_INF("Modem is off, aggregate measurement of child");
+			upload_transfer_begin(meter_id, &message_info->mPeerAddr);
+			coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+			break;
+		}
+#endif
+#if CONFIG_CLOUD_STORE
+		if ((current_modem_state == MODEM_STATE_OFF) && modem_accepts_data(current_modem_state)) {
+			LOG_INF("Modem is off, store measurement until reconnected");
+#if CONFIG_DELIVERY
+			upload_transfer_begin(meter_id, &message_info->mPeerAddr);
+#endif
+			coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+			break;
+		}
+#endif
+#if CONFIG_UPLOAD_SLOT
+		if ((current_modem_state == MODEM_STATE_IDLE) || (current_modem_state == MODEM_STATE_BUSY)) {
+			struct upload_slot slot;
+			uint8_t payload[UPLOAD_SLOT_ENCODED_SIZE];
+			int ret;
+
+			/* A read of the gateway may have claimed the modem meanwhile. */
+			k_mutex_lock(&upload_session_lock, K_FOREVER);
+			ret = upload_slot_request(&message_info->mPeerAddr,
+									  modem_get_state() == MODEM_STATE_IDLE, &slot);
+			if (ret == 0) {
+				upload_session_claim(&message_info->mPeerAddr);
+			}
+			k_mutex_unlock(&upload_session_lock);
+
+			if (ret == 0) {
+				LOG_INF("Modem is idle, start uploading measurement");
+				coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
+			} else if (ret == -EAGAIN) {
+				LOG_INF("Modem is busy, meter uploads in %u ms", slot.delay);
+				coap_utils_send_response_payload(message, message_info,
+												 OT_COAP_CODE_SERVICE_UNAVAILABLE,
+												 payload, upload_slot_encode(&slot, payload));
+			} else {
+				coap_utils_send_response(message, message_info, OT_COAP_CODE_SERVICE_UNAVAILABLE);
+			}
+			break;
+		}
+#endif
+		if (upload_session_claim(&message_info->mPeerAddr) != 0) {
 			LOG_INF("Modem is idle, start uploading measurement");
-			modem_set_state(MODEM_STATE_BUSY);
 			coap_utils_send_response(message, message_info, OT_COAP_CODE_CHANGED);
 		} else {
 			LOG_INF("Modem is busy, wait for next round");
@@ -180,11 +786,358 @@ static void on_modem_request(otMessage *message, const otMessageInfo *message_in
 		}
 		break;
 
+#if CONFIG_DELIVERY
+	case MODEM_COMMAND_CLOUD_ACK:
+		on_cloud_ack(message, message_info);
+		break;
+#endif
+
+#if CONFIG_MAILBOX
+	case MODEM_COMMAND_MAILBOX_ACK:
+		on_mailbox_ack(message, message_info);
+		break;
+#endif
+
 	default:
 		break;
 	}
 }
 
+static void on_alarm_request(otMessage *message, const otMessageInfo *message_info)
+{
+	uint8_t alarm[ALARM_MAX_SIZE];
+	uint16_t length;
+	modem_state current_modem_state = modem_get_state();
+	otCoapCode code = OT_COAP_CODE_SERVICE_UNAVAILABLE;
+
+	length = otMessageRead(message, otMessageGetOffset(message), alarm, sizeof(alarm));
+	LOG_HEXDUMP_INF(alarm, length, "Received alarm:");
+
+	if (modem_accepts_data(current_modem_state)) {
+		if (modem_cloud_publish(MODEM_TRAFFIC_URGENT, alarm, length) == 0) {
+			code = OT_COAP_CODE_CHANGED;
+		}
+	} else {
+		LOG_INF("Modem is off");
+	}
+
+	if (otCoapMessageGetType(message) == OT_COAP_TYPE_CONFIRMABLE) {
+		coap_utils_send_response(message, message_info, code);
+	}
+}
+
+#if CONFIG_METER_CODEC && CONFIG_ACQUISITION
+/* Drop oldest items, journaled ones a whole batch at a time. */
+static void measurement_drop(void)
+{
+	struct meter_rollup oldest;
+	uint16_t count = 1;
+
+#if CONFIG_DELIVERY
+	count = MAX(delivery_journal_drop(), 1);
+#endif
+	while (count-- > 0) {
+		k_msgq_get(&measurement_queue, &oldest, K_NO_WAIT);
+	}
+}
+
+#if CONFIG_DEADBAND
+/* Uploads of readings passing the deadband, started off the acquisition thread */
+static struct k_work deadband_upload_work;
+
+static void deadband_upload_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	upload_measurement();
+}
+#endif
+
+static void measurement_queue_put(struct meter_rollup *item)
+{
+#if CONFIG_DEADBAND
+	/* Coalesced values are merged into the item, it becomes a rollup of them. */
+	if (!deadband_check(item)) {
+		return;
+	}
+#endif
+
+	k_mutex_lock(&measurement_lock, K_FOREVER);
+	while (k_msgq_put(&measurement_queue, item, K_NO_WAIT) != 0) {
+		LOG_WRN("Measurement queue full, oldest dropped");
+		measurement_drop();
+	}
+	k_mutex_unlock(&measurement_lock);
+
+#if CONFIG_DEADBAND
+	/* Report by exception: every reading that passed the deadband is uploaded. */
+	k_work_submit(&deadband_upload_work);
+#endif
+}
+
+static void measurement_add(const struct meter_record *reading)
+{
+	struct meter_rollup item;
+
+#if CONFIG_ROLLUP
+	rollup_add(reading);
+	while (rollup_get(&item)) {
+		measurement_queue_put(&item);
+	}
+#else
+	item = (struct meter_rollup){
+		.start = reading->timestamp,
+		.count = 1,
+		.min = reading->value,
+		.max = reading->value,
+		.mean = reading->value,
+		.last = reading->value,
+	};
+	measurement_queue_put(&item);
+#endif
+}
+
+/* Called from the acquisition thread, a batch makes one reading. */
+static void on_acquisition_batch(const struct acquisition_batch *batch)
+{
+	struct meter_record reading;
+	int64_t sum = 0;
+
+	for (uint16_t i = 0; i < batch->count; i++) {
+		sum += batch->samples[i];
+	}
+
+	reading.timestamp = (uint32_t)(batch->time / MSEC_PER_SEC);
+	reading.value = (int32_t)(sum / batch->count);
+	measurement_add(&reading);
+}
+#endif
+
+/* Fill block with measurement and return number of bytes used. */
+static uint16_t measurement_block_fill(uint8_t *block, uint16_t size)
+{
+#if CONFIG_METER_CODEC
+	struct meter_encoder encoder;
+	struct meter_record reading;
+	struct meter_rollup item;
+	uint8_t type = METER_CODEC_TYPE_DELTA;
+	uint32_t index = 0, end;
+	uint16_t length;
+	int ret;
+
+	k_mutex_lock(&measurement_lock, K_FOREVER);
+	end = k_msgq_num_used_get(&measurement_queue);
+
+#if CONFIG_DELIVERY
+	struct delivery_batch batch;
+	uint32_t seq = 0;
+	bool resend;
+
+	/* Items stay queued until the cloud acknowledged them. */
+	ret = delivery_journal_next(end, &batch);
+	resend = (ret == 0);
+	if (resend) {
+		index = batch.offset;
+		end = batch.offset + batch.count;
+	} else if (ret == -ENOENT) {
+		index = batch.offset;
+	} else {
+		index = end;
+	}
+#endif
+
+	/* Raw readings go to a delta block. */
+	if ((index < end) && (k_msgq_peek_at(&measurement_queue, &item, index) == 0) &&
+	    (item.count > 1)) {
+		type = METER_CODEC_TYPE_ROLLUP;
+	}
+	if (meter_encoder_init(&encoder, type, &block[MEASURE_HEADER_SIZE],
+			       size - MEASURE_HEADER_SIZE) != 0) {
+		k_mutex_unlock(&measurement_lock);
+		return 0;
+	}
+
+	/* Items that do not fit stay queued for the next block. */
+	for (; index < end; index++) {
+		if (k_msgq_peek_at(&measurement_queue, &item, index) != 0) {
+			break;
+		}
+		if (type == METER_CODEC_TYPE_ROLLUP) {
+			ret = meter_encoder_add_rollup(&encoder, &item);
+		} else if (item.count == 1) {
+			reading.timestamp = item.start;
+			reading.value = item.last;
+			ret = meter_encoder_add(&encoder, &reading);
+		} else {
+			ret = -EINVAL;
+		}
+		if (ret != 0) {
+			break;
+		}
+	}
+
+#if CONFIG_DELIVERY
+	if (resend) {
+		seq = batch.seq;
+		delivery_journal_sent(seq);
+	} else if (encoder.count > 0) {
+		seq = delivery_journal_add(encoder.count);
+	}
+	delivery_header_encode(seq, block);
+	measurement_block_seq = seq;
+#else
+	for (uint16_t i = 0; i < encoder.count; i++) {
+		k_msgq_get(&measurement_queue, &item, K_NO_WAIT);
+	}
+#endif
+
+	k_mutex_unlock(&measurement_lock);
+
+	length = MEASURE_HEADER_SIZE + meter_encoder_finish(&encoder);
+	LOG_INF("Encoded %u records in %u bytes", encoder.count, length);
+	/* Only the last block may be shorter than the block size. */
+	memset(&block[length], 0, size - length);
+
+	return length;
+#else
+	/* Fill tx block with ascii 0 ~ 9 */
+	for (uint16_t i = 0; i < size; i++) {
+		block[i] = 48 + i % 10;
+	}
+
+	return size;
+#endif
+}
+
+#if CONFIG_BLE_EXPORT
+/* Encode queued items from the cursor on for the BLE export, they stay queued. */
+static uint16_t on_export_fill(uint32_t *cursor, uint8_t *buf, uint16_t size)
+{
+	struct meter_encoder encoder;
+	struct meter_record reading;
+	struct meter_rollup item;
+	uint8_t type = METER_CODEC_TYPE_DELTA;
+	bool started = false;
+	uint32_t end;
+	int ret;
+
+	k_mutex_lock(&measurement_lock, K_FOREVER);
+	end = k_msgq_num_used_get(&measurement_queue);
+
+	for (uint32_t index = 0; index < end; index++) {
+		if (k_msgq_peek_at(&measurement_queue, &item, index) != 0) {
+			break;
+		}
+		if (item.start < *cursor) {
+			continue;
+		}
+		/* The first item sets the block type, as for uploads. */
+		if (!started) {
+			type = (item.count > 1) ? METER_CODEC_TYPE_ROLLUP : METER_CODEC_TYPE_DELTA;
+			if (meter_encoder_init(&encoder, type, buf, size) != 0) {
+				break;
+			}
+			started = true;
+		}
+		if (type == METER_CODEC_TYPE_ROLLUP) {
+			ret = meter_encoder_add_rollup(&encoder, &item);
+		} else if (item.count == 1) {
+			reading.timestamp = item.start;
+			reading.value = item.last;
+			ret = meter_encoder_add(&encoder, &reading);
+		} else {
+			ret = -EINVAL;
+		}
+		if (ret != 0) {
+			break;
+		}
+		*cursor = item.start + 1;
+	}
+
+	k_mutex_unlock(&measurement_lock);
+
+	return (started && (encoder.count > 0)) ? meter_encoder_finish(&encoder) : 0;
+}
+#endif
+
+/* Check if measurement is waiting for upload. */
+static bool measurement_pending(void)
+{
+#if CONFIG_DELIVERY
+	return delivery_journal_due(k_msgq_num_used_get(&measurement_queue));
+#elif CONFIG_METER_CODEC
+	return k_msgq_num_used_get(&measurement_queue) > 0;
+#else
+	return true;
+#endif
+}
+
+/* Check if another block follows the given one. */
+static bool measurement_more(uint32_t block_count)
+{
+	if (block_count >= max_block_count - 1) {
+		return false;
+	}
+
+	return measurement_pending();
+}
+
+/* Publish measurement block, batches already forwarded are not published again. */
+static int measurement_publish(struct net_buf *buf, const otIp6Address *peer)
+{
+#if CONFIG_DELIVERY
+	const uint8_t *block = buf->data;
+	size_t length = buf->len;
+	struct delivery_header header;
+	uint32_t tag;
+	int ret;
+
+#if CONFIG_AGGREGATOR
+	/* Blocks of children go upstream in batches, the own modem takes no data. */
+	if ((peer != NULL) && aggregates_data(modem_get_state(), peer)) {
+		return aggregator_add(peer, block, length);
+	}
+#endif
+
+	if (delivery_header_parse(block, length, &header) != 0) {
+		return -EBADMSG;
+	}
+#if CONFIG_MAILBOX
+	/* Commands for the meter go with the response to this upload. */
+	if (peer != NULL) {
+		mailbox_meter_seen(peer, header.id);
+	}
+#endif
+
+	ret = delivery_forward_prepare(&header, length, peer, &tag);
+	if ((ret == -EALREADY) || (ret == -ENODATA)) {
+#if CONFIG_METER_PULL
+		if ((ret == -EALREADY) && (peer != NULL)) {
+			meter_pull_block_received(peer, block, length);
+		}
+#endif
+		return 0;
+	}
+
+	/* The cloud acknowledgement is relayed to the meter by the tag. */
+	ret = modem_cloud_publish_buf(MODEM_TRAFFIC_BULK, buf, tag);
+	if (ret != 0) {
+		delivery_forward_cancel(tag);
+	}
+#if CONFIG_METER_PULL
+	else if (peer != NULL) {
+		meter_pull_block_received(peer, block, length);
+	}
+#endif
+
+	return ret;
+#else
+	ARG_UNUSED(peer);
+
+	return modem_cloud_publish_buf(MODEM_TRAFFIC_BULK, buf, 0);
+#endif
+}
+
 static void on_meter_block_tx(void *context,
 							  uint8_t *block,
 							  uint32_t position,
@@ -192,17 +1145,25 @@ static void on_meter_block_tx(void *context,
 							  bool *more)
 {
 	static uint32_t block_count = 0;
-	ARG_UNUSED(position);
+	uint16_t length;
 
-	LOG_INF("send block: Num %i Len %i pos: %i", block_count, *block_length, position);
-	/* Fill tx block with ascii 0 ~ 9 */
-	for (uint16_t i = 0; i < *block_length; i++) {
-		block[i] = 48 + i % 10;
+	/* Upload starts over, e.g. with another modem. */
+	if (position == 0) {
+		block_count = 0;
 	}
-	LOG_HEXDUMP_INF(block, *block_length, "Sent block:");
-	if (block_count == max_block_count - 1)
+#if CONFIG_DELIVERY
+	/* The modem requests the next block once it received the previous one. */
+	if (position != 0) {
+		delivery_journal_accepted(measurement_block_seq);
+	}
+#endif
+
+	LOG_INF("send block: Num %i Len %i pos: %i", block_count, *block_length, position);
+	length = measurement_block_fill(block, *block_length);
+	if (!measurement_more(block_count))
 	{
 		block_count = 0;
+		*block_length = length;
 		*more     = false;
 	}
 	else
@@ -210,6 +1171,13 @@ static void on_meter_block_tx(void *context,
 		*more = true;
 		block_count++;
 	}
+#if CONFIG_BLE_FALLBACK
+	mesh_upload_bytes += *block_length;
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+	upload_bytes += *block_length;
+#endif
+	LOG_HEXDUMP_INF(block, *block_length, "Sent block:");
 }
 
 static otError on_meter_block_rx(void *context,
@@ -220,11 +1188,43 @@ static otError on_meter_block_rx(void *context,
 								 uint32_t total_length)
 {
 	ARG_UNUSED(total_length);
+	const otIp6Address *peer = &upload_session_peer;
+	struct net_buf *buf;
 	int ret;
+#if CONFIG_DELIVERY
+	struct upload_transfer *transfer = NULL;
+	struct delivery_header header;
+
+	/* Blocks of the claimed session have no transfer, they are from its peer. */
+	if (delivery_header_parse(block, block_length, &header) == 0) {
+		transfer = upload_transfer_find(header.id);
+	}
+	if (transfer != NULL) {
+		peer = &transfer->peer;
+	}
+#endif
 
 	LOG_INF("received block: Num %i Len %i more: %d", position / block_length, block_length, more);
 	LOG_HEXDUMP_INF(block, block_length, "Received block:");
-	ret = modem_cloud_upload_data(block, (size_t)block_length);
+#if CONFIG_METER_CODEC
+	/* Padding of the block is not published. */
+	ret = (block_length > MEASURE_HEADER_SIZE) ?
+	      meter_codec_block_length(&block[MEASURE_HEADER_SIZE],
+				       block_length - MEASURE_HEADER_SIZE) : -EBADMSG;
+	if (ret < 0) {
+		LOG_ERR("Invalid measurement block");
+		return OT_ERROR_PARSE;
+	}
+	block_length = (uint16_t)(MEASURE_HEADER_SIZE + ret);
+#endif
+	/* Copied once, the modem and the store share the block from here on. */
+	buf = block_pool_alloc();
+	if (buf == NULL) {
+		return OT_ERROR_NO_BUFS;
+	}
+	net_buf_add_mem(buf, block, block_length);
+	ret = measurement_publish(buf, peer);
+	net_buf_unref(buf);
 	if (ret != 0) {
 		if (ret == -EBUSY) {
 			LOG_DBG("Modem is busy, wait for next round");
@@ -237,27 +1237,80 @@ static otError on_meter_block_rx(void *context,
 			return OT_ERROR_FAILED;
 		}
 	}
+#if CONFIG_DELIVERY
+	if (transfer != NULL) {
+		if (more == false) {
+			LOG_INF("Received all blocks");
+			transfer->active = false;
+		}
+		return OT_ERROR_NONE;
+	}
+#endif
+#if CONFIG_UPLOAD_SLOT
+	upload_session_bytes += block_length;
+#endif
 	if (more == false) {
 		LOG_INF("Received all blocks");
-		modem_set_state(MODEM_STATE_IDLE);
+#if CONFIG_UPLOAD_SLOT
+		upload_slot_session_end(upload_session_bytes);
+#endif
+		upload_session_release(0);
 	}
 	return OT_ERROR_NONE;
 }
 
 static void on_meter_response(void *context, otMessage *message, const otMessageInfo *message_info, otError error)
 {
+#if CONFIG_DELIVERY
+	/* The response tells the modem received the last block. */
+	if ((error == OT_ERROR_NONE) && (message != NULL) &&
+	    (otCoapMessageGetCode(message) == OT_COAP_CODE_CHANGED)) {
+		delivery_journal_accepted(measurement_block_seq);
+	}
+#endif
 	if (error != OT_ERROR_NONE)
 	{
 		LOG_ERR("coap receive response error %d: %s", error, otThreadErrorToString(error));
+#if CONFIG_DELIVERY
+		/* The block in flight may or may not have reached the modem, send it again. */
+		LOG_INF("%u batches to send again", delivery_journal_retry());
+#endif
+#if CONFIG_UPLOAD_FAILOVER
+		if (uploading_measurement && upload_failover()) {
+			return;
+		}
+#endif
 	}
 	/* Upload finiched */
 	uploading_measurement = false;
 	LOG_INF("Upload finished");
+#if CONFIG_BLE_FALLBACK
+	if (error == OT_ERROR_NONE) {
+		ble_fallback_mesh_upload(mesh_upload_bytes,
+					 (uint32_t)(k_uptime_get() - mesh_upload_start));
+	}
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+	if (error == OT_ERROR_NONE) {
+		energy_uploaded(upload_bytes);
+	}
+#endif
+#if CONFIG_MAILBOX
+	/* Commands run after the upload, they may start the next one. */
+	if ((error == OT_ERROR_NONE) && (message != NULL) &&
+	    (otCoapMessageGetCode(message) == OT_COAP_CODE_CHANGED)) {
+		meter_commands_receive(message, message_info);
+	}
+#endif
 	return;
 }
 
 static void on_modem_state_change(modem_state state)
 {
+#if CONFIG_ENERGY_ACCOUNTING
+	energy_modem_state(state);
+#endif
+
 	dk_set_led_off(MODEM_IDLE_LED);
 	dk_set_led_off(MODEM_BUSY_LED);
 
@@ -277,16 +1330,20 @@ static void on_modem_state_change(modem_state state)
 void uploading_measurement_handler(struct k_work *work)
 {
 	static uint32_t block_count = 0;
+	/* Kept until published, so a busy modem does not drop readings */
+	static struct net_buf *block;
 
 	if (uploading_measurement) {
-		uint8_t block[MEASURE_BLOCK_SIZE];
 		int ret;
 
-		/* Fill tx block with ascii 0 ~ 9 */
-		for (uint16_t i = 0; i < MEASURE_BLOCK_SIZE; i++) {
-			block[i] = 48 + i % 10;
+		if (block == NULL) {
+			block = block_pool_alloc();
+			if (block == NULL) {
+				goto error;
+			}
+			net_buf_add(block, measurement_block_fill(block->data, MEASURE_BLOCK_SIZE));
 		}
-		ret = modem_cloud_upload_data(block, MEASURE_BLOCK_SIZE);
+		ret = measurement_publish(block, NULL);
 		if (ret != 0) {
 			if (ret == -EBUSY) {
 				uploading_measurement_retry_count++;
@@ -304,12 +1361,15 @@ void uploading_measurement_handler(struct k_work *work)
 				goto error;
 			}
 		} else {
-			LOG_INF("Sent block: Num %i Len %i", block_count, MEASURE_BLOCK_SIZE);
+			LOG_INF("Sent block: Num %i Len %i", block_count, block->len);
+			net_buf_unref(block);
+			block = NULL;
 			uploading_measurement_retry_count = 0;
-			if (block_count == max_block_count - 1) {
+			if (!measurement_more(block_count)) {
 				block_count = 0;
 				uploading_measurement = false;
-				modem_set_state(MODEM_STATE_IDLE);
+				upload_session_release(own_upload_session);
+				own_upload_session = 0;
 			} else {
 				block_count++;
 				k_work_schedule(&uploading_measurement_work, UPLOAD_MEASUREMENT_TIMEOUT);
@@ -318,12 +1378,80 @@ void uploading_measurement_handler(struct k_work *work)
 	}
 	return;
 error:
+	if (block != NULL) {
+		net_buf_unref(block);
+		block = NULL;
+	}
 	block_count = 0;
 	uploading_measurement = false;
 	uploading_measurement_retry_count = 0;
+	upload_session_release(own_upload_session);
+	own_upload_session = 0;
 	return;
 }
 
+#if CONFIG_BLE_FALLBACK
+#if CONFIG_DELIVERY
+/* Batches handed to the collector, acknowledged once it confirms the last block */
+static struct delivery_header fallback_headers[CONFIG_DELIVERY_JOURNAL_SIZE];
+static uint8_t fallback_header_count;
+#endif
+
+static uint16_t on_fallback_fill(uint8_t *block, uint16_t size, bool *more)
+{
+	uint16_t length;
+
+	if (!measurement_pending()) {
+		return 0;
+	}
+
+	length = measurement_block_fill(block, size);
+#if CONFIG_DELIVERY
+	struct delivery_header *header = &fallback_headers[fallback_header_count];
+
+	/* Batches beyond the journal size are sent again after their timeout. */
+	if ((fallback_header_count < ARRAY_SIZE(fallback_headers)) &&
+	    (delivery_header_parse(block, length, header) == 0) && (header->seq != 0)) {
+		fallback_header_count++;
+	}
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+	upload_bytes += length;
+#endif
+	*more = measurement_pending();
+
+	return length;
+}
+
+static void on_fallback_done(int err)
+{
+#if CONFIG_DELIVERY
+	if (err) {
+		LOG_INF("%u batches to send again", delivery_journal_retry());
+	} else {
+		/* The collector takes over delivery, its confirmation acknowledges the batches. */
+		for (uint8_t i = 0; i < fallback_header_count; i++) {
+			measurement_acked(&fallback_headers[i]);
+		}
+	}
+	fallback_header_count = 0;
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+	if (err == 0) {
+		energy_uploaded(upload_bytes);
+	}
+#endif
+	/* Gateways get another chance before the next fallback. */
+	discover_failures = 0;
+	uploading_measurement = false;
+}
+
+static const struct ble_fallback_cb fallback_cb = {
+	.fill = on_fallback_fill,
+	.done = on_fallback_done,
+};
+#endif
+
 int upload_measurement(void)
 {
 	if (uploading_measurement) {
@@ -331,15 +1459,44 @@ int upload_measurement(void)
 		return -EBUSY;
 	}
 
-	if (modem_get_state() == MODEM_STATE_IDLE) {
+#if CONFIG_DELIVERY
+	if (!delivery_journal_due(k_msgq_num_used_get(&measurement_queue))) {
+		LOG_INF("No measurement to upload");
+		return -ENODATA;
+	}
+#elif CONFIG_METER_CODEC
+	if (k_msgq_num_used_get(&measurement_queue) == 0) {
+		LOG_INF("No measurement to upload");
+		return -ENODATA;
+	}
+#endif
+
+	own_upload_session = upload_session_claim(NULL);
+	if (own_upload_session != 0) {
 		LOG_INF("Modem is idle, start uploading measurement");
-		modem_set_state(MODEM_STATE_BUSY);
 		uploading_measurement = true;
 		k_work_schedule(&uploading_measurement_work, K_NO_WAIT);
 	} else if (modem_get_state() == MODEM_STATE_BUSY) {
 		LOG_INF("Modem is busy, wait for next round");
 		return -EBUSY;
 	} else {
+#if CONFIG_BLE_FALLBACK
+		/* No gateway answered the last discovers, hand measurement to a collector. */
+		if (discover_failures >= CONFIG_BLE_FALLBACK_DISCOVER_FAILURES) {
+			uploading_measurement = true;
+#if CONFIG_DELIVERY
+			fallback_header_count = 0;
+#endif
+#if CONFIG_ENERGY_ACCOUNTING
+			upload_bytes = 0;
+#endif
+			if (ble_fallback_start() == 0) {
+				return 0;
+			}
+			uploading_measurement = false;
+		}
+		discover_failures++;
+#endif
 		LOG_INF("Modem is off. Ask remote modem to upload measurement");
 		coap_utils_modem_discover();
 	}
@@ -347,6 +1504,25 @@ int upload_measurement(void)
 	return 0;
 }
 
+int send_alarm(const uint8_t *alarm, size_t len)
+{
+	modem_state current_modem_state = modem_get_state();
+
+	if (len > ALARM_MAX_SIZE) {
+		LOG_WRN("Alarm too long");
+		return -EINVAL;
+	}
+
+	/* Alarm does not wait for the ongoing measurement upload. */
+	if ((current_modem_state == MODEM_STATE_IDLE) || (current_modem_state == MODEM_STATE_BUSY)) {
+		LOG_INF("Publish alarm with own modem");
+		return modem_cloud_publish(MODEM_TRAFFIC_URGENT, alarm, len);
+	}
+
+	LOG_INF("Modem is off. Send alarm to remote modem");
+	return (coap_utils_send_alarm(alarm, (uint16_t)len) == OT_ERROR_NONE) ? 0 : -EIO;
+}
+
 int main(void)
 {
 	int ret;
@@ -369,10 +1545,38 @@ int main(void)
 		return 0;
 	}
 
+#if CONFIG_RUNTIME_MONITOR
+	runtime_monitor_init();
+#endif
+
+#if CONFIG_OT_BUFFERS
+	ot_buffers_init();
+#endif
+
+#if CONFIG_ENERGY_ACCOUNTING
+	energy_init();
+#endif
+
+#if CONFIG_BLE_EXPORT
+	ble_export_init(on_export_fill);
+#endif
+
+#if CONFIG_BLE_STATS
+	ble_stats_init();
+#endif
+
+#if CONFIG_BLE_FALLBACK
+	ble_fallback_init(&fallback_cb);
+#endif
+
 #if CONFIG_BT_NUS
 	struct bt_nus_cb nus_clbs = {
 		.received = on_nus_received,
+#if CONFIG_BLE_EXPORT
+		.sent = ble_export_sent,
+#else
 		.sent = NULL,
+#endif
 	};
 
 	ret = ble_utils_init(&nus_clbs, on_ble_connect, on_ble_disconnect);
@@ -419,13 +1623,85 @@ int main(void)
 #endif
 
 	k_work_init_delayable(&uploading_measurement_work, uploading_measurement_handler);
+#if CONFIG_RUNTIME_MONITOR
+	runtime_monitor_work_register(&uploading_measurement_work.work, "uploading_measurement");
+#endif
+#if CONFIG_ACQUISITION && CONFIG_DEADBAND
+	k_work_init(&deadband_upload_work, deadband_upload_handler);
+#if CONFIG_RUNTIME_MONITOR
+	runtime_monitor_work_register(&deadband_upload_work, "deadband_upload");
+#endif
+#endif
 
-	ret = ot_coap_init(&on_modem_request, &on_meter_block_tx, &on_meter_block_rx, &on_meter_response);
+#if CONFIG_SED_UTILS
+	ret = sed_utils_init();
+	if (ret) {
+		LOG_ERR("Cannot init SED utilities (error: %d)", ret);
+	}
+#endif
+
+#if CONFIG_UPLOAD_SLOT
+	upload_slot_init();
+#endif
+
+#if CONFIG_ROLLUP
+	rollup_init();
+#endif
+
+#if CONFIG_DEADBAND
+	deadband_init();
+#endif
+
+#if CONFIG_METER_CODEC && CONFIG_ACQUISITION
+	ret = acquisition_init(on_acquisition_batch);
+	if (ret) {
+		LOG_ERR("Cannot init acquisition (error: %d)", ret);
+	}
+#endif
+
+	ret = ot_coap_init(&on_modem_request, &on_meter_block_tx, &on_meter_block_rx, &on_meter_response,
+					   &on_alarm_request);
 	if (ret) {
 		LOG_ERR("Could not initialize OpenThread CoAP");
 	}
 	coap_client_utils_init(on_ot_connect, on_ot_disconnect);
 
+#if CONFIG_DELIVERY
+	ret = delivery_init(measurement_acked);
+	if (ret) {
+		LOG_ERR("Cannot init delivery (error: %d)", ret);
+	}
+	modem_set_ack_handler(delivery_acked);
+	coap_utils_set_meter_pull_handler(on_meter_pull);
+#endif
+
+#if CONFIG_MAILBOX
+	modem_set_command_handler(mailbox_cloud_command);
+	coap_utils_set_meter_upload_response_handler(on_meter_upload_response);
+#endif
+
+#if CONFIG_AGGREGATOR
+	ret = aggregator_init();
+	if (ret) {
+		LOG_ERR("Cannot init aggregator (error: %d)", ret);
+	}
+#endif
+
+#if CONFIG_IMAGE_DIST
+	ret = image_dist_init(meter_command_execute);
+	if (ret) {
+		LOG_ERR("Cannot init image distribution (error: %d)", ret);
+	}
+	modem_set_image_handler(image_dist_cloud_message);
+#endif
+
+#if CONFIG_METER_PULL
+	ret = meter_pull_init(upload_session_claim, upload_session_release);
+	if (ret) {
+		LOG_ERR("Cannot init meter pull (error: %d)", ret);
+	}
+#endif
+
 	ret = modem_init(on_modem_state_change);
 	if (ret) {
 		LOG_ERR("Cannot init modem (error: %d)", ret);
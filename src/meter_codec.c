@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "meter_codec.h"
+
+LOG_MODULE_REGISTER(meter_codec, CONFIG_METER_CODEC_LOG_LEVEL);
+
+#define VARINT_MAX_SIZE 10
+#define BENCH_BLOCK_SIZE 512
+#define BENCH_DEFAULT_COUNT 1000
+#define BENCH_SAMPLE_PERIOD 60
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static size_t varint_encode(uint64_t value, uint8_t *buf)
+{
+	size_t length = 0;
+
+	while (value >= 0x80) {
+		buf[length++] = (uint8_t)value | 0x80;
+		value >>= 7;
+	}
+	buf[length++] = (uint8_t)value;
+
+	return length;
+}
+
+static int varint_decode(struct meter_decoder *decoder, uint64_t *value)
+{
+	uint64_t result = 0;
+
+	for (size_t shift = 0; shift < 7 * VARINT_MAX_SIZE; shift += 7) {
+		uint8_t byte;
+
+		if (decoder->offset >= decoder->length) {
+			return -EBADMSG;
+		}
+		byte = decoder->buf[decoder->offset++];
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			*value = result;
+			return 0;
+		}
+	}
+
+	return -EBADMSG;
+}
+
+int meter_encoder_init(struct meter_encoder *encoder, uint8_t type, uint8_t *buf, size_t size)
+{
+	if (size < METER_CODEC_HEADER_SIZE) {
+		return -ENOSPC;
+	}
+
+	memset(encoder, 0, sizeof(*encoder));
+	encoder->type = type;
+	encoder->buf = buf;
+	encoder->size = size;
+	encoder->length = METER_CODEC_HEADER_SIZE;
+	encoder->buf[0] = type;
+
+	return 0;
+}
+
+static size_t pair_encode(const struct meter_encoder *encoder, uint32_t timestamp, int32_t value,
+			  uint8_t *buf)
+{
+	size_t length;
+
+	/* First record of a block is absolute, so each block decodes on its own. */
+	if (encoder->count == 0) {
+		length = varint_encode(timestamp, buf);
+		length += varint_encode(zigzag_encode(value), &buf[length]);
+	} else {
+		int64_t delta = (int64_t)timestamp - encoder->last.timestamp;
+
+		length = varint_encode(zigzag_encode(delta - encoder->last_delta), buf);
+		length += varint_encode(zigzag_encode((int64_t)value - encoder->last.value),
+					&buf[length]);
+	}
+
+	return length;
+}
+
+static int record_commit(struct meter_encoder *encoder, const uint8_t *buf, size_t length,
+			 uint32_t timestamp, int32_t value)
+{
+	if (encoder->length + length > encoder->size) {
+		return -ENOSPC;
+	}
+
+	memcpy(&encoder->buf[encoder->length], buf, length);
+	encoder->length += length;
+	if (encoder->count > 0) {
+		encoder->last_delta = (int64_t)timestamp - encoder->last.timestamp;
+	}
+	encoder->last.timestamp = timestamp;
+	encoder->last.value = value;
+	encoder->count++;
+
+	return 0;
+}
+
+int meter_encoder_add(struct meter_encoder *encoder, const struct meter_record *record)
+{
+	uint8_t tmp[METER_CODEC_RECORD_MAX_SIZE];
+	size_t length;
+
+	if (encoder->type != METER_CODEC_TYPE_DELTA) {
+		return -EINVAL;
+	}
+	if (encoder->count == UINT16_MAX) {
+		return -ENOSPC;
+	}
+
+	length = pair_encode(encoder, record->timestamp, record->value, tmp);
+
+	return record_commit(encoder, tmp, length, record->timestamp, record->value);
+}
+
+int meter_encoder_add_rollup(struct meter_encoder *encoder, const struct meter_rollup *rollup)
+{
+	uint8_t tmp[METER_CODEC_RECORD_MAX_SIZE];
+	size_t length;
+
+	if (encoder->type != METER_CODEC_TYPE_ROLLUP) {
+		return -EINVAL;
+	}
+	if (encoder->count == UINT16_MAX) {
+		return -ENOSPC;
+	}
+
+	/* Interval start and mean like a reading, the rest relative to the mean. */
+	length = pair_encode(encoder, rollup->start, rollup->mean, tmp);
+	length += varint_encode(rollup->count, &tmp[length]);
+	length += varint_encode((int64_t)rollup->mean - rollup->min, &tmp[length]);
+	length += varint_encode((int64_t)rollup->max - rollup->mean, &tmp[length]);
+	length += varint_encode(zigzag_encode((int64_t)rollup->last - rollup->mean), &tmp[length]);
+
+	return record_commit(encoder, tmp, length, rollup->start, rollup->mean);
+}
+
+size_t meter_encoder_finish(struct meter_encoder *encoder)
+{
+	sys_put_le16(encoder->count, &encoder->buf[1]);
+
+	return encoder->length;
+}
+
+int meter_decoder_init(struct meter_decoder *decoder, const uint8_t *buf, size_t length)
+{
+	if ((length < METER_CODEC_HEADER_SIZE) ||
+	    ((buf[0] != METER_CODEC_TYPE_DELTA) && (buf[0] != METER_CODEC_TYPE_ROLLUP))) {
+		return -EBADMSG;
+	}
+
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->type = buf[0];
+	decoder->buf = buf;
+	decoder->length = length;
+	decoder->offset = METER_CODEC_HEADER_SIZE;
+	decoder->count = sys_get_le16(&buf[1]);
+
+	return 0;
+}
+
+static int pair_decode(struct meter_decoder *decoder, uint32_t *timestamp, int32_t *value)
+{
+	uint64_t encoded_timestamp, encoded_value;
+	int ret;
+
+	ret = varint_decode(decoder, &encoded_timestamp);
+	if (ret == 0) {
+		ret = varint_decode(decoder, &encoded_value);
+	}
+	if (ret != 0) {
+		LOG_DBG("Block truncated at record %u", decoder->decoded);
+		return ret;
+	}
+
+	if (decoder->decoded == 0) {
+		*timestamp = (uint32_t)encoded_timestamp;
+		*value = (int32_t)zigzag_decode(encoded_value);
+	} else {
+		decoder->last_delta += zigzag_decode(encoded_timestamp);
+		*timestamp = (uint32_t)(decoder->last.timestamp + decoder->last_delta);
+		*value = (int32_t)(decoder->last.value + zigzag_decode(encoded_value));
+	}
+
+	decoder->last.timestamp = *timestamp;
+	decoder->last.value = *value;
+
+	return 0;
+}
+
+int meter_decoder_next(struct meter_decoder *decoder, struct meter_record *record)
+{
+	int ret;
+
+	if (decoder->type != METER_CODEC_TYPE_DELTA) {
+		return -EINVAL;
+	}
+	if (decoder->decoded == decoder->count) {
+		return -ENODATA;
+	}
+
+	ret = pair_decode(decoder, &record->timestamp, &record->value);
+	if (ret != 0) {
+		return ret;
+	}
+	decoder->decoded++;
+
+	return 0;
+}
+
+int meter_decoder_next_rollup(struct meter_decoder *decoder, struct meter_rollup *rollup)
+{
+	uint64_t count, below, above, last;
+	int ret;
+
+	if (decoder->type != METER_CODEC_TYPE_ROLLUP) {
+		return -EINVAL;
+	}
+	if (decoder->decoded == decoder->count) {
+		return -ENODATA;
+	}
+
+	ret = pair_decode(decoder, &rollup->start, &rollup->mean);
+	if (ret == 0) {
+		ret = varint_decode(decoder, &count);
+	}
+	if (ret == 0) {
+		ret = varint_decode(decoder, &below);
+	}
+	if (ret == 0) {
+		ret = varint_decode(decoder, &above);
+	}
+	if (ret == 0) {
+		ret = varint_decode(decoder, &last);
+	}
+	if (ret != 0) {
+		return ret;
+	}
+
+	rollup->count = (uint32_t)count;
+	rollup->min = (int32_t)(rollup->mean - (int64_t)below);
+	rollup->max = (int32_t)(rollup->mean + (int64_t)above);
+	rollup->last = (int32_t)(rollup->mean + zigzag_decode(last));
+	decoder->decoded++;
+
+	return 0;
+}
+
+int meter_codec_block_length(const uint8_t *buf, size_t length)
+{
+	struct meter_decoder decoder;
+	struct meter_record record;
+	struct meter_rollup rollup;
+	int ret;
+
+	ret = meter_decoder_init(&decoder, buf, length);
+	if (ret != 0) {
+		return ret;
+	}
+
+	do {
+		ret = (decoder.type == METER_CODEC_TYPE_ROLLUP) ?
+		      meter_decoder_next_rollup(&decoder, &rollup) :
+		      meter_decoder_next(&decoder, &record);
+	} while (ret == 0);
+
+	return (ret == -ENODATA) ? (int)decoder.offset : ret;
+}
+
+static void bench_sample(struct meter_record *record)
+{
+	/* Fixed period with occasional clock jitter, slowly increasing value. */
+	record->timestamp += BENCH_SAMPLE_PERIOD + (int)(sys_rand32_get() % 3) - 1;
+	record->value += sys_rand32_get() % 16;
+}
+
+static int cmd_bench(const struct shell *shell, size_t argc, char **argv)
+{
+	static uint8_t block[BENCH_BLOCK_SIZE];
+	struct meter_record record = { .timestamp = 1700000000, .value = 0 };
+	struct meter_record decoded;
+	struct meter_encoder encoder;
+	struct meter_decoder decoder;
+	uint32_t count = BENCH_DEFAULT_COUNT;
+	uint32_t encoded = 0, blocks = 0, bytes = 0, text_bytes = 0;
+	uint64_t encode_cycles = 0, decode_cycles = 0;
+	uint32_t start;
+	size_t length;
+	char text[24];
+	int ret;
+
+	if (argc > 1) {
+		count = strtoul(argv[1], NULL, 10);
+	}
+
+	bench_sample(&record);
+	while (encoded < count) {
+		struct meter_record first = record;
+
+		meter_encoder_init(&encoder, METER_CODEC_TYPE_DELTA, block, sizeof(block));
+		while (encoded < count) {
+			start = k_cycle_get_32();
+			ret = meter_encoder_add(&encoder, &record);
+			encode_cycles += k_cycle_get_32() - start;
+			if (ret != 0) {
+				break;
+			}
+			text_bytes += snprintf(text, sizeof(text), "%u,%d\n", record.timestamp,
+					       record.value);
+			encoded++;
+			bench_sample(&record);
+		}
+		length = meter_encoder_finish(&encoder);
+
+		/* Decode the block again and compare with the readings. */
+		meter_decoder_init(&decoder, block, length);
+		start = k_cycle_get_32();
+		while (meter_decoder_next(&decoder, &decoded) == 0) {
+		}
+		decode_cycles += k_cycle_get_32() - start;
+		if ((decoder.decoded != encoder.count) || (decoder.offset != length) ||
+		    (decoder.last.timestamp != encoder.last.timestamp) ||
+		    (decoder.last.value != encoder.last.value)) {
+			shell_error(shell, "Block %u starting at %u does not decode", blocks,
+				    first.timestamp);
+			return -EBADMSG;
+		}
+
+		blocks++;
+		bytes += length;
+	}
+
+	if (encoded == 0) {
+		return 0;
+	}
+
+	shell_fprintf(shell, SHELL_INFO, "readings: %u blocks: %u (%u B)\n", encoded, blocks,
+		      BENCH_BLOCK_SIZE);
+	shell_fprintf(shell, SHELL_INFO, "encoded: %u B (%u.%02u B/reading), text: %u B\n", bytes,
+		      bytes / encoded, (bytes % encoded) * 100 / encoded, text_bytes);
+	shell_fprintf(shell, SHELL_INFO, "cycles/reading encode: %llu decode: %llu\n",
+		      encode_cycles / encoded, decode_cycles / encoded);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_meter_codec,
+	SHELL_CMD_ARG(
+		bench, NULL,
+		"Encode and decode synthetic readings. (count)\n",
+		cmd_bench, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(meter_codec, &sub_meter_codec, "meter codec commands", NULL);
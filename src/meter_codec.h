@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __METER_CODEC_H__
+#define __METER_CODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**@brief Block type of delta-of-delta/zig-zag varint encoded readings. */
+#define METER_CODEC_TYPE_DELTA 0x01
+
+/**@brief Block type of rollups, encoded like readings with the mean as value. */
+#define METER_CODEC_TYPE_ROLLUP 0x02
+
+/**@brief Size of the block header: type and little-endian record count. */
+#define METER_CODEC_HEADER_SIZE 3
+
+/**@brief Maximum size of a single encoded record. */
+#define METER_CODEC_RECORD_MAX_SIZE 30
+
+/**@brief Meter reading. */
+struct meter_record {
+	/** Time of the reading [s]. */
+	uint32_t timestamp;
+	/** Reading value. */
+	int32_t value;
+};
+
+/**@brief Aggregate of the readings within an interval. */
+struct meter_rollup {
+	/** Start of the interval [s]. */
+	uint32_t start;
+	/** Number of readings. */
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	int32_t last;
+};
+
+/**@brief Streaming encoder of a single block. */
+struct meter_encoder {
+	uint8_t type;
+	uint8_t *buf;
+	size_t size;
+	size_t length;
+	uint16_t count;
+	struct meter_record last;
+	int64_t last_delta;
+};
+
+/**@brief Decoder of a single block. */
+struct meter_decoder {
+	uint8_t type;
+	const uint8_t *buf;
+	size_t length;
+	size_t offset;
+	uint16_t count;
+	uint16_t decoded;
+	struct meter_record last;
+	int64_t last_delta;
+};
+
+/**
+ * @brief Start encoding a block of given type into @p buf.
+ *
+ * @retval 0       Success.
+ * @retval -ENOSPC @p size cannot hold the block header.
+ */
+int meter_encoder_init(struct meter_encoder *encoder, uint8_t type, uint8_t *buf, size_t size);
+
+/**
+ * @brief Append a record to a METER_CODEC_TYPE_DELTA block.
+ *
+ * @retval 0       Record appended.
+ * @retval -ENOSPC Record does not fit. The block is left unchanged and the
+ *                 record has to go to the next block.
+ * @retval -EINVAL Block is of another type.
+ */
+int meter_encoder_add(struct meter_encoder *encoder, const struct meter_record *record);
+
+/**
+ * @brief Append a rollup to a METER_CODEC_TYPE_ROLLUP block.
+ *
+ * @retval 0       Rollup appended.
+ * @retval -ENOSPC Rollup does not fit. The block is left unchanged.
+ * @retval -EINVAL Block is of another type.
+ */
+int meter_encoder_add_rollup(struct meter_encoder *encoder, const struct meter_rollup *rollup);
+
+/**
+ * @brief Finish the block.
+ *
+ * @return Number of bytes used in the buffer.
+ */
+size_t meter_encoder_finish(struct meter_encoder *encoder);
+
+/**
+ * @brief Start decoding a block.
+ *
+ * @retval 0        Success.
+ * @retval -EBADMSG Not a valid block header.
+ */
+int meter_decoder_init(struct meter_decoder *decoder, const uint8_t *buf, size_t length);
+
+/**
+ * @brief Decode the next record of a METER_CODEC_TYPE_DELTA block.
+ *
+ * @retval 0        @p record is set.
+ * @retval -ENODATA All records were decoded.
+ * @retval -EBADMSG Block is truncated or corrupted.
+ * @retval -EINVAL  Block is of another type.
+ */
+int meter_decoder_next(struct meter_decoder *decoder, struct meter_record *record);
+
+/**
+ * @brief Decode the next rollup of a METER_CODEC_TYPE_ROLLUP block.
+ *
+ * @retval 0        @p rollup is set.
+ * @retval -ENODATA All rollups were decoded.
+ * @retval -EBADMSG Block is truncated or corrupted.
+ * @retval -EINVAL  Block is of another type.
+ */
+int meter_decoder_next_rollup(struct meter_decoder *decoder, struct meter_rollup *rollup);
+
+/**
+ * @brief Get number of bytes used by the encoded block, without padding.
+ *
+ * @return Encoded length, or negative error code of meter_decoder_next.
+ */
+int meter_codec_block_length(const uint8_t *buf, size_t length);
+
+#endif /* __METER_CODEC_H__ */
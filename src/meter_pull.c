@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/coap.h>
+
+#include "coap_utils.h"
+#include "meter_pull.h"
+#include "modem_utils.h"
+
+LOG_MODULE_REGISTER(meter_pull, CONFIG_METER_PULL_LOG_LEVEL);
+
+/* Time to wait for the modem before reading again */
+#define DEFER_INTERVAL K_SECONDS(1)
+
+struct roster_entry {
+	otIp6Address address;
+	/* Header of the last batch received from the meter */
+	uint8_t cursor[DELIVERY_HEADER_SIZE];
+	bool cursor_valid;
+	uint8_t failures;
+	bool in_use;
+};
+
+static struct roster_entry roster[CONFIG_METER_PULL_ROSTER_SIZE];
+static size_t roster_next;
+static meter_pull_claim_handler_t claim_handler;
+static meter_pull_release_handler_t release_handler;
+static struct k_work_delayable pull_work;
+/* Rounds run while the roster has meters */
+static bool pulling;
+
+/* Meter read in progress, -1 if none, and the session holding the modem */
+static int read_index = -1;
+static uint32_t read_session;
+static int64_t read_start_time;
+
+static struct meter_pull_stats stats;
+static K_MUTEX_DEFINE(pull_lock);
+
+static struct roster_entry *roster_find(const otIp6Address *address)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(roster); i++) {
+		if (roster[i].in_use && otIp6IsAddressEqual(&roster[i].address, address)) {
+			return &roster[i];
+		}
+	}
+
+	return NULL;
+}
+
+void meter_pull_roster_add(const otIp6Address *address)
+{
+	k_mutex_lock(&pull_lock, K_FOREVER);
+
+	if (roster_find(address) == NULL) {
+		for (size_t i = 0; i < ARRAY_SIZE(roster); i++) {
+			if (!roster[i].in_use) {
+				memset(&roster[i], 0, sizeof(roster[i]));
+				roster[i].address = *address;
+				roster[i].in_use = true;
+				LOG_DBG("Meter %zu added to roster", i);
+				if (!pulling) {
+					pulling = true;
+					k_work_schedule(&pull_work,
+							K_SECONDS(CONFIG_METER_PULL_PERIOD));
+				}
+				break;
+			}
+		}
+	}
+
+	k_mutex_unlock(&pull_lock);
+}
+
+void meter_pull_block_received(const otIp6Address *address, const uint8_t *block, size_t length)
+{
+	struct roster_entry *entry;
+
+	if (length < DELIVERY_HEADER_SIZE) {
+		return;
+	}
+
+	k_mutex_lock(&pull_lock, K_FOREVER);
+
+	entry = roster_find(address);
+	if (entry != NULL) {
+		memcpy(entry->cursor, block, sizeof(entry->cursor));
+		entry->cursor_valid = true;
+		entry->failures = 0;
+		if (read_index == (int)(entry - roster)) {
+			stats.blocks++;
+			stats.bytes += length;
+		}
+	}
+
+	k_mutex_unlock(&pull_lock);
+}
+
+static void read_end(void)
+{
+	/* The upload of the last block may have released the modem already. */
+	release_handler(read_session);
+
+	read_index = -1;
+	read_session = 0;
+	k_work_reschedule(&pull_work, K_NO_WAIT);
+}
+
+static void on_read_response(void *context, otMessage *message, const otMessageInfo *message_info,
+			     otError error)
+{
+	ARG_UNUSED(context);
+	ARG_UNUSED(message_info);
+
+	k_mutex_lock(&pull_lock, K_FOREVER);
+
+	if (read_index < 0) {
+		k_mutex_unlock(&pull_lock);
+		return;
+	}
+
+	stats.read_time += k_uptime_get() - read_start_time;
+
+	if ((error == OT_ERROR_NONE) && (message != NULL) &&
+	    (otCoapMessageGetCode(message) == OT_COAP_CODE_CONTENT)) {
+		LOG_DBG("Meter %d read", read_index);
+	} else if ((error == OT_ERROR_NONE) && (message != NULL) &&
+		   (otCoapMessageGetCode(message) == OT_COAP_CODE_VALID)) {
+		LOG_DBG("Meter %d has no new batches", read_index);
+		stats.empty++;
+	} else {
+		struct roster_entry *entry = &roster[read_index];
+
+		LOG_WRN("Read of meter %d failed (error: %d)", read_index, error);
+		stats.failed++;
+		if (++entry->failures >= CONFIG_METER_PULL_MAX_FAILURES) {
+			LOG_INF("Meter %d removed from roster", read_index);
+			entry->in_use = false;
+			stats.removed++;
+		}
+	}
+
+	read_end();
+
+	k_mutex_unlock(&pull_lock);
+}
+
+static bool roster_empty(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(roster); i++) {
+		if (roster[i].in_use) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static struct roster_entry *roster_next_entry(void)
+{
+	while (roster_next < ARRAY_SIZE(roster)) {
+		struct roster_entry *entry = &roster[roster_next++];
+
+		if (entry->in_use) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void pull_work_handler(struct k_work *work)
+{
+	struct roster_entry *entry;
+	otIp6Address address;
+	uint8_t cursor[DELIVERY_HEADER_SIZE];
+	uint16_t cursor_length;
+
+	ARG_UNUSED(work);
+
+	/* Reads are paced by the modem, a read adds no more than it drains. */
+	if (modem_cloud_queue_depth() >= CONFIG_METER_PULL_QUEUE_DEPTH) {
+		k_mutex_lock(&pull_lock, K_FOREVER);
+		stats.deferred++;
+		k_mutex_unlock(&pull_lock);
+		k_work_reschedule(&pull_work, DEFER_INTERVAL);
+		return;
+	}
+
+	k_mutex_lock(&pull_lock, K_FOREVER);
+
+	if (read_index >= 0) {
+		k_mutex_unlock(&pull_lock);
+		return;
+	}
+
+	entry = roster_next_entry();
+	if (entry == NULL) {
+		/* Round finished, the next one starts with the period or the next meter. */
+		roster_next = 0;
+		pulling = !roster_empty();
+		if (pulling) {
+			k_work_reschedule(&pull_work, K_SECONDS(CONFIG_METER_PULL_PERIOD));
+		}
+		k_mutex_unlock(&pull_lock);
+		return;
+	}
+
+	/* The modem is claimed under the same lock as for uploads pushed by meters. */
+	read_session = claim_handler(&entry->address);
+	if (read_session == 0) {
+		roster_next = (size_t)(entry - roster);
+		stats.deferred++;
+		k_mutex_unlock(&pull_lock);
+		k_work_reschedule(&pull_work, DEFER_INTERVAL);
+		return;
+	}
+
+	address = entry->address;
+	cursor_length = entry->cursor_valid ? sizeof(cursor) : 0;
+	memcpy(cursor, entry->cursor, sizeof(cursor));
+	read_index = (int)(entry - roster);
+	read_start_time = k_uptime_get();
+	stats.reads++;
+	LOG_DBG("Read meter %d", read_index);
+
+	k_mutex_unlock(&pull_lock);
+
+	if (coap_utils_meter_pull(&address, cursor, cursor_length, on_read_response) !=
+	    OT_ERROR_NONE) {
+		on_read_response(NULL, NULL, NULL, OT_ERROR_FAILED);
+	}
+}
+
+int meter_pull_init(meter_pull_claim_handler_t claim, meter_pull_release_handler_t release)
+{
+	if ((claim == NULL) || (release == NULL)) {
+		return -EINVAL;
+	}
+
+	claim_handler = claim;
+	release_handler = release;
+	k_work_init_delayable(&pull_work, pull_work_handler);
+
+	return 0;
+}
+
+void meter_pull_get_stats(struct meter_pull_stats *out)
+{
+	k_mutex_lock(&pull_lock, K_FOREVER);
+	*out = stats;
+	k_mutex_unlock(&pull_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct meter_pull_stats current;
+	uint32_t meters = 0;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&pull_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		k_mutex_unlock(&pull_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	k_mutex_lock(&pull_lock, K_FOREVER);
+	current = stats;
+	for (size_t i = 0; i < ARRAY_SIZE(roster); i++) {
+		meters += roster[i].in_use ? 1 : 0;
+	}
+	k_mutex_unlock(&pull_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "roster: %u/%u meters\n", meters,
+		      CONFIG_METER_PULL_ROSTER_SIZE);
+	shell_fprintf(shell, SHELL_INFO, "reads: %u empty: %u failed: %u deferred: %u\n",
+		      current.reads, current.empty, current.failed, current.deferred);
+	shell_fprintf(shell, SHELL_INFO, "removed meters: %u\n", current.removed);
+	shell_fprintf(shell, SHELL_INFO, "blocks: %u bytes: %llu\n", current.blocks,
+		      current.bytes);
+	shell_fprintf(shell, SHELL_INFO, "read time avg: %llu ms\n",
+		      current.reads ? current.read_time / current.reads : 0);
+
+	return 0;
+}
+
+static int cmd_roster(const struct shell *shell, size_t argc, char **argv)
+{
+	char address[OT_IP6_ADDRESS_STRING_SIZE];
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	k_mutex_lock(&pull_lock, K_FOREVER);
+	for (size_t i = 0; i < ARRAY_SIZE(roster); i++) {
+		if (!roster[i].in_use) {
+			continue;
+		}
+		otIp6AddressToString(&roster[i].address, address, sizeof(address));
+		shell_fprintf(shell, SHELL_INFO, "%zu: %s failures: %u%s\n", i, address,
+			      roster[i].failures, roster[i].cursor_valid ? "" : " (no cursor)");
+	}
+	k_mutex_unlock(&pull_lock);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_meter_pull,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset pull collection statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_CMD_ARG(
+		roster, NULL,
+		"List meters read by the gateway.\n",
+		cmd_roster, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(meter_pull, &sub_meter_pull, "meter pull commands", NULL);
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __METER_PULL_H__
+#define __METER_PULL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <openthread/ip6.h>
+
+#include "delivery.h"
+
+/**@brief Pull collection statistics. */
+struct meter_pull_stats {
+	/** Reads sent to meters. */
+	uint32_t reads;
+	/** Reads answered without new batches. */
+	uint32_t empty;
+	/** Reads that failed. */
+	uint32_t failed;
+	/** Reads put off because the modem was busy or its queue too deep. */
+	uint32_t deferred;
+	/** Meters removed from the roster after failed reads. */
+	uint32_t removed;
+	/** Blocks and bytes received by reads. */
+	uint32_t blocks;
+	uint64_t bytes;
+	/** Time from read request to the last block [ms]. */
+	uint64_t read_time;
+};
+
+/**
+ * @brief Callback claiming the idle modem for the read of a meter.
+ *
+ * @return session holding the modem busy, 0 if the modem is not idle.
+ */
+typedef uint32_t (*meter_pull_claim_handler_t)(const otIp6Address *peer);
+
+/**
+ * @brief Callback ending the session of a read, unless it ended already.
+ */
+typedef void (*meter_pull_release_handler_t)(uint32_t session);
+
+/**
+ * @brief Initialize pull collection.
+ *
+ * Rounds over the roster start once a meter is added to it, and stop when
+ * the roster is empty.
+ */
+int meter_pull_init(meter_pull_claim_handler_t claim, meter_pull_release_handler_t release);
+
+/**
+ * @brief Add meter to the roster.
+ *
+ * Meters are added when they find the own modem accepting data, so only
+ * gateways with a modem read meters. A full roster ignores new meters.
+ */
+void meter_pull_roster_add(const otIp6Address *address);
+
+/**
+ * @brief Note a block received from a meter, during a read or an upload.
+ *
+ * The header of the batch in the block is sent with the next read, the meter
+ * sends the batches following it.
+ *
+ * @param[in] address address of the meter.
+ * @param[in] block   block starting with the batch header.
+ * @param[in] length  size of the block.
+ */
+void meter_pull_block_received(const otIp6Address *address, const uint8_t *block, size_t length);
+
+/**
+ * @brief Get a copy of the pull collection statistics.
+ */
+void meter_pull_get_stats(struct meter_pull_stats *stats);
+
+#endif /* __METER_PULL_H__ */
@@ -9,8 +9,23 @@ typedef enum {
 	MODEM_STATE_BUSY
 } modem_state;
 
+/**@brief Enumeration describing traffic class of published data. */
+typedef enum {
+	MODEM_TRAFFIC_BULK,
+	MODEM_TRAFFIC_URGENT,
+	MODEM_TRAFFIC_COUNT
+} modem_traffic_class;
+
+struct net_buf;
+
 typedef void (*modem_utils_state_handler_t)(modem_state state);
 
+/**@brief Callback for data acknowledged by the broker, see modem_cloud_publish_tagged. */
+typedef void (*modem_utils_ack_handler_t)(uint32_t tag);
+
+/**@brief Callback for commands received from the cloud. */
+typedef void (*modem_utils_command_handler_t)(const uint8_t *data, size_t size);
+
 /**
  * @brief Initialize modem.
  */
@@ -31,6 +46,64 @@ void modem_set_state(modem_state);
  */
 int modem_cloud_connect(void);
 
+/**
+ * @brief Publish bulk data to the cloud.
+ */
 int modem_cloud_upload_data(const uint8_t *data, size_t size);
 
+/**
+ * @brief Publish data of given traffic class to the cloud.
+ *
+ * @note Urgent data is published with its own topic and QoS, before any
+ *       pending bulk data.
+ */
+int modem_cloud_publish(modem_traffic_class traffic_class, const uint8_t *data, size_t size);
+
+/**
+ * @brief Publish data and report when the broker acknowledged it.
+ *
+ * @note The handler set with modem_set_ack_handler is called with @p tag
+ *       once the data was acknowledged. Tag 0 is not reported.
+ */
+int modem_cloud_publish_tagged(modem_traffic_class traffic_class, const uint8_t *data, size_t size,
+			       uint32_t tag);
+
+/**
+ * @brief Publish data held in a block of the shared pool, see block_pool_alloc.
+ *
+ * The modem takes its own reference to @p buf instead of copying the data,
+ * the caller releases its reference when done with the block.
+ *
+ * @note Tags are reported as for modem_cloud_publish_tagged.
+ */
+int modem_cloud_publish_buf(modem_traffic_class traffic_class, struct net_buf *buf, uint32_t tag);
+
+/**
+ * @brief Set callback for data acknowledged by the broker.
+ */
+void modem_set_ack_handler(modem_utils_ack_handler_t handler);
+
+/**
+ * @brief Set callback for commands received from the cloud.
+ *
+ * @note Commands are received on the command topic of the mesh, the
+ *       command topic followed by the extended PAN ID in hex, subscribed
+ *       once the broker is connected.
+ */
+void modem_set_command_handler(modem_utils_command_handler_t handler);
+
+/**
+ * @brief Set callback for image messages received from the cloud.
+ *
+ * @note Image messages are received on the image topic, subscribed once the
+ *       broker is connected.
+ */
+void modem_set_image_handler(modem_utils_command_handler_t handler);
+
+/**
+ * @brief Get number of payloads waiting for the broker, including the one
+ *        being published.
+ */
+uint32_t modem_cloud_queue_depth(void);
+
 #endif /* __MODEM_UTILS_H__ */
\ No newline at end of file
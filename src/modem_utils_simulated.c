@@ -1,14 +1,23 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/net/buf.h>
 
 #include "modem_utils.h"
 
+#if CONFIG_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
 #include <zephyr/shell/shell.h>
 
 LOG_MODULE_REGISTER(modem_util, CONFIG_MODEM_UTILS_LOG_LEVEL);
 
 static modem_state current_modem_state = MODEM_STATE_UNKNOWN;
 static modem_utils_state_handler_t state_handler;
+static modem_utils_ack_handler_t ack_handler;
+static modem_utils_command_handler_t command_handler;
+static modem_utils_command_handler_t image_handler;
+static uint32_t published[MODEM_TRAFFIC_COUNT];
 
 int modem_init(modem_utils_state_handler_t handler)
 {
@@ -35,13 +44,62 @@ int modem_cloud_connect(void)
 }
 
 int modem_cloud_upload_data(const uint8_t *data, size_t size)
+{
+    return modem_cloud_publish(MODEM_TRAFFIC_BULK, data, size);
+}
+
+int modem_cloud_publish(modem_traffic_class traffic_class, const uint8_t *data, size_t size)
+{
+    return modem_cloud_publish_tagged(traffic_class, data, size, 0);
+}
+
+int modem_cloud_publish_tagged(modem_traffic_class traffic_class, const uint8_t *data, size_t size,
+                               uint32_t tag)
 {
     if (data) {
-        LOG_HEXDUMP_INF(data, size, "upload data:");
+        if (traffic_class == MODEM_TRAFFIC_URGENT) {
+            LOG_HEXDUMP_INF(data, size, "upload urgent data:");
+        } else {
+            LOG_HEXDUMP_INF(data, size, "upload data:");
+        }
+        published[traffic_class]++;
+#if CONFIG_ENERGY_ACCOUNTING
+        energy_uploaded(size);
+#endif
+        /* Simulated broker acknowledges right away. */
+        if ((tag != 0) && ack_handler) {
+            ack_handler(tag);
+        }
     }
     return 0;
 }
 
+int modem_cloud_publish_buf(modem_traffic_class traffic_class, struct net_buf *buf, uint32_t tag)
+{
+    return modem_cloud_publish_tagged(traffic_class, buf->data, buf->len, tag);
+}
+
+void modem_set_ack_handler(modem_utils_ack_handler_t handler)
+{
+    ack_handler = handler;
+}
+
+void modem_set_command_handler(modem_utils_command_handler_t handler)
+{
+    command_handler = handler;
+}
+
+void modem_set_image_handler(modem_utils_command_handler_t handler)
+{
+    image_handler = handler;
+}
+
+uint32_t modem_cloud_queue_depth(void)
+{
+    /* Simulated publish completes right away. */
+    return 0;
+}
+
 static int cmd_state(const struct shell *shell, size_t argc, char **argv)
 {
 	if (argc < 2) {
@@ -70,12 +128,60 @@ static int cmd_state(const struct shell *shell, size_t argc, char **argv)
     return 0;
 }
 
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+    shell_fprintf(shell, SHELL_INFO, "bulk: published %u\n", published[MODEM_TRAFFIC_BULK]);
+    shell_fprintf(shell, SHELL_INFO, "urgent: published %u\n", published[MODEM_TRAFFIC_URGENT]);
+
+    return 0;
+}
+
+static int cmd_command(const struct shell *shell, size_t argc, char **argv)
+{
+    if (command_handler == NULL) {
+        shell_fprintf(shell, SHELL_INFO, "No command handler\n");
+        return -ENOENT;
+    }
+
+    /* Simulated broker delivers the command right away. */
+    command_handler((const uint8_t *)argv[1], strlen(argv[1]));
+    shell_fprintf(shell, SHELL_INFO, "Done\n");
+
+    return 0;
+}
+
+static int cmd_image(const struct shell *shell, size_t argc, char **argv)
+{
+    if (image_handler == NULL) {
+        shell_fprintf(shell, SHELL_INFO, "No image handler\n");
+        return -ENOENT;
+    }
+
+    /* Simulated broker delivers the image message right away. */
+    image_handler((const uint8_t *)argv[1], strlen(argv[1]));
+    shell_fprintf(shell, SHELL_INFO, "Done\n");
+
+    return 0;
+}
+
 SHELL_STATIC_SUBCMD_SET_CREATE(
 	sub_modem_utils,
 	SHELL_CMD_ARG(
 		state, NULL,
 		"Get/Set modem state. (off, idle, busy)\n",
 		cmd_state, 1, 1),
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get publish statistics per traffic class.\n",
+		cmd_stats, 1, 0),
+	SHELL_CMD_ARG(
+		command, NULL,
+		"Receive command from the cloud. (message)\n",
+		cmd_command, 2, 0),
+	SHELL_CMD_ARG(
+		image, NULL,
+		"Receive image message from the cloud. (message)\n",
+		cmd_image, 2, 0),
 	SHELL_SUBCMD_SET_END);
 
 SHELL_CMD_REGISTER(modem_utils, &sub_modem_utils, "modem utils commands", NULL);
\ No newline at end of file
@@ -1,9 +1,34 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
 #include <stdio.h>
+#include <openthread/thread.h>
 #include "modem_utils.h"
+#include "block_pool.h"
 #include <modem/modem_slm.h>
 
+#if CONFIG_CLOUD_COMPRESS
+#include "cloud_compress.h"
+#endif
+
+#if CONFIG_CLOUD_STORE
+#include "cloud_store.h"
+#endif
+
+#if CONFIG_RUNTIME_MONITOR
+#include "runtime_monitor.h"
+#endif
+
+#if CONFIG_ENERGY_ACCOUNTING
+#include "energy.h"
+#endif
+
+#if CONFIG_BEARER_SELECT
+#include "bearer_select.h"
+#endif
+
 LOG_MODULE_REGISTER(modem_util, CONFIG_MODEM_UTILS_LOG_LEVEL);
 
 /**@brief Enumeration describing mqtt cloud state. */
@@ -20,43 +45,136 @@ typedef enum {
 	MQTT_PUB_STATE_FAILED
 } mqtt_publish_state;
 
+/**@brief Publish statistics of a traffic class. */
+struct mqtt_traffic_stats {
+	uint32_t published;
+	uint32_t failed;
+	uint32_t last_latency;
+	uint32_t max_latency;
+	uint64_t total_latency;
+};
+
 #define MODEM_WORKQ_STACK_SIZE 2048
 #define MODEM_WORKQ_PRIORITY 5
 #define MQTT_PUBLISH_CHECK_TIMEOUT K_SECONDS(10)
 #define MQTT_PUBLISH_MAX_RETRY 3
-#define MQTT_PUBLISH_BUFFER_SIZE 1024
 
 #define SLM_SYNC_CHECK_TIMEOUT K_MSEC(CONFIG_MODEM_SLM_POWER_PIN_TIME + 1000)
 #define SLM_SYNC_STR       "Ready\r\n"
-/* TODO: Make modem link mode configurable */
+#if CONFIG_MODEM_UTILS_SLM_LINK_MODE_LTE_M
+#define SLM_LINK_MODE      "AT%XSYSTEMMODE=1,0,0,0\r\n"
+#elif CONFIG_MODEM_UTILS_SLM_LINK_MODE_LTE_M_NB_IOT
+#define SLM_LINK_MODE      "AT%XSYSTEMMODE=1,1,0,0\r\n"
+#else
 #define SLM_LINK_MODE      "AT%XSYSTEMMODE=0,1,0,0\r\n"
+#endif
 #define SLM_LINK_CEREG_5   "AT+CEREG=5\r\n"
 #define SLM_LINK_CFUN_1    "AT+CFUN=1\r\n"
-/* TODO: Make MQTT cfg/con/pub arguments configurable */
-#define SLM_MQTT_CFG       "AT#XMQTTCFG=\"MyMQTT-Client-ID-1234\",300,1\r\n"
-#define SLM_MQTT_CON       "AT#XMQTTCON=1,\"\",\"\",\"broker.hivemq.com\",1883\r\n"
-#define SLM_MQTT_PUB_A     "AT#XMQTTPUB=\"slm\",\""
-#define SLM_MQTT_PUB_B     "\",1,0\r\n"
+#define SLM_LINK_CFUN_4    "AT+CFUN=4\r\n"
+#define SLM_LINK_CESQ_1    "AT%CESQ=1\r\n"
+/* RSRP index of %CESQ, 0 is -140 dBm and 255 unknown */
+#define SLM_CESQ_RSRP_MAX  97
+#define SLM_CESQ_RSRP_OFFSET 140
+/* Clean session, the broker keeps no state for the client. */
+#define SLM_MQTT_CFG       "AT#XMQTTCFG=\"" CONFIG_MODEM_UTILS_MQTT_CLIENT_ID "\"," \
+                           STRINGIFY(CONFIG_MODEM_UTILS_MQTT_KEEPALIVE) ",1\r\n"
+#define SLM_MQTT_CON       "AT#XMQTTCON=1,\"\",\"\",\"" CONFIG_MODEM_UTILS_MQTT_BROKER "\"," \
+                           STRINGIFY(CONFIG_MODEM_UTILS_MQTT_PORT) "\r\n"
+#define SLM_MQTT_DISCON    "AT#XMQTTCON=0\r\n"
+/* Empty message enters data mode, the payload is escaped, see publish_data_send. */
+#define SLM_MQTT_PUB_FMT   "AT#XMQTTPUB=\"%s\",\"\",%d,0\r\n"
+#define SLM_MQTT_PUB_CMD_SIZE 64
+#define SLM_MQTT_SUB_FMT   "AT#XMQTTSUB=\"%s\",%d\r\n"
+#define SLM_DATAMODE_TERMINATOR "+++"
+#define SLM_ESCAPE         0x7d
+#define SLM_ESCAPE_XOR     0x20
+#define SLM_ESCAPE_CHUNK   64
+
+/* Probes are acknowledged, so the latency covers the round trip. */
+#define BEARER_PROBE_QOS 1
+#define BEARER_PROBE_BUSY_RETRY K_SECONDS(1)
 
 static modem_state current_modem_state = MODEM_STATE_UNKNOWN;
 static mqtt_cloud_state mqtt_state = MQTT_CLOUD_STATE_DISCONNECTED;
 static modem_utils_state_handler_t state_handler;
 static mqtt_publish_state mqtt_pub_state = MQTT_PUB_STATE_IDLE;
 static uint8_t mqtt_pub_retries = 0;
-static char mqtt_publish_buffer[MQTT_PUBLISH_BUFFER_SIZE];
+/* Block being published, referenced until the publish is done */
+static struct net_buf *mqtt_publish_buf;
+static modem_traffic_class mqtt_pub_class = MODEM_TRAFFIC_BULK;
+static uint32_t mqtt_pub_tag;
+static modem_utils_ack_handler_t ack_handler;
+static modem_utils_command_handler_t command_handler;
+static modem_utils_command_handler_t image_handler;
+/* Command topic of the own mesh, the prefix and the extended PAN ID in hex */
+static char command_topic[sizeof(CONFIG_MODEM_UTILS_MQTT_COMMAND_TOPIC) + 2 * OT_EXT_PAN_ID_SIZE + 1];
+static int64_t mqtt_pub_enqueue_time;
+#if CONFIG_ENERGY_ACCOUNTING
+/* Size of the ongoing publish before compression */
+static size_t mqtt_pub_size;
+#endif
+/* Urgent data waiting for the ongoing publish to finish */
+static struct net_buf *mqtt_urgent_buf;
+static int64_t mqtt_urgent_enqueue_time;
+static uint32_t mqtt_urgent_tag;
+static struct mqtt_traffic_stats traffic_stats[MODEM_TRAFFIC_COUNT];
+#if CONFIG_CLOUD_STORE
+/* Ongoing publish is the oldest entry of the store */
+static bool mqtt_pub_stored;
+#endif
+#if CONFIG_BEARER_SELECT
+/* Bearer the modem is set to, and the one being probed or BEARER_COUNT */
+static enum bearer link_bearer = BEARER_COUNT;
+static enum bearer probe_bearer = BEARER_COUNT;
+/* Ongoing publish is a probe, and the state it interrupted */
+static bool mqtt_pub_probe;
+static mqtt_publish_state probe_saved_state;
+/* Bearers still to probe in this round, and the probe publish was acknowledged */
+static uint8_t probe_pending;
+static bool probe_measured;
+static int64_t mqtt_pub_send_time;
+#endif
+static K_MUTEX_DEFINE(publish_lock);
+
+static const char *const mqtt_topics[MODEM_TRAFFIC_COUNT] = {
+    [MODEM_TRAFFIC_BULK] = CONFIG_MODEM_UTILS_MQTT_BULK_TOPIC,
+    [MODEM_TRAFFIC_URGENT] = CONFIG_MODEM_UTILS_MQTT_URGENT_TOPIC,
+};
+
+static const int mqtt_qos[MODEM_TRAFFIC_COUNT] = {
+    [MODEM_TRAFFIC_BULK] = CONFIG_MODEM_UTILS_MQTT_BULK_QOS,
+    [MODEM_TRAFFIC_URGENT] = CONFIG_MODEM_UTILS_MQTT_URGENT_QOS,
+};
 
 K_THREAD_STACK_DEFINE(modem_workq_stack_area, MODEM_WORKQ_STACK_SIZE);
 
 SLM_MONITOR(network, "\r\n+CEREG:", cereg_mon);
 SLM_MONITOR(mqtt_cloud, "\r\n#XMQTTEVT:", mqtt_cloud_mon);
+SLM_MONITOR(mqtt_message, "\r\n#XMQTTMSG:", mqtt_message_mon);
+#if CONFIG_BEARER_SELECT
+SLM_MONITOR(signal, "\r\n%CESQ:", cesq_mon);
+#endif
 
 static struct k_work_q modem_workq;
 static struct k_work on_modem_sync_work;
 static struct k_work publish_send_work;
+static struct k_work subscribe_work;
 static struct k_work_delayable modem_sync_check_work;
 static struct k_work_delayable publish_check_work;
+#if CONFIG_CLOUD_STORE
+static struct k_work_delayable store_drain_work;
+#endif
+#if CONFIG_BEARER_SELECT
+static struct k_work_delayable bearer_probe_work;
+#endif
 
 void modem_link_init(void);
+static void publish_start(modem_traffic_class traffic_class, struct net_buf *buf, uint32_t tag,
+                          int64_t enqueue_time, size_t size);
+static void publish_done(bool success);
+#if CONFIG_BEARER_SELECT
+static void probe_publish(void);
+#endif
 
 static void cereg_mon(const char *notif)
 {
@@ -84,20 +202,85 @@ static void mqtt_cloud_mon(const char *notif)
 		    LOG_INF("MQTT broker connected");
             mqtt_state = MQTT_CLOUD_STATE_CONNECTED;
             modem_set_state(MODEM_STATE_IDLE);
+            k_work_submit_to_queue(&modem_workq, &subscribe_work);
+#if CONFIG_BEARER_SELECT
+            probe_publish();
+#endif
+#if CONFIG_CLOUD_STORE
+            k_work_reschedule_for_queue(&modem_workq, &store_drain_work, K_NO_WAIT);
+#endif
         } else {
             LOG_INF("MQTT broker disconnected");
         }
     } else if (event == 3) {
+        k_work_cancel_delayable(&publish_check_work);
         if (result == 0) {
             LOG_INF("MQTT message published");
-            mqtt_pub_state = MQTT_PUB_STATE_IDLE;
         } else {
             LOG_INF("MQTT message not published");
-            mqtt_pub_state = MQTT_PUB_STATE_FAILED;
         }
-        k_work_cancel_delayable(&publish_check_work);
+        publish_done(result == 0);
+    }
+}
+
+/* Notification is "#XMQTTMSG: <topic length>,<message length>", then topic and message lines. */
+static void mqtt_message_mon(const char *notif)
+{
+    const char *params = notif + strlen("\r\n#XMQTTMSG: ");
+    const char *topic, *message;
+    int topic_length, message_length;
+
+    topic_length = atoi(params);
+    params = strchr(params, ',');
+    if (params == NULL) {
+        return;
+    }
+    message_length = atoi(params + 1);
+    topic = strstr(params, "\r\n");
+    if ((topic == NULL) || (topic_length < 0) || (message_length <= 0)) {
+        LOG_WRN("Invalid MQTT message notification");
+        return;
+    }
+    topic += strlen("\r\n");
+    if (strlen(topic) < (size_t)topic_length + strlen("\r\n") + message_length) {
+        LOG_WRN("Truncated MQTT message");
+        return;
+    }
+    message = topic + topic_length + strlen("\r\n");
+
+    LOG_INF("MQTT message received, %d bytes", message_length);
+    if ((topic_length == strlen(CONFIG_MODEM_UTILS_MQTT_IMAGE_TOPIC)) &&
+        (strncmp(topic, CONFIG_MODEM_UTILS_MQTT_IMAGE_TOPIC, topic_length) == 0)) {
+        if (image_handler) {
+            image_handler((const uint8_t *)message, message_length);
+        }
+    } else if ((topic_length == strlen(command_topic)) &&
+               (strncmp(topic, command_topic, topic_length) == 0)) {
+        if (command_handler) {
+            command_handler((const uint8_t *)message, message_length);
+        }
+    } else {
+        LOG_WRN("MQTT message of unknown topic");
+    }
+}
+
+#if CONFIG_BEARER_SELECT
+/* Notification is "%CESQ: <rsrp>,<rsrp threshold>,<rsrq>,<rsrq threshold>". */
+static void cesq_mon(const char *notif)
+{
+    int rsrp = atoi(notif + strlen("\r\n%CESQ: "));
+    enum bearer bearer;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    bearer = link_bearer;
+    k_mutex_unlock(&publish_lock);
+
+    if ((rsrp < 0) || (rsrp > SLM_CESQ_RSRP_MAX) || (bearer >= BEARER_COUNT)) {
+        return;
     }
+    bearer_select_signal(bearer, rsrp - SLM_CESQ_RSRP_OFFSET);
 }
+#endif
 
 static void on_slm_data(const uint8_t *data, size_t datalen)
 {
@@ -117,17 +300,125 @@ static void on_modem_sync(struct k_work *item)
     modem_link_init();
 }
 
+/*
+ * SLM leaves data mode on the terminator anywhere in the data, and binary
+ * blocks may contain it. As in HDLC, every '+' and escape byte is sent as
+ * the escape byte followed by the byte XOR 0x20, so the payload never holds
+ * a '+'. This is part of the wire format of every published payload, the
+ * cloud reverses it before anything else, see scripts/slm_payload.py.
+ */
+static int publish_data_send(const uint8_t *data, size_t size)
+{
+    uint8_t chunk[SLM_ESCAPE_CHUNK];
+    size_t length = 0;
+    int ret;
+
+    for (size_t i = 0; i < size; i++) {
+        if (length + 2 > sizeof(chunk)) {
+            ret = modem_slm_send_data(chunk, length);
+            if (ret) {
+                return ret;
+            }
+            length = 0;
+        }
+        if ((data[i] == SLM_DATAMODE_TERMINATOR[0]) || (data[i] == SLM_ESCAPE)) {
+            chunk[length++] = SLM_ESCAPE;
+            chunk[length++] = data[i] ^ SLM_ESCAPE_XOR;
+        } else {
+            chunk[length++] = data[i];
+        }
+    }
+
+    return (length > 0) ? modem_slm_send_data(chunk, length) : 0;
+}
+
 void publish_send(struct k_work *work)
 {
+    char cmd[SLM_MQTT_PUB_CMD_SIZE];
+    const char *topic;
+    struct net_buf *buf;
+    int qos;
     int ret;
 
+    /* The publish may time out meanwhile, the block is kept until sent. */
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    if (mqtt_publish_buf == NULL) {
+        k_mutex_unlock(&publish_lock);
+        return;
+    }
+    buf = net_buf_ref(mqtt_publish_buf);
+    topic = mqtt_topics[mqtt_pub_class];
+    qos = mqtt_qos[mqtt_pub_class];
+#if CONFIG_BEARER_SELECT
+    if (mqtt_pub_probe) {
+        topic = CONFIG_BEARER_SELECT_PROBE_TOPIC;
+        qos = BEARER_PROBE_QOS;
+    }
+    if (mqtt_pub_retries == 0) {
+        mqtt_pub_send_time = k_uptime_get();
+    }
+#endif
+    snprintf(cmd, sizeof(cmd), SLM_MQTT_PUB_FMT, topic, qos);
+    k_mutex_unlock(&publish_lock);
+
     LOG_INF("Sending SLM data");
-    ret = modem_slm_send_cmd(mqtt_publish_buffer, 0);
+    ret = modem_slm_send_cmd(cmd, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", cmd, ret);
+        goto end;
+    }
+    ret = publish_data_send(buf->data, buf->len);
     if (ret) {
         LOG_ERR("Cannot send SLM data (error: %d)", ret);
-        return;
+    }
+    /* Terminator is sent anyway to leave data mode. */
+    ret = modem_slm_send_data((const uint8_t *)SLM_DATAMODE_TERMINATOR,
+                              strlen(SLM_DATAMODE_TERMINATOR));
+    if (ret) {
+        LOG_ERR("Cannot exit SLM data mode (error: %d)", ret);
+        goto end;
     }
     mqtt_pub_retries++;
+
+end:
+    net_buf_unref(buf);
+}
+
+/* Commands are addressed to the mesh, gateways of other meshes do not queue them. */
+static void command_topic_update(void)
+{
+    struct openthread_context *ot_context = openthread_get_default_context();
+    otExtendedPanId ext_pan_id;
+    char hex[2 * OT_EXT_PAN_ID_SIZE + 1];
+
+    openthread_api_mutex_lock(ot_context);
+    ext_pan_id = *otThreadGetExtendedPanId(ot_context->instance);
+    openthread_api_mutex_unlock(ot_context);
+
+    bin2hex(ext_pan_id.m8, sizeof(ext_pan_id.m8), hex, sizeof(hex));
+    snprintf(command_topic, sizeof(command_topic), "%s/%s",
+             CONFIG_MODEM_UTILS_MQTT_COMMAND_TOPIC, hex);
+}
+
+static void subscribe(struct k_work *work)
+{
+    char cmd[SLM_MQTT_PUB_CMD_SIZE];
+    int ret;
+
+    command_topic_update();
+    snprintf(cmd, sizeof(cmd), SLM_MQTT_SUB_FMT, command_topic,
+             CONFIG_MODEM_UTILS_MQTT_COMMAND_QOS);
+    ret = modem_slm_send_cmd(cmd, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", cmd, ret);
+    }
+
+    snprintf(cmd, sizeof(cmd), SLM_MQTT_SUB_FMT, CONFIG_MODEM_UTILS_MQTT_IMAGE_TOPIC,
+             CONFIG_MODEM_UTILS_MQTT_IMAGE_QOS);
+    ret = modem_slm_send_cmd(cmd, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", cmd, ret);
+    }
 }
 
 static void modem_sync_check(struct k_work *work)
@@ -149,7 +440,7 @@ static void publish_check(struct k_work *work)
     if (mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) {
         if (mqtt_pub_retries >= MQTT_PUBLISH_MAX_RETRY) {
             LOG_ERR("MQTT publish retries exceeded");
-            mqtt_pub_state = MQTT_PUB_STATE_FAILED;
+            publish_done(false);
             return;
         }
         LOG_INF("MQTT publish still in progress. Resending...");
@@ -159,18 +450,230 @@ static void publish_check(struct k_work *work)
     }
 }
 
+#if CONFIG_CLOUD_STORE
+/* Forward stored data one entry at a time, each as soon as the last one is acked. */
+static void store_drain(struct k_work *work)
+{
+    modem_traffic_class traffic_class;
+    struct net_buf *buf;
+    uint32_t tag;
+    int ret;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+
+    /* Resumed by publish_done when the ongoing publish is finished. */
+    if ((mqtt_state != MQTT_CLOUD_STATE_CONNECTED) ||
+        (mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) || (mqtt_urgent_buf != NULL)) {
+        goto end;
+    }
+
+    buf = block_pool_alloc();
+    if (buf == NULL) {
+        k_work_reschedule_for_queue(&modem_workq, &store_drain_work, MQTT_PUBLISH_CHECK_TIMEOUT);
+        goto end;
+    }
+
+    ret = cloud_store_peek(&traffic_class, &tag, buf->data, net_buf_tailroom(buf));
+    if (ret < 0) {
+        net_buf_unref(buf);
+        goto end;
+    }
+
+    LOG_INF("Forwarding %d stored bytes", ret);
+    net_buf_add(buf, ret);
+    mqtt_pub_stored = true;
+    /* Stored data was counted as uploaded when it was stored. */
+    publish_start(traffic_class, buf, tag, k_uptime_get(), 0);
+
+end:
+    k_mutex_unlock(&publish_lock);
+}
+#endif
+
+#if CONFIG_BEARER_SELECT
+/* Switch the modem to a bearer, the broker is connected again once registered. */
+static void link_switch(enum bearer bearer)
+{
+    bool connected;
+    int ret;
+
+    LOG_INF("Switching LTE bearer to %d", bearer);
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    connected = (mqtt_state != MQTT_CLOUD_STATE_DISCONNECTED);
+    mqtt_state = MQTT_CLOUD_STATE_DISCONNECTED;
+    link_bearer = bearer;
+    k_mutex_unlock(&publish_lock);
+
+    if (connected) {
+        ret = modem_slm_send_cmd(SLM_MQTT_DISCON, 0);
+        if (ret) {
+            LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_MQTT_DISCON, ret);
+        }
+    }
+    /* System mode can only be changed offline. */
+    ret = modem_slm_send_cmd(SLM_LINK_CFUN_4, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_CFUN_4, ret);
+    }
+    ret = modem_slm_send_cmd(bearer_select_mode_cmd(bearer), 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", bearer_select_mode_cmd(bearer), ret);
+    }
+    ret = modem_slm_send_cmd(SLM_LINK_CFUN_1, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_CFUN_1, ret);
+    }
+}
+
+/*
+ * Next bearer to probe in this round, the one of the link first, so that it
+ * is probed without a switch. Must be called with publish_lock held.
+ */
+static enum bearer probe_next(void)
+{
+    enum bearer bearer = link_bearer;
+
+    if ((bearer < BEARER_COUNT) && (probe_pending & BIT(bearer))) {
+        return bearer;
+    }
+    for (bearer = 0; bearer < BEARER_COUNT; bearer++) {
+        if (probe_pending & BIT(bearer)) {
+            break;
+        }
+    }
+
+    return bearer;
+}
+
+/* Must be called with publish_lock held, see probe_publish. */
+static void probe_start(void)
+{
+    struct net_buf *buf;
+
+    if ((probe_bearer >= BEARER_COUNT) || (mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING)) {
+        return;
+    }
+
+    buf = block_pool_alloc();
+    if (buf == NULL) {
+        LOG_WRN("No block for a probe publish");
+        return;
+    }
+    memset(net_buf_add(buf, CONFIG_BEARER_SELECT_PROBE_SIZE), 0x55,
+           CONFIG_BEARER_SELECT_PROBE_SIZE);
+
+    LOG_INF("Probing bearer %d", probe_bearer);
+    probe_saved_state = mqtt_pub_state;
+    mqtt_pub_probe = true;
+    publish_start(MODEM_TRAFFIC_BULK, buf, 0, k_uptime_get(), 0);
+}
+
+/*
+ * Publish a probe on the bearer being probed, once the broker is connected.
+ * Every bearer is scored by probes of the same size only, as the publish
+ * latency, dominated by the broker round trip, does not scale with the size.
+ */
+static void probe_publish(void)
+{
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    probe_start();
+    k_mutex_unlock(&publish_lock);
+}
+
+/* Probe the bearers one after the other, then select one until the next probe. */
+static void bearer_probe(struct k_work *work)
+{
+    enum bearer next;
+    bool connected;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+
+    /* Data in flight is not cut off by a switch. */
+    if (mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) {
+        k_mutex_unlock(&publish_lock);
+        k_work_reschedule_for_queue(&modem_workq, &bearer_probe_work, BEARER_PROBE_BUSY_RETRY);
+        return;
+    }
+
+    if (probe_bearer < BEARER_COUNT) {
+        bearer_select_probe_done(probe_bearer, probe_measured);
+    } else {
+        probe_pending = BIT_MASK(BEARER_COUNT);
+    }
+    next = probe_next();
+    probe_bearer = next;
+    probe_measured = false;
+    connected = (next == link_bearer) && (mqtt_state == MQTT_CLOUD_STATE_CONNECTED);
+    if (next < BEARER_COUNT) {
+        probe_pending &= ~BIT(next);
+    }
+    if (connected) {
+        probe_start();
+    }
+
+    k_mutex_unlock(&publish_lock);
+
+    if (next < BEARER_COUNT) {
+        if (!connected) {
+            link_switch(next);
+        }
+        k_work_reschedule_for_queue(&modem_workq, &bearer_probe_work,
+                                    K_SECONDS(CONFIG_BEARER_SELECT_PROBE_TIMEOUT));
+        return;
+    }
+
+    next = bearer_select_decide();
+    if (next != link_bearer) {
+        link_switch(next);
+    }
+    k_work_reschedule_for_queue(&modem_workq, &bearer_probe_work,
+                                K_SECONDS(CONFIG_BEARER_SELECT_PROBE_INTERVAL));
+}
+#endif
+
 int modem_init(modem_utils_state_handler_t handler)
 {
+    const struct k_work_queue_config workq_config = {
+        .name = "modem_workq",
+    };
     int ret;
 
 	k_work_queue_start(&modem_workq, modem_workq_stack_area,
 					   K_THREAD_STACK_SIZEOF(modem_workq_stack_area),
-					   MODEM_WORKQ_PRIORITY, NULL);
+					   MODEM_WORKQ_PRIORITY, &workq_config);
 
     k_work_init(&on_modem_sync_work, on_modem_sync);
     k_work_init(&publish_send_work, publish_send);
+    k_work_init(&subscribe_work, subscribe);
     k_work_init_delayable(&modem_sync_check_work, modem_sync_check);
     k_work_init_delayable(&publish_check_work, publish_check);
+#if CONFIG_BEARER_SELECT
+    k_work_init_delayable(&bearer_probe_work, bearer_probe);
+#endif
+#if CONFIG_CLOUD_STORE
+    k_work_init_delayable(&store_drain_work, store_drain);
+
+    ret = cloud_store_init();
+    if (ret) {
+        LOG_ERR("Cannot init cloud store (error: %d)", ret);
+    }
+#endif
+
+#if CONFIG_RUNTIME_MONITOR
+    runtime_monitor_workq_register(&modem_workq, "modem_workq");
+    runtime_monitor_work_register(&on_modem_sync_work, "on_modem_sync");
+    runtime_monitor_work_register(&publish_send_work, "publish_send");
+    runtime_monitor_work_register(&subscribe_work, "subscribe");
+    runtime_monitor_work_register(&modem_sync_check_work.work, "modem_sync_check");
+    runtime_monitor_work_register(&publish_check_work.work, "publish_check");
+#if CONFIG_CLOUD_STORE
+    runtime_monitor_work_register(&store_drain_work.work, "store_drain");
+#endif
+#if CONFIG_BEARER_SELECT
+    runtime_monitor_work_register(&bearer_probe_work.work, "bearer_probe");
+#endif
+#endif
 
     state_handler = handler;
     state_handler(MODEM_STATE_UNKNOWN);
@@ -189,18 +692,33 @@ void modem_link_init(void)
 {
     int ret;
 
+#if !CONFIG_BEARER_SELECT
     ret = modem_slm_send_cmd(SLM_LINK_MODE, 0);
     if (ret) {
         LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_MODE, ret);
     }
+#endif
     ret = modem_slm_send_cmd(SLM_LINK_CEREG_5, 0);
     if (ret) {
         LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_CEREG_5, ret);
     }
+#if CONFIG_BEARER_SELECT
+    ret = modem_slm_send_cmd(SLM_LINK_CESQ_1, 0);
+    if (ret) {
+        LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_CESQ_1, ret);
+    }
+
+    /* The probe brings the link up on each bearer in turn. */
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    probe_bearer = BEARER_COUNT;
+    k_mutex_unlock(&publish_lock);
+    k_work_reschedule_for_queue(&modem_workq, &bearer_probe_work, K_NO_WAIT);
+#else
     ret = modem_slm_send_cmd(SLM_LINK_CFUN_1, 0);
     if (ret) {
         LOG_ERR("Cannot send SLM command %s (error: %d)", SLM_LINK_CFUN_1, ret);
     }
+#endif
 }
 
 modem_state modem_get_state(void)
@@ -237,34 +755,327 @@ int modem_cloud_connect(void)
     return 0;
 }
 
+/*
+ * Must be called with publish_lock held, the reference to buf is handed over.
+ * Size is that of the data before compression, counted once it is published.
+ */
+static void publish_start(modem_traffic_class traffic_class, struct net_buf *buf, uint32_t tag,
+                          int64_t enqueue_time, size_t size)
+{
+#if CONFIG_ENERGY_ACCOUNTING
+    mqtt_pub_size = size;
+#else
+    ARG_UNUSED(size);
+#endif
+    mqtt_publish_buf = buf;
+    mqtt_pub_class = traffic_class;
+    mqtt_pub_tag = tag;
+    mqtt_pub_enqueue_time = enqueue_time;
+    mqtt_pub_retries = 0;
+    mqtt_pub_state = MQTT_PUB_STATE_PUBLISHING;
+    k_work_submit_to_queue(&modem_workq, &publish_send_work);
+    k_work_schedule(&publish_check_work, MQTT_PUBLISH_CHECK_TIMEOUT);
+}
+
+static void publish_done(bool success)
+{
+    struct mqtt_traffic_stats *stats;
+    uint32_t latency;
+    uint32_t acked_tag = 0;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+
+    if (mqtt_pub_state != MQTT_PUB_STATE_PUBLISHING) {
+        goto end;
+    }
+
+#if CONFIG_BEARER_SELECT
+    if (mqtt_pub_probe) {
+        if (success && (link_bearer == probe_bearer)) {
+            bearer_select_publish(link_bearer, mqtt_publish_buf->len,
+                                  (uint32_t)(k_uptime_get() - mqtt_pub_send_time));
+            probe_measured = true;
+        }
+        /* Probes are neither counted as traffic nor stored. */
+        mqtt_pub_probe = false;
+        mqtt_pub_state = probe_saved_state;
+        k_work_reschedule_for_queue(&modem_workq, &bearer_probe_work, K_NO_WAIT);
+        goto release;
+    }
+#endif
+
+    stats = &traffic_stats[mqtt_pub_class];
+    if (success) {
+        latency = (uint32_t)(k_uptime_get() - mqtt_pub_enqueue_time);
+        stats->published++;
+        stats->last_latency = latency;
+        stats->total_latency += latency;
+        stats->max_latency = MAX(stats->max_latency, latency);
+        mqtt_pub_state = MQTT_PUB_STATE_IDLE;
+        acked_tag = mqtt_pub_tag;
+#if CONFIG_ENERGY_ACCOUNTING
+        energy_uploaded(mqtt_pub_size);
+#endif
+    } else {
+        stats->failed++;
+        /* Failure is reported to the next bulk upload only. */
+        mqtt_pub_state = (mqtt_pub_class == MODEM_TRAFFIC_BULK) ?
+                         MQTT_PUB_STATE_FAILED : MQTT_PUB_STATE_IDLE;
+#if CONFIG_CLOUD_STORE
+        /* Data in flight goes to, or stays in, the store for the next try instead. */
+        if (mqtt_pub_stored) {
+            mqtt_pub_state = MQTT_PUB_STATE_IDLE;
+        } else if (cloud_store_put(mqtt_pub_class, mqtt_pub_tag, mqtt_publish_buf->data,
+                                   mqtt_publish_buf->len) == 0) {
+            mqtt_pub_state = MQTT_PUB_STATE_IDLE;
+#if CONFIG_ENERGY_ACCOUNTING
+            energy_uploaded(mqtt_pub_size);
+#endif
+        }
+#endif
+    }
+
+#if CONFIG_CLOUD_STORE
+    if (mqtt_pub_stored) {
+        mqtt_pub_stored = false;
+        if (success) {
+            cloud_store_pop();
+        }
+    }
+#endif
+
+#if CONFIG_BEARER_SELECT
+release:
+#endif
+    net_buf_unref(mqtt_publish_buf);
+    mqtt_publish_buf = NULL;
+
+    if (mqtt_urgent_buf != NULL) {
+        LOG_INF("Publishing pending urgent data");
+        /* Urgent data is not compressed. */
+        publish_start(MODEM_TRAFFIC_URGENT, mqtt_urgent_buf, mqtt_urgent_tag,
+                      mqtt_urgent_enqueue_time, mqtt_urgent_buf->len);
+        mqtt_urgent_buf = NULL;
+    }
+#if CONFIG_CLOUD_STORE
+    else if (!cloud_store_is_empty()) {
+        /* Full rate while the broker acks, back off when it does not. */
+        k_work_reschedule_for_queue(&modem_workq, &store_drain_work,
+                                    success ? K_NO_WAIT : MQTT_PUBLISH_CHECK_TIMEOUT);
+    }
+#endif
+
+end:
+    k_mutex_unlock(&publish_lock);
+
+    if ((acked_tag != 0) && ack_handler) {
+        ack_handler(acked_tag);
+    }
+}
+
+/* Get the block to publish, bulk data is compressed into a block of its own. */
+static int publish_prepare(modem_traffic_class traffic_class, struct net_buf *buf,
+                           struct net_buf **out)
+{
+#if CONFIG_CLOUD_COMPRESS
+    /* Urgent data is small and must not wait for the compressor. */
+    if (traffic_class == MODEM_TRAFFIC_BULK) {
+        struct net_buf *compressed = block_pool_alloc();
+        int ret;
+
+        if (compressed == NULL) {
+            return -ENOMEM;
+        }
+        ret = cloud_compress(buf->data, buf->len, compressed->data,
+                             net_buf_tailroom(compressed));
+        if (ret < 0) {
+            net_buf_unref(compressed);
+            return ret;
+        }
+        net_buf_add(compressed, ret);
+        *out = compressed;
+        return 0;
+    }
+#else
+    ARG_UNUSED(traffic_class);
+#endif
+
+    *out = net_buf_ref(buf);
+
+    return 0;
+}
+
 int modem_cloud_upload_data(const uint8_t *data, size_t size)
 {
+    return modem_cloud_publish(MODEM_TRAFFIC_BULK, data, size);
+}
+
+int modem_cloud_publish(modem_traffic_class traffic_class, const uint8_t *data, size_t size)
+{
+    return modem_cloud_publish_tagged(traffic_class, data, size, 0);
+}
+
+void modem_set_command_handler(modem_utils_command_handler_t handler)
+{
+    command_handler = handler;
+}
+
+void modem_set_image_handler(modem_utils_command_handler_t handler)
+{
+    image_handler = handler;
+}
+
+void modem_set_ack_handler(modem_utils_ack_handler_t handler)
+{
+    ack_handler = handler;
+}
+
+uint32_t modem_cloud_queue_depth(void)
+{
+    uint32_t depth;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    depth = ((mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) ? 1 : 0) +
+            ((mqtt_urgent_buf != NULL) ? 1 : 0);
+    k_mutex_unlock(&publish_lock);
+
+#if CONFIG_CLOUD_STORE
+    struct cloud_store_stats store_stats;
+
+    cloud_store_get_stats(&store_stats);
+    depth += store_stats.entries;
+#endif
+
+    return depth;
+}
+
+int modem_cloud_publish_tagged(modem_traffic_class traffic_class, const uint8_t *data, size_t size,
+                               uint32_t tag)
+{
+    struct net_buf *buf;
+    int ret;
+
     if (!data) {
         LOG_ERR("Data is NULL");
         return -EINVAL;
     }
-    if (MQTT_PUBLISH_BUFFER_SIZE < (strlen(SLM_MQTT_PUB_A) + size + strlen(SLM_MQTT_PUB_B))) {
+
+    buf = block_pool_alloc();
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+    if (size > net_buf_tailroom(buf)) {
         LOG_ERR("Data size exceeds buffer size");
+        net_buf_unref(buf);
         return -ENOMEM;
-    }   
+    }
+    net_buf_add_mem(buf, data, size);
 
-    if (mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) {
+    ret = modem_cloud_publish_buf(traffic_class, buf, tag);
+    net_buf_unref(buf);
+
+    return ret;
+}
+
+int modem_cloud_publish_buf(modem_traffic_class traffic_class, struct net_buf *buf, uint32_t tag)
+{
+    int64_t now = k_uptime_get();
+    struct net_buf *prepared;
+    int ret = 0;
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+
+#if CONFIG_CLOUD_STORE
+    /* Bulk data queues behind stored data, so the cloud gets it in order. */
+    if (cloud_store_available() &&
+        ((mqtt_state != MQTT_CLOUD_STATE_CONNECTED) ||
+         ((traffic_class == MODEM_TRAFFIC_BULK) && !cloud_store_is_empty()))) {
+        ret = publish_prepare(traffic_class, buf, &prepared);
+        if (ret == 0) {
+            ret = cloud_store_put(traffic_class, tag, prepared->data, prepared->len);
+            net_buf_unref(prepared);
+        }
+        if (ret == 0) {
+#if CONFIG_ENERGY_ACCOUNTING
+            energy_uploaded(buf->len);
+#endif
+            k_work_schedule_for_queue(&modem_workq, &store_drain_work, K_NO_WAIT);
+        }
+        goto end;
+    }
+#endif
+
+    if (traffic_class == MODEM_TRAFFIC_URGENT) {
+        if (mqtt_pub_state != MQTT_PUB_STATE_PUBLISHING) {
+            ret = publish_prepare(traffic_class, buf, &prepared);
+            if (ret == 0) {
+                publish_start(traffic_class, prepared, tag, now, buf->len);
+            }
+        } else if (mqtt_urgent_buf == NULL) {
+            /* Published right after the ongoing one, ahead of bulk data. */
+            ret = publish_prepare(traffic_class, buf, &mqtt_urgent_buf);
+            if (ret == 0) {
+                LOG_INF("Urgent data queued");
+                mqtt_urgent_enqueue_time = now;
+                mqtt_urgent_tag = tag;
+            }
+        } else {
+            LOG_WRN("Urgent publish already pending");
+            ret = -EBUSY;
+        }
+        goto end;
+    }
+
+    if ((mqtt_pub_state == MQTT_PUB_STATE_PUBLISHING) || (mqtt_urgent_buf != NULL)) {
         LOG_WRN("MQTT publish in progress");
-        return -EBUSY;
+        ret = -EBUSY;
+        goto end;
     } else if (mqtt_pub_state == MQTT_PUB_STATE_FAILED) {
         LOG_ERR("MQTT publish failed");
         mqtt_pub_state = MQTT_PUB_STATE_IDLE;
-        return -EIO;
+        ret = -EIO;
+        goto end;
+    }
+
+    ret = publish_prepare(traffic_class, buf, &prepared);
+    if (ret == 0) {
+        publish_start(traffic_class, prepared, tag, now, buf->len);
     }
-    mqtt_pub_retries = 0;
-    /* Create AT command to publish data */
-    memset(mqtt_publish_buffer, 0, sizeof(mqtt_publish_buffer));
-    memcpy(mqtt_publish_buffer, SLM_MQTT_PUB_A, strlen(SLM_MQTT_PUB_A));
-    memcpy(mqtt_publish_buffer + strlen(SLM_MQTT_PUB_A), data, size);
-    memcpy(mqtt_publish_buffer + strlen(SLM_MQTT_PUB_A) + size, SLM_MQTT_PUB_B, strlen(SLM_MQTT_PUB_B));
-    k_work_submit_to_queue(&modem_workq, &publish_send_work);
-    k_work_schedule(&publish_check_work, MQTT_PUBLISH_CHECK_TIMEOUT);
-    mqtt_pub_state = MQTT_PUB_STATE_PUBLISHING;
+
+end:
+    k_mutex_unlock(&publish_lock);
+
+    return ret;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+    static const char *const class_names[MODEM_TRAFFIC_COUNT] = {
+        [MODEM_TRAFFIC_BULK] = "bulk",
+        [MODEM_TRAFFIC_URGENT] = "urgent",
+    };
+
+    k_mutex_lock(&publish_lock, K_FOREVER);
+    for (int i = 0; i < MODEM_TRAFFIC_COUNT; i++) {
+        struct mqtt_traffic_stats *stats = &traffic_stats[i];
+
+        shell_fprintf(shell, SHELL_INFO,
+                      "%s: published %u failed %u latency last/avg/max %u/%u/%u ms\n",
+                      class_names[i], stats->published, stats->failed, stats->last_latency,
+                      stats->published ? (uint32_t)(stats->total_latency / stats->published) : 0,
+                      stats->max_latency);
+    }
+    k_mutex_unlock(&publish_lock);
 
     return 0;
-}
\ No newline at end of file
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_modem_utils,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get publish statistics per traffic class.\n",
+		cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(modem_utils, &sub_modem_utils, "modem utils commands", NULL);
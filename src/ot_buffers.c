@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/message.h>
+
+#include "ot_buffers.h"
+
+LOG_MODULE_REGISTER(ot_buffers, CONFIG_OT_BUFFERS_LOG_LEVEL);
+
+/* Usage histogram in steps of 5 %, the last bin is a full pool. */
+#define USAGE_STEP 5
+#define USAGE_BINS (100 / USAGE_STEP + 1)
+
+#if CONFIG_OPENTHREAD_FTD
+static struct k_work_delayable sample_work;
+#endif
+
+static struct ot_buffers_stats stats = {
+	.min_free = UINT16_MAX,
+};
+static uint32_t usage_bins[USAGE_BINS];
+static enum ot_buffers_level level;
+static K_MUTEX_DEFINE(buffers_lock);
+
+static enum ot_buffers_level level_get(enum ot_buffers_level current, uint32_t free_percent)
+{
+	if (free_percent < CONFIG_OT_BUFFERS_CRITICAL_FREE) {
+		return OT_BUFFERS_LEVEL_CRITICAL;
+	}
+	if ((current == OT_BUFFERS_LEVEL_CRITICAL) &&
+	    (free_percent < CONFIG_OT_BUFFERS_CRITICAL_FREE + CONFIG_OT_BUFFERS_HYSTERESIS)) {
+		return OT_BUFFERS_LEVEL_CRITICAL;
+	}
+	if (free_percent < CONFIG_OT_BUFFERS_LOW_FREE) {
+		return OT_BUFFERS_LEVEL_LOW;
+	}
+	if ((current != OT_BUFFERS_LEVEL_NORMAL) &&
+	    (free_percent < CONFIG_OT_BUFFERS_LOW_FREE + CONFIG_OT_BUFFERS_HYSTERESIS)) {
+		return OT_BUFFERS_LEVEL_LOW;
+	}
+
+	return OT_BUFFERS_LEVEL_NORMAL;
+}
+
+/* Usage [%] not exceeded by the given share of the samples, with the lock held. */
+static uint8_t usage_percentile(uint32_t percent)
+{
+	uint32_t rank = DIV_ROUND_UP(stats.samples * percent, 100);
+	uint32_t count = 0;
+
+	for (size_t i = 0; i < USAGE_BINS; i++) {
+		count += usage_bins[i];
+		if ((count >= rank) && (count > 0)) {
+			return MIN((i + 1) * USAGE_STEP - 1, 100);
+		}
+	}
+
+	return 0;
+}
+
+static void buffers_sample(void)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	enum ot_buffers_level next;
+	otBufferInfo info;
+	uint32_t free_percent;
+	uint32_t usage;
+
+	openthread_api_mutex_lock(ot_context);
+	otMessageGetBufferInfo(ot_context->instance, &info);
+	openthread_api_mutex_unlock(ot_context);
+
+	if (info.mTotalBuffers == 0) {
+		return;
+	}
+
+	free_percent = (info.mFreeBuffers * 100U) / info.mTotalBuffers;
+	usage = 100U - free_percent;
+
+	k_mutex_lock(&buffers_lock, K_FOREVER);
+
+	stats.total = info.mTotalBuffers;
+	stats.free = info.mFreeBuffers;
+	stats.min_free = MIN(stats.min_free, info.mFreeBuffers);
+	stats.samples++;
+	usage_bins[usage / USAGE_STEP]++;
+
+	next = level_get(level, free_percent);
+	if (next > level) {
+		LOG_WRN("%u of %u message buffers free, %s", info.mFreeBuffers, info.mTotalBuffers,
+			(next == OT_BUFFERS_LEVEL_CRITICAL) ? "deferring uploads"
+							    : "deferring discovers");
+		if (next == OT_BUFFERS_LEVEL_CRITICAL) {
+			stats.critical++;
+		} else {
+			stats.low++;
+		}
+	} else if (next < level) {
+		LOG_INF("%u of %u message buffers free, level %d", info.mFreeBuffers,
+			info.mTotalBuffers, next);
+	}
+	level = next;
+
+	k_mutex_unlock(&buffers_lock);
+}
+
+#if CONFIG_OPENTHREAD_FTD
+static void sample_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	buffers_sample();
+	k_work_reschedule(&sample_work, K_MSEC(CONFIG_OT_BUFFERS_PERIOD));
+}
+#endif
+
+uint32_t ot_buffers_admit(enum ot_buffers_traffic traffic)
+{
+	uint32_t delay = 0;
+
+#if !CONFIG_OPENTHREAD_FTD
+	/* End devices sample on demand instead of waking up every period. */
+	buffers_sample();
+#endif
+
+	k_mutex_lock(&buffers_lock, K_FOREVER);
+
+	switch (level) {
+	case OT_BUFFERS_LEVEL_CRITICAL:
+		delay = CONFIG_OT_BUFFERS_DEFER_DELAY;
+		break;
+	case OT_BUFFERS_LEVEL_LOW:
+		/* Every modem answers a discover, uploads in progress come first. */
+		if (traffic == OT_BUFFERS_TRAFFIC_DISCOVER) {
+			delay = CONFIG_OT_BUFFERS_DEFER_DELAY;
+		}
+		break;
+	default:
+		break;
+	}
+
+	if (delay > 0) {
+		stats.deferred[traffic]++;
+		LOG_DBG("Traffic %d deferred by %u ms", traffic, delay);
+	}
+
+	k_mutex_unlock(&buffers_lock);
+
+	return delay;
+}
+
+int ot_buffers_init(void)
+{
+#if CONFIG_OPENTHREAD_FTD
+	k_work_init_delayable(&sample_work, sample_work_handler);
+	k_work_schedule(&sample_work, K_NO_WAIT);
+#endif
+
+	return 0;
+}
+
+void ot_buffers_get_stats(struct ot_buffers_stats *out)
+{
+	k_mutex_lock(&buffers_lock, K_FOREVER);
+	*out = stats;
+	out->p50 = usage_percentile(50);
+	out->p90 = usage_percentile(90);
+	out->p99 = usage_percentile(99);
+	out->level = level;
+	k_mutex_unlock(&buffers_lock);
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct ot_buffers_stats current;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&buffers_lock, K_FOREVER);
+		memset(&stats, 0, sizeof(stats));
+		memset(usage_bins, 0, sizeof(usage_bins));
+		stats.min_free = UINT16_MAX;
+		k_mutex_unlock(&buffers_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	ot_buffers_get_stats(&current);
+
+	shell_fprintf(shell, SHELL_INFO, "buffers: %u, free: %u (min: %u)\n", current.total,
+		      current.free, (current.samples > 0) ? current.min_free : 0);
+	shell_fprintf(shell, SHELL_INFO, "usage: p50 %u%%, p90 %u%%, p99 %u%% of %u samples\n",
+		      current.p50, current.p90, current.p99, current.samples);
+	shell_fprintf(shell, SHELL_INFO, "level: %u, entered low: %u, critical: %u\n",
+		      current.level, current.low, current.critical);
+	shell_fprintf(shell, SHELL_INFO, "deferred discovers: %u, uploads: %u\n",
+		      current.deferred[OT_BUFFERS_TRAFFIC_DISCOVER],
+		      current.deferred[OT_BUFFERS_TRAFFIC_UPLOAD]);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_ot_buffers,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset message buffer statistics. (reset)\n",
+		cmd_stats, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(ot_buffers, &sub_ot_buffers, "OpenThread message buffer commands", NULL);
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __OT_BUFFERS_H__
+#define __OT_BUFFERS_H__
+
+#include <stdint.h>
+
+/**@brief Pressure on the OpenThread message buffers. */
+enum ot_buffers_level {
+	/** Enough free buffers for any traffic. */
+	OT_BUFFERS_LEVEL_NORMAL,
+	/** Free buffers below CONFIG_OT_BUFFERS_LOW_FREE, discovers are deferred. */
+	OT_BUFFERS_LEVEL_LOW,
+	/** Free buffers below CONFIG_OT_BUFFERS_CRITICAL_FREE, uploads are deferred too. */
+	OT_BUFFERS_LEVEL_CRITICAL,
+};
+
+/**@brief Traffic subject to admission. */
+enum ot_buffers_traffic {
+	/** Multicast modem discover, answered by every modem. */
+	OT_BUFFERS_TRAFFIC_DISCOVER,
+	/** New upload session, sent or accepted. */
+	OT_BUFFERS_TRAFFIC_UPLOAD,
+	OT_BUFFERS_TRAFFIC_COUNT,
+};
+
+/**@brief Message buffer usage statistics. */
+struct ot_buffers_stats {
+	/** Buffers of the pool, free at the last sample and fewest free sampled. */
+	uint16_t total;
+	uint16_t free;
+	uint16_t min_free;
+	/** Samples taken, and usage [%] not exceeded by 50, 90 and 99 % of them. */
+	uint32_t samples;
+	uint8_t p50;
+	uint8_t p90;
+	uint8_t p99;
+	/** Current level, and times the low and critical levels were entered. */
+	uint8_t level;
+	uint32_t low;
+	uint32_t critical;
+	/** Deferred traffic per ot_buffers_traffic. */
+	uint32_t deferred[OT_BUFFERS_TRAFFIC_COUNT];
+};
+
+/**
+ * @brief Initialize message buffer tracking.
+ *
+ * Routers sample the buffers every CONFIG_OT_BUFFERS_PERIOD, end devices
+ * sample them when traffic is admitted.
+ */
+int ot_buffers_init(void);
+
+/**
+ * @brief Decide if new traffic may use message buffers now.
+ *
+ * Based on the level of the last sample. A level is left once the free
+ * buffers exceed its threshold by CONFIG_OT_BUFFERS_HYSTERESIS.
+ *
+ * @param[in] traffic traffic to admit.
+ *
+ * @return 0 if admitted, otherwise the time to defer the traffic by [ms].
+ */
+uint32_t ot_buffers_admit(enum ot_buffers_traffic traffic);
+
+/**
+ * @brief Get a copy of the message buffer usage statistics.
+ */
+void ot_buffers_get_stats(struct ot_buffers_stats *stats);
+
+#endif /* __OT_BUFFERS_H__ */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+#include "rollup.h"
+
+LOG_MODULE_REGISTER(rollup, CONFIG_ROLLUP_LOG_LEVEL);
+
+struct rollup_bucket {
+	uint32_t interval;
+	uint32_t start;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t last;
+	int64_t sum;
+};
+
+struct rollup_stats {
+	uint32_t readings;
+	uint32_t rollups;
+};
+
+/* A reading closes at most the open interval and passes itself through. */
+#define CLOSED_COUNT 2
+
+static struct rollup_bucket bucket;
+static struct meter_rollup closed[CLOSED_COUNT];
+static uint8_t closed_head;
+static uint8_t closed_count;
+static uint32_t rollup_interval = CONFIG_ROLLUP_INTERVAL;
+static struct rollup_stats stats;
+static K_MUTEX_DEFINE(rollup_lock);
+
+static struct meter_rollup *closed_alloc(void)
+{
+	if (closed_count == CLOSED_COUNT) {
+		LOG_WRN("Closed interval dropped");
+		closed_head = (closed_head + 1) % CLOSED_COUNT;
+		closed_count--;
+	}
+	stats.rollups++;
+
+	return &closed[(closed_head + closed_count++) % CLOSED_COUNT];
+}
+
+static void bucket_close(void)
+{
+	struct meter_rollup *rollup = closed_alloc();
+
+	rollup->start = bucket.start;
+	rollup->count = bucket.count;
+	rollup->min = bucket.min;
+	rollup->max = bucket.max;
+	rollup->mean = (int32_t)(bucket.sum / bucket.count);
+	rollup->last = bucket.last;
+	bucket.count = 0;
+	LOG_DBG("Rollup at %u: %u readings, mean %d", rollup->start, rollup->count, rollup->mean);
+}
+
+void rollup_init(void)
+{
+	k_mutex_lock(&rollup_lock, K_FOREVER);
+	memset(&bucket, 0, sizeof(bucket));
+	closed_head = 0;
+	closed_count = 0;
+	rollup_interval = CONFIG_ROLLUP_INTERVAL;
+	k_mutex_unlock(&rollup_lock);
+}
+
+void rollup_set_interval(uint32_t interval)
+{
+	k_mutex_lock(&rollup_lock, K_FOREVER);
+	rollup_interval = interval;
+	k_mutex_unlock(&rollup_lock);
+	LOG_INF("Rollup interval %u s", interval);
+}
+
+uint32_t rollup_get_interval(void)
+{
+	return rollup_interval;
+}
+
+void rollup_add(const struct meter_record *reading)
+{
+	uint32_t start = 0;
+
+	k_mutex_lock(&rollup_lock, K_FOREVER);
+
+	stats.readings++;
+
+	if (rollup_interval > 0) {
+		start = reading->timestamp - reading->timestamp % rollup_interval;
+	}
+
+	if ((bucket.count > 0) &&
+	    ((bucket.interval != rollup_interval) || (bucket.start != start))) {
+		bucket_close();
+	}
+
+	if (rollup_interval == 0) {
+		*closed_alloc() = (struct meter_rollup){
+			.start = reading->timestamp,
+			.count = 1,
+			.min = reading->value,
+			.max = reading->value,
+			.mean = reading->value,
+			.last = reading->value,
+		};
+		goto end;
+	}
+
+	if (bucket.count == 0) {
+		bucket.interval = rollup_interval;
+		bucket.start = start;
+		bucket.min = reading->value;
+		bucket.max = reading->value;
+		bucket.sum = 0;
+	}
+	bucket.count++;
+	bucket.min = MIN(bucket.min, reading->value);
+	bucket.max = MAX(bucket.max, reading->value);
+	bucket.sum += reading->value;
+	bucket.last = reading->value;
+
+end:
+	k_mutex_unlock(&rollup_lock);
+}
+
+bool rollup_get(struct meter_rollup *rollup)
+{
+	bool found = false;
+
+	k_mutex_lock(&rollup_lock, K_FOREVER);
+
+	if (closed_count > 0) {
+		*rollup = closed[closed_head];
+		closed_head = (closed_head + 1) % CLOSED_COUNT;
+		closed_count--;
+		found = true;
+	}
+
+	k_mutex_unlock(&rollup_lock);
+
+	return found;
+}
+
+static int cmd_interval(const struct shell *shell, size_t argc, char **argv)
+{
+	if (argc > 1) {
+		rollup_set_interval(strtoul(argv[1], NULL, 10));
+	}
+
+	shell_fprintf(shell, SHELL_INFO, "interval: %u s\n", rollup_get_interval());
+
+	return 0;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct rollup_stats current;
+
+	k_mutex_lock(&rollup_lock, K_FOREVER);
+	current = stats;
+	k_mutex_unlock(&rollup_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "readings: %u rollups: %u\n", current.readings,
+		      current.rollups);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_rollup,
+	SHELL_CMD_ARG(
+		interval, NULL,
+		"Get/Set rollup interval in seconds, 0 for raw readings. (seconds)\n",
+		cmd_interval, 1, 1),
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get rollup statistics.\n",
+		cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(rollup, &sub_rollup, "rollup commands", NULL);
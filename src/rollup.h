@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __ROLLUP_H__
+#define __ROLLUP_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "meter_codec.h"
+
+/**
+ * @brief Initialize rollup engine with the configured interval.
+ */
+void rollup_init(void);
+
+/**
+ * @brief Set rollup interval.
+ *
+ * The open interval is closed with the next reading.
+ *
+ * @param[in] interval interval length [s], 0 to pass raw readings through.
+ */
+void rollup_set_interval(uint32_t interval);
+
+/**
+ * @brief Get rollup interval [s].
+ */
+uint32_t rollup_get_interval(void);
+
+/**
+ * @brief Add reading to the open interval.
+ *
+ * Takes constant time and memory per reading. Closed intervals have to be
+ * taken with rollup_get before the next reading is added.
+ *
+ * @param[in] reading reading in timestamp order.
+ */
+void rollup_add(const struct meter_record *reading);
+
+/**
+ * @brief Take the oldest closed interval.
+ *
+ * Raw readings are given as rollups of a single reading.
+ *
+ * @retval true  @p rollup is set.
+ * @retval false No closed interval.
+ */
+bool rollup_get(struct meter_rollup *rollup);
+
+#endif /* __ROLLUP_H__ */
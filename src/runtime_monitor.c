@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+
+#include "runtime_monitor.h"
+
+LOG_MODULE_REGISTER(runtime_monitor, CONFIG_RUNTIME_MONITOR_LOG_LEVEL);
+
+/* Upper bound of the first histogram bucket [us], the next ones are 10 times larger. */
+#define FIRST_BUCKET_BOUND 100
+
+struct workq_entry {
+	struct k_work_q *queue;
+	const char *name;
+	struct k_work probe;
+	/* Uptime [ticks] when the probe was submitted */
+	int64_t submitted;
+	struct runtime_monitor_histogram delay;
+};
+
+struct work_entry {
+	struct k_work *work;
+	k_work_handler_t handler;
+	const char *name;
+	struct runtime_monitor_histogram execution;
+};
+
+/* Entries are only appended, the wrapped handlers look them up without the lock. */
+static struct workq_entry workqs[CONFIG_RUNTIME_MONITOR_WORKQ_COUNT];
+static size_t workq_count;
+static struct work_entry works[CONFIG_RUNTIME_MONITOR_WORK_COUNT];
+static size_t work_count;
+
+static struct k_work_delayable probe_work;
+static K_MUTEX_DEFINE(monitor_lock);
+
+static uint32_t ticks_to_us(int64_t ticks)
+{
+	return (uint32_t)MIN(k_ticks_to_us_floor64(ticks), UINT32_MAX);
+}
+
+/* Add a latency, with the lock held. */
+static void histogram_add(struct runtime_monitor_histogram *histogram, uint32_t latency)
+{
+	uint32_t bound = FIRST_BUCKET_BOUND;
+	size_t bucket = 0;
+
+	while ((bucket < RUNTIME_MONITOR_BUCKETS - 1) && (latency >= bound)) {
+		bound *= 10;
+		bucket++;
+	}
+
+	histogram->count++;
+	histogram->buckets[bucket]++;
+	histogram->sum += latency;
+	histogram->max = MAX(histogram->max, latency);
+}
+
+static void probe_handler(struct k_work *work)
+{
+	struct workq_entry *entry = CONTAINER_OF(work, struct workq_entry, probe);
+	uint32_t delay = ticks_to_us(k_uptime_ticks() - entry->submitted);
+
+	k_mutex_lock(&monitor_lock, K_FOREVER);
+	histogram_add(&entry->delay, delay);
+	k_mutex_unlock(&monitor_lock);
+}
+
+static void probe_work_handler(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	for (size_t i = 0; i < workq_count; i++) {
+		/* A probe still queued already measures the backlog. */
+		if (k_work_is_pending(&workqs[i].probe)) {
+			continue;
+		}
+
+		workqs[i].submitted = k_uptime_ticks();
+		k_work_submit_to_queue(workqs[i].queue, &workqs[i].probe);
+	}
+
+	k_work_reschedule(&probe_work, K_MSEC(CONFIG_RUNTIME_MONITOR_PERIOD));
+}
+
+static void work_wrapper(struct k_work *work)
+{
+	struct work_entry *entry = NULL;
+	int64_t start;
+	uint32_t execution;
+
+	for (size_t i = 0; i < work_count; i++) {
+		if (works[i].work == work) {
+			entry = &works[i];
+			break;
+		}
+	}
+
+	__ASSERT_NO_MSG(entry != NULL);
+
+	start = k_uptime_ticks();
+	entry->handler(work);
+	execution = ticks_to_us(k_uptime_ticks() - start);
+
+	k_mutex_lock(&monitor_lock, K_FOREVER);
+	histogram_add(&entry->execution, execution);
+	k_mutex_unlock(&monitor_lock);
+}
+
+int runtime_monitor_workq_register(struct k_work_q *queue, const char *name)
+{
+	struct workq_entry *entry;
+	int ret = 0;
+
+	k_mutex_lock(&monitor_lock, K_FOREVER);
+
+	if (workq_count == ARRAY_SIZE(workqs)) {
+		LOG_ERR("No room to monitor workqueue %s", name);
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	entry = &workqs[workq_count];
+	entry->queue = queue;
+	entry->name = name;
+	k_work_init(&entry->probe, probe_handler);
+	workq_count++;
+
+end:
+	k_mutex_unlock(&monitor_lock);
+
+	return ret;
+}
+
+int runtime_monitor_work_register(struct k_work *work, const char *name)
+{
+	struct work_entry *entry;
+	int ret = 0;
+
+	k_mutex_lock(&monitor_lock, K_FOREVER);
+
+	if (work_count == ARRAY_SIZE(works)) {
+		LOG_ERR("No room to monitor work %s", name);
+		ret = -ENOMEM;
+		goto end;
+	}
+
+	entry = &works[work_count];
+	entry->work = work;
+	entry->handler = work->handler;
+	entry->name = name;
+	work_count++;
+
+	/* The entry is in place before the handler can be wrapped. */
+	work->handler = work_wrapper;
+
+end:
+	k_mutex_unlock(&monitor_lock);
+
+	return ret;
+}
+
+int runtime_monitor_init(void)
+{
+	runtime_monitor_workq_register(&k_sys_work_q, "sysworkq");
+	runtime_monitor_workq_register(&openthread_get_default_context()->work_q, "openthread");
+
+	k_work_init_delayable(&probe_work, probe_work_handler);
+	k_work_schedule(&probe_work, K_MSEC(CONFIG_RUNTIME_MONITOR_PERIOD));
+
+	return 0;
+}
+
+static void histogram_print(const struct shell *shell, const char *name,
+			    const struct runtime_monitor_histogram *histogram)
+{
+	shell_fprintf(shell, SHELL_INFO, "%s: %u, avg: %u us, max: %u us\n", name,
+		      histogram->count,
+		      histogram->count ? (uint32_t)(histogram->sum / histogram->count) : 0,
+		      histogram->max);
+	shell_fprintf(shell, SHELL_INFO,
+		      "  <100us: %u <1ms: %u <10ms: %u <100ms: %u <1s: %u >=1s: %u\n",
+		      histogram->buckets[0], histogram->buckets[1], histogram->buckets[2],
+		      histogram->buckets[3], histogram->buckets[4], histogram->buckets[5]);
+}
+
+struct thread_print_context {
+	const struct shell *shell;
+	/* Cycles of all threads since boot */
+	uint64_t cycles;
+};
+
+static void thread_print(const struct k_thread *cthread, void *user_data)
+{
+	struct k_thread *thread = (struct k_thread *)cthread;
+	struct thread_print_context *context = user_data;
+	k_thread_runtime_stats_t runtime;
+	size_t size = thread->stack_info.size;
+	size_t unused;
+	size_t used;
+	uint32_t share = 0;
+	const char *name;
+
+	name = k_thread_name_get(thread);
+	if ((name == NULL) || (name[0] == '\0')) {
+		name = "unnamed";
+	}
+
+	if (k_thread_stack_space_get(thread, &unused) != 0) {
+		unused = size;
+	}
+	used = size - unused;
+
+	if ((context->cycles > 0) && (k_thread_runtime_stats_get(thread, &runtime) == 0)) {
+		/* Per mille */
+		share = (uint32_t)((runtime.execution_cycles * 1000) / context->cycles);
+	}
+
+	shell_fprintf(context->shell,
+		      (used * 100 >= size * CONFIG_RUNTIME_MONITOR_STACK_WARN) ? SHELL_WARNING
+									       : SHELL_INFO,
+		      "%-20s prio: %3d stack: %5zu/%5zu B (%zu%%) cpu: %u.%u%%\n", name,
+		      thread->base.prio, used, size, size ? (used * 100) / size : 0, share / 10,
+		      share % 10);
+}
+
+static int cmd_threads(const struct shell *shell, size_t argc, char **argv)
+{
+	struct thread_print_context context = {.shell = shell};
+	k_thread_runtime_stats_t all;
+
+	ARG_UNUSED(argc);
+	ARG_UNUSED(argv);
+
+	if (k_thread_runtime_stats_all_get(&all) == 0) {
+		context.cycles = all.execution_cycles;
+	}
+
+	k_thread_foreach_unlocked(thread_print, &context);
+
+	return 0;
+}
+
+static int cmd_workq(const struct shell *shell, size_t argc, char **argv)
+{
+	struct runtime_monitor_histogram delay;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&monitor_lock, K_FOREVER);
+		for (size_t i = 0; i < workq_count; i++) {
+			memset(&workqs[i].delay, 0, sizeof(workqs[i].delay));
+		}
+		k_mutex_unlock(&monitor_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	shell_fprintf(shell, SHELL_INFO, "Queueing delay, probed every %u ms\n",
+		      CONFIG_RUNTIME_MONITOR_PERIOD);
+
+	for (size_t i = 0; i < workq_count; i++) {
+		k_mutex_lock(&monitor_lock, K_FOREVER);
+		delay = workqs[i].delay;
+		k_mutex_unlock(&monitor_lock);
+
+		histogram_print(shell, workqs[i].name, &delay);
+	}
+
+	return 0;
+}
+
+static int cmd_work(const struct shell *shell, size_t argc, char **argv)
+{
+	struct runtime_monitor_histogram execution;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		k_mutex_lock(&monitor_lock, K_FOREVER);
+		for (size_t i = 0; i < work_count; i++) {
+			memset(&works[i].execution, 0, sizeof(works[i].execution));
+		}
+		k_mutex_unlock(&monitor_lock);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	shell_fprintf(shell, SHELL_INFO, "Execution time\n");
+
+	for (size_t i = 0; i < work_count; i++) {
+		k_mutex_lock(&monitor_lock, K_FOREVER);
+		execution = works[i].execution;
+		k_mutex_unlock(&monitor_lock);
+
+		histogram_print(shell, works[i].name, &execution);
+	}
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_runtime_monitor,
+	SHELL_CMD_ARG(
+		threads, NULL,
+		"Get stack high-water marks and CPU shares since boot of the threads.\n",
+		cmd_threads, 1, 0),
+	SHELL_CMD_ARG(
+		workq, NULL,
+		"Get/Reset queueing delay histograms of the workqueues. (reset)\n",
+		cmd_workq, 1, 1),
+	SHELL_CMD_ARG(
+		work, NULL,
+		"Get/Reset execution time histograms of the work items. (reset)\n",
+		cmd_work, 1, 1),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(runtime_monitor, &sub_runtime_monitor, "Runtime monitor commands", NULL);
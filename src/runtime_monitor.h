@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __RUNTIME_MONITOR_H__
+#define __RUNTIME_MONITOR_H__
+
+#include <stdint.h>
+
+#include <zephyr/kernel.h>
+
+/**@brief Buckets of a latency histogram, up to 100 us, 1 ms, ..., 1 s and above. */
+#define RUNTIME_MONITOR_BUCKETS 6
+
+/**@brief Latency histogram. */
+struct runtime_monitor_histogram {
+	uint32_t count;
+	uint32_t buckets[RUNTIME_MONITOR_BUCKETS];
+	/** Sum and maximum of the latencies [us]. */
+	uint64_t sum;
+	uint32_t max;
+};
+
+/**
+ * @brief Initialize the runtime monitor.
+ *
+ * Registers the system and OpenThread workqueues and starts probing the
+ * registered workqueues every CONFIG_RUNTIME_MONITOR_PERIOD.
+ */
+int runtime_monitor_init(void);
+
+/**
+ * @brief Register a workqueue whose queueing delay is measured.
+ *
+ * A probe work item is submitted to the queue every period, the time until
+ * it runs is the delay a newly submitted work item sees.
+ *
+ * @param[in] queue started workqueue.
+ * @param[in] name  name shown by the shell.
+ *
+ * @retval 0       Workqueue registered.
+ * @retval -ENOMEM CONFIG_RUNTIME_MONITOR_WORKQ_COUNT workqueues are registered.
+ */
+int runtime_monitor_workq_register(struct k_work_q *queue, const char *name);
+
+/**
+ * @brief Register a work item whose execution time is measured.
+ *
+ * Must be called after the work item is initialized and before it is
+ * submitted. The handler is wrapped, so the work item must not be
+ * initialized again. For a delayable work item pass its work member.
+ *
+ * @param[in] work initialized work item.
+ * @param[in] name name shown by the shell.
+ *
+ * @retval 0       Work item registered.
+ * @retval -ENOMEM CONFIG_RUNTIME_MONITOR_WORK_COUNT work items are registered.
+ */
+int runtime_monitor_work_register(struct k_work *work, const char *name);
+
+#endif /* __RUNTIME_MONITOR_H__ */
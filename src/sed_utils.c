@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <openthread/link.h>
+#include <openthread/thread.h>
+
+#include "sed_utils.h"
+
+LOG_MODULE_REGISTER(sed_utils, CONFIG_SED_UTILS_LOG_LEVEL);
+
+#if CONFIG_SED_UTILS_CSL
+/* CSL period is in microseconds. */
+#define SED_FAST_PERIOD      CONFIG_SED_UTILS_CSL_FAST_PERIOD
+#define SED_PERIOD_PER_MS    USEC_PER_MSEC
+#define SED_WAKEUP_ON_TIME   CONFIG_SED_UTILS_CSL_RECEIVE_ON_TIME
+#else
+/* Poll period is in milliseconds. */
+#define SED_FAST_PERIOD      CONFIG_SED_UTILS_FAST_POLL_PERIOD
+#define SED_PERIOD_PER_MS    1
+#define SED_WAKEUP_ON_TIME   CONFIG_SED_UTILS_POLL_RADIO_ON_TIME
+#endif
+#define SED_BOOST_HOLDOFF    K_MSEC(CONFIG_SED_UTILS_BOOST_HOLDOFF)
+#define SED_BOOST_TIMEOUT    K_MSEC(CONFIG_SED_UTILS_BOOST_TIMEOUT)
+
+static struct k_work_delayable boost_restore_work;
+static struct sed_utils_stats stats;
+static bool boosted;
+static bool in_exchange;
+static uint32_t saved_period;
+static int64_t boost_start_time;
+static int64_t exchange_start_time;
+
+#if CONFIG_SED_UTILS_CSL
+static uint32_t csl_current_period;
+static int64_t csl_period_start_time;
+
+/* Count the receive windows sampled since the last CSL period change. */
+static void csl_account(otInstance *instance)
+{
+	int64_t now = k_uptime_get();
+
+	if (csl_current_period != 0) {
+		uint64_t windows = (now - csl_period_start_time) * USEC_PER_MSEC / csl_current_period;
+
+		stats.csl_windows += windows;
+		if (boosted) {
+			stats.csl_boosted_windows += windows;
+		}
+	}
+	csl_current_period = otLinkGetCslPeriod(instance);
+	csl_period_start_time = now;
+}
+#endif
+
+static uint32_t period_get(otInstance *instance)
+{
+#if CONFIG_SED_UTILS_CSL
+	return otLinkGetCslPeriod(instance);
+#else
+	return otLinkGetPollPeriod(instance);
+#endif
+}
+
+static otError period_set(otInstance *instance, uint32_t period)
+{
+#if CONFIG_SED_UTILS_CSL
+	otError error;
+
+	csl_account(instance);
+	error = otLinkSetCslPeriod(instance, period);
+	csl_current_period = otLinkGetCslPeriod(instance);
+
+	return error;
+#else
+	return otLinkSetPollPeriod(instance, period);
+#endif
+}
+
+static bool is_sleepy_child(otInstance *instance)
+{
+	return (otThreadGetDeviceRole(instance) == OT_DEVICE_ROLE_CHILD) &&
+	       !otThreadGetLinkMode(instance).mRxOnWhenIdle;
+}
+
+static void account_boosted_time(int64_t elapsed)
+{
+	stats.boosted_time += elapsed;
+	if (saved_period > SED_FAST_PERIOD) {
+		uint64_t extra = elapsed * SED_PERIOD_PER_MS / SED_FAST_PERIOD -
+				 elapsed * SED_PERIOD_PER_MS / saved_period;
+
+		stats.extra_wakeups += extra;
+		stats.extra_radio_on_time += extra * SED_WAKEUP_ON_TIME;
+	}
+}
+
+static void boost_restore(struct k_work *work)
+{
+	ARG_UNUSED(work);
+	struct openthread_context *ot_context = openthread_get_default_context();
+	int64_t now = k_uptime_get();
+	otError error;
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (in_exchange) {
+		LOG_WRN("Exchange did not finish in time");
+		in_exchange = false;
+		stats.timeouts++;
+	}
+
+	if (boosted) {
+		error = period_set(ot_context->instance, saved_period);
+		if (error != OT_ERROR_NONE) {
+			LOG_ERR("Cannot restore period %u: %d", saved_period, error);
+		}
+		account_boosted_time(now - boost_start_time);
+		boosted = false;
+		LOG_DBG("Period restored to %u after %lld ms", saved_period,
+			now - boost_start_time);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+}
+
+void sed_utils_boost_start(void)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error;
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (!in_exchange) {
+		in_exchange = true;
+		exchange_start_time = k_uptime_get();
+		stats.exchanges++;
+	}
+
+	if (!boosted && is_sleepy_child(ot_context->instance)) {
+		saved_period = period_get(ot_context->instance);
+		error = period_set(ot_context->instance, SED_FAST_PERIOD);
+		if (error != OT_ERROR_NONE) {
+			LOG_ERR("Cannot set fast period: %d", error);
+		} else {
+			boosted = true;
+			boost_start_time = k_uptime_get();
+			LOG_DBG("Period boosted from %u to %u", saved_period, SED_FAST_PERIOD);
+		}
+	}
+
+	/* Guard against exchanges that are never answered, e.g. no modem found. */
+	k_work_reschedule(&boost_restore_work, SED_BOOST_TIMEOUT);
+
+	openthread_api_mutex_unlock(ot_context);
+}
+
+void sed_utils_boost_stop(void)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(ot_context);
+
+	if (in_exchange) {
+		uint32_t latency = (uint32_t)(k_uptime_get() - exchange_start_time);
+
+		in_exchange = false;
+		stats.last_latency = latency;
+		stats.total_latency += latency;
+		stats.max_latency = MAX(stats.max_latency, latency);
+		LOG_INF("Exchange finished in %u ms", latency);
+		k_work_reschedule(&boost_restore_work, SED_BOOST_HOLDOFF);
+	}
+
+	openthread_api_mutex_unlock(ot_context);
+}
+
+void sed_utils_get_stats(struct sed_utils_stats *out)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(ot_context);
+#if CONFIG_SED_UTILS_CSL
+	csl_account(ot_context->instance);
+#endif
+	*out = stats;
+	if (boosted) {
+		int64_t elapsed = k_uptime_get() - boost_start_time;
+
+		out->boosted_time += elapsed;
+	}
+	openthread_api_mutex_unlock(ot_context);
+}
+
+int sed_utils_init(void)
+{
+	k_work_init_delayable(&boost_restore_work, boost_restore);
+
+#if CONFIG_SED_UTILS_CSL
+	struct openthread_context *ot_context = openthread_get_default_context();
+	otError error;
+
+	openthread_api_mutex_lock(ot_context);
+	error = period_set(ot_context->instance, CONFIG_SED_UTILS_CSL_PERIOD);
+	openthread_api_mutex_unlock(ot_context);
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Cannot set CSL period: %d", error);
+		return -EINVAL;
+	}
+#endif
+
+	return 0;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct sed_utils_stats current;
+	uint32_t finished;
+
+	if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+		struct openthread_context *ot_context = openthread_get_default_context();
+
+		openthread_api_mutex_lock(ot_context);
+		memset(&stats, 0, sizeof(stats));
+		boost_start_time = k_uptime_get();
+#if CONFIG_SED_UTILS_CSL
+		csl_period_start_time = boost_start_time;
+#endif
+		openthread_api_mutex_unlock(ot_context);
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	sed_utils_get_stats(&current);
+	finished = current.exchanges - current.timeouts - (in_exchange ? 1 : 0);
+
+#if CONFIG_SED_UTILS_CSL
+	shell_fprintf(shell, SHELL_INFO, "fast CSL period: %u us\n", SED_FAST_PERIOD);
+#else
+	shell_fprintf(shell, SHELL_INFO, "fast poll period: %u ms\n", SED_FAST_PERIOD);
+#endif
+	shell_fprintf(shell, SHELL_INFO, "hold-off: %u ms\n", CONFIG_SED_UTILS_BOOST_HOLDOFF);
+	shell_fprintf(shell, SHELL_INFO, "exchanges: %u (timeouts: %u)\n", current.exchanges,
+		      current.timeouts);
+	shell_fprintf(shell, SHELL_INFO, "latency last/avg/max: %u/%u/%u ms\n",
+		      current.last_latency,
+		      finished ? (uint32_t)(current.total_latency / finished) : 0,
+		      current.max_latency);
+	shell_fprintf(shell, SHELL_INFO, "boosted time: %llu ms\n", current.boosted_time);
+	shell_fprintf(shell, SHELL_INFO, "extra wakeups: %llu\n", current.extra_wakeups);
+	shell_fprintf(shell, SHELL_INFO, "extra radio-on time: %llu us\n",
+		      current.extra_radio_on_time);
+
+	return 0;
+}
+
+#if CONFIG_SED_UTILS_CSL
+static int cmd_csl(const struct shell *shell, size_t argc, char **argv)
+{
+	struct openthread_context *ot_context = openthread_get_default_context();
+	struct sed_utils_stats current;
+	otError error = OT_ERROR_NONE;
+
+	if (argc > 1) {
+		uint32_t period = strtoul(argv[1], NULL, 10);
+
+		openthread_api_mutex_lock(ot_context);
+		if (boosted) {
+			/* Applied when the exchange is finished. */
+			saved_period = period;
+		} else {
+			error = period_set(ot_context->instance, period);
+		}
+		openthread_api_mutex_unlock(ot_context);
+		if (error != OT_ERROR_NONE) {
+			shell_fprintf(shell, SHELL_INFO, "Invalid CSL period\n");
+			return -EINVAL;
+		}
+		shell_fprintf(shell, SHELL_INFO, "Done\n");
+		return 0;
+	}
+
+	sed_utils_get_stats(&current);
+
+	openthread_api_mutex_lock(ot_context);
+	shell_fprintf(shell, SHELL_INFO, "period: %u us%s\n", otLinkGetCslPeriod(ot_context->instance),
+		      boosted ? " (boosted)" : "");
+	shell_fprintf(shell, SHELL_INFO, "channel: %u\n", otLinkGetCslChannel(ot_context->instance));
+	shell_fprintf(shell, SHELL_INFO, "timeout: %u s\n", otLinkGetCslTimeout(ot_context->instance));
+	openthread_api_mutex_unlock(ot_context);
+	shell_fprintf(shell, SHELL_INFO, "receive windows: %llu (boosted: %llu)\n",
+		      current.csl_windows, current.csl_boosted_windows);
+	shell_fprintf(shell, SHELL_INFO, "receive window radio-on time: %llu us\n",
+		      current.csl_windows * CONFIG_SED_UTILS_CSL_RECEIVE_ON_TIME);
+
+	return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_sed_utils,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get/Reset boost statistics. (reset)\n",
+		cmd_stats, 1, 1),
+#if CONFIG_SED_UTILS_CSL
+	SHELL_CMD_ARG(
+		csl, NULL,
+		"Get CSL receive window statistics/Set idle CSL period. (period in us)\n",
+		cmd_csl, 1, 1),
+#endif
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(sed_utils, &sub_sed_utils, "sleepy end device utils commands", NULL);
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __SED_UTILS_H__
+#define __SED_UTILS_H__
+
+#include <stdint.h>
+
+/**@brief Statistics of boosted discover/upload exchanges. */
+struct sed_utils_stats {
+	/** Number of exchanges started. */
+	uint32_t exchanges;
+	/** Number of exchanges ended by the boost timeout. */
+	uint32_t timeouts;
+	/** Latency of the last finished exchange [ms]. */
+	uint32_t last_latency;
+	/** Longest exchange latency [ms]. */
+	uint32_t max_latency;
+	/** Sum of all finished exchange latencies [ms]. */
+	uint64_t total_latency;
+	/** Total time spent with the fast period [ms]. */
+	uint64_t boosted_time;
+	/** Data polls or CSL receive windows in addition to the low-power schedule. */
+	uint64_t extra_wakeups;
+	/** Estimated radio-on time caused by the extra wakeups [us]. */
+	uint64_t extra_radio_on_time;
+	/** Estimated number of CSL receive windows. */
+	uint64_t csl_windows;
+	/** Estimated number of CSL receive windows with the fast CSL period. */
+	uint64_t csl_boosted_windows;
+};
+
+/**
+ * @brief Initialize sleepy end device utilities.
+ */
+int sed_utils_init(void);
+
+/**
+ * @brief Start a discover/upload exchange and shorten the data poll period,
+ *        or the CSL period when running as a synchronized sleepy end device.
+ *
+ * @note Calling it again while an exchange is in progress has no effect.
+ */
+void sed_utils_boost_start(void);
+
+/**
+ * @brief End the current exchange.
+ *
+ * The low-power period is restored after the configured hold-off.
+ */
+void sed_utils_boost_stop(void);
+
+/**
+ * @brief Get a copy of the exchange statistics.
+ */
+void sed_utils_get_stats(struct sed_utils_stats *stats);
+
+#endif /* __SED_UTILS_H__ */
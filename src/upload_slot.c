@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <openthread/network_time.h>
+
+#include "upload_slot.h"
+
+LOG_MODULE_REGISTER(upload_slot, CONFIG_UPLOAD_SLOT_LOG_LEVEL);
+
+struct slot_reservation {
+	otIp6Address address;
+	int64_t start;
+	bool in_use;
+};
+
+struct upload_slot_stats {
+	uint32_t granted;
+	uint32_t assigned;
+	uint32_t rejected;
+	uint32_t missed;
+	uint32_t sessions;
+	uint64_t bytes;
+	uint64_t session_time;
+};
+
+static struct slot_reservation reservations[CONFIG_UPLOAD_SLOT_COUNT];
+static struct upload_slot_stats stats;
+static uint32_t slot_length = CONFIG_UPLOAD_SLOT_INITIAL_LENGTH;
+static int64_t next_free_time;
+static int64_t session_start_time = -1;
+static K_MUTEX_DEFINE(slot_lock);
+
+static void reservations_expire(int64_t now)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(reservations); i++) {
+		if (reservations[i].in_use && (reservations[i].start + slot_length < now)) {
+			LOG_DBG("Slot at %lld ms missed", reservations[i].start);
+			reservations[i].in_use = false;
+			stats.missed++;
+		}
+	}
+}
+
+static struct slot_reservation *reservation_find(const otIp6Address *address)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(reservations); i++) {
+		if (reservations[i].in_use && otIp6IsAddressEqual(&reservations[i].address, address)) {
+			return &reservations[i];
+		}
+	}
+
+	return NULL;
+}
+
+static struct slot_reservation *reservation_alloc(const otIp6Address *address)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(reservations); i++) {
+		if (!reservations[i].in_use) {
+			reservations[i].in_use = true;
+			reservations[i].address = *address;
+			return &reservations[i];
+		}
+	}
+
+	return NULL;
+}
+
+void upload_slot_init(void)
+{
+	k_mutex_lock(&slot_lock, K_FOREVER);
+	memset(reservations, 0, sizeof(reservations));
+	slot_length = CONFIG_UPLOAD_SLOT_INITIAL_LENGTH;
+	next_free_time = 0;
+	session_start_time = -1;
+	k_mutex_unlock(&slot_lock);
+}
+
+int upload_slot_request(const otIp6Address *requester, bool modem_idle,
+			struct upload_slot *slot)
+{
+	struct slot_reservation *reservation;
+	int64_t now = k_uptime_get();
+	int ret = 0;
+
+	k_mutex_lock(&slot_lock, K_FOREVER);
+
+	reservations_expire(now);
+	reservation = reservation_find(requester);
+
+	/* Meters without a slot may only upload when no slot is reserved. */
+	if (modem_idle &&
+	    ((reservation != NULL) ? (reservation->start <= now) : (next_free_time <= now))) {
+		if (reservation != NULL) {
+			reservation->in_use = false;
+		}
+		session_start_time = now;
+		next_free_time = MAX(next_free_time, now + slot_length);
+		stats.granted++;
+		goto end;
+	}
+
+	if (reservation == NULL) {
+		reservation = reservation_alloc(requester);
+		if (reservation == NULL) {
+			LOG_WRN("No free upload slot");
+			stats.rejected++;
+			ret = -ENOMEM;
+			goto end;
+		}
+		reservation->start = MAX(now, next_free_time);
+		next_free_time = reservation->start + slot_length;
+		stats.assigned++;
+	} else if (reservation->start < now) {
+		/* Slot started while the modem is still busy, the meter gets the next free one. */
+		reservation->start = MAX(now, next_free_time);
+		next_free_time = reservation->start + slot_length;
+		LOG_DBG("Late for slot, moved to %lld ms", reservation->start);
+	}
+
+	slot->delay = (uint32_t)(reservation->start - now);
+	slot->network_time = 0;
+#if CONFIG_OPENTHREAD_TIME_SYNC
+	uint64_t network_time;
+
+	if (otNetworkTimeGet(openthread_get_default_instance(), &network_time) ==
+	    OT_NETWORK_TIME_SYNCHRONIZED) {
+		slot->network_time = network_time + (uint64_t)slot->delay * USEC_PER_MSEC;
+	}
+#endif
+	LOG_INF("Upload slot in %u ms", slot->delay);
+	ret = -EAGAIN;
+
+end:
+	k_mutex_unlock(&slot_lock);
+
+	return ret;
+}
+
+void upload_slot_session_end(size_t bytes)
+{
+	int64_t now = k_uptime_get();
+	uint32_t duration;
+
+	k_mutex_lock(&slot_lock, K_FOREVER);
+
+	if (session_start_time < 0) {
+		goto end;
+	}
+
+	duration = (uint32_t)(now - session_start_time);
+	session_start_time = -1;
+	stats.sessions++;
+	stats.bytes += bytes;
+	stats.session_time += duration;
+
+	/* Follow measured session length with a 25% guard time. */
+	slot_length = (3 * slot_length + duration + duration / 4) / 4;
+	slot_length = CLAMP(slot_length, CONFIG_UPLOAD_SLOT_MIN_LENGTH,
+			    CONFIG_UPLOAD_SLOT_MAX_LENGTH);
+	LOG_DBG("Session took %u ms, slot length %u ms", duration, slot_length);
+
+end:
+	k_mutex_unlock(&slot_lock);
+}
+
+size_t upload_slot_encode(const struct upload_slot *slot, uint8_t *buf)
+{
+	sys_put_le32(slot->delay, buf);
+	sys_put_le64(slot->network_time, &buf[sizeof(uint32_t)]);
+
+	return UPLOAD_SLOT_ENCODED_SIZE;
+}
+
+int upload_slot_parse(otInstance *instance, const otMessage *message, uint32_t *delay)
+{
+	uint8_t buf[UPLOAD_SLOT_ENCODED_SIZE];
+	uint16_t length;
+
+	length = otMessageRead(message, otMessageGetOffset(message), buf, sizeof(buf));
+	if (length < sizeof(uint32_t)) {
+		return -ENOENT;
+	}
+
+	*delay = sys_get_le32(buf);
+
+#if CONFIG_OPENTHREAD_TIME_SYNC
+	uint64_t slot_time, now;
+
+	/* Network time is not affected by the response delivery latency. */
+	if (length == UPLOAD_SLOT_ENCODED_SIZE) {
+		slot_time = sys_get_le64(&buf[sizeof(uint32_t)]);
+		if ((slot_time != 0) &&
+		    (otNetworkTimeGet(instance, &now) == OT_NETWORK_TIME_SYNCHRONIZED)) {
+			*delay = (slot_time > now) ? (uint32_t)((slot_time - now) / USEC_PER_MSEC) : 0;
+		}
+	}
+#else
+	ARG_UNUSED(instance);
+#endif
+
+	return 0;
+}
+
+static int cmd_stats(const struct shell *shell, size_t argc, char **argv)
+{
+	struct upload_slot_stats current;
+	uint32_t pending = 0;
+	uint32_t length;
+
+	k_mutex_lock(&slot_lock, K_FOREVER);
+	current = stats;
+	length = slot_length;
+	for (size_t i = 0; i < ARRAY_SIZE(reservations); i++) {
+		pending += reservations[i].in_use ? 1 : 0;
+	}
+	k_mutex_unlock(&slot_lock);
+
+	shell_fprintf(shell, SHELL_INFO, "slot length: %u ms\n", length);
+	shell_fprintf(shell, SHELL_INFO, "pending slots: %u\n", pending);
+	shell_fprintf(shell, SHELL_INFO, "granted: %u assigned: %u rejected: %u missed: %u\n",
+		      current.granted, current.assigned, current.rejected, current.missed);
+	shell_fprintf(shell, SHELL_INFO, "sessions: %u bytes: %llu\n", current.sessions,
+		      current.bytes);
+	shell_fprintf(shell, SHELL_INFO, "goodput: %llu B/s\n",
+		      current.session_time ?
+		      current.bytes * MSEC_PER_SEC / current.session_time : 0);
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+	sub_upload_slot,
+	SHELL_CMD_ARG(
+		stats, NULL,
+		"Get upload slot statistics.\n",
+		cmd_stats, 1, 0),
+	SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(upload_slot, &sub_upload_slot, "upload slot commands", NULL);
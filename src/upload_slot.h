@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef __UPLOAD_SLOT_H__
+#define __UPLOAD_SLOT_H__
+
+#include <openthread/ip6.h>
+#include <openthread/message.h>
+
+/**@brief Upload slot handed out by a busy modem. */
+struct upload_slot {
+	/** Delay from the response to the start of the slot [ms]. */
+	uint32_t delay;
+	/** Thread network time of the slot start [us], 0 if not synchronized. */
+	uint64_t network_time;
+};
+
+/**@brief Size of an encoded upload slot. */
+#define UPLOAD_SLOT_ENCODED_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
+
+/**
+ * @brief Initialize upload slot scheduling.
+ */
+void upload_slot_init(void);
+
+/**
+ * @brief Handle upload measurement request of a meter.
+ *
+ * @param[in]  requester  address of the meter.
+ * @param[in]  modem_idle true if the modem can accept an upload now.
+ * @param[out] slot       slot assigned to the meter.
+ *
+ * @retval 0       The meter can upload now.
+ * @retval -EAGAIN The meter has to retry in @p slot.
+ * @retval -ENOMEM No slot can be assigned.
+ */
+int upload_slot_request(const otIp6Address *requester, bool modem_idle,
+			struct upload_slot *slot);
+
+/**
+ * @brief Notify that an upload session granted by upload_slot_request ended.
+ *
+ * @param[in] bytes number of bytes received in the session.
+ */
+void upload_slot_session_end(size_t bytes);
+
+/**
+ * @brief Encode slot to the payload of upload measurement response.
+ *
+ * @return Number of bytes written to @p buf.
+ */
+size_t upload_slot_encode(const struct upload_slot *slot, uint8_t *buf);
+
+/**
+ * @brief Get delay until the slot given in upload measurement response.
+ *
+ * Network time is preferred when both nodes are synchronized.
+ *
+ * @retval 0       Slot found, @p delay is set.
+ * @retval -ENOENT Response carries no slot.
+ */
+int upload_slot_parse(otInstance *instance, const otMessage *message, uint32_t *delay);
+
+#endif /* __UPLOAD_SLOT_H__ */